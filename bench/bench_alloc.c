@@ -0,0 +1,140 @@
+#include "libcpucaps.h"
+#include "libcpucaps_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>      /* timespec_get */
+
+/* usage: bench_alloc [buffers] [bufferBytes] */
+/* a blocked kernel summing the same 2 KiB block of every buffer a few times over (e.g. a k-way mix or an FFT stage), */
+/* with the buffers page aligned (a power of two stride, all blocks in the same L1d sets) and from a coloured pool */
+
+#define BENCH_DEFAULT_BUFFERS       16
+#define BENCH_DEFAULT_BUFFER_BYTES  (64 * 1024)
+#define BENCH_BLOCK_ELEMENTS        256     /* 2 KiB of every buffer, 16 of them fit an L1d without conflicts */
+#define BENCH_BLOCK_REPEATS         8
+#define BENCH_NUM_RUNS              5       /* the best run is reported */
+
+static volatile uint64_t s_sink;
+
+static double get_time_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t sum_blocks(uint64_t** buffers, int numBuffers, size_t numElements) {
+    uint64_t sum = 0;
+    size_t block, i;
+    int r, k;
+
+    for (block = 0; block + BENCH_BLOCK_ELEMENTS <= numElements; block += BENCH_BLOCK_ELEMENTS) {
+        for (r = 0; r < BENCH_BLOCK_REPEATS; ++r) {
+            for (i = block; i < block + BENCH_BLOCK_ELEMENTS; ++i) {
+                for (k = 0; k < numBuffers; ++k) {
+                    sum += buffers[k][i];
+                }
+            }
+        }
+    }
+    return sum;
+}
+
+/* ns per load of the best run */
+static double run(const char* name, uint64_t** buffers, int numBuffers, size_t numElements, uint64_t* sum) {
+    double best = 0.0, start, elapsed;
+    size_t numLoads = numElements / BENCH_BLOCK_ELEMENTS * BENCH_BLOCK_ELEMENTS * BENCH_BLOCK_REPEATS * (size_t)numBuffers;
+    int i, colours[4] = { 0 };
+
+    for (i = 0; i < BENCH_NUM_RUNS; ++i) {
+        start = get_time_ns();
+        *sum = sum_blocks(buffers, numBuffers, numElements);
+        elapsed = get_time_ns() - start;
+        if (elapsed > 0.0 && (!best || elapsed < best)) {
+            best = elapsed;
+        }
+    }
+    s_sink = *sum;
+
+    /* page offsets of the first buffers, the same for all of them means the same L1d sets */
+    for (i = 0; i < numBuffers && i < 4; ++i) {
+        colours[i] = (int)((uintptr_t)buffers[i] & 4095);
+    }
+    printf("%-14s %6.3f ns/load   page offsets %4d %4d %4d %4d ...\n", name, best / (double)numLoads,
+           colours[0], colours[1], colours[2], colours[3]);
+
+    return best / (double)numLoads;
+}
+
+static void fill(uint64_t** buffers, int numBuffers, size_t numElements) {
+    size_t i;
+    int k;
+
+    for (k = 0; k < numBuffers; ++k) {
+        for (i = 0; i < numElements; ++i) {
+            buffers[k][i] = (uint64_t)k * numElements + i;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    cpucaps_arena_t arena;
+    cpucaps_pool_t pool;
+    uint64_t** buffers;
+    uint64_t alignedSum, colouredSum;
+    double alignedNs, colouredNs;
+    size_t bufferBytes = BENCH_DEFAULT_BUFFER_BYTES, numElements;
+    int numBuffers = BENCH_DEFAULT_BUFFERS, i, result = 0;
+
+    if (argc > 1) {
+        numBuffers = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        bufferBytes = (size_t)strtoull(argv[2], NULL, 0);
+    }
+    numElements = bufferBytes / sizeof(uint64_t);
+    if (numBuffers <= 0 || numElements < BENCH_BLOCK_ELEMENTS) {
+        printf("usage: %s [buffers] [bufferBytes]\n", argv[0]);
+        return 1;
+    }
+
+    buffers = (uint64_t**)calloc((size_t)numBuffers, sizeof(uint64_t*));
+    /* room for both layouts, every coloured buffer may start up to a page further */
+    if (!buffers || LIBCPUCAPS_ERROR_OK != libcpucaps_ArenaCreate(&arena, NULL, (size_t)numBuffers * (bufferBytes + 2 * 4096) * 2)) {
+        printf("Failed to allocate %d x %llu bytes\n", numBuffers, (unsigned long long)bufferBytes);
+        free(buffers);
+        return 1;
+    }
+
+    printf("line %llu B, destructive interference %llu B, %d colours of %llu B, page %llu B\n",
+           (unsigned long long)arena.geometry.lineBytes, (unsigned long long)arena.geometry.interferenceBytes,
+           arena.geometry.numColours, (unsigned long long)arena.geometry.colourStrideBytes,
+           (unsigned long long)arena.geometry.pageBytes);
+    printf("%d buffers of %llu bytes, %d x %d bytes blocks reused %d times\n\n", numBuffers,
+           (unsigned long long)bufferBytes, numBuffers, (int)(BENCH_BLOCK_ELEMENTS * sizeof(uint64_t)), BENCH_BLOCK_REPEATS);
+
+    for (i = 0; i < numBuffers; ++i) {
+        buffers[i] = (uint64_t*)libcpucaps_ArenaAllocAligned(&arena, bufferBytes, arena.geometry.pageBytes);
+    }
+    fill(buffers, numBuffers, numElements);
+    alignedNs = run("page aligned", buffers, numBuffers, numElements, &alignedSum);
+
+    libcpucaps_ArenaReset(&arena);
+    libcpucaps_PoolInit(&pool, &arena, bufferBytes);
+    for (i = 0; i < numBuffers; ++i) {
+        buffers[i] = (uint64_t*)libcpucaps_PoolAlloc(&pool);
+    }
+    fill(buffers, numBuffers, numElements);
+    colouredNs = run(pool.isColoured ? "coloured pool" : "packed pool", buffers, numBuffers, numElements, &colouredSum);
+
+    if (alignedSum != colouredSum) {
+        printf("wrong result\n");
+        result = 1;
+    } else {
+        printf("\nspeedup %.2fx\n", alignedNs / colouredNs);
+    }
+
+    libcpucaps_ArenaDestroy(&arena);
+    free(buffers);
+    return result;
+}
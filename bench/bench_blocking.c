@@ -0,0 +1,134 @@
+#include "libcpucaps.h"
+#include "libcpucaps_blocking.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>      /* timespec_get */
+
+/* usage: bench_blocking [n] */
+/* out-of-place transpose of an n x n matrix of doubles (4096 by default, a power of two stride on purpose) */
+/* untiled, with the usual hand-picked tiles and with the advised L1 tiles, each at the raw & the padded stride */
+
+#define BENCH_DEFAULT_N     4096
+#define BENCH_NAIVE_TILE    64
+#define BENCH_NUM_RUNS      5       /* the best run is reported */
+
+static double get_time_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void transpose(double* dst, const double* src, size_t n, size_t ld, size_t tileRows, size_t tileCols) {
+    size_t i0, j0, i, j, iEnd, jEnd;
+
+    for (i0 = 0; i0 < n; i0 += tileRows) {
+        iEnd = (i0 + tileRows < n) ? i0 + tileRows : n;
+        for (j0 = 0; j0 < n; j0 += tileCols) {
+            jEnd = (j0 + tileCols < n) ? j0 + tileCols : n;
+            for (i = i0; i < iEnd; ++i) {
+                for (j = j0; j < jEnd; ++j) {
+                    dst[j * ld + i] = src[i * ld + j];
+                }
+            }
+        }
+    }
+}
+
+static int run(const char* name, size_t n, size_t ld, size_t tileRows, size_t tileCols) {
+    double* src = (double*)malloc(n * ld * sizeof(double));
+    double* dst = (double*)malloc(n * ld * sizeof(double));
+    double best = 0.0, start, elapsed;
+    size_t i;
+    int r;
+
+    if (!src || !dst) {
+        printf("Failed to allocate 2 x %llu bytes\n", (unsigned long long)(n * ld * sizeof(double)));
+        free(src);
+        free(dst);
+        return 1;
+    }
+    for (i = 0; i < n * ld; ++i) {
+        src[i] = (double)i;
+        dst[i] = 0.0;
+    }
+
+    for (r = 0; r < BENCH_NUM_RUNS; ++r) {
+        start = get_time_ns();
+        transpose(dst, src, n, ld, tileRows, tileCols);
+        elapsed = get_time_ns() - start;
+        if (elapsed > 0.0 && (!best || elapsed < best)) {
+            best = elapsed;
+        }
+    }
+
+    /* the last element of the first row ends up in the first column */
+    if (dst[(n - 1) * ld] != src[n - 1]) {
+        printf("%s: wrong result\n", name);
+        free(src);
+        free(dst);
+        return 1;
+    }
+
+    printf("%-22s %5llu x %-5llu %8llu B  %8.2f ms  %6.2f GB/s\n", name, (unsigned long long)tileRows,
+           (unsigned long long)tileCols, (unsigned long long)(ld * sizeof(double)), best / 1e6,
+           2.0 * (double)(n * n * sizeof(double)) / best);
+
+    free(src);
+    free(dst);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const cpucaps_t* caps = libcpucaps_GetCachedCaps();
+    cpucaps_kernel_desc_t kernel;
+    cpucaps_blocking_t blocking, paddedBlocking;
+    size_t n = BENCH_DEFAULT_N, paddedLd;
+    int i, result = 0;
+
+    if (argc > 1) {
+        n = (size_t)strtoull(argv[1], NULL, 0);
+        if (n < BENCH_NAIVE_TILE) {
+            printf("usage: %s [n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    kernel.elementBytes = sizeof(double);
+    kernel.numStreams = 2;
+    kernel.reuse = LIBCPUCAPS_REUSE_2D;
+    kernel.numThreads = 1;
+    kernel.rowStrideBytes = n * sizeof(double);
+
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_AdviseBlocking(caps, &kernel, &blocking)) {
+        printf("Failed to advise tiles\n");
+        return 1;
+    }
+    paddedLd = blocking.paddedStrideBytes / sizeof(double);
+    kernel.rowStrideBytes = blocking.paddedStrideBytes;
+    libcpucaps_AdviseBlocking(caps, &kernel, &paddedBlocking);
+
+    printf("Advised tiles (%llu x %llu doubles, 2 streams):\n", (unsigned long long)n, (unsigned long long)n);
+    for (i = 0; i < blocking.numLevels; ++i) {
+        printf("  L%d: %5d x %-5d (%llu KB budget)%s, padded stride: %5d x %-5d\n", blocking.levels[i].level,
+               blocking.levels[i].rows, blocking.levels[i].cols,
+               (unsigned long long)(blocking.levels[i].budgetBytes / 1024),
+               blocking.levels[i].isStrideLimited ? " stride limited" : "",
+               paddedBlocking.levels[i].rows, paddedBlocking.levels[i].cols);
+    }
+    printf("  padded stride: %llu bytes\n\n", (unsigned long long)blocking.paddedStrideBytes);
+
+    printf("variant                 tile          stride       time    throughput\n");
+    result |= run("untiled", n, n, 1, n);
+    result |= run("naive tiles", n, n, BENCH_NAIVE_TILE, BENCH_NAIVE_TILE);
+    if (blocking.numLevels) {
+        result |= run("advised", n, n, (size_t)blocking.levels[0].rows, (size_t)blocking.levels[0].cols);
+    }
+    result |= run("naive tiles, padded", n, paddedLd, BENCH_NAIVE_TILE, BENCH_NAIVE_TILE);
+    if (blocking.numLevels) {
+        result |= run("advised, padded", n, paddedLd, (size_t)paddedBlocking.levels[0].rows,
+                      (size_t)paddedBlocking.levels[0].cols);
+    }
+
+    return result;
+}
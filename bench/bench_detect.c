@@ -0,0 +1,88 @@
+#include "libcpucaps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* usage: bench_detect [runs] */
+/* libcpucaps_GetCaps run after run, cold (CPUID leaf cache dropped before every run) and warm */
+/* percentiles of the whole detection and of every phase, to catch startup regressions */
+
+#define BENCH_DEFAULT_RUNS  100
+
+static const char* const s_phaseNames[LIBCPUCAPS_NUM_PHASES] = { "vendor", "features", "caches", "TSC", "topology" };
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t va = *(const uint64_t*)a;
+    uint64_t vb = *(const uint64_t*)b;
+    return (va < vb) ? -1 : (va > vb);
+}
+
+/* sorts the samples */
+static void print_percentiles(const char* name, uint64_t* samples, int numRuns) {
+    qsort(samples, (size_t)numRuns, sizeof(uint64_t), compare_u64);
+    printf("  %10s : %9.3f %9.3f %9.3f %9.3f ms\n", name, (double)samples[numRuns / 2] / 1e6,
+           (double)samples[numRuns * 90 / 100] / 1e6, (double)samples[numRuns * 99 / 100] / 1e6,
+           (double)samples[numRuns - 1] / 1e6);
+}
+
+static int run(const char* name, int isCold, int numRuns) {
+    uint64_t* samples;
+    cpucaps_t caps;
+    cpucaps_stats_t stats;
+    uint64_t cpuidExecutions = 0, cpuidCacheHits = 0, affinityCalls = 0;
+    int i, phase;
+
+    samples = (uint64_t*)malloc(sizeof(uint64_t) * numRuns * (LIBCPUCAPS_NUM_PHASES + 1));
+    if (!samples) {
+        printf("Failed to allocate the samples\n");
+        return 1;
+    }
+
+    /* the first detection of the process pays for loading code & the OS files, it's not a sample */
+    libcpucaps_GetCaps(&caps);
+
+    for (i = 0; i < numRuns; ++i) {
+        if (isCold) {
+            libcpucaps_SetCPUIDBackend(NULL);   /* drops the leaf cache */
+        }
+        if (LIBCPUCAPS_ERROR_OK != libcpucaps_GetCapsStats(&caps, &stats)) {
+            printf("Failed to get CPU caps\n");
+            free(samples);
+            return 1;
+        }
+
+        samples[i] = stats.totalNs;
+        for (phase = 0; phase < LIBCPUCAPS_NUM_PHASES; ++phase) {
+            samples[(size_t)(phase + 1) * numRuns + i] = stats.phaseNs[phase];
+        }
+        cpuidExecutions += stats.cpuidExecutions;
+        cpuidCacheHits += stats.cpuidCacheHits;
+        affinityCalls += stats.affinityCalls;
+    }
+
+    printf("%s, %d runs: %.1f CPUID executed, %.1f cached, %.1f affinity changes per run\n", name, numRuns,
+           (double)cpuidExecutions / numRuns, (double)cpuidCacheHits / numRuns, (double)affinityCalls / numRuns);
+    printf("                   p50       p90       p99       max\n");
+    print_percentiles("total", samples, numRuns);
+    for (phase = 0; phase < LIBCPUCAPS_NUM_PHASES; ++phase) {
+        print_percentiles(s_phaseNames[phase], samples + (size_t)(phase + 1) * numRuns, numRuns);
+    }
+    printf("\n");
+
+    free(samples);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int numRuns = BENCH_DEFAULT_RUNS;
+
+    if (argc > 1) {
+        numRuns = atoi(argv[1]);
+        if (numRuns <= 0) {
+            printf("usage: %s [runs]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    return run("Cold", 1, numRuns) || run("Warm", 0, numRuns);
+}
@@ -0,0 +1,131 @@
+#include "libcpucaps.h"
+#include "libcpucaps_memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>      /* timespec_get */
+
+/* usage: bench_memory [maxBytes] */
+/* copy & set throughput of every supported strategy from 16 bytes up to maxBytes (1 GiB by default) */
+
+#define BENCH_MIN_SIZE          16
+#define BENCH_DEFAULT_MAX_SIZE  ((size_t)1 << 30)
+#define BENCH_BYTES_PER_RUN     ((size_t)32 << 20)     /* small sizes repeat until this much was moved */
+#define BENCH_NUM_RUNS          3                       /* the best run is reported */
+
+static const char* const s_strategyNames[LIBCPUCAPS_MEMORY_NUM_STRATEGIES] = {
+    "auto", "libc", "rep", "sse2", "avx2", "avx512", "nt"
+};
+
+static double get_time_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* GB/s of the best run, every run repeats the operation until BENCH_BYTES_PER_RUN were moved */
+static double measure(int strategy, int isCopy, char* dst, const char* src, size_t size) {
+    size_t numIterations = (size < BENCH_BYTES_PER_RUN) ? BENCH_BYTES_PER_RUN / size : 1;
+    double best = 0.0, start, elapsed;
+    size_t i;
+    int run;
+
+    for (run = 0; run < BENCH_NUM_RUNS; ++run) {
+        start = get_time_ns();
+        for (i = 0; i < numIterations; ++i) {
+            if (isCopy) {
+                libcpucaps_MemcpyStrategy(strategy, dst, src, size);
+            } else {
+                libcpucaps_MemsetStrategy(strategy, dst, (int)i, size);
+            }
+        }
+        elapsed = get_time_ns() - start;
+        if (elapsed > 0.0 && (double)(size * numIterations) / elapsed > best) {
+            best = (double)(size * numIterations) / elapsed;
+        }
+    }
+
+    return best;
+}
+
+static void print_size(size_t size) {
+    if (size >= ((size_t)1 << 30)) {
+        printf("%6llu GB", (unsigned long long)(size >> 30));
+    } else if (size >= ((size_t)1 << 20)) {
+        printf("%6llu MB", (unsigned long long)(size >> 20));
+    } else if (size >= ((size_t)1 << 10)) {
+        printf("%6llu KB", (unsigned long long)(size >> 10));
+    } else {
+        printf("%6llu B ", (unsigned long long)size);
+    }
+}
+
+static void run_sweep(int isCopy, const int* supported, char* dst, const char* src, size_t maxSize) {
+    size_t size;
+    int strategy;
+
+    printf("\n%s (GB/s)\n    size ", isCopy ? "memcpy" : "memset");
+    for (strategy = 0; strategy < LIBCPUCAPS_MEMORY_NUM_STRATEGIES; ++strategy) {
+        if (supported[strategy]) {
+            printf(" %7s", s_strategyNames[strategy]);
+        }
+    }
+    printf("\n");
+
+    for (size = BENCH_MIN_SIZE; size <= maxSize; size *= 2) {
+        print_size(size);
+        for (strategy = 0; strategy < LIBCPUCAPS_MEMORY_NUM_STRATEGIES; ++strategy) {
+            if (supported[strategy]) {
+                printf(" %7.2f", measure(strategy, isCopy, dst, src, size));
+                fflush(stdout);
+            }
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    const cpucaps_t* caps = libcpucaps_GetCachedCaps();
+    cpucaps_memory_config_t config;
+    int supported[LIBCPUCAPS_MEMORY_NUM_STRATEGIES];
+    size_t maxSize = BENCH_DEFAULT_MAX_SIZE;
+    char *src, *dst;
+    int strategy;
+
+    if (argc > 1) {
+        maxSize = (size_t)strtoull(argv[1], NULL, 0);
+        if (maxSize < BENCH_MIN_SIZE) {
+            printf("usage: %s [maxBytes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    src = (char*)malloc(maxSize);
+    dst = (char*)malloc(maxSize);
+    if (!src || !dst) {
+        printf("Failed to allocate 2 x %llu bytes\n", (unsigned long long)maxSize);
+        free(src);
+        free(dst);
+        return 1;
+    }
+    /* touch every page up front so page faults aren't measured */
+    memset(src, 0x5A, maxSize);
+    memset(dst, 0, maxSize);
+
+    libcpucaps_GetCurrentMemoryConfig(&config);
+    printf("Vector strategy       : %s\n", s_strategyNames[config.vectorStrategy]);
+    printf("Rep threshold         : %llu bytes\n", (unsigned long long)config.repThreshold);
+    printf("Non-temporal threshold: %llu bytes\n", (unsigned long long)config.nonTemporalThreshold);
+
+    for (strategy = 0; strategy < LIBCPUCAPS_MEMORY_NUM_STRATEGIES; ++strategy) {
+        supported[strategy] = libcpucaps_IsMemoryStrategySupported(caps, strategy);
+    }
+
+    run_sweep(1, supported, dst, src, maxSize);
+    run_sweep(0, supported, dst, src, maxSize);
+
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,482 @@
+#include "libcpucaps.h"
+#include "libcpucaps_memory.h"
+#include "libcpucaps_tune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>      /* timespec_get */
+#include <immintrin.h>
+
+/* usage: bench_tune [--retune] [--dir path] */
+/* tunes memcpy, a float dot product, CRC32C & base64 encoding over every ISA tier the cpu supports, */
+/* or loads the winners an earlier run saved for this cpu model */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BENCH_TARGET(isa)           __attribute__((target(isa)))
+#else
+#define BENCH_TARGET(isa)
+#endif
+
+#define BENCH_MAX_COPY_SIZE         ((size_t)4 << 20)
+#define BENCH_MAX_SIZE              ((size_t)1 << 20)
+#define BENCH_NUM_CHECK_SIZES       6
+
+typedef void* (*copy_fn)(void* dst, const void* src, size_t size);
+typedef float (*dot_fn)(const float* a, const float* b, size_t n);
+typedef uint32_t (*crc_fn)(uint32_t crc, const unsigned char* data, size_t size);
+typedef size_t (*base64_fn)(char* dst, const unsigned char* src, size_t size);
+
+typedef struct _s_bench_buffers {
+    unsigned char*  src;
+    unsigned char*  dst;        /* room for the base64 of src */
+    float*          a;
+    float*          b;
+} bench_buffers_t;
+
+static volatile float s_floatSink;
+static volatile uint32_t s_crcSink;
+static volatile size_t s_sizeSink;
+
+static double get_time_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* memcpy: the engine's strategies, libc as the reference */
+
+static void* copy_libc(void* dst, const void* src, size_t size) {
+    return libcpucaps_MemcpyStrategy(LIBCPUCAPS_MEMORY_LIBC, dst, src, size);
+}
+static void* copy_rep(void* dst, const void* src, size_t size) {
+    return libcpucaps_MemcpyStrategy(LIBCPUCAPS_MEMORY_REP, dst, src, size);
+}
+static void* copy_sse2(void* dst, const void* src, size_t size) {
+    return libcpucaps_MemcpyStrategy(LIBCPUCAPS_MEMORY_SSE2, dst, src, size);
+}
+static void* copy_avx2(void* dst, const void* src, size_t size) {
+    return libcpucaps_MemcpyStrategy(LIBCPUCAPS_MEMORY_AVX2, dst, src, size);
+}
+static void* copy_avx512(void* dst, const void* src, size_t size) {
+    return libcpucaps_MemcpyStrategy(LIBCPUCAPS_MEMORY_AVX512, dst, src, size);
+}
+
+/* dot product, the vector versions sum in a different order so they only agree to rounding */
+
+static float dot_scalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static float dot_sse2(const float* a, const float* b, size_t n) {
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+    float lanes[4], sum;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return sum + dot_scalar(a + i, b + i, n - i);
+}
+
+static BENCH_TARGET("avx2,fma") float dot_avx2(const float* a, const float* b, size_t n) {
+    __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+    __m128 half;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+    }
+    sum0 = _mm256_add_ps(sum0, sum1);
+    half = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half) + dot_scalar(a + i, b + i, n - i);
+}
+
+static BENCH_TARGET("avx512f") float dot_avx512(const float* a, const float* b, size_t n) {
+    __m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), sum1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+/* CRC32C (Castagnoli, reflected 0x82F63B78) */
+
+static uint32_t s_crcTable[256];
+
+static void init_crc_table(void) {
+    uint32_t crc;
+    int i, bit;
+
+    for (i = 0; i < 256; ++i) {
+        crc = (uint32_t)i;
+        for (bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+        }
+        s_crcTable[i] = crc;
+    }
+}
+
+static uint32_t crc_table(uint32_t crc, const unsigned char* data, size_t size) {
+    size_t i;
+
+    crc = ~crc;
+    for (i = 0; i < size; ++i) {
+        crc = (crc >> 8) ^ s_crcTable[(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+static BENCH_TARGET("sse4.2") uint32_t crc_sse42(uint32_t crc, const unsigned char* data, size_t size) {
+    uint64_t crc64 = ~crc, word;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        memcpy(&word, data + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    for (; i < size; ++i) {
+        crc64 = _mm_crc32_u8((uint32_t)crc64, data[i]);
+    }
+    return ~(uint32_t)crc64;
+}
+
+/* base64 encoding, the vector versions follow W. Muła's pshufb lookup */
+
+static const char s_base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t base64_scalar(char* dst, const unsigned char* src, size_t size) {
+    char* out = dst;
+    uint32_t triple;
+    size_t i;
+
+    for (i = 0; i + 3 <= size; i += 3) {
+        triple = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        *out++ = s_base64Chars[(triple >> 18) & 63];
+        *out++ = s_base64Chars[(triple >> 12) & 63];
+        *out++ = s_base64Chars[(triple >> 6) & 63];
+        *out++ = s_base64Chars[triple & 63];
+    }
+    if (i < size) {
+        triple = (uint32_t)src[i] << 16;
+        if (i + 1 < size) {
+            triple |= (uint32_t)src[i + 1] << 8;
+        }
+        *out++ = s_base64Chars[(triple >> 18) & 63];
+        *out++ = s_base64Chars[(triple >> 12) & 63];
+        *out++ = (i + 1 < size) ? s_base64Chars[(triple >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+    return (size_t)(out - dst);
+}
+
+/* 12 input bytes of each 16 byte lane to 16 6-bit indices, then to ASCII by range offsets */
+static BENCH_TARGET("ssse3") __m128i base64_lane_ssse3(__m128i in) {
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i indices, ranges;
+
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    indices = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040)),
+                           _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010)));
+
+    ranges = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    ranges = _mm_or_si128(ranges, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, ranges), indices);
+}
+
+static BENCH_TARGET("ssse3") size_t base64_ssse3(char* dst, const unsigned char* src, size_t size) {
+    size_t i;
+
+    /* 16 byte loads, 12 of them used */
+    for (i = 0; i + 16 <= size; i += 12) {
+        _mm_storeu_si128((__m128i*)(dst + i / 3 * 4), base64_lane_ssse3(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+    return i / 3 * 4 + base64_scalar(dst + i / 3 * 4, src + i, size - i);
+}
+
+static BENCH_TARGET("avx2") size_t base64_avx2(char* dst, const unsigned char* src, size_t size) {
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    __m256i in, indices, ranges;
+    size_t i;
+
+    /* 24 bytes per step, the second lane loads from 12 bytes in */
+    for (i = 0; i + 28 <= size; i += 24) {
+        in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + i))),
+                                     _mm_loadu_si128((const __m128i*)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+        indices = _mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040)),
+                                  _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010)));
+
+        ranges = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        ranges = _mm256_or_si256(ranges, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i*)(dst + i / 3 * 4), _mm256_add_epi8(_mm256_shuffle_epi8(offsets, ranges), indices));
+    }
+    return i / 3 * 4 + base64_scalar(dst + i / 3 * 4, src + i, size - i);
+}
+
+/* variants from the best to the baseline one */
+
+static const cpucaps_impl_t s_copyImpls[] = {
+    { "avx512", (libcpucaps_func_t)copy_avx512, { libcpucaps_HasAVX512F } },
+    { "avx2",   (libcpucaps_func_t)copy_avx2,   { libcpucaps_HasAVX2 } },
+    { "rep",    (libcpucaps_func_t)copy_rep,    { libcpucaps_HasERMS } },
+    { "sse2",   (libcpucaps_func_t)copy_sse2,   { libcpucaps_HasSSE2 } },
+    { "libc",   (libcpucaps_func_t)copy_libc,   { NULL } }
+};
+static const cpucaps_impl_t s_dotImpls[] = {
+    { "avx512", (libcpucaps_func_t)dot_avx512,  { libcpucaps_HasAVX512F } },
+    { "avx2",   (libcpucaps_func_t)dot_avx2,    { libcpucaps_HasAVX2, libcpucaps_HasFMA3 } },
+    { "sse2",   (libcpucaps_func_t)dot_sse2,    { libcpucaps_HasSSE2 } },
+    { "scalar", (libcpucaps_func_t)dot_scalar,  { NULL } }
+};
+static const cpucaps_impl_t s_crcImpls[] = {
+    { "sse42",  (libcpucaps_func_t)crc_sse42,   { libcpucaps_HasSSE42 } },
+    { "table",  (libcpucaps_func_t)crc_table,   { NULL } }
+};
+static const cpucaps_impl_t s_base64Impls[] = {
+    { "avx2",   (libcpucaps_func_t)base64_avx2,   { libcpucaps_HasAVX2 } },
+    { "ssse3",  (libcpucaps_func_t)base64_ssse3,  { libcpucaps_HasSSSE3 } },
+    { "scalar", (libcpucaps_func_t)base64_scalar, { NULL } }
+};
+
+static cpucaps_dispatch_t s_copyDispatch = LIBCPUCAPS_DISPATCH_INIT(s_copyImpls);
+static cpucaps_dispatch_t s_dotDispatch = LIBCPUCAPS_DISPATCH_INIT(s_dotImpls);
+static cpucaps_dispatch_t s_crcDispatch = LIBCPUCAPS_DISPATCH_INIT(s_crcImpls);
+static cpucaps_dispatch_t s_base64Dispatch = LIBCPUCAPS_DISPATCH_INIT(s_base64Impls);
+
+/* problem sizes are input bytes for all kernels */
+
+static void run_copy(libcpucaps_func_t func, size_t size, void* context) {
+    bench_buffers_t* buffers = (bench_buffers_t*)context;
+    ((copy_fn)func)(buffers->dst, buffers->src, size);
+}
+
+static void run_dot(libcpucaps_func_t func, size_t size, void* context) {
+    bench_buffers_t* buffers = (bench_buffers_t*)context;
+    s_floatSink = ((dot_fn)func)(buffers->a, buffers->b, size / sizeof(float));
+}
+
+static void run_crc(libcpucaps_func_t func, size_t size, void* context) {
+    bench_buffers_t* buffers = (bench_buffers_t*)context;
+    s_crcSink = ((crc_fn)func)(0, buffers->src, size);
+}
+
+static void run_base64(libcpucaps_func_t func, size_t size, void* context) {
+    bench_buffers_t* buffers = (bench_buffers_t*)context;
+    s_sizeSink = ((base64_fn)func)((char*)buffers->dst, buffers->src, size);
+}
+
+/* every supported variant has to agree with the baseline one before its timings mean anything */
+static int check_impls(bench_buffers_t* buffers, const cpucaps_t* caps) {
+    static const size_t sizes[BENCH_NUM_CHECK_SIZES] = { 0, 1, 15, 100, 4097, 65536 + 29 };
+    char* expected;
+    float expectedDot, dot;
+    size_t expectedLength, length;
+    int i, s, ok = 1;
+
+    expected = (char*)malloc(BENCH_MAX_SIZE / 3 * 4 + 8);
+    if (!expected) {
+        return 0;
+    }
+
+    for (s = 0; s < BENCH_NUM_CHECK_SIZES; ++s) {
+        for (i = 0; i < s_copyDispatch.numImpls; ++i) {
+            if (libcpucaps_IsImplSupported(&s_copyImpls[i], caps)) {
+                memset(buffers->dst, 0, sizes[s] + 1);
+                ((copy_fn)s_copyImpls[i].func)(buffers->dst, buffers->src, sizes[s]);
+                if (memcmp(buffers->dst, buffers->src, sizes[s]) || buffers->dst[sizes[s]]) {
+                    printf("memcpy %s is wrong at %llu bytes\n", s_copyImpls[i].name, (unsigned long long)sizes[s]);
+                    ok = 0;
+                }
+            }
+        }
+
+        expectedDot = dot_scalar(buffers->a, buffers->b, sizes[s] / sizeof(float));
+        for (i = 0; i < s_dotDispatch.numImpls; ++i) {
+            if (libcpucaps_IsImplSupported(&s_dotImpls[i], caps)) {
+                dot = ((dot_fn)s_dotImpls[i].func)(buffers->a, buffers->b, sizes[s] / sizeof(float));
+                if (dot - expectedDot > 1e-3f * (expectedDot + 1.0f) || expectedDot - dot > 1e-3f * (expectedDot + 1.0f)) {
+                    printf("dot %s is wrong at %llu bytes\n", s_dotImpls[i].name, (unsigned long long)sizes[s]);
+                    ok = 0;
+                }
+            }
+        }
+
+        for (i = 0; i < s_crcDispatch.numImpls; ++i) {
+            if (libcpucaps_IsImplSupported(&s_crcImpls[i], caps) &&
+                ((crc_fn)s_crcImpls[i].func)(0, buffers->src, sizes[s]) != crc_table(0, buffers->src, sizes[s])) {
+                printf("crc32c %s is wrong at %llu bytes\n", s_crcImpls[i].name, (unsigned long long)sizes[s]);
+                ok = 0;
+            }
+        }
+
+        expectedLength = base64_scalar(expected, buffers->src, sizes[s]);
+        for (i = 0; i < s_base64Dispatch.numImpls; ++i) {
+            if (libcpucaps_IsImplSupported(&s_base64Impls[i], caps)) {
+                length = ((base64_fn)s_base64Impls[i].func)((char*)buffers->dst, buffers->src, sizes[s]);
+                if (length != expectedLength || memcmp(buffers->dst, expected, length)) {
+                    printf("base64 %s is wrong at %llu bytes\n", s_base64Impls[i].name, (unsigned long long)sizes[s]);
+                    ok = 0;
+                }
+            }
+        }
+    }
+
+    free(expected);
+    return ok;
+}
+
+static void print_size(size_t size) {
+    if (size >= ((size_t)1 << 20)) {
+        printf("%6llu MB", (unsigned long long)(size >> 20));
+    } else if (size >= ((size_t)1 << 10)) {
+        printf("%6llu KB", (unsigned long long)(size >> 10));
+    } else {
+        printf("%6llu B ", (unsigned long long)size);
+    }
+}
+
+static void print_kernel(const cpucaps_tune_table_t* table, const cpucaps_tune_kernel_t* kernel) {
+    const cpucaps_tune_entry_t* entry;
+    libcpucaps_func_t defaultFunc = libcpucaps_DispatchGet(kernel->table);
+    int i, j;
+
+    printf("\n%s (default %s)\n", kernel->name, (kernel->table->selected >= 0) ? kernel->table->impls[kernel->table->selected].name : "-");
+    for (i = 0; i < table->numEntries; ++i) {
+        entry = &table->entries[i];
+        if (strcmp(entry->kernel, kernel->name)) {
+            continue;
+        }
+        print_size((size_t)1 << entry->bucket);
+        printf("  %-7s %12.1f ns %8.2f GB/s", entry->impl, entry->nsPerCall,
+               entry->nsPerCall > 0.0 ? (double)((size_t)1 << entry->bucket) / entry->nsPerCall : 0.0);
+        j = libcpucaps_TuneSelect(table, kernel, (size_t)1 << entry->bucket);
+        printf("%s\n", (j >= 0 && kernel->table->impls[j].func != defaultFunc) ? "  *" : "");
+    }
+}
+
+int main(int argc, char** argv) {
+    cpucaps_tune_table_t* table;
+    cpucaps_tune_kernel_t kernels[4];
+    bench_buffers_t buffers;
+    const cpucaps_t* caps;
+    const char* dir = NULL;
+    double start;
+    size_t i;
+    int retune = 0, numKernels = 0, k, result;
+
+    for (k = 1; k < argc; ++k) {
+        if (!strcmp(argv[k], "--retune")) {
+            retune = 1;
+        } else if (!strcmp(argv[k], "--dir") && k + 1 < argc) {
+            dir = argv[++k];
+        } else {
+            printf("usage: %s [--retune] [--dir path]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES | LIBCPUCAPS_DETECT_NAME);
+    init_crc_table();
+
+    table = (cpucaps_tune_table_t*)malloc(sizeof(cpucaps_tune_table_t));
+    buffers.src = (unsigned char*)malloc(BENCH_MAX_COPY_SIZE + 64);
+    buffers.dst = (unsigned char*)malloc(BENCH_MAX_COPY_SIZE + 64);
+    buffers.a = (float*)malloc(BENCH_MAX_SIZE);
+    buffers.b = (float*)malloc(BENCH_MAX_SIZE);
+    if (!table || !buffers.src || !buffers.dst || !buffers.a || !buffers.b) {
+        printf("Failed to allocate the buffers\n");
+        return 1;
+    }
+    for (i = 0; i < BENCH_MAX_COPY_SIZE + 64; ++i) {
+        buffers.src[i] = (unsigned char)(i * 2654435761u >> 13);
+    }
+    for (i = 0; i < BENCH_MAX_SIZE / sizeof(float); ++i) {
+        buffers.a[i] = (float)(i % 7) * 0.25f;
+        buffers.b[i] = (float)(i % 5) * 0.5f;
+    }
+
+    if (!check_impls(&buffers, caps)) {
+        return 1;
+    }
+
+    kernels[numKernels].name = "memcpy";
+    kernels[numKernels].table = &s_copyDispatch;
+    kernels[numKernels].run = run_copy;
+    kernels[numKernels].minSize = 16;
+    kernels[numKernels++].maxSize = BENCH_MAX_COPY_SIZE;
+    kernels[numKernels].name = "dot";
+    kernels[numKernels].table = &s_dotDispatch;
+    kernels[numKernels].run = run_dot;
+    kernels[numKernels].minSize = 64;
+    kernels[numKernels++].maxSize = BENCH_MAX_SIZE;
+    kernels[numKernels].name = "crc32c";
+    kernels[numKernels].table = &s_crcDispatch;
+    kernels[numKernels].run = run_crc;
+    kernels[numKernels].minSize = 16;
+    kernels[numKernels++].maxSize = BENCH_MAX_SIZE;
+    kernels[numKernels].name = "base64";
+    kernels[numKernels].table = &s_base64Dispatch;
+    kernels[numKernels].run = run_base64;
+    kernels[numKernels].minSize = 16;
+    kernels[numKernels++].maxSize = BENCH_MAX_SIZE;
+    for (k = 0; k < numKernels; ++k) {
+        kernels[k].context = &buffers;
+    }
+
+    printf("%s (family 0x%X, model 0x%X)\n", caps->name, (unsigned char)caps->family, (unsigned char)caps->model);
+
+    start = get_time_ns();
+    if (retune) {
+        result = libcpucaps_TuneInit(caps, table);
+        for (k = 0; k < numKernels && result == LIBCPUCAPS_ERROR_OK; ++k) {
+            result = libcpucaps_Tune(table, caps, &kernels[k], NULL);
+        }
+        if (result == LIBCPUCAPS_ERROR_OK && libcpucaps_TuneSave(dir, table) != LIBCPUCAPS_ERROR_OK) {
+            printf("Failed to save the table\n");
+        }
+    } else {
+        result = libcpucaps_GetTuneTable(dir, caps, kernels, numKernels, NULL, table);
+        if (result == LIBCPUCAPS_TUNE_NOT_SAVED) {
+            printf("Failed to save the table\n");
+            result = LIBCPUCAPS_ERROR_OK;
+        }
+    }
+    if (result != LIBCPUCAPS_ERROR_OK) {
+        printf("Tuning failed (%d)\n", result);
+        return 1;
+    }
+    printf("table ready in %.1f ms (* = differs from the default dispatch)\n", (get_time_ns() - start) / 1e6);
+
+    for (k = 0; k < numKernels; ++k) {
+        print_kernel(table, &kernels[k]);
+    }
+
+    free(buffers.src);
+    free(buffers.dst);
+    free(buffers.a);
+    free(buffers.b);
+    free(table);
+    return 0;
+}
@@ -0,0 +1,474 @@
+#ifndef LIBCPUCAPS_HPP_HEADER
+#define LIBCPUCAPS_HPP_HEADER
+
+/* C++17 wrapper: inline feature checks that fold to constants for everything the translation unit */
+/* is already compiled for (e.g. -mavx2 makes has<avx2>() a compile-time true) */
+/* usage: if (cpucaps::has<cpucaps::avx2, cpucaps::fma3>()) { ... } */
+
+#include "libcpucaps.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace cpucaps {
+
+/* what the compiler may already assume about the target, a binary built for it can't run without these */
+namespace baseline {
+#if defined(__x86_64__) || defined(_M_X64)
+    constexpr bool x86_64 = true;
+#else
+    constexpr bool x86_64 = false;
+#endif
+    constexpr bool fpu = x86_64;
+    constexpr bool tsc = x86_64;
+    constexpr bool cmpxchg8 = x86_64;
+#if defined(__MMX__) || defined(_M_X64)
+    constexpr bool mmx = true;
+#else
+    constexpr bool mmx = false;
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    constexpr bool sse = true;
+#else
+    constexpr bool sse = false;
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    constexpr bool sse2 = true;
+#else
+    constexpr bool sse2 = false;
+#endif
+#if defined(__SSE3__) || defined(__AVX__)
+    constexpr bool sse3 = true;
+#else
+    constexpr bool sse3 = false;
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+    constexpr bool ssse3 = true;
+#else
+    constexpr bool ssse3 = false;
+#endif
+#if defined(__SSE4_1__) || defined(__AVX__)
+    constexpr bool sse41 = true;
+#else
+    constexpr bool sse41 = false;
+#endif
+#if defined(__SSE4_2__) || defined(__AVX__)
+    constexpr bool sse42 = true;
+#else
+    constexpr bool sse42 = false;
+#endif
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) || defined(__CX16__)
+    constexpr bool cmpxchg16b = true;
+#else
+    constexpr bool cmpxchg16b = false;
+#endif
+#if defined(__ABM__) || (defined(__LZCNT__) && defined(__POPCNT__))
+    constexpr bool abm = true;
+#else
+    constexpr bool abm = false;
+#endif
+#if defined(__SSE4A__)
+    constexpr bool sse4a = true;
+#else
+    constexpr bool sse4a = false;
+#endif
+#if defined(__AES__)
+    constexpr bool aes = true;
+#else
+    constexpr bool aes = false;
+#endif
+#if defined(__AVX__)
+    constexpr bool avx = true;
+#else
+    constexpr bool avx = false;
+#endif
+#if defined(__AVX2__)
+    constexpr bool avx2 = true;
+#else
+    constexpr bool avx2 = false;
+#endif
+#if defined(__AVX512F__)
+    constexpr bool avx512f = true;
+#else
+    constexpr bool avx512f = false;
+#endif
+#if defined(__AVX512PF__)
+    constexpr bool avx512pf = true;
+#else
+    constexpr bool avx512pf = false;
+#endif
+#if defined(__AVX512ER__)
+    constexpr bool avx512er = true;
+#else
+    constexpr bool avx512er = false;
+#endif
+#if defined(__AVX512CD__)
+    constexpr bool avx512cd = true;
+#else
+    constexpr bool avx512cd = false;
+#endif
+#if defined(__F16C__)
+    constexpr bool f16c = true;
+#else
+    constexpr bool f16c = false;
+#endif
+#if defined(__RDRND__)
+    constexpr bool rdrand = true;
+#else
+    constexpr bool rdrand = false;
+#endif
+#if defined(__RDSEED__)
+    constexpr bool rdseed = true;
+#else
+    constexpr bool rdseed = false;
+#endif
+#if defined(__FMA__)
+    constexpr bool fma3 = true;
+#else
+    constexpr bool fma3 = false;
+#endif
+#if defined(__FMA4__)
+    constexpr bool fma4 = true;
+#else
+    constexpr bool fma4 = false;
+#endif
+#if defined(__POPCNT__) || defined(__SSE4_2__)
+    constexpr bool popcnt = true;
+#else
+    constexpr bool popcnt = false;
+#endif
+#if defined(__BMI__)
+    constexpr bool bmi1 = true;
+#else
+    constexpr bool bmi1 = false;
+#endif
+#if defined(__BMI2__)
+    constexpr bool bmi2 = true;
+#else
+    constexpr bool bmi2 = false;
+#endif
+#if defined(__ADX__)
+    constexpr bool adx = true;
+#else
+    constexpr bool adx = false;
+#endif
+#if defined(__MOVBE__)
+    constexpr bool movbe = true;
+#else
+    constexpr bool movbe = false;
+#endif
+#if defined(__SHA__)
+    constexpr bool sha = true;
+#else
+    constexpr bool sha = false;
+#endif
+#if defined(__PCLMUL__)
+    constexpr bool pclmulqdq = true;
+#else
+    constexpr bool pclmulqdq = false;
+#endif
+#if defined(__VAES__)
+    constexpr bool vaes = true;
+#else
+    constexpr bool vaes = false;
+#endif
+#if defined(__VPCLMULQDQ__)
+    constexpr bool vpclmulqdq = true;
+#else
+    constexpr bool vpclmulqdq = false;
+#endif
+#if defined(__GFNI__)
+    constexpr bool gfni = true;
+#else
+    constexpr bool gfni = false;
+#endif
+#if defined(__AVX512BW__)
+    constexpr bool avx512bw = true;
+#else
+    constexpr bool avx512bw = false;
+#endif
+#if defined(__AVX512DQ__)
+    constexpr bool avx512dq = true;
+#else
+    constexpr bool avx512dq = false;
+#endif
+#if defined(__AVX512VL__)
+    constexpr bool avx512vl = true;
+#else
+    constexpr bool avx512vl = false;
+#endif
+#if defined(__AVX512VNNI__)
+    constexpr bool avx512vnni = true;
+#else
+    constexpr bool avx512vnni = false;
+#endif
+#if defined(__AVX512BF16__)
+    constexpr bool avx512bf16 = true;
+#else
+    constexpr bool avx512bf16 = false;
+#endif
+#if defined(__AVX512FP16__)
+    constexpr bool avx512fp16 = true;
+#else
+    constexpr bool avx512fp16 = false;
+#endif
+#if defined(__AVX512VBMI__)
+    constexpr bool avx512vbmi = true;
+#else
+    constexpr bool avx512vbmi = false;
+#endif
+#if defined(__AVX512VBMI2__)
+    constexpr bool avx512vbmi2 = true;
+#else
+    constexpr bool avx512vbmi2 = false;
+#endif
+#if defined(__AVX512BITALG__)
+    constexpr bool avx512bitalg = true;
+#else
+    constexpr bool avx512bitalg = false;
+#endif
+#if defined(__AVX512VPOPCNTDQ__)
+    constexpr bool avx512vpopcntdq = true;
+#else
+    constexpr bool avx512vpopcntdq = false;
+#endif
+#if defined(__AVXVNNI__)
+    constexpr bool avxvnni = true;
+#else
+    constexpr bool avxvnni = false;
+#endif
+#if defined(__AVX10_1__)
+    constexpr bool avx10 = true;
+#else
+    constexpr bool avx10 = false;
+#endif
+#if defined(__CLFLUSHOPT__)
+    constexpr bool clflushopt = true;
+#else
+    constexpr bool clflushopt = false;
+#endif
+#if defined(__CLWB__)
+    constexpr bool clwb = true;
+#else
+    constexpr bool clwb = false;
+#endif
+#if defined(__WAITPKG__)
+    constexpr bool waitpkg = true;
+#else
+    constexpr bool waitpkg = false;
+#endif
+#if defined(__MWAITX__)
+    constexpr bool monitorx = true;
+#else
+    constexpr bool monitorx = false;
+#endif
+#if defined(__FXSR__) || defined(_M_X64)
+    constexpr bool fxsr = true;
+#else
+    constexpr bool fxsr = false;
+#endif
+#if defined(__LAHF_SAHF__)
+    constexpr bool lahfsahf = true;
+#else
+    constexpr bool lahfsahf = false;
+#endif
+    constexpr bool cmov = x86_64;
+    constexpr bool syscall = x86_64;
+    constexpr bool longmode = x86_64;
+}
+
+/* feature descriptors: index into cpucaps_features_t and whether the compile target implies the feature */
+#define LIBCPUCAPS_CXX_FEATURE(name, featureName, isBaseline)                  \
+    struct name {                                                           \
+        static constexpr int  id = LIBCPUCAPS_FEATURE_##featureName;         \
+        static constexpr bool inBaseline = isBaseline;                      \
+    }
+
+LIBCPUCAPS_CXX_FEATURE(fpu,              FPU,              baseline::fpu);
+LIBCPUCAPS_CXX_FEATURE(pse,              PSE,              false);
+LIBCPUCAPS_CXX_FEATURE(tsc,              TSC,              baseline::tsc);
+LIBCPUCAPS_CXX_FEATURE(cmpxchg8,         CMPXCHG8,         baseline::cmpxchg8);
+LIBCPUCAPS_CXX_FEATURE(cmpxchg16b,       CMPXCHG16B,       baseline::cmpxchg16b);
+LIBCPUCAPS_CXX_FEATURE(mmx,              MMX,              baseline::mmx);
+LIBCPUCAPS_CXX_FEATURE(mmxext,           MMXEXT,           false);
+LIBCPUCAPS_CXX_FEATURE(amd3dnow,         3DNOW,            false);
+LIBCPUCAPS_CXX_FEATURE(amd3dnowext,      3DNOWEXT,         false);
+LIBCPUCAPS_CXX_FEATURE(sse,              SSE,              baseline::sse);
+LIBCPUCAPS_CXX_FEATURE(sse2,             SSE2,             baseline::sse2);
+LIBCPUCAPS_CXX_FEATURE(sse3,             SSE3,             baseline::sse3);
+LIBCPUCAPS_CXX_FEATURE(ssse3,            SSSE3,            baseline::ssse3);
+LIBCPUCAPS_CXX_FEATURE(sse41,            SSE41,            baseline::sse41);
+LIBCPUCAPS_CXX_FEATURE(sse42,            SSE42,            baseline::sse42);
+LIBCPUCAPS_CXX_FEATURE(abm,              ABM,              baseline::abm);
+LIBCPUCAPS_CXX_FEATURE(sse4a,            SSE4A,            baseline::sse4a);
+LIBCPUCAPS_CXX_FEATURE(misalignsse,      MISALIGNSSE,      false);
+LIBCPUCAPS_CXX_FEATURE(aes,              AES,              baseline::aes);
+LIBCPUCAPS_CXX_FEATURE(avx,              AVX,              baseline::avx);
+LIBCPUCAPS_CXX_FEATURE(avx2,             AVX2,             baseline::avx2);
+LIBCPUCAPS_CXX_FEATURE(avx512f,          AVX512F,          baseline::avx512f);
+LIBCPUCAPS_CXX_FEATURE(avx512pf,         AVX512PF,         baseline::avx512pf);
+LIBCPUCAPS_CXX_FEATURE(avx512er,         AVX512ER,         baseline::avx512er);
+LIBCPUCAPS_CXX_FEATURE(avx512cd,         AVX512CD,         baseline::avx512cd);
+LIBCPUCAPS_CXX_FEATURE(f16c,             F16C,             baseline::f16c);
+LIBCPUCAPS_CXX_FEATURE(rdrand,           RDRAND,           baseline::rdrand);
+LIBCPUCAPS_CXX_FEATURE(rdseed,           RDSEED,           baseline::rdseed);
+LIBCPUCAPS_CXX_FEATURE(fma3,             FMA3,             baseline::fma3);
+LIBCPUCAPS_CXX_FEATURE(fma4,             FMA4,             baseline::fma4);
+LIBCPUCAPS_CXX_FEATURE(hybrid,           HYBRID,           false);
+LIBCPUCAPS_CXX_FEATURE(osxsave,          OSXSAVE,          false);
+LIBCPUCAPS_CXX_FEATURE(invariant_tsc,    INVARIANT_TSC,    false);
+LIBCPUCAPS_CXX_FEATURE(rdtscp,           RDTSCP,           false);
+LIBCPUCAPS_CXX_FEATURE(popcnt,           POPCNT,           baseline::popcnt);
+LIBCPUCAPS_CXX_FEATURE(bmi1,             BMI1,             baseline::bmi1);
+LIBCPUCAPS_CXX_FEATURE(bmi2,             BMI2,             baseline::bmi2);
+LIBCPUCAPS_CXX_FEATURE(adx,              ADX,              baseline::adx);
+LIBCPUCAPS_CXX_FEATURE(movbe,            MOVBE,            baseline::movbe);
+LIBCPUCAPS_CXX_FEATURE(sha,              SHA,              baseline::sha);
+LIBCPUCAPS_CXX_FEATURE(pclmulqdq,        PCLMULQDQ,        baseline::pclmulqdq);
+LIBCPUCAPS_CXX_FEATURE(vaes,             VAES,             baseline::vaes);
+LIBCPUCAPS_CXX_FEATURE(vpclmulqdq,       VPCLMULQDQ,       baseline::vpclmulqdq);
+LIBCPUCAPS_CXX_FEATURE(gfni,             GFNI,             baseline::gfni);
+LIBCPUCAPS_CXX_FEATURE(avx512bw,         AVX512BW,         baseline::avx512bw);
+LIBCPUCAPS_CXX_FEATURE(avx512dq,         AVX512DQ,         baseline::avx512dq);
+LIBCPUCAPS_CXX_FEATURE(avx512vl,         AVX512VL,         baseline::avx512vl);
+LIBCPUCAPS_CXX_FEATURE(avx512vnni,       AVX512VNNI,       baseline::avx512vnni);
+LIBCPUCAPS_CXX_FEATURE(avx512bf16,       AVX512BF16,       baseline::avx512bf16);
+LIBCPUCAPS_CXX_FEATURE(avx512fp16,       AVX512FP16,       baseline::avx512fp16);
+LIBCPUCAPS_CXX_FEATURE(avx512vbmi,       AVX512VBMI,       baseline::avx512vbmi);
+LIBCPUCAPS_CXX_FEATURE(avx512vbmi2,      AVX512VBMI2,      baseline::avx512vbmi2);
+LIBCPUCAPS_CXX_FEATURE(avx512bitalg,     AVX512BITALG,     baseline::avx512bitalg);
+LIBCPUCAPS_CXX_FEATURE(avx512vpopcntdq,  AVX512VPOPCNTDQ,  baseline::avx512vpopcntdq);
+LIBCPUCAPS_CXX_FEATURE(avxvnni,          AVXVNNI,          baseline::avxvnni);
+LIBCPUCAPS_CXX_FEATURE(avx10,            AVX10,            baseline::avx10);
+LIBCPUCAPS_CXX_FEATURE(erms,             ERMS,             false);
+LIBCPUCAPS_CXX_FEATURE(fsrm,             FSRM,             false);
+LIBCPUCAPS_CXX_FEATURE(clflushopt,       CLFLUSHOPT,       baseline::clflushopt);
+LIBCPUCAPS_CXX_FEATURE(clwb,             CLWB,             baseline::clwb);
+LIBCPUCAPS_CXX_FEATURE(cmov,             CMOV,             baseline::cmov);
+LIBCPUCAPS_CXX_FEATURE(fxsr,             FXSR,             baseline::fxsr);
+LIBCPUCAPS_CXX_FEATURE(lahfsahf,         LAHFSAHF,         baseline::lahfsahf);
+LIBCPUCAPS_CXX_FEATURE(syscall,          SYSCALL,          baseline::syscall);
+LIBCPUCAPS_CXX_FEATURE(longmode,         LONGMODE,         baseline::longmode);
+LIBCPUCAPS_CXX_FEATURE(hypervisor,       HYPERVISOR,       false);
+/* never in the baseline, -mamx-tile can't grant the per-process permission (see libcpucaps_EnableAMX) */
+LIBCPUCAPS_CXX_FEATURE(amx_tile,         AMX_TILE,         false);
+LIBCPUCAPS_CXX_FEATURE(amx_bf16,         AMX_BF16,         false);
+LIBCPUCAPS_CXX_FEATURE(amx_int8,         AMX_INT8,         false);
+LIBCPUCAPS_CXX_FEATURE(amx_fp16,         AMX_FP16,         false);
+LIBCPUCAPS_CXX_FEATURE(waitpkg,          WAITPKG,          baseline::waitpkg);
+LIBCPUCAPS_CXX_FEATURE(monitorx,         MONITORX,         baseline::monitorx);
+LIBCPUCAPS_CXX_FEATURE(pdpe1gb,          PDPE1GB,          false);
+
+#undef LIBCPUCAPS_CXX_FEATURE
+
+/* a set of features an implementation requires */
+/* features in the compile-time baseline are left out of the mask, so they are never checked */
+template <typename... Features>
+struct feature_set {
+    static constexpr bool inBaseline = (Features::inBaseline && ...);
+
+    static constexpr std::uint64_t word(int w) noexcept {
+        return (((!Features::inBaseline && Features::id / 64 == w) ? (std::uint64_t(1) << (Features::id % 64)) : 0) | ... | 0);
+    }
+
+    static constexpr cpucaps_features_t mask() noexcept {
+        return cpucaps_features_t{ { word(0), word(1) } };
+    }
+
+    /* one AND-compare per word */
+    static bool supported(const cpucaps_t& caps) noexcept {
+        constexpr std::uint64_t w0 = word(0);
+        constexpr std::uint64_t w1 = word(1);
+        static_assert(LIBCPUCAPS_FEATURE_WORDS == 2, "feature_set assumes two feature words");
+        return ((caps.features.words[0] & w0) == w0) & ((caps.features.words[1] & w1) == w1);
+    }
+};
+
+/* checks against the given caps, features in the compile-time baseline never touch them */
+template <typename... Features>
+inline bool has(const cpucaps_t& caps) noexcept {
+    if constexpr (feature_set<Features...>::inBaseline) {
+        return true;
+    } else {
+        return feature_set<Features...>::supported(caps);
+    }
+}
+
+/* checks against the process-wide cached caps, detected on the first call that can't be folded */
+template <typename... Features>
+inline bool has() noexcept {
+    if constexpr (feature_set<Features...>::inBaseline) {
+        return true;
+    } else {
+        return feature_set<Features...>::supported(*libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES));
+    }
+}
+
+namespace detail {
+    template <typename Func, typename... Impls>
+    struct resolver {
+        static constexpr std::size_t count = 0;
+
+        static Func resolve(const cpucaps_t&) noexcept {
+            return nullptr;
+        }
+    };
+
+    /* stops at the first impl the compile target always supports, the ones after it are never instantiated */
+    template <typename Func, typename First, typename... Rest>
+    struct resolver<Func, First, Rest...> {
+        static constexpr std::size_t count = First::features::inBaseline ? 1 : (1 + resolver<Func, Rest...>::count);
+
+        static Func resolve(const cpucaps_t& caps) noexcept {
+            if constexpr (First::features::inBaseline) {
+                return &First::run;
+            } else {
+                return First::features::supported(caps) ? &First::run : resolver<Func, Rest...>::resolve(caps);
+            }
+        }
+    };
+}
+
+/* compile-time counterpart of cpucaps_dispatch_t, impls are ordered from the best to the baseline one: */
+/*   struct dot_avx2 { using features = cpucaps::feature_set<cpucaps::avx2, cpucaps::fma3>; static float run(const float*, const float*, size_t); }; */
+/*   struct dot_sse2 { using features = cpucaps::feature_set<cpucaps::sse2>; static float run(const float*, const float*, size_t); }; */
+/*   float r = cpucaps::dispatch<dot_avx2, dot_sse2>::call(a, b, n); */
+/* when an impl is in the compile-time baseline it's called directly and the impls after it are dropped */
+template <typename First, typename... Rest>
+struct dispatch {
+    using func_type = decltype(&First::run);
+
+    /* impls that are actually compiled in */
+    static constexpr std::size_t candidates = detail::resolver<func_type, First, Rest...>::count;
+    /* no runtime check at all, the best impl is always supported */
+    static constexpr bool isStatic = First::features::inBaseline;
+
+    /* best supported impl for the given caps, nullptr if none */
+    static func_type get(const cpucaps_t& caps) noexcept {
+        return detail::resolver<func_type, First, Rest...>::resolve(caps);
+    }
+
+    /* best supported impl for this process, resolved once */
+    static func_type get() noexcept {
+        if constexpr (isStatic) {
+            return &First::run;
+        } else {
+            static const func_type func = get(*libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES));
+            return func;
+        }
+    }
+
+    template <typename... Args>
+    static decltype(auto) call(Args&&... args) {
+        if constexpr (isStatic) {
+            return First::run(std::forward<Args>(args)...);
+        } else {
+            return get()(std::forward<Args>(args)...);
+        }
+    }
+};
+
+} /* namespace cpucaps */
+
+#endif /* LIBCPUCAPS_HPP_HEADER */
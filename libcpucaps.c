@@ -3,9 +3,10 @@
 #endif
 
 #include "libcpucaps.h"
-#include <stdint.h>
+#include "libcpucaps_internal.h"
 #include <stdio.h>
 #include <string.h>    /* memcpy, memset, memcmp */
+#include <time.h>      /* clock_gettime */
 
 #if defined(__clang__) || defined(__GNUC__) || defined(__GNUG__) || defined(__ICC) || defined(__INTEL_COMPILER)
 #include <cpuid.h>
@@ -14,15 +15,6 @@
 #ifdef __linux__
 
 #include <sched.h>
-#include <unistd.h>
-#if __GLIBC_PREREQ(2,30)
-/* we have gettid !!! */
-#else
-#include <sys/syscall.h>
-static pid_t gettid() {
-    return syscall(SYS_gettid);
-}
-#endif
 
 #else
 
@@ -30,48 +22,74 @@ static pid_t gettid() {
 #define VC_EXTRALEAN
 #define NOMINMAX
 #include <Windows.h>
+#include <immintrin.h>  /* _xgetbv */
 
 #endif
 
-typedef struct _s_cpuid_result {
-    uint32_t eax, ebx, ecx, edx;
-} cpuid_result_t;
-
-int cpuid_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result);
 void query_Intel_caches(cpucaps_t* caps);
-void query_Intel_topology(uint32_t highestFunc, cpucaps_t* caps);
 void query_AMD_caches(uint32_t highestFuncEx, cpucaps_t* caps);
-void query_AMD_topology(uint32_t highestFuncEx, cpucaps_t* caps);
+void query_tsc(uint32_t highestFunc, cpucaps_t* caps);
+void query_amx(uint32_t highestFunc, cpucaps_t* caps);
+void query_topology(cpucaps_t* caps);
+
+/* registers the feature bits are read from */
+#define FEATURE_REG_1_ECX           0
+#define FEATURE_REG_1_EDX           1
+#define FEATURE_REG_7_EBX           2
+#define FEATURE_REG_7_ECX           3
+#define FEATURE_REG_7_EDX           4
+#define FEATURE_REG_7_1_EAX         5
+#define FEATURE_REG_7_1_EDX         6
+#define FEATURE_REG_80000001_ECX    7
+#define FEATURE_REG_80000001_EDX    8
+#define FEATURE_REG_80000007_EDX    9
+#define NUM_FEATURE_REGS            10
+
+static void decode_features(const uint32_t* regs, int xcr0, cpucaps_features_t* features);
+static void query_hypervisor(cpucaps_t* caps);
+static void start_stats(cpucaps_stats_t* stats, uint64_t* phaseStart);
+static void end_phase(cpucaps_stats_t* stats, int phase, uint64_t* phaseStart);
+static void finish_stats(cpucaps_stats_t* stats);
+static int detect_parts(cpucaps_t* caps, int parts, cpucaps_stats_t* stats);
 
 int libcpucaps_GetCaps(cpucaps_t* caps) {
-    uint32_t highestFunc, highestFuncEx;
-    cpuid_result_t cpuidResult;
+    return libcpucaps_GetCapsStats(caps, NULL);
+}
 
+int libcpucaps_GetCapsStats(cpucaps_t* caps, cpucaps_stats_t* stats) {
     if (!caps) {
         return LIBCPUCAPS_ERROR_INVALID_PARAM;
     }
     memset(caps, 0, sizeof(cpucaps_t));
+    return detect_parts(caps, LIBCPUCAPS_DETECT_ALL, stats);
+}
 
-    /* get the highest function id */
-    memset(&cpuidResult, 0, sizeof(cpuidResult));
-    cpuid_wrapper(0, 0, &cpuidResult);
-    highestFunc = cpuidResult.eax;
-
-    /* copy over the CPU vendor string */
-    memcpy(&caps->vendor[0], &cpuidResult.ebx, 4);
-    memcpy(&caps->vendor[4], &cpuidResult.edx, 4);
-    memcpy(&caps->vendor[8], &cpuidResult.ecx, 4);
+int libcpucaps_GetCapsEx(cpucaps_t* caps, int parts) {
+    if (!caps) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(caps, 0, sizeof(cpucaps_t));
+    return detect_parts(caps, parts, NULL);
+}
 
-    if (!memcmp(caps->vendor, "GenuineIntel", 12)) {
-        caps->isIntel = 1;
-    } else if (!memcmp(caps->vendor, "AuthenticAMD", 12)) {
-        caps->isAMD = 1;
+int libcpucaps_CompleteCaps(cpucaps_t* caps, int parts) {
+    if (!caps || !(caps->detectedParts & LIBCPUCAPS_DETECT_FEATURES)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
     }
+    return detect_parts(caps, parts, NULL);
+}
+
+/* vendor, family & model, the feature leaves, XCR0, hypervisor, AVX10 & AMX - CPUID & XGETBV only */
+static void query_features(uint32_t highestFunc, uint32_t highestFuncEx, cpucaps_t* caps) {
+    uint32_t regs[NUM_FEATURE_REGS];
+    cpuid_result_t cpuidResult;
+
+    memset(regs, 0, sizeof(regs));
 
     if (highestFunc >= 1) {
         cpuid_wrapper(1, 0, &cpuidResult);
-        caps->func1_ecx = cpuidResult.ecx;
-        caps->func1_edx = cpuidResult.edx;
+        regs[FEATURE_REG_1_ECX] = cpuidResult.ecx;
+        regs[FEATURE_REG_1_EDX] = cpuidResult.edx;
 
         caps->stepping = cpuidResult.eax & 0xF;
         caps->model = (cpuidResult.eax >> 4) & 0xF;
@@ -79,30 +97,61 @@ int libcpucaps_GetCaps(cpucaps_t* caps) {
         caps->cpuType = (cpuidResult.eax >> 12) & 0x3;
         caps->modelEx = (cpuidResult.eax >> 16) & 0xF;
         caps->familyEx = (cpuidResult.eax >> 20) & 0xFF;
-    }
 
-    if (highestFunc >= 4 && caps->isIntel) {
-        query_Intel_caches(caps);                   /* Intel's "Deterministic Cache Parameters Leaf" */
-        query_Intel_topology(highestFunc, caps);    /* Intel's "Extended Topology Enumeration leaf" (both V1 & V2) */
+        /* the OS has enabled XGETBV, so we can check which register states it actually saves */
+        if (GET_BIT(regs[FEATURE_REG_1_ECX], 27)) {
+            caps->xcr0 = (int)(xgetbv_wrapper(0) & 0xFFFFFFFF);
+        }
     }
 
     if (highestFunc >= 7) {
         cpuid_wrapper(7, 0, &cpuidResult);
-        caps->func7_ebx = cpuidResult.ebx;
-        caps->func7_ecx = cpuidResult.ecx;
+        regs[FEATURE_REG_7_EBX] = cpuidResult.ebx;
+        regs[FEATURE_REG_7_ECX] = cpuidResult.ecx;
+        regs[FEATURE_REG_7_EDX] = cpuidResult.edx;
+
+        /* EAX is the highest subleaf */
+        if (cpuidResult.eax >= 1) {
+            cpuid_wrapper(7, 1, &cpuidResult);
+            regs[FEATURE_REG_7_1_EAX] = cpuidResult.eax;
+            regs[FEATURE_REG_7_1_EDX] = cpuidResult.edx;
+        }
     }
 
-    /* get the highest extended function id */
-    cpuid_wrapper(0x80000000, 0, &cpuidResult);
-    highestFuncEx = cpuidResult.eax;
-
     if (highestFuncEx >= 0x80000001) {
         cpuid_wrapper(0x80000001, 0, &cpuidResult);
-        caps->func80000001_ecx = cpuidResult.ecx;
-        caps->func80000001_edx = cpuidResult.edx;
+        regs[FEATURE_REG_80000001_ECX] = cpuidResult.ecx;
+        regs[FEATURE_REG_80000001_EDX] = cpuidResult.edx;
     }
 
-    /* copy over the CPU name string */
+    if (highestFuncEx >= 0x80000007) {
+        cpuid_wrapper(0x80000007, 0, &cpuidResult);
+        regs[FEATURE_REG_80000007_EDX] = cpuidResult.edx;
+    }
+
+    decode_features(regs, caps->xcr0, &caps->features);
+
+    /* hypervisor vendor, from here on every CPUID of a VM is served from the leaf cache */
+    if (libcpucaps_HasFeature(caps, LIBCPUCAPS_FEATURE_HYPERVISOR)) {
+        query_hypervisor(caps);
+    }
+
+    /* AVX10 Converged Vector ISA Leaf, EBX[7:0] is the version */
+    if (highestFunc >= 0x24 && libcpucaps_HasAVX10(caps)) {
+        cpuid_wrapper(0x24, 0, &cpuidResult);
+        caps->avx10Version = (int)(cpuidResult.ebx & 0xFF);
+    }
+
+    /* AMX tile palettes & TMUL limits */
+    if (highestFunc >= 0x1D && libcpucaps_HasAMXTile(caps)) {
+        query_amx(highestFunc, caps);
+    }
+}
+
+/* copy over the CPU name string */
+static void query_name(uint32_t highestFuncEx, cpucaps_t* caps) {
+    cpuid_result_t cpuidResult;
+
     if (highestFuncEx >= 0x80000002) {
         cpuid_wrapper(0x80000002, 0, &cpuidResult);
         memcpy(&caps->name[0], &cpuidResult, 16);
@@ -117,115 +166,687 @@ int libcpucaps_GetCaps(cpucaps_t* caps) {
             }
         }
     }
+}
+
+/* fills in the requested parts caps doesn't have yet, the features always come first as the other parts depend on them */
+static int detect_parts(cpucaps_t* caps, int parts, cpucaps_stats_t* stats) {
+    uint32_t highestFunc, highestFuncEx;
+    cpuid_result_t cpuidResult;
+    uint64_t phaseStart = 0;
+
+    parts = (parts | LIBCPUCAPS_DETECT_FEATURES) & LIBCPUCAPS_DETECT_ALL & ~caps->detectedParts;
+    start_stats(stats, &phaseStart);
 
-    /* AMD caches info */
-    if (highestFuncEx >= 0x80000005 && caps->isAMD) {
-        query_AMD_caches(highestFuncEx, caps);
-        query_AMD_topology(highestFuncEx, caps);
+    /* get the highest function id */
+    memset(&cpuidResult, 0, sizeof(cpuidResult));
+    cpuid_wrapper(0, 0, &cpuidResult);
+    highestFunc = cpuidResult.eax;
+
+    if (parts & LIBCPUCAPS_DETECT_FEATURES) {
+        /* copy over the CPU vendor string */
+        memcpy(&caps->vendor[0], &cpuidResult.ebx, 4);
+        memcpy(&caps->vendor[4], &cpuidResult.edx, 4);
+        memcpy(&caps->vendor[8], &cpuidResult.ecx, 4);
+
+        if (!memcmp(caps->vendor, "GenuineIntel", 12)) {
+            caps->isIntel = 1;
+        } else if (!memcmp(caps->vendor, "AuthenticAMD", 12)) {
+            caps->isAMD = 1;
+        }
     }
+    end_phase(stats, LIBCPUCAPS_PHASE_VENDOR, &phaseStart);
+
+    /* get the highest extended function id */
+    cpuid_wrapper(0x80000000, 0, &cpuidResult);
+    highestFuncEx = cpuidResult.eax;
 
+    if (parts & LIBCPUCAPS_DETECT_FEATURES) {
+        query_features(highestFunc, highestFuncEx, caps);
+    }
+    if (parts & LIBCPUCAPS_DETECT_NAME) {
+        query_name(highestFuncEx, caps);
+    }
+    end_phase(stats, LIBCPUCAPS_PHASE_FEATURES, &phaseStart);
+
+    if (parts & LIBCPUCAPS_DETECT_CACHES) {
+        if (highestFunc >= 4 && caps->isIntel) {
+            query_Intel_caches(caps);               /* Intel's "Deterministic Cache Parameters Leaf" */
+        } else if (highestFuncEx >= 0x80000005 && caps->isAMD) {
+            query_AMD_caches(highestFuncEx, caps);
+        }
+    }
+    end_phase(stats, LIBCPUCAPS_PHASE_CACHES, &phaseStart);
+
+    /* TSC frequency from the CPUID leaves, calibrating is left to libcpucaps_InitTSCClock */
+    if (parts & LIBCPUCAPS_DETECT_TSC) {
+        query_tsc(highestFunc, caps);
+    }
+    end_phase(stats, LIBCPUCAPS_PHASE_TSC, &phaseStart);
+
+    /* every logical cpu is probed in parallel by the topology engine */
+    if (parts & LIBCPUCAPS_DETECT_TOPOLOGY) {
+        query_topology(caps);
+    }
+    end_phase(stats, LIBCPUCAPS_PHASE_TOPOLOGY, &phaseStart);
+
+    caps->detectedParts |= parts;
+    finish_stats(stats);
     return LIBCPUCAPS_ERROR_OK;
 }
 
+static cpucaps_t        s_cachedCaps;
+static volatile int32_t s_cachedCapsParts = 0;     /* LIBCPUCAPS_DETECT_xxx parts published so far */
+static volatile int32_t s_cachedCapsLock = 0;      /* held while a thread fills in missing parts */
+
+const cpucaps_t* libcpucaps_GetCachedCaps(void) {
+    return libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_ALL);
+}
+
+const cpucaps_t* libcpucaps_GetCachedCapsEx(int parts) {
+    parts = (parts | LIBCPUCAPS_DETECT_FEATURES) & LIBCPUCAPS_DETECT_ALL;
+
+    /* fast path - a single acquire load once the parts are published */
+    if ((atomic_load_acquire_wrapper(&s_cachedCapsParts) & parts) == parts) {
+        return &s_cachedCaps;
+    }
+
+    /* one thread at a time adds the missing parts, the fields of the published ones aren't written again */
+    while (!atomic_compare_exchange_wrapper(&s_cachedCapsLock, 0, 1)) {
+        thread_yield_wrapper();
+    }
+    if ((atomic_load_acquire_wrapper(&s_cachedCapsParts) & parts) != parts) {
+        detect_parts(&s_cachedCaps, parts, NULL);
+        atomic_store_release_wrapper(&s_cachedCapsParts, s_cachedCaps.detectedParts);
+    }
+    atomic_store_release_wrapper(&s_cachedCapsLock, 0);
+
+    return &s_cachedCaps;
+}
+
+
+
+#define HAS_FEATURE(caps, feature)  ((int)(((caps)->features.words[(feature) / 64] >> ((feature) % 64)) & 1))
+
+typedef struct _s_feature_bit {
+    int feature;
+    int reg;        /* FEATURE_REG_xxx */
+    int bit;
+    int xcr0Mask;   /* register state the OS has to save for the feature to be usable, 0 if none */
+} feature_bit_t;
+
+static const feature_bit_t s_featureBits[] = {
+    { LIBCPUCAPS_FEATURE_FPU,               FEATURE_REG_1_EDX,         0, 0 },
+    { LIBCPUCAPS_FEATURE_PSE,               FEATURE_REG_1_EDX,         3, 0 },
+    { LIBCPUCAPS_FEATURE_TSC,               FEATURE_REG_1_EDX,         4, 0 },
+    { LIBCPUCAPS_FEATURE_CMPXCHG8,          FEATURE_REG_1_EDX,         8, 0 },
+    { LIBCPUCAPS_FEATURE_CMPXCHG16B,        FEATURE_REG_1_ECX,        13, 0 },
+    { LIBCPUCAPS_FEATURE_MMX,               FEATURE_REG_1_EDX,        23, 0 },
+    { LIBCPUCAPS_FEATURE_MMXEXT,            FEATURE_REG_80000001_EDX, 23, 0 },
+    { LIBCPUCAPS_FEATURE_3DNOW,             FEATURE_REG_80000001_EDX, 31, 0 },
+    { LIBCPUCAPS_FEATURE_3DNOWEXT,          FEATURE_REG_80000001_EDX, 30, 0 },
+    { LIBCPUCAPS_FEATURE_SSE,               FEATURE_REG_1_EDX,        25, 0 },
+    { LIBCPUCAPS_FEATURE_SSE2,              FEATURE_REG_1_EDX,        26, 0 },
+    { LIBCPUCAPS_FEATURE_SSE3,              FEATURE_REG_1_ECX,         0, 0 },
+    { LIBCPUCAPS_FEATURE_SSSE3,             FEATURE_REG_1_ECX,         9, 0 },
+    { LIBCPUCAPS_FEATURE_SSE41,             FEATURE_REG_1_ECX,        19, 0 },
+    { LIBCPUCAPS_FEATURE_SSE42,             FEATURE_REG_1_ECX,        20, 0 },
+    { LIBCPUCAPS_FEATURE_ABM,               FEATURE_REG_80000001_ECX,  5, 0 },
+    { LIBCPUCAPS_FEATURE_SSE4A,             FEATURE_REG_80000001_ECX,  6, 0 },
+    { LIBCPUCAPS_FEATURE_MISALIGNSSE,       FEATURE_REG_80000001_ECX,  7, 0 },
+    { LIBCPUCAPS_FEATURE_AES,               FEATURE_REG_1_ECX,        25, 0 },
+    { LIBCPUCAPS_FEATURE_AVX,               FEATURE_REG_1_ECX,        28, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX2,              FEATURE_REG_7_EBX,         5, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512F,           FEATURE_REG_7_EBX,        16, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512PF,          FEATURE_REG_7_EBX,        26, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512ER,          FEATURE_REG_7_EBX,        27, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512CD,          FEATURE_REG_7_EBX,        28, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_F16C,              FEATURE_REG_1_ECX,        29, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_RDRAND,            FEATURE_REG_1_ECX,        30, 0 },
+    { LIBCPUCAPS_FEATURE_RDSEED,            FEATURE_REG_7_EBX,        18, 0 },
+    { LIBCPUCAPS_FEATURE_FMA3,              FEATURE_REG_1_ECX,        12, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_FMA4,              FEATURE_REG_80000001_ECX, 16, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_HYBRID,            FEATURE_REG_7_EDX,        15, 0 },
+    { LIBCPUCAPS_FEATURE_OSXSAVE,           FEATURE_REG_1_ECX,        27, 0 },
+    { LIBCPUCAPS_FEATURE_INVARIANT_TSC,     FEATURE_REG_80000007_EDX,  8, 0 },
+    { LIBCPUCAPS_FEATURE_RDTSCP,            FEATURE_REG_80000001_EDX, 27, 0 },
+    { LIBCPUCAPS_FEATURE_POPCNT,            FEATURE_REG_1_ECX,        23, 0 },
+    { LIBCPUCAPS_FEATURE_BMI1,              FEATURE_REG_7_EBX,         3, 0 },
+    { LIBCPUCAPS_FEATURE_BMI2,              FEATURE_REG_7_EBX,         8, 0 },
+    { LIBCPUCAPS_FEATURE_ADX,               FEATURE_REG_7_EBX,        19, 0 },
+    { LIBCPUCAPS_FEATURE_MOVBE,             FEATURE_REG_1_ECX,        22, 0 },
+    { LIBCPUCAPS_FEATURE_SHA,               FEATURE_REG_7_EBX,        29, 0 },
+    { LIBCPUCAPS_FEATURE_PCLMULQDQ,         FEATURE_REG_1_ECX,         1, 0 },
+    { LIBCPUCAPS_FEATURE_VAES,              FEATURE_REG_7_ECX,         9, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_VPCLMULQDQ,        FEATURE_REG_7_ECX,        10, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_GFNI,              FEATURE_REG_7_ECX,         8, 0 },
+    { LIBCPUCAPS_FEATURE_AVX512BW,          FEATURE_REG_7_EBX,        30, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512DQ,          FEATURE_REG_7_EBX,        17, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512VL,          FEATURE_REG_7_EBX,        31, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512VNNI,        FEATURE_REG_7_ECX,        11, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512BF16,        FEATURE_REG_7_1_EAX,       5, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512FP16,        FEATURE_REG_7_EDX,        23, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512VBMI,        FEATURE_REG_7_ECX,         1, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512VBMI2,       FEATURE_REG_7_ECX,         6, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512BITALG,      FEATURE_REG_7_ECX,        12, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX512VPOPCNTDQ,   FEATURE_REG_7_ECX,        14, XCR0_ZMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVXVNNI,           FEATURE_REG_7_1_EAX,       4, XCR0_YMM_MASK },
+    { LIBCPUCAPS_FEATURE_AVX10,             FEATURE_REG_7_1_EDX,      19, XCR0_AVX10_MASK },
+    { LIBCPUCAPS_FEATURE_ERMS,              FEATURE_REG_7_EBX,         9, 0 },
+    { LIBCPUCAPS_FEATURE_FSRM,              FEATURE_REG_7_EDX,         4, 0 },
+    { LIBCPUCAPS_FEATURE_CLFLUSHOPT,        FEATURE_REG_7_EBX,        23, 0 },
+    { LIBCPUCAPS_FEATURE_CLWB,              FEATURE_REG_7_EBX,        24, 0 },
+    { LIBCPUCAPS_FEATURE_CMOV,              FEATURE_REG_1_EDX,        15, 0 },
+    { LIBCPUCAPS_FEATURE_FXSR,              FEATURE_REG_1_EDX,        24, 0 },
+    { LIBCPUCAPS_FEATURE_LAHFSAHF,          FEATURE_REG_80000001_ECX,  0, 0 },
+    { LIBCPUCAPS_FEATURE_SYSCALL,           FEATURE_REG_80000001_EDX, 11, 0 },
+    { LIBCPUCAPS_FEATURE_LONGMODE,          FEATURE_REG_80000001_EDX, 29, 0 },
+    { LIBCPUCAPS_FEATURE_HYPERVISOR,        FEATURE_REG_1_ECX,        31, 0 },
+    { LIBCPUCAPS_FEATURE_AMX_TILE,          FEATURE_REG_7_EDX,        24, XCR0_AMX_MASK },
+    { LIBCPUCAPS_FEATURE_AMX_BF16,          FEATURE_REG_7_EDX,        22, XCR0_AMX_MASK },
+    { LIBCPUCAPS_FEATURE_AMX_INT8,          FEATURE_REG_7_EDX,        25, XCR0_AMX_MASK },
+    { LIBCPUCAPS_FEATURE_AMX_FP16,          FEATURE_REG_7_1_EAX,      21, XCR0_AMX_MASK },
+    { LIBCPUCAPS_FEATURE_WAITPKG,           FEATURE_REG_7_ECX,         5, 0 },
+    { LIBCPUCAPS_FEATURE_MONITORX,          FEATURE_REG_80000001_ECX, 29, 0 },
+    { LIBCPUCAPS_FEATURE_PDPE1GB,           FEATURE_REG_80000001_EDX, 26, 0 }
+};
+
+/* adds the features of the registers to the set, no libc calls as the ifunc resolver uses it too */
+static void decode_features(const uint32_t* regs, int xcr0, cpucaps_features_t* features) {
+    const feature_bit_t* bit;
+    size_t i;
+
+    for (i = 0; i < sizeof(s_featureBits) / sizeof(s_featureBits[0]); ++i) {
+        bit = &s_featureBits[i];
+        if (!GET_BIT(regs[bit->reg], bit->bit)) {
+            continue;
+        }
+        if (bit->xcr0Mask && !(GET_BIT(regs[FEATURE_REG_1_ECX], 27) && (xcr0 & bit->xcr0Mask) == bit->xcr0Mask)) {
+            continue;
+        }
+        features->words[bit->feature / 64] |= (uint64_t)1 << (bit->feature % 64);
+    }
+}
+
+static int has_os_state(const cpucaps_t* caps, int xcr0Mask) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_OSXSAVE) && ((caps->xcr0 & xcr0Mask) == xcr0Mask);
+}
+
+static const cpucaps_features_t s_x86LevelMasks[] = {
+    { { X86_LEVEL_V1(0), X86_LEVEL_V1(1) } },
+    { { X86_LEVEL_V2(0), X86_LEVEL_V2(1) } },
+    { { X86_LEVEL_V3(0), X86_LEVEL_V3(1) } },
+    { { X86_LEVEL_V4(0), X86_LEVEL_V4(1) } }
+};
+
+int libcpucaps_GetX86Level(const cpucaps_t* caps) {
+    int level = LIBCPUCAPS_X86_LEVEL_NONE;
+
+    while (level < LIBCPUCAPS_X86_LEVEL_V4 && libcpucaps_HasAll(caps, &s_x86LevelMasks[level])) {
+        ++level;
+    }
+
+    return level;
+}
+
+int libcpucaps_HasFeature(const cpucaps_t* caps, int feature) {
+    if (feature < 0 || feature >= LIBCPUCAPS_NUM_FEATURES) {
+        return 0;
+    }
+    return HAS_FEATURE(caps, feature);
+}
+
+int libcpucaps_HasAll(const cpucaps_t* caps, const cpucaps_features_t* mask) {
+    return ((caps->features.words[0] & mask->words[0]) == mask->words[0]) &
+           ((caps->features.words[1] & mask->words[1]) == mask->words[1]);
+}
 
+int libcpucaps_HasAny(const cpucaps_t* caps, const cpucaps_features_t* mask) {
+    return ((caps->features.words[0] & mask->words[0]) | (caps->features.words[1] & mask->words[1])) != 0;
+}
 
-#define GET_BIT(a, bit)  (((a) >> (bit)) & 1)
+int libcpucaps_AddFeature(cpucaps_features_t* mask, int feature) {
+    if (!mask || feature < 0 || feature >= LIBCPUCAPS_NUM_FEATURES) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    mask->words[feature / 64] |= (uint64_t)1 << (feature % 64);
+    return LIBCPUCAPS_ERROR_OK;
+}
 
-int libcpucaps_HasFPU(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 0);
+int libcpucaps_HasFPU(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_FPU);
+}
+int libcpucaps_HasPSE(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_PSE);
+}
+int libcpucaps_HasTSC(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_TSC);
+}
+int libcpucaps_HasInvariantTSC(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_INVARIANT_TSC);
+}
+int libcpucaps_HasRDTSCP(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_RDTSCP);
+}
+int libcpucaps_HasCMPXCHG8(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_CMPXCHG8);
+}
+int libcpucaps_HasCMPXCHG16B(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_CMPXCHG16B);
+}
+int libcpucaps_HasMMX(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_MMX);
+}
+int libcpucaps_HasMMXExt(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_MMXEXT);
+}
+int libcpucaps_Has3DNow(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_3DNOW);
+}
+int libcpucaps_Has3DNowExt(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_3DNOWEXT);
+}
+int libcpucaps_HasSSE(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSE);
+}
+int libcpucaps_HasSSE2(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSE2);
+}
+int libcpucaps_HasSSE3(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSE3);
+}
+int libcpucaps_HasSSSE3(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSSE3);
+}
+int libcpucaps_HasSSE41(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSE41);
+}
+int libcpucaps_HasSSE42(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSE42);
+}
+int libcpucaps_HasABM(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_ABM);
+}
+int libcpucaps_HasPOPCNT(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_POPCNT);
+}
+int libcpucaps_HasSSE4a(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SSE4A);
+}
+int libcpucaps_HasMisalignSSE(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_MISALIGNSSE);
+}
+int libcpucaps_HasAES(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AES);
+}
+int libcpucaps_HasAVX(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX);
+}
+int libcpucaps_HasAVX2(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX2);
+}
+int libcpucaps_HasAVX512F(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512F);
+}
+int libcpucaps_HasAVX512PF(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512PF);
+}
+int libcpucaps_HasAVX512ER(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512ER);
+}
+int libcpucaps_HasAVX512CD(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512CD);
+}
+int libcpucaps_HasF16C(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_F16C);
+}
+int libcpucaps_HasRDRAND(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_RDRAND);
+}
+int libcpucaps_HasRDSEED(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_RDSEED);
+}
+int libcpucaps_HasFMA3(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_FMA3);
+}
+int libcpucaps_HasFMA4(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_FMA4);
+}
+int libcpucaps_HasBMI1(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_BMI1);
+}
+int libcpucaps_HasBMI2(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_BMI2);
+}
+int libcpucaps_HasADX(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_ADX);
+}
+int libcpucaps_HasMOVBE(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_MOVBE);
+}
+int libcpucaps_HasSHA(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_SHA);
 }
-int libcpucaps_HasPSE(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 3);
+int libcpucaps_HasPCLMULQDQ(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_PCLMULQDQ);
 }
-int libcpucaps_HasTSC(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 4);
+int libcpucaps_HasVAES(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_VAES);
 }
-int libcpucaps_HasCMPXCHG8(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 8);
+int libcpucaps_HasVPCLMULQDQ(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_VPCLMULQDQ);
 }
-int libcpucaps_HasCMPXCHG16B(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 13);
+int libcpucaps_HasGFNI(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_GFNI);
 }
-int libcpucaps_HasMMX(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 23);
+int libcpucaps_HasAVX512BW(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512BW);
 }
-int libcpucaps_HasMMXExt(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_edx, 23);
+int libcpucaps_HasAVX512DQ(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512DQ);
 }
-int libcpucaps_Has3DNow(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_edx, 31);
+int libcpucaps_HasAVX512VL(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512VL);
 }
-int libcpucaps_Has3DNowExt(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_edx, 30);
+int libcpucaps_HasAVX512VNNI(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512VNNI);
 }
-int libcpucaps_HasSSE(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 25);
+int libcpucaps_HasAVX512BF16(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512BF16);
 }
-int libcpucaps_HasSSE2(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_edx, 26);
+int libcpucaps_HasAVX512FP16(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512FP16);
 }
-int libcpucaps_HasSSE3(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 0);
+int libcpucaps_HasAVX512VBMI(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512VBMI);
 }
-int libcpucaps_HasSSSE3(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 9);
+int libcpucaps_HasAVX512VBMI2(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512VBMI2);
 }
-int libcpucaps_HasSSE41(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 19);
+int libcpucaps_HasAVX512BITALG(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512BITALG);
 }
-int libcpucaps_HasSSE42(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 20);
+int libcpucaps_HasAVX512VPOPCNTDQ(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX512VPOPCNTDQ);
 }
-int libcpucaps_HasABM(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_ecx, 5);
+int libcpucaps_HasAVXVNNI(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVXVNNI);
 }
-int libcpucaps_HasSSE4a(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_ecx, 6);
+int libcpucaps_HasAVX10(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AVX10);
 }
-int libcpucaps_HasMisalignSSE(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_ecx, 7);
+int libcpucaps_HasERMS(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_ERMS);
 }
-int libcpucaps_HasAES(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 25);
+int libcpucaps_HasFSRM(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_FSRM);
 }
-int libcpucaps_HasAVX(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 28);
+int libcpucaps_HasCLFLUSHOPT(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_CLFLUSHOPT);
 }
-int libcpucaps_HasAVX2(cpucaps_t* caps) {
-    return GET_BIT(caps->func7_ebx, 5);
+int libcpucaps_HasCLWB(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_CLWB);
 }
-int libcpucaps_HasAVX512F(cpucaps_t* caps) {
-    return GET_BIT(caps->func7_ebx, 16);
+int libcpucaps_HasHybrid(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_HYBRID);
 }
-int libcpucaps_HasAVX512PF(cpucaps_t* caps) {
-    return GET_BIT(caps->func7_ebx, 26);
+int libcpucaps_HasOSXSAVE(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_OSXSAVE);
 }
-int libcpucaps_HasAVX512ER(cpucaps_t* caps) {
-    return GET_BIT(caps->func7_ebx, 27);
+int libcpucaps_HasYMMState(const cpucaps_t* caps) {
+    return has_os_state(caps, XCR0_YMM_MASK);
 }
-int libcpucaps_HasAVX512CD(cpucaps_t* caps) {
-    return GET_BIT(caps->func7_ebx, 28);
+int libcpucaps_HasZMMState(const cpucaps_t* caps) {
+    return has_os_state(caps, XCR0_ZMM_MASK);
 }
-int libcpucaps_HasF16C(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 29);
+int libcpucaps_HasAMXState(const cpucaps_t* caps) {
+    return has_os_state(caps, XCR0_AMX_MASK);
 }
-int libcpucaps_HasRDRAND(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 30);
+int libcpucaps_HasAMXTile(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AMX_TILE);
 }
-int libcpucaps_HasRDSEED(cpucaps_t* caps) {
-    return GET_BIT(caps->func7_ebx, 18);
+int libcpucaps_HasAMXBF16(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AMX_BF16);
 }
-int libcpucaps_HasFMA3(cpucaps_t* caps) {
-    return GET_BIT(caps->func1_ecx, 12);
+int libcpucaps_HasAMXINT8(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AMX_INT8);
 }
-int libcpucaps_HasFMA4(cpucaps_t* caps) {
-    return GET_BIT(caps->func80000001_ecx, 16);
+int libcpucaps_HasAMXFP16(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_AMX_FP16);
+}
+int libcpucaps_HasWAITPKG(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_WAITPKG);
+}
+int libcpucaps_HasMONITORX(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_MONITORX);
+}
+int libcpucaps_HasPDPE1GB(const cpucaps_t* caps) {
+    return HAS_FEATURE(caps, LIBCPUCAPS_FEATURE_PDPE1GB);
 }
 
 
-int cpuid_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result) {
+int libcpucaps_IsImplSupported(const cpucaps_impl_t* impl, const cpucaps_t* caps) {
+    int i;
+
+    for (i = 0; i < LIBCPUCAPS_DISPATCH_MAX_REQUIREMENTS && impl->requires[i]; ++i) {
+        if (!impl->requires[i](caps)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* the function pointer is published last, a thread that loads it with acquire also sees selected */
+static void store_func_release(cpucaps_dispatch_t* table, libcpucaps_func_t func) {
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    table->func = func;
+#else
+    __atomic_store_n(&table->func, func, __ATOMIC_RELEASE);
+#endif
+}
+
+static libcpucaps_func_t load_func_acquire(const cpucaps_dispatch_t* table) {
+#ifdef _MSC_VER
+    libcpucaps_func_t func = table->func;
+    _ReadWriteBarrier();
+    return func;
+#else
+    return __atomic_load_n(&table->func, __ATOMIC_ACQUIRE);
+#endif
+}
+
+int libcpucaps_DispatchResolve(cpucaps_dispatch_t* table, const cpucaps_t* caps) {
+    int i;
+
+    if (!table || !table->impls) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    }
+
+    for (i = (table->firstAllowed > 0) ? table->firstAllowed : 0; i < table->numImpls; ++i) {
+        if (table->impls[i].func && libcpucaps_IsImplSupported(&table->impls[i], caps)) {
+            table->selected = i;
+            store_func_release(table, table->impls[i].func);
+            return LIBCPUCAPS_ERROR_OK;
+        }
+    }
+
+    table->selected = -1;
+    store_func_release(table, 0);
+    return LIBCPUCAPS_ERROR_FAILED;
+}
+
+int libcpucaps_DispatchForce(cpucaps_dispatch_t* table, const cpucaps_t* caps, int firstAllowed) {
+    if (!table || firstAllowed < 0 || firstAllowed >= table->numImpls) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+
+    table->firstAllowed = firstAllowed;
+    return libcpucaps_DispatchResolve(table, caps);
+}
+
+libcpucaps_func_t libcpucaps_DispatchGet(cpucaps_dispatch_t* table) {
+    libcpucaps_func_t func;
+
+    if (!table) {
+        return 0;
+    }
+    func = load_func_acquire(table);
+    if (!func) {
+        libcpucaps_DispatchResolve(table, 0);
+        func = load_func_acquire(table);
+    }
+
+    return func;
+}
+
+/* the ifunc resolver runs while the loader relocates the program - in a static binary even before libc's */
+/* own ifuncs (memset, memcpy) are resolved - so it uses none of libc, the CPUID backend, the leaf cache */
+/* or the stats, only the raw instructions into locals */
+static void cpuid_raw(uint32_t func, uint32_t subfunc, uint32_t* regs) {
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, (int)func, (int)subfunc);
+#else
+    __cpuid_count(func, subfunc, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv_raw(void) {
+#ifdef _MSC_VER
+    return (uint64_t)_xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+/* volatile stores, so the compiler can't turn the loop back into a memset call */
+static void clear_raw(void* data, size_t size) {
+    volatile unsigned char* p = (volatile unsigned char*)data;
+
+    while (size--) {
+        *p++ = 0;
+    }
+}
+
+/* the feature registers of query_features */
+static void read_features_raw(uint32_t* regs, int* xcr0) {
+    uint32_t leaf[4], highestFunc, highestFuncEx;
+
+    regs[FEATURE_REG_1_ECX] = regs[FEATURE_REG_1_EDX] = regs[FEATURE_REG_7_EBX] = regs[FEATURE_REG_7_ECX] = 0;
+    regs[FEATURE_REG_7_EDX] = regs[FEATURE_REG_7_1_EAX] = regs[FEATURE_REG_7_1_EDX] = 0;
+    regs[FEATURE_REG_80000001_ECX] = regs[FEATURE_REG_80000001_EDX] = regs[FEATURE_REG_80000007_EDX] = 0;
+    *xcr0 = 0;
+
+    cpuid_raw(0, 0, leaf);
+    highestFunc = leaf[0];
+    cpuid_raw(0x80000000, 0, leaf);
+    highestFuncEx = leaf[0];
+
+    if (highestFunc >= 1) {
+        cpuid_raw(1, 0, leaf);
+        regs[FEATURE_REG_1_ECX] = leaf[2];
+        regs[FEATURE_REG_1_EDX] = leaf[3];
+        if (GET_BIT(leaf[2], 27)) {
+            *xcr0 = (int)(xgetbv_raw() & 0xFFFFFFFF);
+        }
+    }
+    if (highestFunc >= 7) {
+        cpuid_raw(7, 0, leaf);
+        regs[FEATURE_REG_7_EBX] = leaf[1];
+        regs[FEATURE_REG_7_ECX] = leaf[2];
+        regs[FEATURE_REG_7_EDX] = leaf[3];
+        if (leaf[0] >= 1) {
+            cpuid_raw(7, 1, leaf);
+            regs[FEATURE_REG_7_1_EAX] = leaf[0];
+            regs[FEATURE_REG_7_1_EDX] = leaf[3];
+        }
+    }
+    if (highestFuncEx >= 0x80000001) {
+        cpuid_raw(0x80000001, 0, leaf);
+        regs[FEATURE_REG_80000001_ECX] = leaf[2];
+        regs[FEATURE_REG_80000001_EDX] = leaf[3];
+    }
+    if (highestFuncEx >= 0x80000007) {
+        cpuid_raw(0x80000007, 0, leaf);
+        regs[FEATURE_REG_80000007_EDX] = leaf[3];
+    }
+}
+
+/* the caps the requirements see only have the features & XCR0, like those of LIBCPUCAPS_DETECT_FEATURES */
+/* without the hypervisor, AVX10 & AMX details */
+libcpucaps_func_t libcpucaps_DispatchResolveIfunc(const cpucaps_dispatch_t* table) {
+    uint32_t regs[NUM_FEATURE_REGS];
+    cpucaps_t caps;
+    int i, j;
+
+    if (!table || !table->impls) {
+        return 0;
+    }
+
+    clear_raw(&caps, sizeof(caps));
+    read_features_raw(regs, &caps.xcr0);
+    decode_features(regs, caps.xcr0, &caps.features);
+    caps.detectedParts = LIBCPUCAPS_DETECT_FEATURES;
+
+    /* libcpucaps_IsImplSupported, inlined so no call goes through the PLT of a shared build */
+    for (i = 0; i < table->numImpls; ++i) {
+        if (!table->impls[i].func) {
+            continue;
+        }
+        for (j = 0; j < LIBCPUCAPS_DISPATCH_MAX_REQUIREMENTS && table->impls[i].requires[j]; ++j) {
+            if (!table->impls[i].requires[j](&caps)) {
+                break;
+            }
+        }
+        if (j == LIBCPUCAPS_DISPATCH_MAX_REQUIREMENTS || !table->impls[i].requires[j]) {
+            return table->impls[i].func;
+        }
+    }
+    return 0;
+}
+
+
+/* leaf cache states, entries are claimed with a CAS and published with a release store */
+#define CPUID_CACHE_SIZE        64      /* distinct (leaf, subleaf) pairs a detection reads, with room to spare */
+#define CPUID_ENTRY_EMPTY       0
+#define CPUID_ENTRY_WRITING     1
+#define CPUID_ENTRY_READY       2
+
+#define CPUID_CACHE_UNDECIDED   0
+#define CPUID_CACHE_OFF         1       /* bare metal, CPUID is cheap enough */
+#define CPUID_CACHE_ON          2       /* under a hypervisor every CPUID is a VM exit */
+
+typedef struct _s_cpuid_cache_entry {
+    volatile int32_t  state;
+    uint32_t          func;
+    uint32_t          subfunc;
+    int               isSupported;
+    cpuid_result_t    result;
+} cpuid_cache_entry_t;
+
+static volatile libcpucaps_cpuid_fn s_cpuidBackend = 0;
+static volatile int32_t             s_cpuidCacheMode = CPUID_CACHE_UNDECIDED;
+static cpuid_cache_entry_t          s_cpuidCache[CPUID_CACHE_SIZE];
+
+static int execute_cpuid(uint32_t func, uint32_t subfunc, cpuid_result_t* result) {
+    libcpucaps_cpuid_fn backend = s_cpuidBackend;
 #ifdef _MSC_VER
     int cpuInfo[4];
+#endif
+
+    stats_count_cpuid(func, 0);
+
+    if (backend) {
+        memset(result, 0, sizeof(cpuid_result_t));
+        return backend(func, subfunc, &result->eax);
+    }
+
+#ifdef _MSC_VER
     memset(cpuInfo, 0, sizeof(cpuInfo));
 
     __cpuidex(cpuInfo, (int)func, (int)subfunc);
@@ -233,46 +854,265 @@ int cpuid_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result) {
     memcpy(result, cpuInfo, sizeof(cpuid_result_t));
     return 1;
 #else
+    /* __get_cpuid_count checks against the basic or the extended range, the hypervisor range is asked */
+    /* only if leaf 1 has the hypervisor bit and its base leaf tells the highest one */
+    if ((func & 0xF0000000) == 0x40000000) {
+        __cpuid_count(func, subfunc, result->eax, result->ebx, result->ecx, result->edx);
+        return 1;
+    }
     return __get_cpuid_count(func, subfunc, &result->eax, &result->ebx, &result->ecx, &result->edx);
 #endif
 }
 
-static size_t get_current_thread_wrapper() {
+int is_hypervisor_present(void) {
+    cpuid_result_t cpuidResult;
+    int32_t mode = atomic_load_acquire_wrapper(&s_cpuidCacheMode);
+
+    if (mode == CPUID_CACHE_UNDECIDED) {
+        memset(&cpuidResult, 0, sizeof(cpuidResult));
+        execute_cpuid(1, 0, &cpuidResult);
+        mode = GET_BIT(cpuidResult.ecx, 31) ? CPUID_CACHE_ON : CPUID_CACHE_OFF;
+        atomic_store_release_wrapper(&s_cpuidCacheMode, mode);
+    }
+
+    return mode == CPUID_CACHE_ON;
+}
+
+/* in VMs each (leaf, subleaf) is read once, results of other cpus never differ in the leaves read here */
+int cpuid_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result) {
+    cpuid_cache_entry_t* entry;
+    uint32_t slot;
+    int isSupported, i;
+
+    if (!is_hypervisor_present()) {
+        return execute_cpuid(func, subfunc, result);
+    }
+
+    slot = (func ^ (func >> 16) ^ (subfunc * 7)) % CPUID_CACHE_SIZE;
+    for (i = 0; i < CPUID_CACHE_SIZE; ++i) {
+        entry = &s_cpuidCache[(slot + (uint32_t)i) % CPUID_CACHE_SIZE];
+
+        switch (atomic_load_acquire_wrapper(&entry->state)) {
+        case CPUID_ENTRY_READY:
+            if (entry->func == func && entry->subfunc == subfunc) {
+                stats_count_cpuid(func, 1);
+                *result = entry->result;
+                return entry->isSupported;
+            }
+            break;
+        case CPUID_ENTRY_EMPTY:
+            isSupported = execute_cpuid(func, subfunc, result);
+            if (atomic_compare_exchange_wrapper(&entry->state, CPUID_ENTRY_EMPTY, CPUID_ENTRY_WRITING)) {
+                entry->func = func;
+                entry->subfunc = subfunc;
+                entry->isSupported = isSupported;
+                entry->result = *result;
+                atomic_store_release_wrapper(&entry->state, CPUID_ENTRY_READY);
+            }
+            return isSupported;
+        default:
+            break;
+        }
+    }
+
+    return execute_cpuid(func, subfunc, result);
+}
+
+/* APIC IDs, core types & cache sharing differ between cpus, these are never cached */
+int cpuid_per_cpu_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result) {
+    return execute_cpuid(func, subfunc, result);
+}
+
+void libcpucaps_SetCPUIDBackend(libcpucaps_cpuid_fn backend) {
+    s_cpuidBackend = backend;
+
+    /* the cache & the hypervisor bit belong to the previous backend */
+    memset(s_cpuidCache, 0, sizeof(s_cpuidCache));
+    atomic_store_release_wrapper(&s_cpuidCacheMode, CPUID_CACHE_UNDECIDED);
+}
+
+/* detection stats, only counted while libcpucaps_GetCapsStats runs */
+/* per-leaf slots: basic 0x00 - 0x3F, hypervisor 0x40000000 - 0x4000003F & 0x40000100 - 0x4000013F, extended 0x80000000 - 0x8000003F */
+#define STATS_RANGE_SLOTS   64
+#define STATS_NUM_RANGES    4
+#define STATS_NUM_SLOTS     (STATS_RANGE_SLOTS * STATS_NUM_RANGES)
+
+typedef struct _s_stats_counters {
+    volatile int32_t  executions[STATS_NUM_SLOTS];
+    volatile int32_t  cacheHits[STATS_NUM_SLOTS];
+    volatile int32_t  totalExecutions;
+    volatile int32_t  totalCacheHits;
+    volatile int32_t  affinityCalls;
+    volatile int32_t  pinnedThreads;
+} stats_counters_t;
+
+static const uint32_t   s_statsRangeBases[STATS_NUM_RANGES] = { 0, 0x40000000, 0x40000100, 0x80000000 };
+static stats_counters_t s_statsCounters;
+static volatile int32_t s_statsActive = 0;
+
+void stats_count_cpuid(uint32_t func, int isCacheHit) {
+    int i;
+
+    if (!atomic_load_acquire_wrapper(&s_statsActive)) {
+        return;
+    }
+
+    atomic_add_wrapper(isCacheHit ? &s_statsCounters.totalCacheHits : &s_statsCounters.totalExecutions, 1);
+    for (i = 0; i < STATS_NUM_RANGES; ++i) {
+        if (func - s_statsRangeBases[i] < STATS_RANGE_SLOTS) {
+            atomic_add_wrapper(isCacheHit ? &s_statsCounters.cacheHits[i * STATS_RANGE_SLOTS + (func - s_statsRangeBases[i])] :
+                               &s_statsCounters.executions[i * STATS_RANGE_SLOTS + (func - s_statsRangeBases[i])], 1);
+            break;
+        }
+    }
+}
+
+void stats_count_affinity(void) {
+    if (atomic_load_acquire_wrapper(&s_statsActive)) {
+        atomic_add_wrapper(&s_statsCounters.affinityCalls, 1);
+    }
+}
+
+void stats_count_pinned_thread(void) {
+    if (atomic_load_acquire_wrapper(&s_statsActive)) {
+        atomic_add_wrapper(&s_statsCounters.pinnedThreads, 1);
+    }
+}
+
+static void start_stats(cpucaps_stats_t* stats, uint64_t* phaseStart) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(cpucaps_stats_t));
+    memset((void*)&s_statsCounters, 0, sizeof(s_statsCounters));
+    atomic_store_release_wrapper(&s_statsActive, 1);
+    *phaseStart = get_time_ns_wrapper();
+}
+
+static void end_phase(cpucaps_stats_t* stats, int phase, uint64_t* phaseStart) {
+    uint64_t now;
+
+    if (!stats) {
+        return;
+    }
+
+    now = get_time_ns_wrapper();
+    stats->phaseNs[phase] += now - *phaseStart;
+    *phaseStart = now;
+}
+
+static void finish_stats(cpucaps_stats_t* stats) {
+    int i, slot;
+
+    if (!stats) {
+        return;
+    }
+    atomic_store_release_wrapper(&s_statsActive, 0);
+
+    for (slot = 0; slot < STATS_NUM_SLOTS && stats->numLeaves < LIBCPUCAPS_STATS_MAX_LEAVES; ++slot) {
+        if (s_statsCounters.executions[slot] || s_statsCounters.cacheHits[slot]) {
+            stats->leaves[stats->numLeaves].leaf = s_statsRangeBases[slot / STATS_RANGE_SLOTS] + (uint32_t)(slot % STATS_RANGE_SLOTS);
+            stats->leaves[stats->numLeaves].executions = (uint32_t)s_statsCounters.executions[slot];
+            stats->leaves[stats->numLeaves].cacheHits = (uint32_t)s_statsCounters.cacheHits[slot];
+            ++stats->numLeaves;
+        }
+    }
+    stats->cpuidExecutions = (uint32_t)s_statsCounters.totalExecutions;
+    stats->cpuidCacheHits = (uint32_t)s_statsCounters.totalCacheHits;
+    stats->affinityCalls = (uint32_t)s_statsCounters.affinityCalls;
+    stats->pinnedThreads = (uint32_t)s_statsCounters.pinnedThreads;
+
+    for (i = 0; i < LIBCPUCAPS_NUM_PHASES; ++i) {
+        stats->totalNs += stats->phaseNs[i];
+    }
+}
+
+/* only valid if CPUID.1:ECX.OSXSAVE is set, otherwise XGETBV raises #UD */
+uint64_t xgetbv_wrapper(uint32_t index) {
 #ifdef _MSC_VER
-    return (size_t)GetCurrentThread();
+    return (uint64_t)_xgetbv(index);
 #else
-    return (size_t)gettid();
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((uint64_t)edx << 32) | eax;
 #endif
 }
 
-static size_t set_thread_affinity_wrapper(size_t threadHandle, size_t affinityMask) {
+uint64_t get_time_ns_wrapper(void) {
 #ifdef _MSC_VER
-    return (size_t)SetThreadAffinityMask((HANDLE)threadHandle, (DWORD_PTR)affinityMask);
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
 #else
-    size_t oldAffinity = 0;
-    cpu_set_t mask;
-
-    CPU_ZERO(&mask);
-    sched_getaffinity((pid_t)threadHandle, sizeof(mask), &mask);
-    for (size_t i = 0; i < 64; ++i) {
-        if (CPU_ISSET(i, &mask)) {
-            oldAffinity |= (1 << i);
-        }
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
 
-    CPU_ZERO(&mask);
-    for (size_t i = 0; i < 64; ++i) {
-        if (affinityMask & (1 << i)) {
-            CPU_SET(i, &mask);
-        }
-    }
+int32_t atomic_load_acquire_wrapper(volatile int32_t* value) {
+#ifdef _MSC_VER
+    int32_t result = *value;    /* aligned loads are atomic on x86, the barrier keeps the compiler from reordering */
+    _ReadWriteBarrier();
+    return result;
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void atomic_store_release_wrapper(volatile int32_t* value, int32_t newValue) {
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    *value = newValue;
+#else
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#endif
+}
 
-    sched_setaffinity((pid_t)threadHandle, sizeof(mask), &mask);
+int atomic_compare_exchange_wrapper(volatile int32_t* value, int32_t expected, int32_t newValue) {
+#ifdef _MSC_VER
+    return InterlockedCompareExchange((volatile LONG*)value, (LONG)newValue, (LONG)expected) == (LONG)expected;
+#else
+    return __atomic_compare_exchange_n(value, &expected, newValue, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
 
-    return oldAffinity;
+void* atomic_load_pointer_acquire_wrapper(void* volatile* value) {
+#ifdef _MSC_VER
+    void* result = *value;
+    _ReadWriteBarrier();
+    return result;
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
 #endif
 }
 
+void atomic_store_pointer_release_wrapper(void* volatile* value, void* newValue) {
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    *value = newValue;
+#else
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#endif
+}
+
+void atomic_add_wrapper(volatile int32_t* value, int32_t addend) {
+#ifdef _MSC_VER
+    InterlockedExchangeAdd((volatile LONG*)value, (LONG)addend);
+#else
+    __atomic_fetch_add(value, addend, __ATOMIC_RELAXED);
+#endif
+}
+
+void thread_yield_wrapper(void) {
+#ifdef _MSC_VER
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
 
 /* https://www.intel.com/content/dam/www/public/us/en/documents/manuals/64-ia-32-architectures-software-developer-instruction-set-reference-manual-325383.pdf */
 /* Deterministic Cache Parameters Leaf */
@@ -320,89 +1160,11 @@ void query_Intel_caches(cpucaps_t* caps) {
             caps->L3_lineSizeBytes = (int)lineSize;
             caps->L3_sizeKibiBytes = (int)cacheSizeKB;
             caps->L3_associativityType = (int)assocWays;
+            caps->L3_associativityLeaf = 4;
         }
     }
 }
 
-/* https://www.intel.com/content/dam/www/public/us/en/documents/manuals/64-ia-32-architectures-software-developer-instruction-set-reference-manual-325383.pdf */
-/* https://www.intel.com/content/dam/develop/external/us/en/documents/intel-64-architecture-processor-topology-enumeration.pdf */
-/* Extended Topology Enumeration Leaf */
-/* https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sdm.html */
-/* V2 Extended Topology Enumeration Leaf */
-/* In theory we should be able to just while (1) {} and break of level type == 0 */
-/*   but it's better to cap our iterations for sanity */
-#define MAX_INTEL_TOPOLOGY_ITERATIONS   7
-void query_Intel_topology(uint32_t highestFunc, cpucaps_t* caps) {
-    uint32_t topologyFunc, level, levelType, smtValue, coreValue, nextShift, smtShift, coreShift, smtMask, coreMask, core;
-    size_t thread, affinityMask;
-    cpuid_result_t cpuidResult;
-
-    if (highestFunc >= 11) {
-        topologyFunc = (highestFunc >= 31) ? 31 : 11;
-
-        smtValue = 1;
-        coreValue = 1;
-
-        for (level = 0; level < MAX_INTEL_TOPOLOGY_ITERATIONS; ++level) {
-            cpuid_wrapper(topologyFunc, level, &cpuidResult);
-
-            /* Level types:      */
-            /* 0: Invalid.       */
-            /* 1: SMT.           */
-            /* 2: Core.          */
-            /* 3: Module.        */
-            /* 4: Tile.          */
-            /* 5: Die.           */
-            /* 6 - 255: Reserved */
-            levelType = (cpuidResult.ecx >> 8) & 0xFF;
-            if (!levelType) {
-                break;
-            }
-
-            /* Bits 04 - 00: Number of bits to shift right on x2APIC ID to get a unique topology ID of the next level type*. */
-            /* All logical processors with the same next level ID share current level. */
-            nextShift = cpuidResult.eax & 0x1F;
-
-            if (levelType == 1) {
-                smtValue = cpuidResult.ebx & 0xFFFF;
-                smtShift = nextShift;
-                smtMask = (~0u) >> (32 - nextShift);
-            } else if (levelType == 2) {
-                coreValue = cpuidResult.ebx & 0xFFFF;
-                coreShift = nextShift;
-                coreMask = (~0u) >> (32 - nextShift);
-            }
-        }
-
-        caps->numLogicalCores = (int)coreValue;
-        caps->numCores = caps->numLogicalCores / smtValue;
-
-        if (caps->numLogicalCores > 1) {
-            thread = get_current_thread_wrapper();
-            affinityMask = set_thread_affinity_wrapper(thread, 1);
-            level = 1; //#NOTE_SK: reusing it to count physical cores
-            for (core = 0; core < (uint32_t)caps->numLogicalCores; ++core) {
-                set_thread_affinity_wrapper(thread, (size_t)1 << core);
-                cpuid_wrapper(topologyFunc, 0, &cpuidResult);
-
-                coreValue = (cpuidResult.edx >> smtShift) & coreMask;
-                caps->coreIDs[core] = (char)(coreValue & 0xFF);
-
-                if (core && (caps->coreIDs[core] != caps->coreIDs[core - 1])) {
-                    ++level;
-                }
-            }
-            set_thread_affinity_wrapper(thread, affinityMask);
-
-            caps->numCores = (int)level;
-        }
-    } else {
-        /* TODO: implement older ways of topology query mechanisms ? */
-        caps->numCores = 1;
-        caps->numLogicalCores = 1;
-    }
-}
-
 /* https://developer.amd.com/wp-content/resources/56255_3_03.PDF */
 void query_AMD_caches(uint32_t highestFuncEx, cpucaps_t* caps) {
     cpuid_result_t cpuidResult;
@@ -431,6 +1193,7 @@ void query_AMD_caches(uint32_t highestFuncEx, cpucaps_t* caps) {
         if (caps->L3_sizeKibiBytes) {  /* 0 means L3 is disabled */
             caps->L3_lineSizeBytes = cpuidResult.edx & 0xFF;
             caps->L3_associativityType = (cpuidResult.edx >> 12) & 0xF;
+            caps->L3_associativityLeaf = 0x80000006;
 
             /* 9 is reserved, and on Zen 2 L3 assoc. will always be 9 */
             /* indicating that we have to use the new way of caches query - function 0x8000001D */
@@ -440,44 +1203,113 @@ void query_AMD_caches(uint32_t highestFuncEx, cpucaps_t* caps) {
 
                 caps->L3_lineSizeBytes = (cpuidResult.ebx & 0xFFF) + 1;
                 caps->L3_associativityType = ((cpuidResult.ebx >> 22) & 0x3FF) + 1;
+                caps->L3_associativityLeaf = 0x8000001D;
             }
         }
     }
 }
 
-// https://www.amd.com/system/files/TechDocs/25481.pdf
-// page 34: CPUID Fn8000_001E
-void query_AMD_topology(uint32_t highestFuncEx, cpucaps_t* caps) {
-    uint32_t numLogicalCores, numCores, core;
-    size_t thread, affinityMask;
+typedef struct _s_hypervisor_signature {
+    char  signature[12];
+    int   hypervisor;
+} hypervisor_signature_t;
+
+static const hypervisor_signature_t s_hypervisorSignatures[] = {
+    { "KVMKVMKVM\0\0\0", LIBCPUCAPS_HYPERVISOR_KVM },
+    { "Linux KVM Hv",       LIBCPUCAPS_HYPERVISOR_KVM },
+    { "Microsoft Hv",       LIBCPUCAPS_HYPERVISOR_HYPERV },
+    { "VMwareVMware",       LIBCPUCAPS_HYPERVISOR_VMWARE },
+    { "XenVMMXenVMM",       LIBCPUCAPS_HYPERVISOR_XEN },
+    { "TCGTCGTCGTCG",       LIBCPUCAPS_HYPERVISOR_QEMU },
+    { "VBoxVBoxVBox",       LIBCPUCAPS_HYPERVISOR_VIRTUALBOX },
+    { " lrpepyh  vr",       LIBCPUCAPS_HYPERVISOR_PARALLELS },
+    { "bhyve bhyve ",       LIBCPUCAPS_HYPERVISOR_BHYVE },
+    { "ACRNACRNACRN",       LIBCPUCAPS_HYPERVISOR_ACRN }
+};
+
+/* vendor signature in EBX, ECX, EDX of the base leaf, EAX is the highest leaf of the range */
+static int query_hypervisor_leaf(uint32_t baseLeaf, char* vendor, uint32_t* maxLeaf) {
     cpuid_result_t cpuidResult;
+    int i;
 
-    caps->numCores = 1;
-    caps->numLogicalCores = 1;
+    memset(&cpuidResult, 0, sizeof(cpuidResult));
+    cpuid_wrapper(baseLeaf, 0, &cpuidResult);
+    memcpy(&vendor[0], &cpuidResult.ebx, 4);
+    memcpy(&vendor[4], &cpuidResult.ecx, 4);
+    memcpy(&vendor[8], &cpuidResult.edx, 4);
+    vendor[12] = 0;
+    *maxLeaf = (cpuidResult.eax >= baseLeaf && cpuidResult.eax < baseLeaf + 0x100) ? cpuidResult.eax : 0;
+
+    for (i = 0; i < (int)(sizeof(s_hypervisorSignatures) / sizeof(s_hypervisorSignatures[0])); ++i) {
+        if (!memcmp(vendor, s_hypervisorSignatures[i].signature, 12)) {
+            return s_hypervisorSignatures[i].hypervisor;
+        }
+    }
+    return LIBCPUCAPS_HYPERVISOR_UNKNOWN;
+}
 
-    // If CPUID Fn8000_0001_ECX[TopologyExtensions]==0 then CPUID Fn8000_001E_E[D,C,B,A]X is reserved
-    if (GET_BIT(caps->func80000001_ecx, 22) && highestFuncEx >= 0x8000001E) {
-        cpuid_wrapper(1, 0, &cpuidResult);
-        numLogicalCores = (cpuidResult.ebx >> 16) & 0xFF;
+/* https://lwn.net/Articles/301888/ - hypervisor CPUID interface proposal, leaves 0x40000000 - 0x400000FF */
+static void query_hypervisor(cpucaps_t* caps) {
+    char vendor[LIBCPUCAPS_MAX_CPU_VENDOR_LEN];
+    uint32_t maxLeaf;
+    int hypervisor;
+
+    caps->hypervisor = query_hypervisor_leaf(0x40000000, caps->hypervisorVendor, &caps->hypervisorMaxLeaf);
 
-        if (numLogicalCores > 1) {
-            thread = get_current_thread_wrapper();
-            affinityMask = set_thread_affinity_wrapper(thread, 1);
-            numCores = 1;
-            for (core = 0; core < numLogicalCores; ++core) {
-                set_thread_affinity_wrapper(thread, (size_t)1 << core);
-                cpuid_wrapper(0x8000001E, 0, &cpuidResult);
+    /* KVM & Xen with Hyper-V enlightenments put Hyper-V's leaves first and their own at 0x40000100 */
+    if (caps->hypervisor == LIBCPUCAPS_HYPERVISOR_HYPERV) {
+        hypervisor = query_hypervisor_leaf(0x40000100, vendor, &maxLeaf);
+        if (hypervisor == LIBCPUCAPS_HYPERVISOR_KVM || hypervisor == LIBCPUCAPS_HYPERVISOR_XEN) {
+            caps->hypervisor = hypervisor;
+            memcpy(caps->hypervisorVendor, vendor, sizeof(vendor));
+        }
+    }
+}
 
-                caps->coreIDs[core] = (char)(cpuidResult.ebx & 0xFF);
+/* legacy topology fields are a summary of what the topology engine finds */
+static void summarize_topology(const cpucaps_topology_t* topology, cpucaps_t* caps) {
+    int i;
 
-                if (core && (caps->coreIDs[core] != caps->coreIDs[core - 1])) {
-                    ++numCores;
+    caps->numCores = 1;
+    caps->numLogicalCores = 1;
+    caps->topologyConfidence = LIBCPUCAPS_TOPOLOGY_CONFIDENCE_LOW;
+    caps->L3_numInstances = 0;
+    caps->L3_numSharingCPUs = 0;
+
+    if (topology) {
+        caps->numCores = topology->numCores;
+        caps->numLogicalCores = topology->numCPUs;
+        caps->topologyConfidence = topology->confidence;
+        for (i = 0; i < topology->numCPUs && i < LIBCPUCAPS_MAX_CPU_CORES; ++i) {
+            caps->coreIDs[i] = (char)topology->cpus[i].coreIndex;
+        }
+        for (i = 0; i < topology->numCaches; ++i) {
+            if (topology->caches[i].level == 3) {
+                ++caps->L3_numInstances;
+                if (caps->L3_numSharingCPUs < topology->caches[i].numCPUs) {
+                    caps->L3_numSharingCPUs = topology->caches[i].numCPUs;
                 }
             }
-            set_thread_affinity_wrapper(thread, affinityMask);
-
-            caps->numCores = (int)numCores;
-            caps->numLogicalCores = (int)numLogicalCores;
         }
     }
 }
+
+void query_topology(cpucaps_t* caps) {
+    cpucaps_topology_t* topology;
+
+    if (libcpucaps_GetTopology(&topology) == LIBCPUCAPS_ERROR_OK) {
+        summarize_topology(topology, caps);
+        libcpucaps_FreeTopology(topology);
+    } else {
+        summarize_topology(NULL, caps);
+    }
+}
+
+int libcpucaps_CompleteCapsTopology(cpucaps_t* caps, const cpucaps_topology_t* topology) {
+    if (!caps || !topology || !(caps->detectedParts & LIBCPUCAPS_DETECT_FEATURES)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    summarize_topology(topology, caps);
+    caps->detectedParts |= LIBCPUCAPS_DETECT_TOPOLOGY;
+    return LIBCPUCAPS_ERROR_OK;
+}
@@ -1,14 +1,122 @@
 ﻿#ifndef LIBCPUCAPS_H_HEADER
 #define LIBCPUCAPS_H_HEADER
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define LIBCPUCAPS_MAX_CPU_NAME_LEN     48
 #define LIBCPUCAPS_MAX_CPU_VENDOR_LEN   (12 + 1)
 #define LIBCPUCAPS_MAX_CPU_CORES        128
 
+/* x86-64 psABI microarchitecture levels (x86-64-v1 ... x86-64-v4) */
+#define LIBCPUCAPS_X86_LEVEL_NONE       0
+#define LIBCPUCAPS_X86_LEVEL_V1         1
+#define LIBCPUCAPS_X86_LEVEL_V2         2
+#define LIBCPUCAPS_X86_LEVEL_V3         3
+#define LIBCPUCAPS_X86_LEVEL_V4         4
+
 #define LIBCPUCAPS_ERROR_OK              0
 #define LIBCPUCAPS_ERROR_FAILED         -1
 #define LIBCPUCAPS_ERROR_INVALID_PARAM  -2
 
+/* feature indices into cpucaps_features_t, the values are stable */
+#define LIBCPUCAPS_FEATURE_FPU              0
+#define LIBCPUCAPS_FEATURE_PSE              1
+#define LIBCPUCAPS_FEATURE_TSC              2
+#define LIBCPUCAPS_FEATURE_CMPXCHG8         3
+#define LIBCPUCAPS_FEATURE_CMPXCHG16B       4
+#define LIBCPUCAPS_FEATURE_MMX              5
+#define LIBCPUCAPS_FEATURE_MMXEXT           6
+#define LIBCPUCAPS_FEATURE_3DNOW            7
+#define LIBCPUCAPS_FEATURE_3DNOWEXT         8
+#define LIBCPUCAPS_FEATURE_SSE              9
+#define LIBCPUCAPS_FEATURE_SSE2             10
+#define LIBCPUCAPS_FEATURE_SSE3             11
+#define LIBCPUCAPS_FEATURE_SSSE3            12
+#define LIBCPUCAPS_FEATURE_SSE41            13
+#define LIBCPUCAPS_FEATURE_SSE42            14
+#define LIBCPUCAPS_FEATURE_ABM              15  /* LZCNT */
+#define LIBCPUCAPS_FEATURE_SSE4A            16
+#define LIBCPUCAPS_FEATURE_MISALIGNSSE      17
+#define LIBCPUCAPS_FEATURE_AES              18
+#define LIBCPUCAPS_FEATURE_AVX              19
+#define LIBCPUCAPS_FEATURE_AVX2             20
+#define LIBCPUCAPS_FEATURE_AVX512F          21
+#define LIBCPUCAPS_FEATURE_AVX512PF         22
+#define LIBCPUCAPS_FEATURE_AVX512ER         23
+#define LIBCPUCAPS_FEATURE_AVX512CD         24
+#define LIBCPUCAPS_FEATURE_F16C             25
+#define LIBCPUCAPS_FEATURE_RDRAND           26
+#define LIBCPUCAPS_FEATURE_RDSEED           27
+#define LIBCPUCAPS_FEATURE_FMA3             28
+#define LIBCPUCAPS_FEATURE_FMA4             29
+#define LIBCPUCAPS_FEATURE_HYBRID           30
+#define LIBCPUCAPS_FEATURE_OSXSAVE          31
+#define LIBCPUCAPS_FEATURE_INVARIANT_TSC    32
+#define LIBCPUCAPS_FEATURE_RDTSCP           33
+#define LIBCPUCAPS_FEATURE_POPCNT           34
+#define LIBCPUCAPS_FEATURE_BMI1             35
+#define LIBCPUCAPS_FEATURE_BMI2             36
+#define LIBCPUCAPS_FEATURE_ADX              37
+#define LIBCPUCAPS_FEATURE_MOVBE            38
+#define LIBCPUCAPS_FEATURE_SHA              39
+#define LIBCPUCAPS_FEATURE_PCLMULQDQ        40
+#define LIBCPUCAPS_FEATURE_VAES             41
+#define LIBCPUCAPS_FEATURE_VPCLMULQDQ       42
+#define LIBCPUCAPS_FEATURE_GFNI             43
+#define LIBCPUCAPS_FEATURE_AVX512BW         44
+#define LIBCPUCAPS_FEATURE_AVX512DQ         45
+#define LIBCPUCAPS_FEATURE_AVX512VL         46
+#define LIBCPUCAPS_FEATURE_AVX512VNNI       47
+#define LIBCPUCAPS_FEATURE_AVX512BF16       48
+#define LIBCPUCAPS_FEATURE_AVX512FP16       49
+#define LIBCPUCAPS_FEATURE_AVX512VBMI       50
+#define LIBCPUCAPS_FEATURE_AVX512VBMI2      51
+#define LIBCPUCAPS_FEATURE_AVX512BITALG     52
+#define LIBCPUCAPS_FEATURE_AVX512VPOPCNTDQ  53
+#define LIBCPUCAPS_FEATURE_AVXVNNI          54
+#define LIBCPUCAPS_FEATURE_AVX10            55
+#define LIBCPUCAPS_FEATURE_ERMS             56  /* enhanced REP MOVSB/STOSB */
+#define LIBCPUCAPS_FEATURE_FSRM             57  /* fast short REP MOVSB */
+#define LIBCPUCAPS_FEATURE_CLFLUSHOPT       58
+#define LIBCPUCAPS_FEATURE_CLWB             59
+#define LIBCPUCAPS_FEATURE_CMOV             60
+#define LIBCPUCAPS_FEATURE_FXSR             61
+#define LIBCPUCAPS_FEATURE_LAHFSAHF         62  /* LAHF/SAHF in 64-bit mode */
+#define LIBCPUCAPS_FEATURE_SYSCALL          63
+#define LIBCPUCAPS_FEATURE_LONGMODE         64
+#define LIBCPUCAPS_FEATURE_HYPERVISOR       65  /* running under a hypervisor */
+#define LIBCPUCAPS_FEATURE_AMX_TILE         66
+#define LIBCPUCAPS_FEATURE_AMX_BF16         67
+#define LIBCPUCAPS_FEATURE_AMX_INT8         68
+#define LIBCPUCAPS_FEATURE_AMX_FP16         69
+#define LIBCPUCAPS_FEATURE_WAITPKG          70  /* UMONITOR, UMWAIT, TPAUSE */
+#define LIBCPUCAPS_FEATURE_MONITORX         71  /* AMD's MONITORX & MWAITX */
+#define LIBCPUCAPS_FEATURE_PDPE1GB          72  /* 1 GiB pages */
+#define LIBCPUCAPS_NUM_FEATURES             73
+
+#define LIBCPUCAPS_FEATURE_WORDS            2
+/* bit of the feature within word w of cpucaps_features_t, for static masks: */
+/*   { { LIBCPUCAPS_FEATURE_BIT(AVX2, 0) | LIBCPUCAPS_FEATURE_BIT(FMA3, 0), LIBCPUCAPS_FEATURE_BIT(AVX2, 1) | LIBCPUCAPS_FEATURE_BIT(FMA3, 1) } } */
+#define LIBCPUCAPS_FEATURE_BIT(name, w)     ((LIBCPUCAPS_FEATURE_##name / 64 == (w)) ? ((uint64_t)1 << (LIBCPUCAPS_FEATURE_##name % 64)) : 0)
+
+#define LIBCPUCAPS_MAX_AMX_PALETTES        4
+
+/* AMX tile palette (CPUID leaf 0x1D), palette 0 is the "tiles off" state and isn't listed */
+typedef struct _s_cpucaps_amx_palette {
+    int   palette;          /* palette ID to put in the tile configuration */
+    int   totalTileBytes;
+    int   bytesPerTile;
+    int   bytesPerRow;      /* max. colsb */
+    int   maxNames;         /* number of tile registers */
+    int   maxRows;
+} cpucaps_amx_palette_t;
+
+/* set of features, either detected ones or a mask of requirements */
+typedef struct _s_cpucaps_features {
+    uint64_t  words[LIBCPUCAPS_FEATURE_WORDS];
+} cpucaps_features_t;
+
 typedef struct _s_cpucaps {
     char  vendor[LIBCPUCAPS_MAX_CPU_VENDOR_LEN];
     char  name[LIBCPUCAPS_MAX_CPU_NAME_LEN];
@@ -25,10 +133,12 @@ typedef struct _s_cpucaps {
     char  modelEx;
     char  familyEx;
 
-    /* topology */
+    /* topology (summary of libcpucaps_GetTopology, coreIDs covers the first LIBCPUCAPS_MAX_CPU_CORES cpus) */
     int   numCores;
     int   numLogicalCores;
     char  coreIDs[LIBCPUCAPS_MAX_CPU_CORES];
+    int   L3_numInstances;      /* L3 cache instances, e.g. one per CCX of a Zen cpu, 0 without an L3 */
+    int   L3_numSharingCPUs;    /* logical cpus sharing an L3 instance (the most of any instance) */
 
     /* cache info */
     int   L1d_lineSizeBytes;
@@ -43,60 +153,477 @@ typedef struct _s_cpucaps {
     int   L3_lineSizeBytes;
     int   L3_sizeKibiBytes;
     int   L3_associativityType;
+    /* CPUID leaf the L3 associativity comes from: the number of ways from 4 & 0x8000001D, AMD's 4-bit code */
+    /* from 0x80000006 (which is also what AMD's L2 associativity is) */
+    uint32_t  L3_associativityLeaf;
+
+    /* usable features as a LIBCPUCAPS_FEATURE_xxx bitset */
+    /* AVX & AVX-512 family bits are only set if the OS saves the corresponding register state */
+    cpucaps_features_t  features;
 
-    /* cpu features */
-    int   func1_ecx;
-    int   func1_edx;
-    int   func7_ebx;
-    int   func7_ecx;
+    /* OS-enabled register state (XCR0, low 32 bits), 0 if OSXSAVE isn't set */
+    int   xcr0;
 
-    /* cpu extended features */
-    int   func80000001_ecx;
-    int   func80000001_edx;
+    /* AVX10 converged vector ISA version (CPUID leaf 0x24), 0 if not supported */
+    int   avx10Version;
+
+    /* AMX tiles (CPUID leaves 0x1D & 0x1E), only filled in if AMX-TILE is usable */
+    int                    amxNumPalettes;
+    cpucaps_amx_palette_t  amxPalettes[LIBCPUCAPS_MAX_AMX_PALETTES];
+    int                    amxTmulMaxK;     /* rows or columns of the TMUL unit */
+    int                    amxTmulMaxN;     /* column bytes of the TMUL unit */
+
+    /* time stamp counter frequency, 0 if unknown */
+    uint64_t  tscFrequencyHz;
+    int       tscFrequencySource;   /* LIBCPUCAPS_TSC_SOURCE_xxx */
+
+    /* hypervisor (CPUID leaf 1 ECX bit 31 & leaf 0x40000000), LIBCPUCAPS_HYPERVISOR_NONE on bare metal */
+    int       hypervisor;           /* LIBCPUCAPS_HYPERVISOR_xxx */
+    char      hypervisorVendor[LIBCPUCAPS_MAX_CPU_VENDOR_LEN];
+    uint32_t  hypervisorMaxLeaf;    /* highest 0x400000xx leaf, 0 if there's none */
+    int       topologyConfidence;   /* LIBCPUCAPS_TOPOLOGY_CONFIDENCE_xxx of the topology summary */
+
+    /* LIBCPUCAPS_DETECT_xxx parts filled in, the fields of the other parts are 0 */
+    int       detectedParts;
 } cpucaps_t;
 
+/* parts of cpucaps_t detected by libcpucaps_GetCapsEx, the features are always detected */
+#define LIBCPUCAPS_DETECT_FEATURES      0x01    /* vendor, family & model, feature bits, XCR0, hypervisor, AVX10, AMX */
+#define LIBCPUCAPS_DETECT_NAME          0x02    /* brand string */
+#define LIBCPUCAPS_DETECT_CACHES        0x04    /* L1 - L3 sizes, lines & associativity */
+#define LIBCPUCAPS_DETECT_TSC           0x08    /* TSC frequency from CPUID, 0 if it has none */
+#define LIBCPUCAPS_DETECT_TOPOLOGY      0x10    /* numCores, numLogicalCores, coreIDs, L3 sharing, runs a thread on every cpu */
+#define LIBCPUCAPS_DETECT_ALL           0x1F
+
+/* hypervisors told apart by the vendor signature of CPUID leaf 0x40000000 */
+#define LIBCPUCAPS_HYPERVISOR_NONE          0
+#define LIBCPUCAPS_HYPERVISOR_UNKNOWN       1   /* the hypervisor bit is set, the signature isn't a known one */
+#define LIBCPUCAPS_HYPERVISOR_KVM           2   /* also with Hyper-V enlightenments */
+#define LIBCPUCAPS_HYPERVISOR_HYPERV        3
+#define LIBCPUCAPS_HYPERVISOR_VMWARE        4
+#define LIBCPUCAPS_HYPERVISOR_XEN           5
+#define LIBCPUCAPS_HYPERVISOR_QEMU          6   /* QEMU's TCG, i.e. emulated */
+#define LIBCPUCAPS_HYPERVISOR_VIRTUALBOX    7
+#define LIBCPUCAPS_HYPERVISOR_PARALLELS     8
+#define LIBCPUCAPS_HYPERVISOR_BHYVE         9
+#define LIBCPUCAPS_HYPERVISOR_ACRN          10
+
+/* how far the topology can be trusted */
+#define LIBCPUCAPS_TOPOLOGY_CONFIDENCE_LOW      0   /* contradicts itself (duplicate APIC IDs, SMT siblings not sharing an L1) */
+#define LIBCPUCAPS_TOPOLOGY_CONFIDENCE_VIRTUAL  1   /* consistent, but made up by the hypervisor: vCPUs may float over host threads */
+#define LIBCPUCAPS_TOPOLOGY_CONFIDENCE_HIGH     2   /* bare metal */
+
+/* where cpucaps_t::tscFrequencyHz comes from */
+#define LIBCPUCAPS_TSC_SOURCE_UNKNOWN       0
+#define LIBCPUCAPS_TSC_SOURCE_CPUID_15      1   /* TSC / crystal clock ratio leaf */
+#define LIBCPUCAPS_TSC_SOURCE_CPUID_16      2   /* processor base frequency leaf */
+#define LIBCPUCAPS_TSC_SOURCE_HYPERVISOR    3   /* hypervisor timing leaf 0x40000010 */
+#define LIBCPUCAPS_TSC_SOURCE_CALIBRATED    4   /* measured against the OS raw monotonic clock (libcpucaps_InitTSCClock only) */
+
+/* cache types, same values as in CPUID leaf 4 */
+#define LIBCPUCAPS_CACHE_DATA           1
+#define LIBCPUCAPS_CACHE_INSTRUCTION    2
+#define LIBCPUCAPS_CACHE_UNIFIED        3
+
+/* hybrid core types, same values as in CPUID leaf 0x1A */
+#define LIBCPUCAPS_CORE_TYPE_UNKNOWN        0
+#define LIBCPUCAPS_CORE_TYPE_EFFICIENT      0x20    /* Intel Atom */
+#define LIBCPUCAPS_CORE_TYPE_PERFORMANCE    0x40    /* Intel Core */
+
+/* set of logical cpus (by OS cpu number), the storage is owned by the object containing the set */
+typedef struct _s_cpucaps_cpuset {
+    int        numWords;
+    uint64_t*  words;
+} cpucaps_cpuset_t;
+
+/* one logical cpu, IDs are split out of the x2APIC ID using the topology shift widths */
+typedef struct _s_cpucaps_cpu {
+    int       cpuIndex;     /* OS logical cpu number */
+    int       coreIndex;    /* system-wide physical core index, 0 ... numCores - 1 */
+    uint32_t  x2apicID;
+    uint32_t  smtID;
+    uint32_t  coreID;
+    uint32_t  moduleID;
+    uint32_t  tileID;
+    uint32_t  dieID;
+    uint32_t  packageID;
+    int       coreType;         /* LIBCPUCAPS_CORE_TYPE_xxx, always PERFORMANCE on non-hybrid cpus */
+    uint32_t  nativeModelID;    /* model of the core type (hybrid cpus only) */
+    int       L1d_cacheIndex;   /* indices into cpucaps_topology_t::caches, -1 if none */
+    int       L1i_cacheIndex;
+    int       L2_cacheIndex;
+    int       L3_cacheIndex;
+    char      isAllowed;    /* the process affinity allows running on it */
+    char      fromOS;       /* x2APIC ID was reported by the OS instead of CPUID on that cpu */
+} cpucaps_cpu_t;
+
+/* one cache instance, e.g. each CCX of a Zen cpu has its own L3 instance */
+typedef struct _s_cpucaps_cache {
+    int               level;
+    int               type;             /* LIBCPUCAPS_CACHE_xxx */
+    int               sizeKibiBytes;
+    int               lineSizeBytes;
+    int               partitions;
+    int               ways;             /* 0 if fully associative */
+    int               sets;
+    char              isInclusive;      /* includes the lower cache levels */
+    int               numCPUs;          /* logical cpus sharing this instance */
+    cpucaps_cpuset_t  cpus;
+} cpucaps_cache_t;
+
+typedef struct _s_cpucaps_topology {
+    int             numCPUs;        /* online logical cpus */
+    int             numCores;       /* physical cores */
+    int             numPackages;
+    int             maxCPUIndex;    /* highest OS cpu number + 1 */
+
+    /* x2APIC ID shift widths, level ID = bits from the previous level's shift up to its own */
+    /* package ID = x2APIC ID >> dieShift, levels the cpu doesn't report take no bits */
+    int             smtShift;
+    int             coreShift;
+    int             moduleShift;
+    int             tileShift;
+    int             dieShift;
+
+    cpucaps_cpu_t*  cpus;           /* numCPUs entries sorted by cpuIndex */
+
+    int               numCaches;
+    cpucaps_cache_t*  caches;       /* sorted by level, type and instance */
+
+    /* LIBCPUCAPS_TOPOLOGY_CONFIDENCE_xxx, in VMs the x2APIC IDs come from the OS instead of a CPUID walk */
+    /* with LOW confidence because of duplicate IDs every cpu counts as a core of its own */
+    int             confidence;
+
+    /* ready-made affinity masks, on non-hybrid cpus all cores are P-cores */
+    int               isHybrid;
+    cpucaps_cpuset_t  pcoreCPUs;        /* all P-core threads */
+    cpucaps_cpuset_t  ecoreCPUs;        /* all E-core threads */
+    cpucaps_cpuset_t  pcorePrimaryCPUs; /* one thread per P-core */
+} cpucaps_topology_t;
+
+/* thread placement policies, LIBCPUCAPS_PLACEMENT_AVOID_CORE0 can be combined with any of them */
+#define LIBCPUCAPS_PLACEMENT_COMPACT        0       /* fill SMT siblings of a core first */
+#define LIBCPUCAPS_PLACEMENT_SCATTER        1       /* one thread per physical core first, spread over L3 domains */
+#define LIBCPUCAPS_PLACEMENT_PER_L3         2       /* contiguous groups of threads inside one L3 domain (CCX) */
+#define LIBCPUCAPS_PLACEMENT_AVOID_CORE0    0x100   /* leave the physical core of cpu 0 for IRQs */
+
+/* affinity plan, one cpu set per worker thread */
+typedef struct _s_cpucaps_plan {
+    int               numThreads;
+    cpucaps_cpuset_t* threads;
+} cpucaps_plan_t;
+
+/* NUMA node as reported by the OS */
+typedef struct _s_cpucaps_numa_node {
+    int               nodeID;
+    int               packageID;        /* package of the node's cpus, -1 if cpu-less, -2 if they span packages */
+    uint64_t          memTotalBytes;
+    uint64_t          memFreeBytes;
+    int*              distances;        /* row of the distance matrix, indexed like cpucaps_numa_t::nodes */
+    int               numCPUs;
+    cpucaps_cpuset_t  cpus;
+} cpucaps_numa_node_t;
+
+typedef struct _s_cpucaps_numa {
+    int                   numNodes;
+    cpucaps_numa_node_t*  nodes;        /* online nodes in ascending nodeID order */
+    int                   maxCPUIndex;
+    int*                  cpuToNode;    /* index into nodes by OS cpu number, -1 if unknown */
+    int                   isConsistent; /* node assignment agrees with the CPUID package IDs */
+} cpucaps_numa_t;
+
+/* cpus the process can actually use: the topology limited by the affinity mask, the cgroup cpuset & CFS quota */
+typedef struct _s_cpucaps_concurrency {
+    int               numCPUs;          /* usable logical cpus */
+    int               numCores;         /* physical cores with at least one usable cpu */
+    int               numFullCores;     /* physical cores with all of their SMT siblings usable */
+    double            cpuQuota;         /* CFS bandwidth limit in cpus (quota / period), 0 if unlimited */
+    int               effectiveThreads; /* busy threads to run: numCPUs, rounded down to the quota, at least 1 */
+    int               cgroupVersion;    /* 1 or 2, 0 if no cgroup limits were found */
+    int               maxCPUIndex;
+    cpucaps_cpuset_t  cpus;             /* usable logical cpus */
+    cpucaps_cpuset_t  primaryCPUs;      /* the lowest numbered usable SMT sibling of every usable core */
+} cpucaps_concurrency_t;
+
+/* compiler target for building code tuned to this cpu (GCC & Clang option names) */
+#define LIBCPUCAPS_MAX_TARGET_NAME_LEN  32
+
+typedef struct _s_cpucaps_target {
+    char                march[LIBCPUCAPS_MAX_TARGET_NAME_LEN];  /* named microarchitecture or x86-64-vN, empty if not x86-64 */
+    char                mtune[LIBCPUCAPS_MAX_TARGET_NAME_LEN];  /* named microarchitecture or "generic" */
+    int                 x86Level;           /* LIBCPUCAPS_X86_LEVEL_xxx of the cpu, even if march names a lower one */
+    int                 isNamedArch;        /* march is the named one, 0 if the cpu may lack some of its features (e.g. in a VM) */
+    cpucaps_features_t  extraFeatures;      /* usable features march doesn't imply, passed as -m<feature> */
+    int                 l1CacheSizeKibiBytes;
+    int                 l1CacheLineSizeBytes;
+    int                 l2CacheSizeKibiBytes;
+} cpucaps_target_t;
+
+/* libcpucaps_FormatTarget flags */
+#define LIBCPUCAPS_TARGET_SHELL         0       /* one line of space separated options */
+#define LIBCPUCAPS_TARGET_JSON          1       /* an object with the fields and a "flags" array */
+#define LIBCPUCAPS_TARGET_NO_PARAMS     2       /* leave out GCC's --param cache sizes (Clang doesn't take them) */
+#define LIBCPUCAPS_TARGET_PORTABLE      4       /* no named -march & -mtune, just the x86-64 level, for any cpu of that level */
+/* only names & -m options GCC <major> knows, older names stand in for newer ones (Clang takes the same names) */
+/* below GCC 11 the level is -march=x86-64 and the -m options of the rest of it, x86-64-vN is new in GCC 11 */
+/* without it, those of the GCC libcpucaps was built with, or all of them when built by another compiler */
+#define LIBCPUCAPS_TARGET_GCC_SHIFT     8
+#define LIBCPUCAPS_TARGET_GCC_MASK      0xFF00
+#define LIBCPUCAPS_TARGET_GCC(major)    (((major) << LIBCPUCAPS_TARGET_GCC_SHIFT) & LIBCPUCAPS_TARGET_GCC_MASK)
+
+/* detection phases timed by libcpucaps_GetCapsStats */
+#define LIBCPUCAPS_PHASE_VENDOR         0   /* leaf 0, vendor string */
+#define LIBCPUCAPS_PHASE_FEATURES       1   /* feature leaves, XCR0, hypervisor, AVX10, AMX, name string */
+#define LIBCPUCAPS_PHASE_CACHES         2   /* Intel's leaf 4 or AMD's 0x80000005 - 0x8000001D */
+#define LIBCPUCAPS_PHASE_TSC            3   /* TSC frequency leaves */
+#define LIBCPUCAPS_PHASE_TOPOLOGY       4   /* probing every logical cpu */
+#define LIBCPUCAPS_NUM_PHASES           5
+
+#define LIBCPUCAPS_STATS_MAX_LEAVES     64
+
+typedef struct _s_cpucaps_leaf_stats {
+    uint32_t  leaf;
+    uint32_t  executions;   /* CPUID instructions (or backend calls), all subleaves and cpus */
+    uint32_t  cacheHits;    /* served from the leaf cache (VMs only) */
+} cpucaps_leaf_stats_t;
+
+/* cost of one detection */
+typedef struct _s_cpucaps_stats {
+    int                   numLeaves;
+    cpucaps_leaf_stats_t  leaves[LIBCPUCAPS_STATS_MAX_LEAVES];  /* in ascending leaf order */
+    uint32_t              cpuidExecutions;      /* totals, including leaves the table has no room for */
+    uint32_t              cpuidCacheHits;
+    uint32_t              affinityCalls;        /* the calling thread migrated to another cpu (and back) */
+    uint32_t              pinnedThreads;        /* probe threads created pinned to a cpu */
+    uint64_t              phaseNs[LIBCPUCAPS_NUM_PHASES];  /* wall-clock time by LIBCPUCAPS_PHASE_xxx */
+    uint64_t              totalNs;
+} cpucaps_stats_t;
+
+/* dispatch tables: a set of implementations of one kernel, ordered from the best to the baseline one */
+#define LIBCPUCAPS_DISPATCH_MAX_REQUIREMENTS    4
+
+typedef void (*libcpucaps_func_t)(void);                    /* generic function pointer, cast to the real signature */
+typedef int (*libcpucaps_feature_fn)(const cpucaps_t* caps);   /* feature query, e.g. libcpucaps_HasAVX2 */
+
+typedef struct _s_cpucaps_impl {
+    const char*           name;
+    libcpucaps_func_t     func;
+    /* all of the features the impl requires, unused slots are NULL */
+    libcpucaps_feature_fn requires[LIBCPUCAPS_DISPATCH_MAX_REQUIREMENTS];
+} cpucaps_impl_t;
+
+typedef struct _s_cpucaps_dispatch {
+    const cpucaps_impl_t*       impls;
+    int                         numImpls;
+    int                         firstAllowed;   /* impls before this index are skipped (forced lower tier) */
+    int                         selected;       /* index of the resolved impl, -1 if unresolved */
+    volatile libcpucaps_func_t  func;           /* resolved function pointer, stored with release after selected */
+} cpucaps_dispatch_t;
+
+#define LIBCPUCAPS_DISPATCH_INIT(implsArray)    { (implsArray), (int)(sizeof(implsArray) / sizeof((implsArray)[0])), 0, -1, 0 }
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 /* returns LIBCPUCAPS_ERROR_xxx */
 int libcpucaps_GetCaps(cpucaps_t* caps);
+/* libcpucaps_GetCaps that also reports what the detection cost (stats is optional) */
+/* counters are process-wide, other detections running at the same time are counted as well */
+int libcpucaps_GetCapsStats(cpucaps_t* caps, cpucaps_stats_t* stats);
+/* detects only the LIBCPUCAPS_DETECT_xxx parts, the features alone cost a few CPUIDs & no syscalls */
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_GetCapsEx(cpucaps_t* caps, int parts);
+/* adds the parts caps doesn't have yet, caps has to come from libcpucaps_GetCapsEx or libcpucaps_GetCaps */
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_CompleteCaps(cpucaps_t* caps, int parts);
+
+/* CPUID replacement, e.g. replaying a dump of another cpu, regs are EAX, EBX, ECX, EDX */
+/* returns 0 if the leaf isn't supported */
+typedef int (*libcpucaps_cpuid_fn)(uint32_t func, uint32_t subfunc, uint32_t regs[4]);
+/* routes every CPUID the library executes to the backend, NULL restores the instruction */
+/* call it before detecting anything, the cached caps keep what they detected first */
+/* the backend is also asked for the per-cpu leaves from threads pinned to each cpu, XGETBV isn't replaced */
+void libcpucaps_SetCPUIDBackend(libcpucaps_cpuid_fn backend);
+
+/* returns process-wide caps with every part, detected only once on the very first call */
+/* safe to call from any thread, the returned caps must not be modified */
+const cpucaps_t* libcpucaps_GetCachedCaps(void);
+/* process-wide caps with at least the LIBCPUCAPS_DETECT_xxx parts, missing ones are detected on first request */
+/* parts already returned are never written again, so the caps can be read while other threads add parts */
+const cpucaps_t* libcpucaps_GetCachedCapsEx(int parts);
+
+/* enumerates every online logical cpu, probing them in parallel from threads pinned to each one */
+/* returns LIBCPUCAPS_ERROR_xxx, the result has to be released with libcpucaps_FreeTopology */
+int libcpucaps_GetTopology(cpucaps_topology_t** topology);
+void libcpucaps_FreeTopology(cpucaps_topology_t* topology);
+/* adds the LIBCPUCAPS_DETECT_TOPOLOGY part from a topology already enumerated, so that a caller needing */
+/* both probes the cpus once: libcpucaps_GetCapsEx without the part, then libcpucaps_GetTopology */
+/* caps has to come from libcpucaps_GetCapsEx or libcpucaps_GetCaps, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_CompleteCapsTopology(cpucaps_t* caps, const cpucaps_topology_t* topology);
+
+/* cpu set queries */
+int libcpucaps_CpuSetHas(const cpucaps_cpuset_t* set, int cpuIndex);
+int libcpucaps_CpuSetCount(const cpucaps_cpuset_t* set);
+
+/* plans affinity of numThreads workers over the cpus the process may run on (LIBCPUCAPS_PLACEMENT_xxx policy) */
+/* returns LIBCPUCAPS_ERROR_xxx, the result has to be released with libcpucaps_FreePlan */
+int libcpucaps_PlanThreads(const cpucaps_topology_t* topology, int numThreads, int policy, cpucaps_plan_t** plan);
+void libcpucaps_FreePlan(cpucaps_plan_t* plan);
+/* reads NUMA nodes from <sysfsRoot>/devices/system/node (NULL means "/sys"), no libnuma needed */
+/* topology (optional) is used to cross-check nodes against packages, without OS support everything is node 0 */
+/* returns LIBCPUCAPS_ERROR_xxx, the result has to be released with libcpucaps_FreeNUMA */
+int libcpucaps_GetNUMA(const char* sysfsRoot, const cpucaps_topology_t* topology, cpucaps_numa_t** numa);
+void libcpucaps_FreeNUMA(cpucaps_numa_t* numa);
+/* returns node ID of the cpu, -1 if unknown */
+int libcpucaps_GetCPUNode(const cpucaps_numa_t* numa, int cpuIndex);
+/* reads the cgroup v1 or v2 limits of the process from cgroupRoot (NULL means "/sys/fs/cgroup", a copy of the */
+/* tree works too) and intersects them with the affinity mask & the topology (optional, to tell cores apart) */
+/* returns LIBCPUCAPS_ERROR_xxx, the result has to be released with libcpucaps_FreeConcurrency */
+int libcpucaps_GetConcurrency(const char* cgroupRoot, const cpucaps_topology_t* topology, cpucaps_concurrency_t** concurrency);
+void libcpucaps_FreeConcurrency(cpucaps_concurrency_t* concurrency);
+
+/* snapshots of the caps & topology for processes that can't afford probing every cpu at startup */
+/* a snapshot is only valid for the boot, CPUID signature & microcode revision it was written with */
+/* dir is where the snapshot file lives, NULL means $XDG_RUNTIME_DIR or /tmp (not supported on Windows) */
+/* only a process allowed on every cpu of the topology saves one, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_SaveSnapshot(const char* dir, const cpucaps_t* caps, const cpucaps_topology_t* topology);
+/* topology is optional, the result has to be released with libcpucaps_FreeTopology, its cpus' isAllowed */
+/* are those of this process, returns LIBCPUCAPS_ERROR_xxx, LIBCPUCAPS_ERROR_FAILED if there's no valid snapshot */
+int libcpucaps_LoadSnapshot(const char* dir, cpucaps_t* caps, cpucaps_topology_t** topology);
+/* loads the snapshot, or detects the caps & topology and saves a new one, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_GetCapsSnapshot(const char* dir, cpucaps_t* caps, cpucaps_topology_t** topology);
+
+/* picks -march, -mtune & -m<feature> options for the caps, pass NULL caps to use the cached ones */
+/* flags are LIBCPUCAPS_TARGET_xxx (only PORTABLE & GCC matter here), returns LIBCPUCAPS_ERROR_xxx */
+/* march stays at the x86-64 level under a hypervisor, or if the cpu lacks some of its generation's features */
+int libcpucaps_GetTarget(const cpucaps_t* caps, int flags, cpucaps_target_t* target);
+/* formats the target as compiler options (LIBCPUCAPS_TARGET_xxx flags) into a zero-terminated buffer */
+/* returns LIBCPUCAPS_ERROR_xxx, LIBCPUCAPS_ERROR_FAILED if the buffer is too small */
+int libcpucaps_FormatTarget(const cpucaps_target_t* target, int flags, char* buffer, size_t bufferSize);
+
+/* binds the calling thread to the set (e.g. plan->threads[i]), returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_SetThreadAffinity(const cpucaps_cpuset_t* set);
+
+/* returns x86-64 microarchitecture level the cpu & OS fully support (LIBCPUCAPS_X86_LEVEL_xxx) */
+int libcpucaps_GetX86Level(const cpucaps_t* caps);
+
+/* feature bitset queries (return 1 or 0) */
+int libcpucaps_HasFeature(const cpucaps_t* caps, int feature);                  /* LIBCPUCAPS_FEATURE_xxx */
+int libcpucaps_HasAll(const cpucaps_t* caps, const cpucaps_features_t* mask);   /* every feature of the mask */
+int libcpucaps_HasAny(const cpucaps_t* caps, const cpucaps_features_t* mask);   /* at least one feature of the mask */
+/* adds a LIBCPUCAPS_FEATURE_xxx to the mask, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_AddFeature(cpucaps_features_t* mask, int feature);
 
 /* functions to query specific features support (returns 1 or 0) */
-int libcpucaps_HasFPU(cpucaps_t* caps);
-int libcpucaps_HasPSE(cpucaps_t* caps);
-int libcpucaps_HasTSC(cpucaps_t* caps);
-int libcpucaps_HasCMPXCHG8(cpucaps_t* caps);
-int libcpucaps_HasCMPXCHG16B(cpucaps_t* caps);
-int libcpucaps_HasMMX(cpucaps_t* caps);
-int libcpucaps_HasMMXExt(cpucaps_t* caps);
-int libcpucaps_Has3DNow(cpucaps_t* caps);
-int libcpucaps_Has3DNowExt(cpucaps_t* caps);
-int libcpucaps_HasSSE(cpucaps_t* caps);
-int libcpucaps_HasSSE2(cpucaps_t* caps);
-int libcpucaps_HasSSE3(cpucaps_t* caps);
-int libcpucaps_HasSSSE3(cpucaps_t* caps);
-int libcpucaps_HasSSE41(cpucaps_t* caps);
-int libcpucaps_HasSSE42(cpucaps_t* caps);
-int libcpucaps_HasABM(cpucaps_t* caps);		/* POPCNT & LZCNT */
-int libcpucaps_HasSSE4a(cpucaps_t* caps);
-int libcpucaps_HasMisalignSSE(cpucaps_t* caps);
-int libcpucaps_HasAES(cpucaps_t* caps);
-int libcpucaps_HasAVX(cpucaps_t* caps);
-int libcpucaps_HasAVX2(cpucaps_t* caps);
-int libcpucaps_HasAVX512F(cpucaps_t* caps);
-int libcpucaps_HasAVX512PF(cpucaps_t* caps);
-int libcpucaps_HasAVX512ER(cpucaps_t* caps);
-int libcpucaps_HasAVX512CD(cpucaps_t* caps);
-int libcpucaps_HasF16C(cpucaps_t* caps);
-int libcpucaps_HasRDRAND(cpucaps_t* caps);
-int libcpucaps_HasRDSEED(cpucaps_t* caps);
-int libcpucaps_HasFMA3(cpucaps_t* caps);
-int libcpucaps_HasFMA4(cpucaps_t* caps);
+/* AVX & AVX-512 family queries also check that the OS saves the corresponding register state */
+int libcpucaps_HasFPU(const cpucaps_t* caps);
+int libcpucaps_HasPSE(const cpucaps_t* caps);
+int libcpucaps_HasTSC(const cpucaps_t* caps);
+int libcpucaps_HasInvariantTSC(const cpucaps_t* caps);     /* constant rate in all ACPI P-, C- and T-states */
+int libcpucaps_HasRDTSCP(const cpucaps_t* caps);
+int libcpucaps_HasCMPXCHG8(const cpucaps_t* caps);
+int libcpucaps_HasCMPXCHG16B(const cpucaps_t* caps);
+int libcpucaps_HasMMX(const cpucaps_t* caps);
+int libcpucaps_HasMMXExt(const cpucaps_t* caps);
+int libcpucaps_Has3DNow(const cpucaps_t* caps);
+int libcpucaps_Has3DNowExt(const cpucaps_t* caps);
+int libcpucaps_HasSSE(const cpucaps_t* caps);
+int libcpucaps_HasSSE2(const cpucaps_t* caps);
+int libcpucaps_HasSSE3(const cpucaps_t* caps);
+int libcpucaps_HasSSSE3(const cpucaps_t* caps);
+int libcpucaps_HasSSE41(const cpucaps_t* caps);
+int libcpucaps_HasSSE42(const cpucaps_t* caps);
+int libcpucaps_HasABM(const cpucaps_t* caps);		/* LZCNT */
+int libcpucaps_HasPOPCNT(const cpucaps_t* caps);
+int libcpucaps_HasSSE4a(const cpucaps_t* caps);
+int libcpucaps_HasMisalignSSE(const cpucaps_t* caps);
+int libcpucaps_HasAES(const cpucaps_t* caps);
+int libcpucaps_HasAVX(const cpucaps_t* caps);
+int libcpucaps_HasAVX2(const cpucaps_t* caps);
+int libcpucaps_HasAVX512F(const cpucaps_t* caps);
+int libcpucaps_HasAVX512PF(const cpucaps_t* caps);
+int libcpucaps_HasAVX512ER(const cpucaps_t* caps);
+int libcpucaps_HasAVX512CD(const cpucaps_t* caps);
+int libcpucaps_HasF16C(const cpucaps_t* caps);
+int libcpucaps_HasRDRAND(const cpucaps_t* caps);
+int libcpucaps_HasRDSEED(const cpucaps_t* caps);
+int libcpucaps_HasFMA3(const cpucaps_t* caps);
+int libcpucaps_HasFMA4(const cpucaps_t* caps);
+int libcpucaps_HasBMI1(const cpucaps_t* caps);
+int libcpucaps_HasBMI2(const cpucaps_t* caps);
+int libcpucaps_HasADX(const cpucaps_t* caps);
+int libcpucaps_HasMOVBE(const cpucaps_t* caps);
+int libcpucaps_HasSHA(const cpucaps_t* caps);
+int libcpucaps_HasPCLMULQDQ(const cpucaps_t* caps);
+int libcpucaps_HasVAES(const cpucaps_t* caps);
+int libcpucaps_HasVPCLMULQDQ(const cpucaps_t* caps);
+int libcpucaps_HasGFNI(const cpucaps_t* caps);
+int libcpucaps_HasAVX512BW(const cpucaps_t* caps);
+int libcpucaps_HasAVX512DQ(const cpucaps_t* caps);
+int libcpucaps_HasAVX512VL(const cpucaps_t* caps);
+int libcpucaps_HasAVX512VNNI(const cpucaps_t* caps);
+int libcpucaps_HasAVX512BF16(const cpucaps_t* caps);
+int libcpucaps_HasAVX512FP16(const cpucaps_t* caps);
+int libcpucaps_HasAVX512VBMI(const cpucaps_t* caps);
+int libcpucaps_HasAVX512VBMI2(const cpucaps_t* caps);
+int libcpucaps_HasAVX512BITALG(const cpucaps_t* caps);
+int libcpucaps_HasAVX512VPOPCNTDQ(const cpucaps_t* caps);
+int libcpucaps_HasAVXVNNI(const cpucaps_t* caps);
+int libcpucaps_HasAVX10(const cpucaps_t* caps);       /* see cpucaps_t::avx10Version */
+int libcpucaps_HasERMS(const cpucaps_t* caps);
+int libcpucaps_HasFSRM(const cpucaps_t* caps);
+int libcpucaps_HasCLFLUSHOPT(const cpucaps_t* caps);
+int libcpucaps_HasCLWB(const cpucaps_t* caps);
+int libcpucaps_HasHybrid(const cpucaps_t* caps);      /* P-cores & E-cores */
+int libcpucaps_HasOSXSAVE(const cpucaps_t* caps);
+int libcpucaps_HasYMMState(const cpucaps_t* caps);    /* OS saves YMM registers */
+int libcpucaps_HasZMMState(const cpucaps_t* caps);    /* OS saves ZMM & opmask registers */
+int libcpucaps_HasAMXState(const cpucaps_t* caps);    /* OS saves AMX tile config & data */
+/* AMX queries only tell the cpu & OS support it, on Linux the process still has to call libcpucaps_EnableAMX */
+int libcpucaps_HasAMXTile(const cpucaps_t* caps);
+int libcpucaps_HasAMXBF16(const cpucaps_t* caps);
+int libcpucaps_HasAMXINT8(const cpucaps_t* caps);
+int libcpucaps_HasAMXFP16(const cpucaps_t* caps);
+int libcpucaps_HasWAITPKG(const cpucaps_t* caps);
+int libcpucaps_HasMONITORX(const cpucaps_t* caps);
+int libcpucaps_HasPDPE1GB(const cpucaps_t* caps);
+
+/* asks the OS for permission to use AMX tile data in this process (all of its threads), must be done */
+/* before the first tile instruction or it raises SIGILL on Linux, calling it again is cheap */
+/* returns LIBCPUCAPS_ERROR_xxx, LIBCPUCAPS_ERROR_FAILED if the cpu or OS doesn't support AMX or denies it */
+int libcpucaps_EnableAMX(void);
+
+/* checks all the requirements of the impl against the caps (returns 1 or 0) */
+int libcpucaps_IsImplSupported(const cpucaps_impl_t* impl, const cpucaps_t* caps);
+/* resolves the table to the best supported impl, pass NULL caps to use the cached ones */
+/* returns LIBCPUCAPS_ERROR_xxx, LIBCPUCAPS_ERROR_FAILED if no impl is supported */
+int libcpucaps_DispatchResolve(cpucaps_dispatch_t* table, const cpucaps_t* caps);
+/* patches the table to never pick impls before firstAllowed (e.g. to benchmark a lower ISA tier) */
+/* pass 0 to restore the normal selection, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_DispatchForce(cpucaps_dispatch_t* table, const cpucaps_t* caps, int firstAllowed);
+/* resolves (if needed) and returns the selected function pointer, NULL if none is supported */
+libcpucaps_func_t libcpucaps_DispatchGet(cpucaps_dispatch_t* table);
+/* for ifunc resolvers: the best impl by the feature bits alone (raw CPUID & XGETBV, no libc, no CPUID backend), */
+/* without touching the table or the cached caps, NULL if none is supported */
+libcpucaps_func_t libcpucaps_DispatchResolveIfunc(const cpucaps_dispatch_t* table);
 
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
 
+/* GNU ifunc: the dynamic loader resolves the function once at load time, calls have zero dispatch overhead */
+/* note that such functions can't be patched later with libcpucaps_DispatchForce, and that the resolver */
+/* runs before constructors, it only reads the feature bits */
+/* usage: LIBCPUCAPS_DISPATCH_IFUNC(float, dot_product, (const float* a, const float* b, size_t n), dotTable); */
+#if defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define LIBCPUCAPS_HAS_IFUNC    1
+#define LIBCPUCAPS_DISPATCH_IFUNC(retType, funcName, params, table)                     \
+    static retType (*funcName##_libcpucaps_resolver(void)) params {                     \
+        return (retType (*) params)libcpucaps_DispatchResolveIfunc(&(table));           \
+    }                                                                                   \
+    retType funcName params __attribute__((ifunc(#funcName "_libcpucaps_resolver")))
+#endif
+
 
 #endif /* LIBCPUCAPS_H_HEADER */
@@ -0,0 +1,245 @@
+#include "libcpucaps.h"
+#include "libcpucaps_alloc.h"
+#include <stdint.h>    /* uintptr_t, SIZE_MAX */
+#include <stdlib.h>    /* malloc, free */
+#include <string.h>    /* memcpy, memset */
+
+#ifdef __linux__
+#include <unistd.h>    /* sysconf */
+#else
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+#define ALLOC_DEFAULT_LINE_SIZE     64
+#define ALLOC_DEFAULT_PAGE_SIZE     4096
+#define ALLOC_AMD_ZEN_FAMILY        0x17
+
+#define ALIGN_UP(value, alignment)  (((value) + (alignment) - 1) & ~((alignment) - 1))
+
+static size_t get_page_size_wrapper(void) {
+#ifdef __linux__
+    long pageSize = sysconf(_SC_PAGESIZE);
+    return (pageSize > 0) ? (size_t)pageSize : ALLOC_DEFAULT_PAGE_SIZE;
+#else
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize ? (size_t)info.dwPageSize : ALLOC_DEFAULT_PAGE_SIZE;
+#endif
+}
+
+static int is_power_of_two(size_t value) {
+    return value && !(value & (value - 1));
+}
+
+/* Intel's L2 spatial prefetcher completes every line to its 128-byte aligned pair, Zen's L2 prefetchers */
+/* fetch the adjacent line too, so data written by different threads has to be two lines apart */
+static int pairs_lines(const cpucaps_t* caps) {
+    int family = (unsigned char)caps->family;
+
+    if (family == 0xF) {
+        family += (unsigned char)caps->familyEx;
+    }
+    return caps->isIntel || (caps->isAMD && family >= ALLOC_AMD_ZEN_FAMILY);
+}
+
+int libcpucaps_GetAllocGeometry(const cpucaps_t* caps, cpucaps_alloc_geometry_t* geometry) {
+    size_t lineBytes, wayBytes;
+    int ways;
+
+    if (!geometry) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES);
+    }
+    memset(geometry, 0, sizeof(cpucaps_alloc_geometry_t));
+
+    lineBytes = is_power_of_two((size_t)caps->L1d_lineSizeBytes) ? (size_t)caps->L1d_lineSizeBytes : ALLOC_DEFAULT_LINE_SIZE;
+    geometry->lineBytes = lineBytes;
+    geometry->interferenceBytes = lineBytes;
+    /* an L2 with longer lines shares them between what the L1d keeps apart */
+    if (is_power_of_two((size_t)caps->L2_lineSizeBytes) && (size_t)caps->L2_lineSizeBytes > geometry->interferenceBytes) {
+        geometry->interferenceBytes = (size_t)caps->L2_lineSizeBytes;
+    }
+    if (pairs_lines(caps)) {
+        geometry->interferenceBytes *= 2;
+    }
+
+    geometry->pageBytes = get_page_size_wrapper();
+    if (!is_power_of_two(geometry->pageBytes)) {
+        geometry->pageBytes = ALLOC_DEFAULT_PAGE_SIZE;
+    }
+
+    /* the L1d way is what same-sized buffers alias in, AMD reports a fully associative L1 as 0xFF */
+    ways = caps->L1d_associativityType;
+    if (caps->L1d_sizeKibiBytes > 0 && ways > 0 && !(caps->isAMD && ways == 0xFF)) {
+        wayBytes = (size_t)caps->L1d_sizeKibiBytes * 1024 / (size_t)ways;
+    } else {
+        wayBytes = geometry->pageBytes;
+    }
+    /* with regular pages the OS picks the address bits above the page offset, colours past it would be random */
+    if (wayBytes > geometry->pageBytes) {
+        wayBytes = geometry->pageBytes;
+    }
+
+    geometry->colourStrideBytes = geometry->interferenceBytes;
+    geometry->numColours = (int)(wayBytes / geometry->colourStrideBytes);
+    if (geometry->numColours < 1) {
+        geometry->numColours = 1;
+    }
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+int libcpucaps_ArenaCreate(cpucaps_arena_t* arena, const cpucaps_t* caps, size_t capacity) {
+    int result;
+
+    if (!arena || !capacity) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(arena, 0, sizeof(cpucaps_arena_t));
+
+    result = libcpucaps_GetAllocGeometry(caps, &arena->geometry);
+    if (result != LIBCPUCAPS_ERROR_OK) {
+        return result;
+    }
+
+    /* the block starts at a page boundary so that colours & page aligned allocations mean the same as */
+    /* in the address space */
+    if (capacity > SIZE_MAX - arena->geometry.pageBytes) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    arena->block = malloc(capacity + arena->geometry.pageBytes);
+    if (!arena->block) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    arena->base = (char*)ALIGN_UP((uintptr_t)arena->block, (uintptr_t)arena->geometry.pageBytes);
+    arena->capacity = capacity;
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+void libcpucaps_ArenaDestroy(cpucaps_arena_t* arena) {
+    if (arena) {
+        free(arena->block);
+        memset(arena, 0, sizeof(cpucaps_arena_t));
+    }
+}
+
+void libcpucaps_ArenaReset(cpucaps_arena_t* arena) {
+    if (arena) {
+        arena->used = 0;
+        arena->nextColour = 0;
+    }
+}
+
+/* offset is added after aligning, the size is padded so the next allocation gets lines of its own */
+static void* arena_alloc(cpucaps_arena_t* arena, size_t size, size_t alignment, size_t offset) {
+    size_t start, end;
+
+    if (!arena || !arena->base || !is_power_of_two(alignment)) {
+        return NULL;
+    }
+    if (alignment < arena->geometry.interferenceBytes) {
+        alignment = arena->geometry.interferenceBytes;
+    }
+
+    start = ALIGN_UP(arena->used, alignment) + offset;
+    if (start < arena->used || size > arena->capacity || start > arena->capacity - size) {
+        return NULL;
+    }
+    end = start + size;
+    end = ALIGN_UP(end, arena->geometry.interferenceBytes);
+
+    arena->used = (end < arena->capacity) ? end : arena->capacity;
+    return arena->base + start;
+}
+
+void* libcpucaps_ArenaAlloc(cpucaps_arena_t* arena, size_t size) {
+    return arena_alloc(arena, size, 1, 0);
+}
+
+void* libcpucaps_ArenaAllocAligned(cpucaps_arena_t* arena, size_t size, size_t alignment) {
+    return arena_alloc(arena, size, alignment, 0);
+}
+
+void* libcpucaps_ArenaAllocSlots(cpucaps_arena_t* arena, size_t slotBytes, int numSlots, size_t* strideBytes) {
+    size_t stride;
+
+    if (!arena || !slotBytes || numSlots <= 0) {
+        return NULL;
+    }
+    stride = ALIGN_UP(slotBytes, arena->geometry.interferenceBytes);
+    if (stride < slotBytes || stride > ((size_t)-1) / (size_t)numSlots) {
+        return NULL;
+    }
+    if (strideBytes) {
+        *strideBytes = stride;
+    }
+    return arena_alloc(arena, stride * (size_t)numSlots, 1, 0);
+}
+
+void* libcpucaps_ArenaAllocColoured(cpucaps_arena_t* arena, size_t size) {
+    void* result;
+    int colour;
+
+    if (!arena) {
+        return NULL;
+    }
+    colour = arena->nextColour;
+    result = arena_alloc(arena, size, arena->geometry.pageBytes, (size_t)colour * arena->geometry.colourStrideBytes);
+    if (result) {
+        arena->nextColour = (colour + 1) % arena->geometry.numColours;
+    }
+    return result;
+}
+
+int libcpucaps_PoolInit(cpucaps_pool_t* pool, cpucaps_arena_t* arena, size_t blockBytes) {
+    size_t wayBytes;
+
+    if (!pool || !arena || !arena->base || !blockBytes) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(pool, 0, sizeof(cpucaps_pool_t));
+
+    /* room for the free list link */
+    if (blockBytes < sizeof(void*)) {
+        blockBytes = sizeof(void*);
+    }
+    pool->arena = arena;
+    pool->blockBytes = blockBytes;
+
+    /* smaller blocks already spread over the sets as they're packed one after the other */
+    wayBytes = (size_t)arena->geometry.numColours * arena->geometry.colourStrideBytes;
+    pool->isColoured = (blockBytes >= wayBytes);
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+void* libcpucaps_PoolAlloc(cpucaps_pool_t* pool) {
+    void* block;
+
+    if (!pool || !pool->arena) {
+        return NULL;
+    }
+    if (pool->freeList) {
+        block = pool->freeList;
+        memcpy(&pool->freeList, block, sizeof(void*));
+        return block;
+    }
+
+    if (pool->isColoured) {
+        return libcpucaps_ArenaAllocColoured(pool->arena, pool->blockBytes);
+    }
+    return libcpucaps_ArenaAlloc(pool->arena, pool->blockBytes);
+}
+
+void libcpucaps_PoolFree(cpucaps_pool_t* pool, void* block) {
+    if (pool && block) {
+        memcpy(block, &pool->freeList, sizeof(void*));
+        pool->freeList = block;
+    }
+}
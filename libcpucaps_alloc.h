@@ -0,0 +1,71 @@
+#ifndef LIBCPUCAPS_ALLOC_H_HEADER
+#define LIBCPUCAPS_ALLOC_H_HEADER
+
+/* optional allocator module: bump arenas & free-list pools laid out by the detected cache geometry */
+/* allocations don't share the lines the prefetchers fetch together, so per-thread data doesn't false-share, */
+/* and same-sized large buffers get "colours" (offsets into the L1d way) so they don't pile up in the same sets */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+
+typedef struct _s_cpucaps_alloc_geometry {
+    size_t  lineBytes;              /* L1d line, the constructive interference size */
+    size_t  interferenceBytes;      /* destructive interference size: lines the spatial prefetchers pair up */
+    size_t  colourStrideBytes;      /* offset between two colours, interferenceBytes */
+    int     numColours;             /* colours in the L1d way, at most a page's worth as the OS picks the upper address bits */
+    size_t  pageBytes;
+} cpucaps_alloc_geometry_t;
+
+/* single threaded bump allocator over one block, use one arena per thread */
+typedef struct _s_cpucaps_arena {
+    cpucaps_alloc_geometry_t  geometry;
+    char*                     base;
+    size_t                    capacity;
+    size_t                    used;
+    int                       nextColour;
+    void*                     block;      /* what was malloc'ed */
+} cpucaps_arena_t;
+
+/* fixed size blocks carved from an arena, freed blocks are reused last in, first out */
+typedef struct _s_cpucaps_pool {
+    cpucaps_arena_t*  arena;
+    size_t            blockBytes;
+    int               isColoured;         /* blocks of an L1d way or more are page aligned & coloured */
+    void*             freeList;
+} cpucaps_pool_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* pass NULL caps to use the cached ones, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_GetAllocGeometry(const cpucaps_t* caps, cpucaps_alloc_geometry_t* geometry);
+
+/* capacity has to be above 0 & leave room for a page of alignment in a size_t, else LIBCPUCAPS_ERROR_INVALID_PARAM */
+/* returns LIBCPUCAPS_ERROR_xxx, the arena has to be released with libcpucaps_ArenaDestroy */
+int libcpucaps_ArenaCreate(cpucaps_arena_t* arena, const cpucaps_t* caps, size_t capacity);
+void libcpucaps_ArenaDestroy(cpucaps_arena_t* arena);
+/* releases every allocation at once, pools over the arena have to be initialized again */
+void libcpucaps_ArenaReset(cpucaps_arena_t* arena);
+
+/* the allocators return NULL once the arena is full */
+/* aligned & padded to interferenceBytes, nothing else lands on the lines of the allocation */
+void* libcpucaps_ArenaAlloc(cpucaps_arena_t* arena, size_t size);
+/* alignment is a power of two, the allocation is still padded to interferenceBytes */
+void* libcpucaps_ArenaAllocAligned(cpucaps_arena_t* arena, size_t size, size_t alignment);
+/* numSlots slots (e.g. one per thread), each padded to a multiple of interferenceBytes, strideBytes gets their distance */
+void* libcpucaps_ArenaAllocSlots(cpucaps_arena_t* arena, size_t slotBytes, int numSlots, size_t* strideBytes);
+/* large buffers: a page boundary plus the next colour, consecutive buffers start in different L1d & L2 sets */
+void* libcpucaps_ArenaAllocColoured(cpucaps_arena_t* arena, size_t size);
+
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_PoolInit(cpucaps_pool_t* pool, cpucaps_arena_t* arena, size_t blockBytes);
+/* NULL once the arena is full */
+void* libcpucaps_PoolAlloc(cpucaps_pool_t* pool);
+void libcpucaps_PoolFree(cpucaps_pool_t* pool, void* block);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_ALLOC_H_HEADER */
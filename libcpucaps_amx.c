@@ -0,0 +1,89 @@
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+
+#ifdef __linux__
+
+#include <unistd.h>         /* syscall */
+#include <sys/syscall.h>    /* SYS_arch_prctl */
+
+/* asm/prctl.h of older kernel headers doesn't have these */
+#ifndef ARCH_GET_XCOMP_PERM
+#define ARCH_GET_XCOMP_PERM     0x1022
+#endif
+#ifndef ARCH_REQ_XCOMP_PERM
+#define ARCH_REQ_XCOMP_PERM     0x1023
+#endif
+
+#endif
+
+#define XFEATURE_XTILEDATA      18      /* XSAVE state component number of the tile data */
+
+/* https://www.intel.com/content/dam/www/public/us/en/documents/manuals/64-ia-32-architectures-software-developer-instruction-set-reference-manual-325383.pdf */
+/* Tile Information Main Leaf (0x1D), TMUL Information Main Leaf (0x1E) */
+void query_amx(uint32_t highestFunc, cpucaps_t* caps) {
+    cpuid_result_t cpuidResult;
+    cpucaps_amx_palette_t* palette;
+    uint32_t maxPalette, i;
+
+    /* EAX is the highest palette, subleaf N describes palette N */
+    cpuid_wrapper(0x1D, 0, &cpuidResult);
+    maxPalette = cpuidResult.eax;
+
+    for (i = 1; i <= maxPalette && caps->amxNumPalettes < LIBCPUCAPS_MAX_AMX_PALETTES; ++i) {
+        cpuid_wrapper(0x1D, i, &cpuidResult);
+        palette = &caps->amxPalettes[caps->amxNumPalettes++];
+        palette->palette = (int)i;
+        palette->totalTileBytes = (int)(cpuidResult.eax & 0xFFFF);
+        palette->bytesPerTile = (int)(cpuidResult.eax >> 16);
+        palette->bytesPerRow = (int)(cpuidResult.ebx & 0xFFFF);
+        palette->maxNames = (int)(cpuidResult.ebx >> 16);
+        palette->maxRows = (int)(cpuidResult.ecx & 0xFFFF);
+    }
+
+    if (highestFunc >= 0x1E) {
+        cpuid_wrapper(0x1E, 0, &cpuidResult);
+        caps->amxTmulMaxK = (int)(cpuidResult.ebx & 0xFF);
+        caps->amxTmulMaxN = (int)((cpuidResult.ebx >> 8) & 0xFFFF);
+    }
+}
+
+static volatile int s_amxEnabled = 0;
+
+int libcpucaps_EnableAMX(void) {
+    const cpucaps_t* caps;
+#ifdef __linux__
+    unsigned long permitted = 0;
+#endif
+
+    if (s_amxEnabled) {
+        return LIBCPUCAPS_ERROR_OK;
+    }
+
+    caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    if (!libcpucaps_HasAMXTile(caps)) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+#ifdef __linux__
+    /* the kernel keeps the tile data XFD-armed (first use faults) until the process is granted the permission */
+    if (syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA)) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    /* user mode can't read IA32_XFD, the permitted set is what the kernel's #NM handler goes by */
+    if (syscall(SYS_arch_prctl, ARCH_GET_XCOMP_PERM, &permitted) || !GET_BIT(permitted, XFEATURE_XTILEDATA)) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+#endif
+
+    /* Windows handles XFD on its own, elsewhere enabled XCR0 bits are all there is to check */
+    if ((xgetbv_wrapper(0) & XCR0_AMX_MASK) != XCR0_AMX_MASK) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    s_amxEnabled = 1;
+    return LIBCPUCAPS_ERROR_OK;
+}
@@ -0,0 +1,213 @@
+#include "libcpucaps.h"
+#include "libcpucaps_blocking.h"
+#include <string.h>    /* memset */
+
+#define BLOCKING_DEFAULT_LINE_SIZE  64
+#define BLOCKING_FULLY_ASSOCIATIVE  0
+
+/* AMD's 4-bit L2/L3 associativity encoding (CPUID 0x80000006), lower bounds of the ranges */
+/* L3 code 9 is replaced by the real number of ways from 0x8000001D during detection, which can be below 16 too */
+static const int s_amdWays[16] = { 0, 1, 2, 3, 4, 6, 8, 0, 16, 0, 32, 48, 64, 96, 128, BLOCKING_FULLY_ASSOCIATIVE };
+
+static int get_ways(const cpucaps_t* caps, int level, int associativityType) {
+    int isCode = (level == 2) || (level == 3 && caps->L3_associativityLeaf != 0x8000001D);
+
+    if (caps->isAMD && isCode && associativityType < 16) {
+        return s_amdWays[associativityType];
+    }
+    /* AMD's L1 (0x80000005) and Intel's leaf 4 report the number of ways, AMD's 0xFF is fully associative */
+    if (caps->isAMD && associativityType == 0xFF) {
+        return BLOCKING_FULLY_ASSOCIATIVE;
+    }
+    return associativityType;
+}
+
+static size_t gcd(size_t a, size_t b) {
+    size_t t;
+
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static size_t isqrt(size_t value) {
+    size_t root = 0, bit = (size_t)1 << (sizeof(size_t) * 8 - 2);
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/* rows of a tile start rowStrideBytes apart, which maps them onto gcd(stride, way size) spaced sets */
+/* a way holds a full period of them, so without conflicts a set keeps at most one row per way of every period */
+static int max_rows_by_stride(size_t rowStrideBytes, size_t wayBytes, int usableWays, size_t rowBytes, int numStreams) {
+    size_t spacing = gcd(rowStrideBytes, wayBytes);
+    size_t period = wayBytes / spacing;
+    size_t overlap = (rowBytes + spacing - 1) / spacing;    /* rows of a period sharing each set */
+    size_t maxRows = period * (size_t)usableWays / overlap / (size_t)numStreams;
+
+    if (maxRows < 1) {
+        return 1;
+    }
+    return (maxRows > 0x7FFFFFFF) ? 0x7FFFFFFF : (int)maxRows;
+}
+
+static void advise_level(const cpucaps_kernel_desc_t* kernel, int level, int sizeKibiBytes, int lineSizeBytes, int ways,
+                         int numSharing, cpucaps_tile_t* tile) {
+    size_t cacheBytes = (size_t)sizeKibiBytes * 1024;
+    size_t lineElements, streamElements, cols, rows;
+    int usableWays;
+
+    /* one way is left for whatever the kernel doesn't tile (stack, loop invariants, lines on their way out) */
+    if (ways == BLOCKING_FULLY_ASSOCIATIVE) {
+        usableWays = 7;
+        tile->budgetBytes = cacheBytes / 8 * 7;
+    } else if (ways == 1) {
+        usableWays = 1;
+        tile->budgetBytes = cacheBytes / 2;
+    } else {
+        usableWays = ways - 1;
+        tile->budgetBytes = cacheBytes / ways * usableWays;
+    }
+    tile->budgetBytes /= numSharing;
+    tile->level = level;
+
+    lineElements = (size_t)lineSizeBytes / kernel->elementBytes;
+    if (!lineElements) {
+        lineElements = 1;
+    }
+    streamElements = tile->budgetBytes / kernel->elementBytes / kernel->numStreams;
+
+    if (kernel->reuse == LIBCPUCAPS_REUSE_STREAM) {
+        rows = 1;
+        cols = streamElements / lineElements * lineElements;
+    } else {
+        cols = isqrt(streamElements) / lineElements * lineElements;
+        if (cols < lineElements) {
+            cols = lineElements;
+        }
+        /* whole lines in both directions, a transposed or column-walked operand reads the rows as lines */
+        rows = streamElements / cols;
+        if (rows >= lineElements) {
+            rows = rows / lineElements * lineElements;
+        }
+    }
+    if (cols < lineElements) {
+        cols = lineElements;
+    }
+    if (rows < 1) {
+        rows = 1;
+    }
+
+    /* L3s are sliced with hashed set indices, strides only matter for the per-core levels */
+    if (kernel->reuse == LIBCPUCAPS_REUSE_2D && kernel->rowStrideBytes && level < 3 && ways != BLOCKING_FULLY_ASSOCIATIVE) {
+        size_t maxRows = (size_t)max_rows_by_stride(kernel->rowStrideBytes, cacheBytes / ways, usableWays,
+                                                    cols * kernel->elementBytes, kernel->numStreams);
+        /* fewer rows than a line's worth would waste the lines of a transposed operand and conflict anyway, */
+        /* only padding the stride helps then, a smaller tile just adds loop overhead on top of the misses */
+        if (rows > maxRows) {
+            if (maxRows >= lineElements) {
+                rows = maxRows / lineElements * lineElements;
+            }
+            tile->isStrideLimited = 1;
+        }
+    }
+
+    tile->rows = (int)rows;
+    tile->cols = (int)cols;
+    tile->workingSetBytes = rows * cols * kernel->elementBytes * kernel->numStreams;
+}
+
+int libcpucaps_AdviseBlocking(const cpucaps_t* caps, const cpucaps_kernel_desc_t* kernel, cpucaps_blocking_t* blocking) {
+    int sizes[LIBCPUCAPS_MAX_BLOCKING_LEVELS], lineSizes[LIBCPUCAPS_MAX_BLOCKING_LEVELS], assocTypes[LIBCPUCAPS_MAX_BLOCKING_LEVELS];
+    int numThreads, smtWidth, numSharing, i;
+
+    if (!kernel || !blocking || kernel->elementBytes <= 0 || kernel->numStreams <= 0 ||
+        (kernel->reuse != LIBCPUCAPS_REUSE_STREAM && kernel->reuse != LIBCPUCAPS_REUSE_2D)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES | LIBCPUCAPS_DETECT_TOPOLOGY);
+    }
+
+    memset(blocking, 0, sizeof(cpucaps_blocking_t));
+
+    sizes[0] = caps->L1d_sizeKibiBytes;
+    sizes[1] = caps->L2_sizeKibiBytes;
+    sizes[2] = caps->L3_sizeKibiBytes;
+    lineSizes[0] = caps->L1d_lineSizeBytes;
+    lineSizes[1] = caps->L2_lineSizeBytes;
+    lineSizes[2] = caps->L3_lineSizeBytes;
+    assocTypes[0] = caps->L1d_associativityType;
+    assocTypes[1] = caps->L2_associativityType;
+    assocTypes[2] = caps->L3_associativityType;
+
+    /* L1 & L2 are shared by the SMT siblings of a core, the threads spread over the L3 instances */
+    numThreads = (kernel->numThreads > 1) ? kernel->numThreads : 1;
+    smtWidth = (caps->numCores > 0 && caps->numLogicalCores > caps->numCores) ? caps->numLogicalCores / caps->numCores : 1;
+
+    for (i = 0; i < LIBCPUCAPS_MAX_BLOCKING_LEVELS; ++i) {
+        if (sizes[i] <= 0) {
+            continue;
+        }
+        if (i < 2) {
+            numSharing = (numThreads < smtWidth) ? numThreads : smtWidth;
+        } else {
+            numSharing = (caps->numLogicalCores > 0 && numThreads > caps->numLogicalCores) ? caps->numLogicalCores : numThreads;
+            if (caps->L3_numInstances > 1) {
+                numSharing = (numSharing + caps->L3_numInstances - 1) / caps->L3_numInstances;
+            }
+            if (caps->L3_numSharingCPUs > 0 && numSharing > caps->L3_numSharingCPUs) {
+                numSharing = caps->L3_numSharingCPUs;
+            }
+        }
+
+        advise_level(kernel, i + 1, sizes[i], lineSizes[i] ? lineSizes[i] : BLOCKING_DEFAULT_LINE_SIZE,
+                     get_ways(caps, i + 1, assocTypes[i]), numSharing, &blocking->levels[blocking->numLevels++]);
+    }
+
+    if (kernel->rowStrideBytes) {
+        blocking->paddedStrideBytes = libcpucaps_PadStride(caps, kernel->rowStrideBytes, kernel->elementBytes);
+    }
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+size_t libcpucaps_PadStride(const cpucaps_t* caps, size_t strideBytes, int elementBytes) {
+    size_t lineSize, numLines, padded;
+
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES);
+    }
+    lineSize = caps->L1d_lineSizeBytes ? (size_t)caps->L1d_lineSizeBytes : BLOCKING_DEFAULT_LINE_SIZE;
+
+    /* strides that aren't whole lines already walk through every set */
+    if (strideBytes < lineSize || strideBytes % lineSize) {
+        return strideBytes;
+    }
+
+    /* an odd number of lines is coprime with the power of two number of sets of every level */
+    numLines = strideBytes / lineSize;
+    if (!(numLines & 1)) {
+        ++numLines;
+    }
+    padded = numLines * lineSize;
+
+    if (elementBytes > 0 && padded % elementBytes) {
+        padded += elementBytes - padded % elementBytes;
+    }
+    return padded;
+}
@@ -0,0 +1,57 @@
+#ifndef LIBCPUCAPS_BLOCKING_H_HEADER
+#define LIBCPUCAPS_BLOCKING_H_HEADER
+
+/* optional cache blocking module: tile sizes of tiled kernels (GEMM, convolutions, transposes, hash joins) */
+/* for every cache level, fitting the share of the cache the kernel gets and the associativity of its rows */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+
+/* how the kernel reuses the data of a tile */
+#define LIBCPUCAPS_REUSE_STREAM     0   /* 1D chunks touched a few times each, e.g. hash join partitions */
+#define LIBCPUCAPS_REUSE_2D         1   /* rows x cols tiles of every stream are resident together, e.g. transposes, */
+                                        /* stencils, GEMM with square blocks */
+
+#define LIBCPUCAPS_MAX_BLOCKING_LEVELS  3
+
+typedef struct _s_cpucaps_kernel_desc {
+    int     elementBytes;
+    int     numStreams;         /* operand arrays with a tile resident at the same time, e.g. 3 for C += A * B */
+    int     reuse;              /* LIBCPUCAPS_REUSE_xxx */
+    int     numThreads;         /* threads running the kernel, 0 or 1 if single threaded */
+    size_t  rowStrideBytes;     /* distance between the rows of the operands (leading dimension), 0 if unknown */
+} cpucaps_kernel_desc_t;
+
+/* tile for one cache level, rows x cols elements per stream */
+typedef struct _s_cpucaps_tile {
+    int     level;
+    size_t  budgetBytes;        /* share of the cache all streams of one thread may fill */
+    int     rows;               /* 1 for LIBCPUCAPS_REUSE_STREAM */
+    int     cols;               /* a multiple of the cache line (in elements) */
+    size_t  workingSetBytes;    /* all streams, rows * cols * elementBytes * numStreams */
+    int     isStrideLimited;    /* rowStrideBytes maps the rows onto too few sets, rows were cut unless that left */
+                                /* less than a line's worth of them */
+} cpucaps_tile_t;
+
+typedef struct _s_cpucaps_blocking {
+    int             numLevels;
+    cpucaps_tile_t  levels[LIBCPUCAPS_MAX_BLOCKING_LEVELS];    /* L1d, L2, L3, levels the cpu doesn't have are left out */
+    size_t          paddedStrideBytes;  /* rowStrideBytes padded so that rows spread over all sets, 0 if it's unknown */
+} cpucaps_blocking_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* recommends tiles for the kernel, pass NULL caps to use the cached ones */
+/* tiles are for rowStrideBytes as is, if the stride limits them use paddedStrideBytes & advise again */
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_AdviseBlocking(const cpucaps_t* caps, const cpucaps_kernel_desc_t* kernel, cpucaps_blocking_t* blocking);
+/* smallest stride >= strideBytes (a multiple of elementBytes) whose rows don't pile up in the same cache sets */
+size_t libcpucaps_PadStride(const cpucaps_t* caps, size_t strideBytes, int elementBytes);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_BLOCKING_H_HEADER */
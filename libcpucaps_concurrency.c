@@ -0,0 +1,322 @@
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+#include <stdio.h>
+#include <stdlib.h>    /* calloc, free, strtod */
+#include <string.h>    /* memchr, memcpy, memset, strchr, strrchr, strlen, strncmp */
+
+#define CONCURRENCY_DEFAULT_CGROUP_ROOT "/sys/fs/cgroup"
+#define CONCURRENCY_PROC_CGROUP         "/proc/self/cgroup"
+#define CONCURRENCY_MAX_PATH            1024
+#define CONCURRENCY_FILE_BUFFER_SIZE    16384
+#define CONCURRENCY_PROC_BUFFER_SIZE    4096
+
+/* cgroup v1 mount directories of the controllers, the co-mounted name first */
+static const char* const s_cpuControllerDirs[] = { "cpu,cpuacct", "cpuacct,cpu", "cpu" };
+
+/* controller is one of the comma separated names in [names, end) */
+static int has_controller(const char* names, const char* end, const char* controller) {
+    size_t length = strlen(controller);
+    const char* next;
+
+    for (; names < end; names = next + 1) {
+        next = memchr(names, ',', (size_t)(end - names));
+        if (!next) {
+            next = end;
+        }
+        if ((size_t)(next - names) == length && !strncmp(names, controller, length)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the process' cgroup from /proc/self/cgroup lines "<id>:<controllers>:<path>", v2 is "0::<path>" */
+/* controller is NULL for the v2 line, the path is left empty if there's no matching line */
+static void find_cgroup_path(const char* procCgroup, const char* controller, char* path, size_t pathSize) {
+    const char *line, *names, *p, *end;
+    size_t length;
+
+    path[0] = 0;
+    for (line = procCgroup; *line; line = end + 1) {
+        end = strchr(line, '\n');
+        if (!end) {
+            end = line + strlen(line);
+        }
+        names = memchr(line, ':', (size_t)(end - line));
+        p = names ? memchr(names + 1, ':', (size_t)(end - names - 1)) : NULL;
+
+        if (p && (controller ? has_controller(names + 1, p, controller) : (p == names + 1))) {
+            length = (size_t)(end - p - 1);
+            /* "/" is the base directory itself */
+            if (length < pathSize && !(length == 1 && p[1] == '/')) {
+                memcpy(path, p + 1, length);
+                path[length] = 0;
+            }
+            return;
+        }
+        if (!*end) {
+            break;
+        }
+    }
+}
+
+/* "<dir>/<name>", returns 0 if it doesn't fit - a cut path would read somebody else's file */
+static int join_path(char* path, const char* dir, const char* name) {
+    int length = snprintf(path, CONCURRENCY_MAX_PATH, "%s/%s", dir, name);
+    return length > 0 && length < CONCURRENCY_MAX_PATH;
+}
+
+/* base & the cgroup path, which is empty or starts with a slash */
+static int get_cgroup_dir(char* dir, const char* base, const char* path) {
+    int length = snprintf(dir, CONCURRENCY_MAX_PATH, "%s%s", base, path);
+    return length > 0 && length < CONCURRENCY_MAX_PATH;
+}
+
+/* drops the last path component of dir while it's below base, returns 0 at the base */
+static int go_up(char* dir, size_t baseLength) {
+    char* slash;
+
+    if (strlen(dir) <= baseLength) {
+        return 0;
+    }
+    slash = strrchr(dir + baseLength, '/');
+    if (!slash) {
+        dir[baseLength] = 0;
+    } else {
+        *slash = 0;
+    }
+    return 1;
+}
+
+/* reads file from the deepest directory that has it, from base/path up to base */
+/* levels that don't exist are skipped - in a container without a cgroup namespace the path is the host's one */
+/* while base is already the container's own cgroup */
+static int read_nearest(const char* base, const char* path, const char* file, char* buffer) {
+    char dir[CONCURRENCY_MAX_PATH], filePath[CONCURRENCY_MAX_PATH];
+    size_t baseLength = strlen(base);
+
+    if (!get_cgroup_dir(dir, base, path)) {
+        return 0;
+    }
+    do {
+        if (join_path(filePath, dir, file) && read_text_file(filePath, buffer, CONCURRENCY_FILE_BUFFER_SIZE) && buffer[0] &&
+            buffer[0] != '\n') {
+            return 1;
+        }
+    } while (go_up(dir, baseLength));
+
+    return 0;
+}
+
+/* the strictest CFS bandwidth limit of the cgroup & its ancestors, in cpus, 0 if none */
+static double read_quota(int version, const char* base, const char* path, char* buffer) {
+    char dir[CONCURRENCY_MAX_PATH], filePath[CONCURRENCY_MAX_PATH];
+    size_t baseLength = strlen(base);
+    double quota, period, result = 0.0;
+    char* end;
+
+    if (!get_cgroup_dir(dir, base, path)) {
+        return 0.0;
+    }
+    do {
+        quota = period = 0.0;
+        if (version == 2) {
+            /* "max 100000" or "250000 100000" */
+            if (join_path(filePath, dir, "cpu.max") && read_text_file(filePath, buffer, CONCURRENCY_FILE_BUFFER_SIZE) &&
+                strncmp(buffer, "max", 3)) {
+                quota = strtod(buffer, &end);
+                period = strtod(end, NULL);
+            }
+        } else {
+            /* -1 is unlimited */
+            if (join_path(filePath, dir, "cpu.cfs_quota_us") && read_text_file(filePath, buffer, CONCURRENCY_FILE_BUFFER_SIZE)) {
+                quota = strtod(buffer, NULL);
+                if (join_path(filePath, dir, "cpu.cfs_period_us") && read_text_file(filePath, buffer, CONCURRENCY_FILE_BUFFER_SIZE)) {
+                    period = strtod(buffer, NULL);
+                }
+            }
+        }
+
+        if (quota > 0.0 && period > 0.0 && (result == 0.0 || quota / period < result)) {
+            result = quota / period;
+        }
+    } while (go_up(dir, baseLength));
+
+    return result;
+}
+
+/* intersects cpus with the cgroup cpuset & reads the quota, returns the cgroup version found (0 if none) */
+static int read_cgroup_limits(const char* root, uint64_t* cpus, int numWords, double* quota, char* buffer) {
+    char procCgroup[CONCURRENCY_PROC_BUFFER_SIZE], path[CONCURRENCY_MAX_PATH], base[CONCURRENCY_MAX_PATH];
+    uint64_t* cpuset;
+    int version = 0, hasCpuset = 0, i;
+
+    *quota = 0.0;
+    if (!read_text_file(CONCURRENCY_PROC_CGROUP, procCgroup, sizeof(procCgroup))) {
+        procCgroup[0] = 0;
+    }
+    cpuset = (uint64_t*)calloc((size_t)numWords, sizeof(uint64_t));
+    if (!cpuset) {
+        return 0;
+    }
+
+    /* the unified hierarchy has cgroup.controllers in every directory, v1 mounts a directory per controller */
+    if (join_path(path, root, "cgroup.controllers") && read_text_file(path, buffer, CONCURRENCY_FILE_BUFFER_SIZE)) {
+        version = 2;
+        find_cgroup_path(procCgroup, NULL, path, sizeof(path));
+        hasCpuset = read_nearest(root, path, "cpuset.cpus.effective", buffer) && parse_cpu_list(buffer, cpuset, numWords);
+        *quota = read_quota(2, root, path, buffer);
+    } else {
+        find_cgroup_path(procCgroup, "cpuset", path, sizeof(path));
+        hasCpuset = join_path(base, root, "cpuset") &&
+                    (read_nearest(base, path, "cpuset.effective_cpus", buffer) || read_nearest(base, path, "cpuset.cpus", buffer)) &&
+                    parse_cpu_list(buffer, cpuset, numWords);
+
+        find_cgroup_path(procCgroup, "cpu", path, sizeof(path));
+        for (i = 0; i < (int)(sizeof(s_cpuControllerDirs) / sizeof(s_cpuControllerDirs[0])) && *quota == 0.0; ++i) {
+            if (join_path(base, root, s_cpuControllerDirs[i])) {
+                *quota = read_quota(1, base, path, buffer);
+            }
+        }
+        version = (hasCpuset || *quota > 0.0) ? 1 : 0;
+    }
+
+    if (hasCpuset) {
+        for (i = 0; i < numWords; ++i) {
+            cpus[i] &= cpuset[i];
+        }
+    }
+
+    free(cpuset);
+    return version;
+}
+
+static cpucaps_concurrency_t* allocate_concurrency(int numWords) {
+    cpucaps_concurrency_t* concurrency;
+    uint64_t* words;
+
+    /* a single block - header & the storage of both cpu sets */
+    concurrency = (cpucaps_concurrency_t*)calloc(1, sizeof(cpucaps_concurrency_t) + sizeof(uint64_t) * numWords * 2);
+    if (!concurrency) {
+        return NULL;
+    }
+
+    words = (uint64_t*)(concurrency + 1);
+    concurrency->maxCPUIndex = numWords * CPU_WORD_BITS;
+    concurrency->cpus.numWords = numWords;
+    concurrency->cpus.words = words;
+    concurrency->primaryCPUs.numWords = numWords;
+    concurrency->primaryCPUs.words = words + numWords;
+
+    return concurrency;
+}
+
+/* which cores the usable cpus belong to */
+static int count_cores(cpucaps_concurrency_t* result, const cpucaps_topology_t* topology) {
+    int *usable, *total;
+    const cpucaps_cpu_t* cpu;
+    int i;
+
+    usable = (int*)calloc((size_t)topology->numCores * 2, sizeof(int));
+    if (!usable) {
+        return 0;
+    }
+    total = usable + topology->numCores;
+
+    for (i = 0; i < topology->numCPUs; ++i) {
+        cpu = &topology->cpus[i];
+        if (cpu->coreIndex < 0 || cpu->coreIndex >= topology->numCores) {
+            continue;
+        }
+        ++total[cpu->coreIndex];
+        if (!libcpucaps_CpuSetHas(&result->cpus, cpu->cpuIndex)) {
+            continue;
+        }
+        /* cpus are sorted by cpuIndex, so the first usable sibling is the lowest numbered one */
+        if (!usable[cpu->coreIndex]++) {
+            result->primaryCPUs.words[cpu->cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu->cpuIndex);
+            ++result->numCores;
+        }
+    }
+    for (i = 0; i < topology->numCores; ++i) {
+        result->numFullCores += (usable[i] && usable[i] == total[i]);
+    }
+
+    free(usable);
+    return 1;
+}
+
+int libcpucaps_GetConcurrency(const char* cgroupRoot, const cpucaps_topology_t* topology, cpucaps_concurrency_t** concurrency) {
+    cpucaps_concurrency_t* result;
+    uint64_t* affinity;
+    char* buffer;
+    int capacity, numWords, i;
+
+    if (!concurrency) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    *concurrency = NULL;
+    if (!cgroupRoot) {
+        cgroupRoot = CONCURRENCY_DEFAULT_CGROUP_ROOT;
+    }
+
+    capacity = get_cpu_capacity_wrapper();
+    if (topology && topology->maxCPUIndex > capacity) {
+        capacity = topology->maxCPUIndex;
+    }
+    numWords = CPU_WORDS(capacity);
+
+    result = allocate_concurrency(numWords);
+    affinity = (uint64_t*)calloc((size_t)numWords, sizeof(uint64_t));
+    buffer = (char*)malloc(CONCURRENCY_FILE_BUFFER_SIZE);
+    if (!result || !affinity || !buffer) {
+        free(result);
+        free(affinity);
+        free(buffer);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    /* online cpus of the topology, the affinity mask only holds online cpus anyway */
+    if (topology) {
+        for (i = 0; i < topology->numCPUs; ++i) {
+            result->cpus.words[topology->cpus[i].cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(topology->cpus[i].cpuIndex);
+        }
+    } else {
+        memset(result->cpus.words, 0xFF, sizeof(uint64_t) * numWords);
+    }
+
+    if (get_thread_affinity_wrapper(affinity, numWords)) {
+        for (i = 0; i < numWords; ++i) {
+            result->cpus.words[i] &= affinity[i];
+        }
+    }
+
+    result->cgroupVersion = read_cgroup_limits(cgroupRoot, result->cpus.words, numWords, &result->cpuQuota, buffer);
+    result->numCPUs = libcpucaps_CpuSetCount(&result->cpus);
+
+    /* without a topology every cpu counts as a core of its own */
+    if (!topology || !count_cores(result, topology)) {
+        memcpy(result->primaryCPUs.words, result->cpus.words, sizeof(uint64_t) * numWords);
+        result->numCores = result->numCPUs;
+        result->numFullCores = result->numCPUs;
+    }
+
+    /* busy threads beyond the quota get throttled for the rest of every period, so it's rounded down */
+    result->effectiveThreads = result->numCPUs;
+    if (result->cpuQuota > 0.0 && (double)result->effectiveThreads > result->cpuQuota) {
+        result->effectiveThreads = (int)result->cpuQuota;
+    }
+    if (result->effectiveThreads < 1) {
+        result->effectiveThreads = 1;
+    }
+
+    free(affinity);
+    free(buffer);
+
+    *concurrency = result;
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+void libcpucaps_FreeConcurrency(cpucaps_concurrency_t* concurrency) {
+    free(concurrency);
+}
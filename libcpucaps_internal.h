@@ -0,0 +1,113 @@
+#ifndef LIBCPUCAPS_INTERNAL_H_HEADER
+#define LIBCPUCAPS_INTERNAL_H_HEADER
+
+/* shared between the library's translation units, not a part of the public API */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct _s_cpuid_result {
+    uint32_t eax, ebx, ecx, edx;
+} cpuid_result_t;
+
+#define GET_BIT(a, bit)  (((a) >> (bit)) & 1)
+
+#define CPU_WORD_BITS           64
+#define CPU_WORDS(numCPUs)      (((numCPUs) + CPU_WORD_BITS - 1) / CPU_WORD_BITS)
+#define CPU_WORD_BIT(cpu)       ((uint64_t)1 << ((cpu) % CPU_WORD_BITS))
+
+/* XCR0 state components */
+#define XCR0_SSE_STATE      0x00000002  /* XMM */
+#define XCR0_AVX_STATE      0x00000004  /* upper halves of YMM */
+#define XCR0_OPMASK_STATE   0x00000020  /* k0 - k7 */
+#define XCR0_ZMM_HI256      0x00000040  /* upper halves of ZMM0 - ZMM15 */
+#define XCR0_HI16_ZMM       0x00000080  /* ZMM16 - ZMM31 */
+#define XCR0_TILECFG_STATE  0x00020000
+#define XCR0_TILEDATA_STATE 0x00040000
+
+#define XCR0_YMM_MASK       (XCR0_SSE_STATE | XCR0_AVX_STATE)
+#define XCR0_ZMM_MASK       (XCR0_YMM_MASK | XCR0_OPMASK_STATE | XCR0_ZMM_HI256 | XCR0_HI16_ZMM)
+#define XCR0_AVX10_MASK     (XCR0_YMM_MASK | XCR0_OPMASK_STATE)     /* 512-bit AVX10 also needs the ZMM state */
+#define XCR0_AMX_MASK       (XCR0_TILECFG_STATE | XCR0_TILEDATA_STATE)
+
+/* x86-64 psABI levels, each one on top of the previous */
+/* v1: CMOV, CX8, FPU, FXSR, MMX, SSE, SSE2 + SYSCALL & long mode */
+#define X86_LEVEL_V1(w)     (LIBCPUCAPS_FEATURE_BIT(CMOV, w) | LIBCPUCAPS_FEATURE_BIT(CMPXCHG8, w) | LIBCPUCAPS_FEATURE_BIT(FPU, w) |    \
+                             LIBCPUCAPS_FEATURE_BIT(FXSR, w) | LIBCPUCAPS_FEATURE_BIT(MMX, w) | LIBCPUCAPS_FEATURE_BIT(SSE, w) |        \
+                             LIBCPUCAPS_FEATURE_BIT(SSE2, w) | LIBCPUCAPS_FEATURE_BIT(SYSCALL, w) | LIBCPUCAPS_FEATURE_BIT(LONGMODE, w))
+/* v2: CMPXCHG16B, LAHF/SAHF, POPCNT, SSE3, SSE4.1, SSE4.2, SSSE3 */
+#define X86_LEVEL_V2(w)     (LIBCPUCAPS_FEATURE_BIT(CMPXCHG16B, w) | LIBCPUCAPS_FEATURE_BIT(LAHFSAHF, w) | LIBCPUCAPS_FEATURE_BIT(POPCNT, w) | \
+                             LIBCPUCAPS_FEATURE_BIT(SSE3, w) | LIBCPUCAPS_FEATURE_BIT(SSE41, w) | LIBCPUCAPS_FEATURE_BIT(SSE42, w) |       \
+                             LIBCPUCAPS_FEATURE_BIT(SSSE3, w))
+/* v3: AVX, AVX2, BMI1, BMI2, F16C, FMA, LZCNT, MOVBE, OSXSAVE (AVX bits already imply the YMM state) */
+#define X86_LEVEL_V3(w)     (LIBCPUCAPS_FEATURE_BIT(AVX, w) | LIBCPUCAPS_FEATURE_BIT(AVX2, w) | LIBCPUCAPS_FEATURE_BIT(BMI1, w) |      \
+                             LIBCPUCAPS_FEATURE_BIT(BMI2, w) | LIBCPUCAPS_FEATURE_BIT(F16C, w) | LIBCPUCAPS_FEATURE_BIT(FMA3, w) |     \
+                             LIBCPUCAPS_FEATURE_BIT(ABM, w) | LIBCPUCAPS_FEATURE_BIT(MOVBE, w) | LIBCPUCAPS_FEATURE_BIT(OSXSAVE, w))
+/* v4: AVX512F, AVX512BW, AVX512CD, AVX512DQ, AVX512VL (+ ZMM state) */
+#define X86_LEVEL_V4(w)     (LIBCPUCAPS_FEATURE_BIT(AVX512F, w) | LIBCPUCAPS_FEATURE_BIT(AVX512BW, w) | LIBCPUCAPS_FEATURE_BIT(AVX512CD, w) | \
+                             LIBCPUCAPS_FEATURE_BIT(AVX512DQ, w) | LIBCPUCAPS_FEATURE_BIT(AVX512VL, w))
+
+/* CPUID through the backend (libcpucaps_SetCPUIDBackend), cached per (leaf, subleaf) under a hypervisor */
+int cpuid_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result);
+/* never cached, for leaves that differ between cpus (APIC IDs, core types, cache sharing) */
+int cpuid_per_cpu_wrapper(uint32_t func, uint32_t subfunc, cpuid_result_t* result);
+/* CPUID leaf 1 ECX bit 31, checked once */
+int is_hypervisor_present(void);
+
+/* libcpucaps_GetCapsStats counters, no-ops unless it's running */
+void stats_count_cpuid(uint32_t func, int isCacheHit);
+void stats_count_affinity(void);
+void stats_count_pinned_thread(void);
+uint64_t xgetbv_wrapper(uint32_t index);
+
+/* number of logical cpus the OS affinity calls accept (>= number of configured cpus) */
+int get_cpu_capacity_wrapper(void);
+/* affinity of the calling thread as an array of 64-bit words, returns 1 on success */
+int get_thread_affinity_wrapper(uint64_t* words, int numWords);
+int set_thread_affinity_wrapper(const uint64_t* words, int numWords);
+
+/* starts a thread pinned to cpuIndex (not pinned if negative), returns 0 on failure */
+typedef void (*thread_proc_t)(void* arg);
+size_t start_thread_wrapper(thread_proc_t proc, void* arg, int cpuIndex);
+void join_thread_wrapper(size_t thread);
+
+/* 32-bit atomics: an acquire load pairs with a release store to publish data written before it */
+int32_t atomic_load_acquire_wrapper(volatile int32_t* value);
+void atomic_store_release_wrapper(volatile int32_t* value, int32_t newValue);
+/* returns 1 if *value was expected and is now newValue */
+int atomic_compare_exchange_wrapper(volatile int32_t* value, int32_t expected, int32_t newValue);
+void atomic_add_wrapper(volatile int32_t* value, int32_t addend);
+/* the same for pointers, to publish data that is never changed afterwards as a whole */
+void* atomic_load_pointer_acquire_wrapper(void* volatile* value);
+void atomic_store_pointer_release_wrapper(void* volatile* value, void* newValue);
+void thread_yield_wrapper(void);
+
+/* monotonic time in nanoseconds */
+uint64_t get_time_ns_wrapper(void);
+
+/* allocates a topology as a single block with the cpu sets wired up, everything else zeroed */
+struct _s_cpucaps_topology* alloc_topology(int numCPUs, int numCaches, int maxCPUIndex);
+
+/* reads a whole (small) text file into buffer, returns 1 on success */
+int read_text_file(const char* path, char* buffer, size_t bufferSize);
+/* per user directory for files kept between processes: $envName, else $HOME/homeSubdir (if not NULL), else /tmp */
+/* (%LOCALAPPDATA% on Windows), returns 1 on success */
+int get_user_dir_wrapper(const char* envName, const char* homeSubdir, char* dir, size_t size);
+/* opens a file for reading (binary) if it's a regular file owned by this user, NULL otherwise */
+FILE* open_trusted_file_wrapper(const char* path);
+/* files other processes read are written to a temp file next to path and renamed over it, so that readers */
+/* never see a partial file: create_temp_file_wrapper opens the temp file for writing (binary) and sets */
+/* tempPath (room for path + 16), commit_temp_file_wrapper closes it and renames it over path if isComplete, */
+/* else removes it, returns 1 once path is replaced */
+FILE* create_temp_file_wrapper(const char* path, char* tempPath, size_t tempPathSize);
+int commit_temp_file_wrapper(FILE* file, const char* tempPath, const char* path, int isComplete);
+/* parses Linux cpu list format ("0-3,8,10-11") into words, returns the number of cpus set */
+int parse_cpu_list(const char* text, uint64_t* words, int numWords);
+int popcount64(uint64_t value);
+/* smallest shift such that (1 << shift) >= value */
+uint32_t log2_ceil(uint32_t value);
+/* FNV-1a, for checksums & file names */
+uint64_t fnv1a64(const void* data, size_t size);
+
+#endif /* LIBCPUCAPS_INTERNAL_H_HEADER */
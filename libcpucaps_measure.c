@@ -0,0 +1,444 @@
+#include "libcpucaps.h"
+#include "libcpucaps_measure.h"
+#include "libcpucaps_spin.h"
+#include "libcpucaps_internal.h"
+#include <stdlib.h>    /* malloc, calloc, free */
+#include <string.h>    /* memset, memcpy */
+
+#ifdef __linux__
+#include <sys/mman.h>  /* madvise */
+#endif
+
+#define MEASURE_DEFAULT_LINE_SIZE       64
+#define MEASURE_DEFAULT_MAX_WORKING_SET (64 * 1024 * 1024)
+#define MEASURE_MIN_LOADS               (1 << 20)
+#define MEASURE_LATENCY_REPEATS         3
+#define MEASURE_MIN_BANDWIDTH_BYTES     (16 * 1024 * 1024)
+#define MEASURE_BANDWIDTH_PASSES        4
+#define MEASURE_ALIGNMENT               4096
+#define MEASURE_HUGE_PAGE_SIZE          (2 * 1024 * 1024)
+#define MEASURE_FLAG_SPIN_NS            50000
+
+/* latency has to rise by this much over the plateau to leave it (for two points in a row, to ignore spikes), */
+/* and the next plateau starts once two steps in a row grow by less than the settle ratio */
+#define KNEE_RISE_RATIO                 1.5
+#define KNEE_SETTLE_RATIO               1.15
+
+static volatile uintptr_t s_sink;
+
+static void* aligned_alloc_wrapper(size_t size, size_t alignment, void** block) {
+    *block = malloc(size + alignment - 1);
+    if (!*block) {
+        return NULL;
+    }
+    return (void*)(((uintptr_t)*block + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+static uint64_t xorshift64(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static int get_line_size(const cpucaps_t* caps) {
+    return (caps && caps->L1d_lineSizeBytes >= (int)sizeof(void*)) ? caps->L1d_lineSizeBytes : MEASURE_DEFAULT_LINE_SIZE;
+}
+
+/* the biggest cache the cpu reports, 0 if it reports none */
+static size_t get_last_level_bytes(const cpucaps_t* caps) {
+    if (caps->L3_sizeKibiBytes) {
+        return (size_t)caps->L3_sizeKibiBytes * 1024;
+    }
+    if (caps->L2_sizeKibiBytes) {
+        return (size_t)caps->L2_sizeKibiBytes * 1024;
+    }
+    return (size_t)caps->L1d_sizeKibiBytes * 1024;
+}
+
+/* one pointer per cache line, linked into a single random cycle so the prefetchers can't guess the next line */
+static double measure_latency(size_t workingSetBytes, int lineSize) {
+    void* block;
+    char* buffer;
+    uint32_t* order;
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    size_t numLines, numLoads, bytes, i, j;
+    uint32_t swap;
+    void** p;
+    uint64_t start, elapsed, best;
+    int repeat;
+
+    numLines = workingSetBytes / (size_t)lineSize;
+    if (numLines < 2 || numLines > 0xFFFFFFFFu) {
+        return 0.0;
+    }
+
+    /* random lines over 4K pages mostly measure the page walks, transparent huge pages keep the TLB out of the curve */
+    /* the working sets that fit into one only need to be page aligned */
+    bytes = numLines * (size_t)lineSize;
+    buffer = (char*)aligned_alloc_wrapper(bytes, (bytes >= MEASURE_HUGE_PAGE_SIZE) ? MEASURE_HUGE_PAGE_SIZE : MEASURE_ALIGNMENT, &block);
+#ifdef __linux__
+    if (buffer && bytes >= MEASURE_HUGE_PAGE_SIZE) {
+        madvise(buffer, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    order = (uint32_t*)malloc(numLines * sizeof(uint32_t));
+    if (!buffer || !order) {
+        free(block);
+        free(order);
+        return 0.0;
+    }
+
+    /* Sattolo's shuffle gives one cycle through all of the lines */
+    for (i = 0; i < numLines; ++i) {
+        order[i] = (uint32_t)i;
+    }
+    for (i = numLines - 1; i > 0; --i) {
+        j = (size_t)(xorshift64(&seed) % i);
+        swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (i = 0; i < numLines; ++i) {
+        *(void**)(buffer + (size_t)order[i] * lineSize) = buffer + (size_t)order[(i + 1) % numLines] * lineSize;
+    }
+    free(order);
+
+    /* one full lap to warm the caches & TLBs up */
+    p = (void**)buffer;
+    for (i = 0; i < numLines; ++i) {
+        p = (void**)*p;
+    }
+
+    /* interference only ever makes a run slower, so the fastest one is the closest to the truth */
+    numLoads = (numLines > MEASURE_MIN_LOADS) ? numLines : MEASURE_MIN_LOADS;
+    for (repeat = 0, best = ~(uint64_t)0; repeat < MEASURE_LATENCY_REPEATS; ++repeat) {
+        start = get_time_ns_wrapper();
+        for (i = 0; i < numLoads; ++i) {
+            p = (void**)*p;
+        }
+        elapsed = get_time_ns_wrapper() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    s_sink = (uintptr_t)p;
+
+    free(block);
+    return (double)best / (double)numLoads;
+}
+
+double libcpucaps_MeasureLatency(size_t workingSetBytes) {
+    return measure_latency(workingSetBytes, get_line_size(libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES)));
+}
+
+
+/* every worker prepares its buffers, then all of them start at once on the go flag */
+typedef struct _s_bandwidth_worker {
+    int                 kind;
+    size_t              bytes;
+    volatile uint32_t*  go;
+    volatile uint32_t   isReady;
+    int                 isValid;
+    uint64_t            startTime;
+    uint64_t            endTime;
+    uint64_t            bytesMoved;
+} bandwidth_worker_t;
+
+static uint64_t read_kernel(const uint64_t* data, size_t count) {
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        s0 += data[i];
+        s1 += data[i + 1];
+        s2 += data[i + 2];
+        s3 += data[i + 3];
+    }
+    return s0 + s1 + s2 + s3;
+}
+
+/* the spin module's wait, yielding now and then as the thread setting the flag may need this cpu */
+static void wait_for_flag(const volatile uint32_t* flag) {
+    while (!libcpucaps_SpinWait32(flag, 0, MEASURE_FLAG_SPIN_NS)) {
+        thread_yield_wrapper();
+    }
+}
+
+static void bandwidth_thread_proc(void* arg) {
+    bandwidth_worker_t* worker = (bandwidth_worker_t*)arg;
+    void* block;
+    char* buffer;
+    size_t half;
+    uint64_t sum = 0;
+    int pass;
+
+    buffer = (char*)aligned_alloc_wrapper(worker->bytes, MEASURE_ALIGNMENT, &block);
+    if (buffer) {
+        memset(buffer, 1, worker->bytes);   /* fault the pages in before the clock starts */
+        worker->isValid = 1;
+    }
+    worker->isReady = 1;
+    wait_for_flag(worker->go);
+    if (!buffer) {
+        return;
+    }
+
+    /* copy moves half of the buffer into the other half, counting both the read & written bytes */
+    half = worker->bytes / 2;
+    worker->startTime = get_time_ns_wrapper();
+    for (pass = 0; pass < MEASURE_BANDWIDTH_PASSES; ++pass) {
+        if (worker->kind == LIBCPUCAPS_BANDWIDTH_READ) {
+            sum += read_kernel((const uint64_t*)buffer, worker->bytes / sizeof(uint64_t));
+            worker->bytesMoved += worker->bytes;
+        } else if (worker->kind == LIBCPUCAPS_BANDWIDTH_WRITE) {
+            memset(buffer, pass, worker->bytes);
+            worker->bytesMoved += worker->bytes;
+        } else {
+            memcpy(buffer + ((pass & 1) ? 0 : half), buffer + ((pass & 1) ? half : 0), half);
+            worker->bytesMoved += half * 2;
+        }
+    }
+    worker->endTime = get_time_ns_wrapper();
+    s_sink = (uintptr_t)sum + (uintptr_t)buffer[worker->bytes - 1];
+
+    free(block);
+}
+
+/* OS numbers of the cpus the process may run on (cpus may be NULL to only count them), returns their count */
+static int get_allowed_cpus(int* cpus, int maxCPUs) {
+    uint64_t* words;
+    int capacity, numWords, cpu, count = 0;
+
+    capacity = get_cpu_capacity_wrapper();
+    numWords = CPU_WORDS(capacity);
+    words = (uint64_t*)calloc((size_t)numWords, sizeof(uint64_t));
+    if (!words) {
+        return 0;
+    }
+
+    if (get_thread_affinity_wrapper(words, numWords)) {
+        for (cpu = 0; cpu < capacity && count < maxCPUs; ++cpu) {
+            if (words[cpu / CPU_WORD_BITS] & CPU_WORD_BIT(cpu)) {
+                if (cpus) {
+                    cpus[count] = cpu;
+                }
+                ++count;
+            }
+        }
+    }
+
+    free(words);
+    return count;
+}
+
+static double measure_bandwidth(const cpucaps_t* caps, int kind, size_t bytesPerThread, int numThreads) {
+    bandwidth_worker_t* workers;
+    size_t* threads;
+    int* cpus;
+    int numCPUs, i, numStarted;
+    volatile uint32_t go = 0;
+    uint64_t firstStart = 0, lastEnd = 0, bytesMoved = 0;
+
+    if (kind < LIBCPUCAPS_BANDWIDTH_READ || kind > LIBCPUCAPS_BANDWIDTH_COPY || numThreads < 0) {
+        return 0.0;
+    }
+
+    cpus = (int*)calloc((size_t)get_cpu_capacity_wrapper(), sizeof(int));
+    if (!cpus) {
+        return 0.0;
+    }
+    numCPUs = get_allowed_cpus(cpus, get_cpu_capacity_wrapper());
+    if (!numCPUs) {
+        free(cpus);
+        return 0.0;
+    }
+    if (!numThreads || numThreads > numCPUs) {
+        numThreads = numCPUs;
+    }
+
+    /* all of the buffers together have to be well beyond the last level cache */
+    if (!bytesPerThread) {
+        bytesPerThread = get_last_level_bytes(caps) * 4 / (size_t)numThreads;
+        if (bytesPerThread < MEASURE_MIN_BANDWIDTH_BYTES) {
+            bytesPerThread = MEASURE_MIN_BANDWIDTH_BYTES;
+        }
+    }
+    bytesPerThread &= ~(size_t)(MEASURE_DEFAULT_LINE_SIZE * 2 - 1);
+    if (!bytesPerThread) {
+        free(cpus);
+        return 0.0;
+    }
+
+    workers = (bandwidth_worker_t*)calloc((size_t)numThreads, sizeof(bandwidth_worker_t));
+    threads = (size_t*)calloc((size_t)numThreads, sizeof(size_t));
+    if (!workers || !threads) {
+        free(workers);
+        free(threads);
+        free(cpus);
+        return 0.0;
+    }
+
+    for (i = 0, numStarted = 0; i < numThreads; ++i) {
+        workers[i].kind = kind;
+        workers[i].bytes = bytesPerThread;
+        workers[i].go = &go;
+        threads[i] = start_thread_wrapper(bandwidth_thread_proc, &workers[i], cpus[i]);
+        numStarted += (threads[i] != 0);
+    }
+
+    for (i = 0; i < numThreads; ++i) {
+        if (threads[i]) {
+            wait_for_flag(&workers[i].isReady);
+        }
+    }
+    go = 1;
+
+    for (i = 0; i < numThreads; ++i) {
+        if (!threads[i]) {
+            continue;
+        }
+        join_thread_wrapper(threads[i]);
+        if (!workers[i].isValid) {
+            continue;
+        }
+
+        if (!firstStart || workers[i].startTime < firstStart) {
+            firstStart = workers[i].startTime;
+        }
+        if (workers[i].endTime > lastEnd) {
+            lastEnd = workers[i].endTime;
+        }
+        bytesMoved += workers[i].bytesMoved;
+    }
+
+    free(workers);
+    free(threads);
+    free(cpus);
+
+    /* the wall time from the first thread starting to the last one finishing, so stragglers count */
+    if (!numStarted || lastEnd <= firstStart) {
+        return 0.0;
+    }
+    return (double)bytesMoved / (double)(lastEnd - firstStart);
+}
+
+double libcpucaps_MeasureBandwidth(int kind, size_t bytesPerThread, int numThreads) {
+    return measure_bandwidth(libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES), kind, bytesPerThread, numThreads);
+}
+
+
+/* walks one plateau of the curve starting at *start, returns the point before the steepest step of the following */
+/* rise or -1 if the curve never rises, *start is moved past the rise to where the next plateau begins */
+static int find_knee(const cpucaps_measurements_t* measurements, int* start) {
+    const cpucaps_latency_point_t* points = measurements->latency;
+    int i, rise, knee, n = measurements->numLatencyPoints;
+    double plateau, step, steepest;
+
+    plateau = (*start < n) ? points[*start].nanosecondsPerLoad : 0.0;
+    for (rise = *start; rise + 2 < n; ++rise) {
+        if (points[rise + 1].nanosecondsPerLoad > plateau * KNEE_RISE_RATIO &&
+            points[rise + 2].nanosecondsPerLoad > plateau * KNEE_RISE_RATIO) {
+            break;
+        }
+        if (points[rise + 1].nanosecondsPerLoad < plateau) {
+            plateau = points[rise + 1].nanosecondsPerLoad;
+        }
+    }
+    if (rise + 2 >= n) {
+        return -1;
+    }
+
+    for (i = rise + 1; i + 2 < n; ++i) {
+        if (points[i + 1].nanosecondsPerLoad <= points[i].nanosecondsPerLoad * KNEE_SETTLE_RATIO &&
+            points[i + 2].nanosecondsPerLoad <= points[i + 1].nanosecondsPerLoad * KNEE_SETTLE_RATIO) {
+            break;
+        }
+    }
+    *start = i;
+
+    /* replacement & prefetch effects round the rise off, the steepest step is where the level really runs out */
+    for (knee = rise, steepest = 0.0; rise < i; ++rise) {
+        step = points[rise + 1].nanosecondsPerLoad / points[rise].nanosecondsPerLoad;
+        if (step > steepest) {
+            steepest = step;
+            knee = rise;
+        }
+    }
+
+    return knee;
+}
+
+int libcpucaps_Measure(const cpucaps_t* caps, int flags, cpucaps_measurements_t* measurements) {
+    size_t maxBytes, bytes;
+    int i, start, knee, lineSize, level;
+    int* effectiveSizes[3];
+
+    if (!measurements || !(flags & LIBCPUCAPS_MEASURE_ALL)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(measurements, 0, sizeof(cpucaps_measurements_t));
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES);
+    }
+
+    if (flags & LIBCPUCAPS_MEASURE_LATENCY) {
+        /* sweep up to 4x the biggest cache the cpu reports, so the last plateau is main memory */
+        maxBytes = get_last_level_bytes(caps) * 4;
+        if (maxBytes < MEASURE_DEFAULT_MAX_WORKING_SET) {
+            maxBytes = MEASURE_DEFAULT_MAX_WORKING_SET;
+        } else if (maxBytes > LIBCPUCAPS_MEASURE_MAX_WORKING_SET) {
+            maxBytes = LIBCPUCAPS_MEASURE_MAX_WORKING_SET;
+        }
+
+        /* 4 steps per octave (1, 1.25, 1.5, 1.75 x a power of two), all line-aligned */
+        lineSize = get_line_size(caps);
+        for (i = 0; i < LIBCPUCAPS_MEASURE_MAX_POINTS; ++i) {
+            bytes = LIBCPUCAPS_MEASURE_MIN_WORKING_SET << (i / LIBCPUCAPS_MEASURE_POINTS_PER_OCTAVE);
+            bytes += (bytes / LIBCPUCAPS_MEASURE_POINTS_PER_OCTAVE) * (size_t)(i % LIBCPUCAPS_MEASURE_POINTS_PER_OCTAVE);
+            bytes -= bytes % (size_t)lineSize;
+            if (bytes > maxBytes) {
+                break;
+            }
+
+            measurements->latency[i].workingSetBytes = bytes;
+            measurements->latency[i].nanosecondsPerLoad = measure_latency(bytes, lineSize);
+            if (measurements->latency[i].nanosecondsPerLoad <= 0.0) {
+                break;
+            }
+            ++measurements->numLatencyPoints;
+        }
+
+        effectiveSizes[0] = &measurements->L1d_effectiveSizeKibiBytes;
+        effectiveSizes[1] = &measurements->L2_effectiveSizeKibiBytes;
+        effectiveSizes[2] = &measurements->L3_effectiveSizeKibiBytes;
+        for (level = 0, start = 0; level < 3; ++level) {
+            /* no L3 reported means the last knee is main memory, don't call it an L3 */
+            if (level == 2 && !caps->L3_sizeKibiBytes) {
+                break;
+            }
+            knee = find_knee(measurements, &start);
+            if (knee < 0) {
+                break;
+            }
+            *effectiveSizes[level] = (int)(measurements->latency[knee].workingSetBytes / 1024);
+        }
+    }
+
+    if (flags & LIBCPUCAPS_MEASURE_BANDWIDTH) {
+        measurements->readGBps = measure_bandwidth(caps, LIBCPUCAPS_BANDWIDTH_READ, 0, 1);
+        measurements->writeGBps = measure_bandwidth(caps, LIBCPUCAPS_BANDWIDTH_WRITE, 0, 1);
+        measurements->copyGBps = measure_bandwidth(caps, LIBCPUCAPS_BANDWIDTH_COPY, 0, 1);
+
+        if (flags & LIBCPUCAPS_MEASURE_ALL_CORES) {
+            measurements->numThreads = get_allowed_cpus(NULL, get_cpu_capacity_wrapper());
+            measurements->allCoresReadGBps = measure_bandwidth(caps, LIBCPUCAPS_BANDWIDTH_READ, 0, 0);
+            measurements->allCoresWriteGBps = measure_bandwidth(caps, LIBCPUCAPS_BANDWIDTH_WRITE, 0, 0);
+            measurements->allCoresCopyGBps = measure_bandwidth(caps, LIBCPUCAPS_BANDWIDTH_COPY, 0, 0);
+        }
+    }
+
+    return LIBCPUCAPS_ERROR_OK;
+}
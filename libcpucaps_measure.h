@@ -0,0 +1,71 @@
+#ifndef LIBCPUCAPS_MEASURE_H_HEADER
+#define LIBCPUCAPS_MEASURE_H_HEADER
+
+/* optional measurement module: what the caches & memory actually deliver to this process */
+/* (CAT partitioning, VMs and slice-hashed L3s often differ from what CPUID reports) */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+
+/* the latency sweep: 4 working sets per octave from 4 KiB to 1 GiB, both ends included */
+#define LIBCPUCAPS_MEASURE_MIN_WORKING_SET      ((size_t)4 * 1024)
+#define LIBCPUCAPS_MEASURE_NUM_OCTAVES          18
+#define LIBCPUCAPS_MEASURE_MAX_WORKING_SET      (LIBCPUCAPS_MEASURE_MIN_WORKING_SET << LIBCPUCAPS_MEASURE_NUM_OCTAVES)
+#define LIBCPUCAPS_MEASURE_POINTS_PER_OCTAVE    4
+#define LIBCPUCAPS_MEASURE_MAX_POINTS           (LIBCPUCAPS_MEASURE_NUM_OCTAVES * LIBCPUCAPS_MEASURE_POINTS_PER_OCTAVE + 1)
+
+/* bandwidth kernels */
+#define LIBCPUCAPS_BANDWIDTH_READ       0
+#define LIBCPUCAPS_BANDWIDTH_WRITE      1
+#define LIBCPUCAPS_BANDWIDTH_COPY       2
+
+/* what libcpucaps_Measure runs */
+#define LIBCPUCAPS_MEASURE_LATENCY      0x1
+#define LIBCPUCAPS_MEASURE_BANDWIDTH    0x2
+#define LIBCPUCAPS_MEASURE_ALL_CORES    0x4     /* bandwidth on all allowed cpus as well */
+#define LIBCPUCAPS_MEASURE_ALL          0x7
+
+typedef struct _s_cpucaps_latency_point {
+    size_t  workingSetBytes;
+    double  nanosecondsPerLoad;
+} cpucaps_latency_point_t;
+
+typedef struct _s_cpucaps_measurements {
+    /* randomized pointer-chase latency curve */
+    int                      numLatencyPoints;
+    cpucaps_latency_point_t  latency[LIBCPUCAPS_MEASURE_MAX_POINTS];
+
+    /* knee points of the latency curve, 0 if not detected */
+    int     L1d_effectiveSizeKibiBytes;
+    int     L2_effectiveSizeKibiBytes;
+    int     L3_effectiveSizeKibiBytes;
+
+    /* streaming bandwidth in GB/s (1e9 bytes per second), copy counts bytes read + written */
+    double  readGBps;
+    double  writeGBps;
+    double  copyGBps;
+    int     numThreads;                 /* threads used for the all-cores numbers */
+    double  allCoresReadGBps;
+    double  allCoresWriteGBps;
+    double  allCoresCopyGBps;
+} cpucaps_measurements_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* average latency of a dependent load over a randomly linked working set, returns <= 0 on failure */
+double libcpucaps_MeasureLatency(size_t workingSetBytes);
+/* streaming bandwidth (LIBCPUCAPS_BANDWIDTH_xxx) with numThreads pinned threads (0 = all allowed cpus) */
+/* bytesPerThread == 0 picks a buffer well beyond the last level cache, returns GB/s or <= 0 on failure */
+double libcpucaps_MeasureBandwidth(int kind, size_t bytesPerThread, int numThreads);
+
+/* runs the measurements selected by flags (LIBCPUCAPS_MEASURE_xxx), caps provide the sizes to sweep */
+/* pass NULL caps to use the cached ones, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_Measure(const cpucaps_t* caps, int flags, cpucaps_measurements_t* measurements);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_MEASURE_H_HEADER */
@@ -0,0 +1,462 @@
+#include "libcpucaps.h"
+#include "libcpucaps_memory.h"
+#include "libcpucaps_internal.h"
+#include <stdint.h>    /* SIZE_MAX */
+#include <stdlib.h>    /* getenv, strtoull, malloc */
+#include <string.h>    /* memcpy, memset */
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MEMORY_TARGET(isa)              __attribute__((target(isa)))
+#else
+#define MEMORY_TARGET(isa)
+#endif
+
+#define MEMORY_UNROLL                   4
+#define MEMORY_NONTEMPORAL_ALIGNMENT    64      /* one cache line, so every streaming store fills whole lines */
+#define MEMORY_MIN_NONTEMPORAL          (256 * 1024)
+#define MEMORY_DEFAULT_L3_SIZE          (8 * 1024 * 1024)
+/* glibc's heuristics: rep movsb's startup cost pays off after 2 KiB per 16 bytes of vector width, */
+/* much sooner with fast short rep movsb */
+#define MEMORY_REP_BYTES_PER_VECTOR_BYTE    128
+#define MEMORY_FSRM_REP_THRESHOLD           2112
+
+typedef void (*copy_func_t)(char* dst, const char* src, size_t size);
+typedef void (*set_func_t)(char* dst, int value, size_t size);
+
+/* below 64 bytes: two overlapping moves of the largest size that fits */
+static void copy_small(char* dst, const char* src, size_t size) {
+    if (size >= 32) {
+        memcpy(dst, src, 32);
+        memcpy(dst + size - 32, src + size - 32, 32);
+    } else if (size >= 16) {
+        memcpy(dst, src, 16);
+        memcpy(dst + size - 16, src + size - 16, 16);
+    } else if (size >= 8) {
+        memcpy(dst, src, 8);
+        memcpy(dst + size - 8, src + size - 8, 8);
+    } else if (size >= 4) {
+        memcpy(dst, src, 4);
+        memcpy(dst + size - 4, src + size - 4, 4);
+    } else if (size) {
+        dst[0] = src[0];
+        dst[size / 2] = src[size / 2];
+        dst[size - 1] = src[size - 1];
+    }
+}
+
+static void set_small(char* dst, int value, size_t size) {
+    uint64_t pattern = (uint64_t)(unsigned char)value * 0x0101010101010101ull;
+    size_t i;
+
+    if (size >= 8) {
+        for (i = 0; i + 8 < size; i += 8) {
+            memcpy(dst + i, &pattern, 8);
+        }
+        memcpy(dst + size - 8, &pattern, 8);
+    } else if (size >= 4) {
+        memcpy(dst, &pattern, 4);
+        memcpy(dst + size - 4, &pattern, 4);
+    } else if (size) {
+        dst[0] = dst[size / 2] = dst[size - 1] = (char)value;
+    }
+}
+
+/* unaligned loops unrolled 4x, the last vector is loaded up front and stored at the very end (overlapping) */
+#define DEFINE_COPY_LOOP(name, isa, vector_t, load, store)                                          \
+    static MEMORY_TARGET(isa) void name(char* dst, const char* src, size_t size) {                  \
+        vector_t a, b, c, d, tail;                                                                  \
+        char* end = dst + size;                                                                     \
+        if (size < sizeof(vector_t)) {                                                              \
+            copy_small(dst, src, size);                                                             \
+            return;                                                                                 \
+        }                                                                                           \
+        tail = load((const vector_t*)(src + size - sizeof(vector_t)));                              \
+        for (; size > MEMORY_UNROLL * sizeof(vector_t); size -= MEMORY_UNROLL * sizeof(vector_t)) { \
+            a = load((const vector_t*)src);                                                         \
+            b = load((const vector_t*)src + 1);                                                     \
+            c = load((const vector_t*)src + 2);                                                     \
+            d = load((const vector_t*)src + 3);                                                     \
+            store((vector_t*)dst, a);                                                               \
+            store((vector_t*)dst + 1, b);                                                           \
+            store((vector_t*)dst + 2, c);                                                           \
+            store((vector_t*)dst + 3, d);                                                           \
+            src += MEMORY_UNROLL * sizeof(vector_t);                                                \
+            dst += MEMORY_UNROLL * sizeof(vector_t);                                                \
+        }                                                                                           \
+        for (; size > sizeof(vector_t); size -= sizeof(vector_t)) {                                 \
+            store((vector_t*)dst, load((const vector_t*)src));                                      \
+            src += sizeof(vector_t);                                                                \
+            dst += sizeof(vector_t);                                                                \
+        }                                                                                           \
+        store((vector_t*)(end - sizeof(vector_t)), tail);                                           \
+    }
+
+#define DEFINE_SET_LOOP(name, isa, vector_t, broadcast, store)                                      \
+    static MEMORY_TARGET(isa) void name(char* dst, int value, size_t size) {                        \
+        vector_t v;                                                                                 \
+        char* end = dst + size;                                                                     \
+        if (size < sizeof(vector_t)) {                                                              \
+            set_small(dst, value, size);                                                            \
+            return;                                                                                 \
+        }                                                                                           \
+        v = broadcast(value);                                                                       \
+        for (; size > MEMORY_UNROLL * sizeof(vector_t); size -= MEMORY_UNROLL * sizeof(vector_t)) { \
+            store((vector_t*)dst, v);                                                               \
+            store((vector_t*)dst + 1, v);                                                           \
+            store((vector_t*)dst + 2, v);                                                           \
+            store((vector_t*)dst + 3, v);                                                           \
+            dst += MEMORY_UNROLL * sizeof(vector_t);                                                \
+        }                                                                                           \
+        for (; size > sizeof(vector_t); size -= sizeof(vector_t)) {                                 \
+            store((vector_t*)dst, v);                                                               \
+            dst += sizeof(vector_t);                                                                \
+        }                                                                                           \
+        store((vector_t*)(end - sizeof(vector_t)), v);                                              \
+    }
+
+/* the destination is aligned to a cache line with a normal head copy, then whole lines are streamed */
+/* the streaming stores are weakly ordered, the sfence makes them visible before the function returns */
+#define DEFINE_NONTEMPORAL_COPY(name, isa, vector_t, load, stream, smallCopy)                       \
+    static MEMORY_TARGET(isa) void name(char* dst, const char* src, size_t size) {                  \
+        size_t head = (size_t)(-(intptr_t)dst) & (MEMORY_NONTEMPORAL_ALIGNMENT - 1);                \
+        size_t i;                                                                                   \
+        if (size < head + MEMORY_NONTEMPORAL_ALIGNMENT) {                                           \
+            smallCopy(dst, src, size);                                                              \
+            return;                                                                                 \
+        }                                                                                           \
+        copy_small(dst, src, head);                                                                 \
+        dst += head;                                                                                \
+        src += head;                                                                                \
+        size -= head;                                                                               \
+        for (; size >= MEMORY_NONTEMPORAL_ALIGNMENT; size -= MEMORY_NONTEMPORAL_ALIGNMENT) {        \
+            for (i = 0; i < MEMORY_NONTEMPORAL_ALIGNMENT; i += sizeof(vector_t)) {                  \
+                stream((vector_t*)(dst + i), load((const vector_t*)(src + i)));                     \
+            }                                                                                       \
+            src += MEMORY_NONTEMPORAL_ALIGNMENT;                                                    \
+            dst += MEMORY_NONTEMPORAL_ALIGNMENT;                                                    \
+        }                                                                                           \
+        _mm_sfence();                                                                               \
+        copy_small(dst, src, size);                                                                 \
+    }
+
+#define DEFINE_NONTEMPORAL_SET(name, isa, vector_t, broadcast, stream, smallSet)                    \
+    static MEMORY_TARGET(isa) void name(char* dst, int value, size_t size) {                        \
+        size_t head = (size_t)(-(intptr_t)dst) & (MEMORY_NONTEMPORAL_ALIGNMENT - 1);                \
+        vector_t v;                                                                                 \
+        size_t i;                                                                                   \
+        if (size < head + MEMORY_NONTEMPORAL_ALIGNMENT) {                                           \
+            smallSet(dst, value, size);                                                             \
+            return;                                                                                 \
+        }                                                                                           \
+        v = broadcast(value);                                                                       \
+        set_small(dst, value, head);                                                                \
+        dst += head;                                                                                \
+        size -= head;                                                                               \
+        for (; size >= MEMORY_NONTEMPORAL_ALIGNMENT; size -= MEMORY_NONTEMPORAL_ALIGNMENT) {        \
+            for (i = 0; i < MEMORY_NONTEMPORAL_ALIGNMENT; i += sizeof(vector_t)) {                  \
+                stream((vector_t*)(dst + i), v);                                                    \
+            }                                                                                       \
+            dst += MEMORY_NONTEMPORAL_ALIGNMENT;                                                    \
+        }                                                                                           \
+        _mm_sfence();                                                                               \
+        set_small(dst, value, size);                                                                \
+    }
+
+#define BROADCAST_128(value)    _mm_set1_epi8((char)(value))
+#define BROADCAST_256(value)    _mm256_set1_epi8((char)(value))
+#define BROADCAST_512(value)    _mm512_set1_epi32((int)((unsigned char)(value) * 0x01010101u))
+#define LOAD_512(p)             _mm512_loadu_si512((const void*)(p))
+#define STORE_512(p, v)         _mm512_storeu_si512((void*)(p), (v))
+#define STREAM_512(p, v)        _mm512_stream_si512((void*)(p), (v))
+
+DEFINE_COPY_LOOP(copy_sse2, "sse2", __m128i, _mm_loadu_si128, _mm_storeu_si128)
+DEFINE_COPY_LOOP(copy_avx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_storeu_si256)
+DEFINE_COPY_LOOP(copy_avx512, "avx512f", __m512i, LOAD_512, STORE_512)
+DEFINE_SET_LOOP(set_sse2, "sse2", __m128i, BROADCAST_128, _mm_storeu_si128)
+DEFINE_SET_LOOP(set_avx2, "avx2", __m256i, BROADCAST_256, _mm256_storeu_si256)
+DEFINE_SET_LOOP(set_avx512, "avx512f", __m512i, BROADCAST_512, STORE_512)
+
+DEFINE_NONTEMPORAL_COPY(copy_nontemporal_sse2, "sse2", __m128i, _mm_loadu_si128, _mm_stream_si128, copy_sse2)
+DEFINE_NONTEMPORAL_COPY(copy_nontemporal_avx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_stream_si256, copy_avx2)
+DEFINE_NONTEMPORAL_COPY(copy_nontemporal_avx512, "avx512f", __m512i, LOAD_512, STREAM_512, copy_avx512)
+DEFINE_NONTEMPORAL_SET(set_nontemporal_sse2, "sse2", __m128i, BROADCAST_128, _mm_stream_si128, set_sse2)
+DEFINE_NONTEMPORAL_SET(set_nontemporal_avx2, "avx2", __m256i, BROADCAST_256, _mm256_stream_si256, set_avx2)
+DEFINE_NONTEMPORAL_SET(set_nontemporal_avx512, "avx512f", __m512i, BROADCAST_512, STREAM_512, set_avx512)
+
+static void copy_rep(char* dst, const char* src, size_t size) {
+#ifdef _MSC_VER
+    __movsb((unsigned char*)dst, (const unsigned char*)src, size);
+#else
+    __asm__ __volatile__("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) : : "memory");
+#endif
+}
+
+static void set_rep(char* dst, int value, size_t size) {
+#ifdef _MSC_VER
+    __stosb((unsigned char*)dst, (unsigned char)value, size);
+#else
+    __asm__ __volatile__("rep stosb" : "+D"(dst), "+c"(size) : "a"(value) : "memory");
+#endif
+}
+
+/* vector widths from the best to the baseline one, a strategy's index is LIBCPUCAPS_MEMORY_AVX512 - strategy */
+#define LOOP_INDEX(strategy)    (LIBCPUCAPS_MEMORY_AVX512 - (strategy))
+
+static const cpucaps_impl_t s_copyLoops[] = {
+    { "avx512", (libcpucaps_func_t)copy_avx512, { libcpucaps_HasAVX512F } },
+    { "avx2",   (libcpucaps_func_t)copy_avx2,   { libcpucaps_HasAVX2 } },
+    { "sse2",   (libcpucaps_func_t)copy_sse2,   { libcpucaps_HasSSE2 } }
+};
+static const cpucaps_impl_t s_setLoops[] = {
+    { "avx512", (libcpucaps_func_t)set_avx512,  { libcpucaps_HasAVX512F } },
+    { "avx2",   (libcpucaps_func_t)set_avx2,    { libcpucaps_HasAVX2 } },
+    { "sse2",   (libcpucaps_func_t)set_sse2,    { libcpucaps_HasSSE2 } }
+};
+static const cpucaps_impl_t s_copyNonTemporals[] = {
+    { "avx512", (libcpucaps_func_t)copy_nontemporal_avx512, { libcpucaps_HasAVX512F } },
+    { "avx2",   (libcpucaps_func_t)copy_nontemporal_avx2,   { libcpucaps_HasAVX2 } },
+    { "sse2",   (libcpucaps_func_t)copy_nontemporal_sse2,   { libcpucaps_HasSSE2 } }
+};
+static const cpucaps_impl_t s_setNonTemporals[] = {
+    { "avx512", (libcpucaps_func_t)set_nontemporal_avx512,  { libcpucaps_HasAVX512F } },
+    { "avx2",   (libcpucaps_func_t)set_nontemporal_avx2,    { libcpucaps_HasAVX2 } },
+    { "sse2",   (libcpucaps_func_t)set_nontemporal_sse2,    { libcpucaps_HasSSE2 } }
+};
+
+/* a config with the functions of its vector strategy, never changed once it's published, so a call sees */
+/* either the old or the new one as a whole. Replaced ones are kept as a call may still be using them */
+typedef struct _s_memory_state {
+    cpucaps_memory_config_t   config;
+    copy_func_t               copyLoop;
+    set_func_t                setLoop;
+    copy_func_t               copyNonTemporal;
+    set_func_t                setNonTemporal;
+    struct _s_memory_state*   replaced;
+} memory_state_t;
+
+/* SSE2 without rep or streaming stores, in case a state can't be allocated */
+static const memory_state_t s_baselineState = {
+    { LIBCPUCAPS_MEMORY_SSE2, SIZE_MAX, SIZE_MAX }, copy_sse2, set_sse2, copy_nontemporal_sse2, set_nontemporal_sse2, NULL
+};
+
+static void* volatile s_memoryState = NULL;         /* memory_state_t, stored with release once it's filled in */
+static volatile int32_t s_memoryStateLock = 0;      /* held while a thread replaces it */
+
+static void override_threshold(const char* name, size_t* threshold) {
+    const char* value = getenv(name);
+    char* end;
+    unsigned long long parsed;
+
+    if (!value || !*value) {
+        return;
+    }
+    parsed = strtoull(value, &end, 0);
+    if (end != value && !*end) {
+        *threshold = (size_t)parsed;
+    }
+}
+
+int libcpucaps_GetMemoryConfig(const cpucaps_t* caps, cpucaps_memory_config_t* config) {
+    size_t L3Bytes, L2Bytes, vectorBytes;
+    int numSharing, i;
+
+    if (!config) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES | LIBCPUCAPS_DETECT_TOPOLOGY);
+    }
+
+    config->vectorStrategy = LIBCPUCAPS_MEMORY_SSE2;
+    for (i = 0; i < (int)(sizeof(s_copyLoops) / sizeof(s_copyLoops[0])); ++i) {
+        if (libcpucaps_IsImplSupported(&s_copyLoops[i], caps)) {
+            config->vectorStrategy = LIBCPUCAPS_MEMORY_AVX512 - i;
+            break;
+        }
+    }
+    vectorBytes = (size_t)16 << (config->vectorStrategy - LIBCPUCAPS_MEMORY_SSE2);
+
+    if (libcpucaps_HasFSRM(caps)) {
+        config->repThreshold = MEMORY_FSRM_REP_THRESHOLD;
+    } else if (libcpucaps_HasERMS(caps)) {
+        config->repThreshold = vectorBytes * MEMORY_REP_BYTES_PER_VECTOR_BYTE;
+    } else {
+        config->repThreshold = SIZE_MAX;
+    }
+
+    /* past 3/4 of a cpu's share of its L3 instance a copy mostly evicts what the other cpus cache, */
+    /* and the destination lines wouldn't survive until they're read anyway */
+    L3Bytes = caps->L3_sizeKibiBytes ? (size_t)caps->L3_sizeKibiBytes * 1024 : MEMORY_DEFAULT_L3_SIZE;
+    L2Bytes = (size_t)caps->L2_sizeKibiBytes * 1024;
+    numSharing = (caps->L3_numSharingCPUs > 0) ? caps->L3_numSharingCPUs : caps->numLogicalCores;
+    config->nonTemporalThreshold = L3Bytes / ((numSharing > 0) ? numSharing : 1) / 4 * 3;
+    if (config->nonTemporalThreshold < L2Bytes) {
+        config->nonTemporalThreshold = L2Bytes;
+    }
+    if (config->nonTemporalThreshold < MEMORY_MIN_NONTEMPORAL) {
+        config->nonTemporalThreshold = MEMORY_MIN_NONTEMPORAL;
+    }
+
+    override_threshold(LIBCPUCAPS_MEMORY_REP_THRESHOLD_ENV, &config->repThreshold);
+    override_threshold(LIBCPUCAPS_MEMORY_NONTEMPORAL_THRESHOLD_ENV, &config->nonTemporalThreshold);
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+/* isDefault only applies the config if none is set yet, so a lazy first call can't undo libcpucaps_SetMemoryConfig */
+static int set_config(const cpucaps_memory_config_t* config, int isDefault) {
+    const cpucaps_t* caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    cpucaps_memory_config_t tuned;
+    memory_state_t* state;
+    int index;
+
+    /* the tuned thresholds need the L3 size & its sharing, not just the features */
+    if (!config) {
+        libcpucaps_GetMemoryConfig(NULL, &tuned);
+        config = &tuned;
+    }
+    if (config->vectorStrategy < LIBCPUCAPS_MEMORY_SSE2 || config->vectorStrategy > LIBCPUCAPS_MEMORY_AVX512 ||
+        !libcpucaps_IsMemoryStrategySupported(caps, config->vectorStrategy)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+
+    /* the streaming stores use the same vectors as the loops, a forced strategy applies to both */
+    state = (memory_state_t*)malloc(sizeof(memory_state_t));
+    if (!state) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    index = LOOP_INDEX(config->vectorStrategy);
+    state->config = *config;
+    state->copyLoop = (copy_func_t)s_copyLoops[index].func;
+    state->setLoop = (set_func_t)s_setLoops[index].func;
+    state->copyNonTemporal = (copy_func_t)s_copyNonTemporals[index].func;
+    state->setNonTemporal = (set_func_t)s_setNonTemporals[index].func;
+
+    while (!atomic_compare_exchange_wrapper(&s_memoryStateLock, 0, 1)) {
+        thread_yield_wrapper();
+    }
+    state->replaced = (memory_state_t*)atomic_load_pointer_acquire_wrapper(&s_memoryState);
+    if (!isDefault || !state->replaced) {
+        atomic_store_pointer_release_wrapper(&s_memoryState, state);
+        state = NULL;
+    }
+    atomic_store_release_wrapper(&s_memoryStateLock, 0);
+
+    /* another thread applied the default first */
+    free(state);
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+/* the acquire pairs with set_config's release, the state is seen filled in */
+static const memory_state_t* get_state(void) {
+    const memory_state_t* state = (const memory_state_t*)atomic_load_pointer_acquire_wrapper(&s_memoryState);
+
+    if (!state) {
+        set_config(NULL, 1);
+        state = (const memory_state_t*)atomic_load_pointer_acquire_wrapper(&s_memoryState);
+    }
+    return state ? state : &s_baselineState;
+}
+
+int libcpucaps_SetMemoryConfig(const cpucaps_memory_config_t* config) {
+    return set_config(config, 0);
+}
+
+void libcpucaps_GetCurrentMemoryConfig(cpucaps_memory_config_t* config) {
+    *config = get_state()->config;
+}
+
+int libcpucaps_IsMemoryStrategySupported(const cpucaps_t* caps, int strategy) {
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    }
+
+    switch (strategy) {
+    case LIBCPUCAPS_MEMORY_AUTO:
+    case LIBCPUCAPS_MEMORY_LIBC:
+        return 1;
+    case LIBCPUCAPS_MEMORY_REP:
+        return libcpucaps_HasERMS(caps);
+    case LIBCPUCAPS_MEMORY_SSE2:
+    case LIBCPUCAPS_MEMORY_AVX2:
+    case LIBCPUCAPS_MEMORY_AVX512:
+        return libcpucaps_IsImplSupported(&s_copyLoops[LOOP_INDEX(strategy)], caps);
+    case LIBCPUCAPS_MEMORY_NONTEMPORAL:
+        return libcpucaps_HasSSE2(caps);
+    default:
+        return 0;
+    }
+}
+
+void* libcpucaps_Memcpy(void* dst, const void* src, size_t size) {
+    const memory_state_t* state = get_state();
+
+    if (size >= state->config.nonTemporalThreshold) {
+        state->copyNonTemporal((char*)dst, (const char*)src, size);
+    } else if (size >= state->config.repThreshold) {
+        copy_rep((char*)dst, (const char*)src, size);
+    } else {
+        state->copyLoop((char*)dst, (const char*)src, size);
+    }
+
+    return dst;
+}
+
+void* libcpucaps_Memset(void* dst, int value, size_t size) {
+    const memory_state_t* state = get_state();
+
+    if (size >= state->config.nonTemporalThreshold) {
+        state->setNonTemporal((char*)dst, value, size);
+    } else if (size >= state->config.repThreshold) {
+        set_rep((char*)dst, value, size);
+    } else {
+        state->setLoop((char*)dst, value, size);
+    }
+
+    return dst;
+}
+
+void* libcpucaps_MemcpyStrategy(int strategy, void* dst, const void* src, size_t size) {
+    switch (strategy) {
+    case LIBCPUCAPS_MEMORY_AUTO:
+        return libcpucaps_Memcpy(dst, src, size);
+    case LIBCPUCAPS_MEMORY_LIBC:
+        return memcpy(dst, src, size);
+    case LIBCPUCAPS_MEMORY_REP:
+        copy_rep((char*)dst, (const char*)src, size);
+        return dst;
+    case LIBCPUCAPS_MEMORY_SSE2:
+    case LIBCPUCAPS_MEMORY_AVX2:
+    case LIBCPUCAPS_MEMORY_AVX512:
+        ((copy_func_t)s_copyLoops[LOOP_INDEX(strategy)].func)((char*)dst, (const char*)src, size);
+        return dst;
+    case LIBCPUCAPS_MEMORY_NONTEMPORAL:
+        get_state()->copyNonTemporal((char*)dst, (const char*)src, size);
+        return dst;
+    default:
+        return NULL;
+    }
+}
+
+void* libcpucaps_MemsetStrategy(int strategy, void* dst, int value, size_t size) {
+    switch (strategy) {
+    case LIBCPUCAPS_MEMORY_AUTO:
+        return libcpucaps_Memset(dst, value, size);
+    case LIBCPUCAPS_MEMORY_LIBC:
+        return memset(dst, value, size);
+    case LIBCPUCAPS_MEMORY_REP:
+        set_rep((char*)dst, value, size);
+        return dst;
+    case LIBCPUCAPS_MEMORY_SSE2:
+    case LIBCPUCAPS_MEMORY_AVX2:
+    case LIBCPUCAPS_MEMORY_AVX512:
+        ((set_func_t)s_setLoops[LOOP_INDEX(strategy)].func)((char*)dst, value, size);
+        return dst;
+    case LIBCPUCAPS_MEMORY_NONTEMPORAL:
+        get_state()->setNonTemporal((char*)dst, value, size);
+        return dst;
+    default:
+        return NULL;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LIBCPUCAPS_MEMORY_H_HEADER
+#define LIBCPUCAPS_MEMORY_H_HEADER
+
+/* optional memory routines module: memcpy & memset picking the strategy by size from the detected caps */
+/* small sizes use the widest vector loop, then rep movsb/stosb (ERMS), then non-temporal stores */
+/* past the point where a copy would only evict everybody else's data from the L3 */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+
+/* strategies, LIBCPUCAPS_MEMORY_AUTO is the size based mix of the others */
+#define LIBCPUCAPS_MEMORY_AUTO              0
+#define LIBCPUCAPS_MEMORY_LIBC              1   /* memcpy / memset of the C library */
+#define LIBCPUCAPS_MEMORY_REP               2   /* rep movsb / rep stosb, needs ERMS */
+#define LIBCPUCAPS_MEMORY_SSE2              3   /* unrolled vector loops */
+#define LIBCPUCAPS_MEMORY_AVX2              4
+#define LIBCPUCAPS_MEMORY_AVX512            5
+#define LIBCPUCAPS_MEMORY_NONTEMPORAL       6   /* streaming stores with the config's vectors, bypasses the caches */
+#define LIBCPUCAPS_MEMORY_NUM_STRATEGIES    7
+
+/* environment variables overriding the tuned thresholds (in bytes) */
+#define LIBCPUCAPS_MEMORY_REP_THRESHOLD_ENV         "LIBCPUCAPS_REP_THRESHOLD"
+#define LIBCPUCAPS_MEMORY_NONTEMPORAL_THRESHOLD_ENV "LIBCPUCAPS_NONTEMPORAL_THRESHOLD"
+
+typedef struct _s_cpucaps_memory_config {
+    int     vectorStrategy;         /* LIBCPUCAPS_MEMORY_SSE2 / AVX2 / AVX512, for the loops & the streaming stores */
+    size_t  repThreshold;           /* sizes from here on use rep movsb/stosb, SIZE_MAX without ERMS */
+    size_t  nonTemporalThreshold;   /* sizes from here on use non-temporal stores */
+} cpucaps_memory_config_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* tuned config for the caps (the environment overrides included), pass NULL caps to use the cached ones */
+/* the non-temporal threshold is 3/4 of a logical cpu's share of its L3 instance, at least the L2 size */
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_GetMemoryConfig(const cpucaps_t* caps, cpucaps_memory_config_t* config);
+/* makes libcpucaps_Memcpy & libcpucaps_Memset use the config, NULL restores the tuned one */
+/* affects calls that start afterwards, a call sees either the old or the new config as a whole */
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_SetMemoryConfig(const cpucaps_memory_config_t* config);
+/* config currently in use */
+void libcpucaps_GetCurrentMemoryConfig(cpucaps_memory_config_t* config);
+
+/* returns 1 if the cpu can run the strategy (LIBCPUCAPS_MEMORY_xxx), pass NULL caps to use the cached ones */
+int libcpucaps_IsMemoryStrategySupported(const cpucaps_t* caps, int strategy);
+
+/* like memcpy (the buffers must not overlap) & memset, the first call applies the tuned config if none is set */
+void* libcpucaps_Memcpy(void* dst, const void* src, size_t size);
+void* libcpucaps_Memset(void* dst, int value, size_t size);
+/* one strategy for every size (e.g. for benchmarks), the strategy has to be supported */
+void* libcpucaps_MemcpyStrategy(int strategy, void* dst, const void* src, size_t size);
+void* libcpucaps_MemsetStrategy(int strategy, void* dst, int value, size_t size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_MEMORY_H_HEADER */
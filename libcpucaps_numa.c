@@ -0,0 +1,206 @@
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+#include <stdio.h>
+#include <stdlib.h>    /* calloc, free, strtol, strtoull */
+#include <string.h>    /* strlen, strstr */
+
+#define NUMA_DEFAULT_SYSFS_ROOT     "/sys"
+#define NUMA_MAX_PATH               1024
+#define NUMA_FILE_BUFFER_SIZE       16384
+#define NUMA_MAX_NODES              1024
+
+/* "Node 0 MemTotal:       16384 kB" */
+static uint64_t parse_meminfo_bytes(const char* meminfo, const char* key) {
+    const char* p = strstr(meminfo, key);
+
+    if (!p) {
+        return 0;
+    }
+    p += strlen(key);
+    return (uint64_t)strtoull(p, NULL, 10) * 1024;
+}
+
+static void fill_packages(cpucaps_numa_t* numa, const cpucaps_topology_t* topology) {
+    cpucaps_numa_node_t* node;
+    const cpucaps_cpu_t* cpu;
+    int i, n;
+
+    numa->isConsistent = 1;
+    for (n = 0; n < numa->numNodes; ++n) {
+        node = &numa->nodes[n];
+        node->packageID = -1;
+
+        for (i = 0; topology && i < topology->numCPUs; ++i) {
+            cpu = &topology->cpus[i];
+            if (!libcpucaps_CpuSetHas(&node->cpus, cpu->cpuIndex)) {
+                continue;
+            }
+
+            if (node->packageID == -1) {
+                node->packageID = (int)cpu->packageID;
+            } else if (node->packageID != (int)cpu->packageID) {
+                /* a node can't span packages (sub-NUMA clustering splits them, never joins them) */
+                node->packageID = -2;
+                numa->isConsistent = 0;
+                break;
+            }
+        }
+    }
+}
+
+static cpucaps_numa_t* allocate_numa(int numNodes, int numWords) {
+    cpucaps_numa_t* numa;
+    uint64_t* words;
+    int* ints;
+    int i, maxCPUIndex = numWords * CPU_WORD_BITS;
+
+    /* a single block - header, nodes, distance matrix, cpu to node map and the cpu sets storage */
+    numa = (cpucaps_numa_t*)calloc(1, sizeof(cpucaps_numa_t) + sizeof(cpucaps_numa_node_t) * numNodes +
+                                      sizeof(uint64_t) * numWords * numNodes +
+                                      sizeof(int) * ((size_t)numNodes * numNodes + maxCPUIndex));
+    if (!numa) {
+        return NULL;
+    }
+
+    numa->numNodes = numNodes;
+    numa->maxCPUIndex = maxCPUIndex;
+    numa->nodes = (cpucaps_numa_node_t*)(numa + 1);
+    words = (uint64_t*)(numa->nodes + numNodes);
+    ints = (int*)(words + (size_t)numWords * numNodes);
+
+    for (i = 0; i < numNodes; ++i) {
+        numa->nodes[i].cpus.numWords = numWords;
+        numa->nodes[i].cpus.words = words + (size_t)i * numWords;
+        numa->nodes[i].distances = ints + (size_t)i * numNodes;
+    }
+    numa->cpuToNode = ints + (size_t)numNodes * numNodes;
+    for (i = 0; i < maxCPUIndex; ++i) {
+        numa->cpuToNode[i] = -1;
+    }
+
+    return numa;
+}
+
+/* no NUMA information from the OS, so everything is one node */
+static cpucaps_numa_t* make_single_node(const cpucaps_topology_t* topology, int numWords) {
+    cpucaps_numa_t* numa = allocate_numa(1, numWords);
+    int i, cpuIndex;
+
+    if (!numa) {
+        return NULL;
+    }
+
+    numa->nodes[0].distances[0] = 10;
+    for (i = 0; topology && i < topology->numCPUs; ++i) {
+        cpuIndex = topology->cpus[i].cpuIndex;
+        numa->nodes[0].cpus.words[cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpuIndex);
+        numa->cpuToNode[cpuIndex] = 0;
+        ++numa->nodes[0].numCPUs;
+    }
+
+    return numa;
+}
+
+int libcpucaps_GetNUMA(const char* sysfsRoot, const cpucaps_topology_t* topology, cpucaps_numa_t** numa) {
+    char path[NUMA_MAX_PATH];
+    char* buffer;
+    uint64_t* nodeWords;
+    cpucaps_numa_t* result;
+    cpucaps_numa_node_t* node;
+    const char* p;
+    char* end;
+    int capacity, numWords, numNodes, nodeID, i, n, cpu;
+
+    if (!numa) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    *numa = NULL;
+    if (!sysfsRoot) {
+        sysfsRoot = NUMA_DEFAULT_SYSFS_ROOT;
+    }
+
+    capacity = get_cpu_capacity_wrapper();
+    if (topology && topology->maxCPUIndex > capacity) {
+        capacity = topology->maxCPUIndex;
+    }
+    numWords = CPU_WORDS(capacity);
+
+    buffer = (char*)malloc(NUMA_FILE_BUFFER_SIZE);
+    nodeWords = (uint64_t*)calloc((size_t)CPU_WORDS(NUMA_MAX_NODES), sizeof(uint64_t));
+    if (!buffer || !nodeWords) {
+        free(buffer);
+        free(nodeWords);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    /* online nodes use the same list format as cpus */
+    snprintf(path, sizeof(path), "%s/devices/system/node/online", sysfsRoot);
+    numNodes = read_text_file(path, buffer, NUMA_FILE_BUFFER_SIZE) ? parse_cpu_list(buffer, nodeWords, CPU_WORDS(NUMA_MAX_NODES)) : 0;
+
+    result = numNodes ? allocate_numa(numNodes, numWords) : make_single_node(topology, numWords);
+    if (!result || !numNodes) {
+        free(buffer);
+        free(nodeWords);
+        if (result) {
+            fill_packages(result, topology);
+        }
+        *numa = result;
+        return result ? LIBCPUCAPS_ERROR_OK : LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    for (nodeID = 0, n = 0; n < numNodes; ++nodeID) {
+        if (!(nodeWords[nodeID / CPU_WORD_BITS] & CPU_WORD_BIT(nodeID))) {
+            continue;
+        }
+
+        node = &result->nodes[n++];
+        node->nodeID = nodeID;
+
+        snprintf(path, sizeof(path), "%s/devices/system/node/node%d/cpulist", sysfsRoot, nodeID);
+        if (read_text_file(path, buffer, NUMA_FILE_BUFFER_SIZE)) {
+            node->numCPUs = parse_cpu_list(buffer, node->cpus.words, numWords);
+        }
+
+        /* distances to every online node, in the same order */
+        snprintf(path, sizeof(path), "%s/devices/system/node/node%d/distance", sysfsRoot, nodeID);
+        if (read_text_file(path, buffer, NUMA_FILE_BUFFER_SIZE)) {
+            for (i = 0, p = buffer; i < numNodes; ++i, p = end) {
+                node->distances[i] = (int)strtol(p, &end, 10);
+                if (end == p) {
+                    break;
+                }
+            }
+        }
+
+        snprintf(path, sizeof(path), "%s/devices/system/node/node%d/meminfo", sysfsRoot, nodeID);
+        if (read_text_file(path, buffer, NUMA_FILE_BUFFER_SIZE)) {
+            node->memTotalBytes = parse_meminfo_bytes(buffer, "MemTotal:");
+            node->memFreeBytes = parse_meminfo_bytes(buffer, "MemFree:");
+        }
+
+        for (cpu = 0; cpu < result->maxCPUIndex; ++cpu) {
+            if (libcpucaps_CpuSetHas(&node->cpus, cpu)) {
+                result->cpuToNode[cpu] = n - 1;
+            }
+        }
+    }
+
+    free(buffer);
+    free(nodeWords);
+
+    fill_packages(result, topology);
+
+    *numa = result;
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+void libcpucaps_FreeNUMA(cpucaps_numa_t* numa) {
+    free(numa);
+}
+
+int libcpucaps_GetCPUNode(const cpucaps_numa_t* numa, int cpuIndex) {
+    if (!numa || cpuIndex < 0 || cpuIndex >= numa->maxCPUIndex || numa->cpuToNode[cpuIndex] < 0) {
+        return -1;
+    }
+    return numa->nodes[numa->cpuToNode[cpuIndex]].nodeID;
+}
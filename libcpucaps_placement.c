@@ -0,0 +1,215 @@
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+#include <stdlib.h>    /* calloc, free, qsort */
+#include <string.h>    /* memset */
+
+/* a logical cpu the plan may use, with its ranks precomputed for sorting */
+typedef struct _s_placement_candidate {
+    int cpuIndex;
+    int coreIndex;
+    int smtID;
+    int smtRank;            /* 0 for the first sibling of a core, 1 for the second ... */
+    int domain;             /* L3 domain (or package if there's no L3) */
+    int coreRankInDomain;   /* 0 for the first core of a domain, 1 for the second ... */
+} placement_candidate_t;
+
+static int compare_by_core(const void* a, const void* b) {
+    const placement_candidate_t* ca = (const placement_candidate_t*)a;
+    const placement_candidate_t* cb = (const placement_candidate_t*)b;
+    if (ca->coreIndex != cb->coreIndex) {
+        return ca->coreIndex - cb->coreIndex;
+    }
+    if (ca->smtID != cb->smtID) {
+        return ca->smtID - cb->smtID;
+    }
+    return ca->cpuIndex - cb->cpuIndex;
+}
+
+/* compact: fill all siblings of a core before moving to the next one, cores of a domain stay together */
+static int compare_compact(const void* a, const void* b) {
+    const placement_candidate_t* ca = (const placement_candidate_t*)a;
+    const placement_candidate_t* cb = (const placement_candidate_t*)b;
+    if (ca->domain != cb->domain) {
+        return ca->domain - cb->domain;
+    }
+    if (ca->coreRankInDomain != cb->coreRankInDomain) {
+        return ca->coreRankInDomain - cb->coreRankInDomain;
+    }
+    return ca->smtRank - cb->smtRank;
+}
+
+/* scatter: one thread per physical core first, round-robin over the domains to spread cache & memory load */
+static int compare_scatter(const void* a, const void* b) {
+    const placement_candidate_t* ca = (const placement_candidate_t*)a;
+    const placement_candidate_t* cb = (const placement_candidate_t*)b;
+    if (ca->smtRank != cb->smtRank) {
+        return ca->smtRank - cb->smtRank;
+    }
+    if (ca->coreRankInDomain != cb->coreRankInDomain) {
+        return ca->coreRankInDomain - cb->coreRankInDomain;
+    }
+    return ca->domain - cb->domain;
+}
+
+/* per L3: domains one after another, scattered over the cores inside of each domain */
+static int compare_per_domain(const void* a, const void* b) {
+    const placement_candidate_t* ca = (const placement_candidate_t*)a;
+    const placement_candidate_t* cb = (const placement_candidate_t*)b;
+    if (ca->domain != cb->domain) {
+        return ca->domain - cb->domain;
+    }
+    if (ca->smtRank != cb->smtRank) {
+        return ca->smtRank - cb->smtRank;
+    }
+    return ca->coreRankInDomain - cb->coreRankInDomain;
+}
+
+static int collect_candidates(const cpucaps_topology_t* topology, int avoidCore0, placement_candidate_t* candidates) {
+    const cpucaps_cpu_t* cpu;
+    int i, numCandidates, core0 = -1;
+
+    /* IRQs default to cpu 0, so its whole physical core is left alone */
+    if (avoidCore0) {
+        for (i = 0; i < topology->numCPUs; ++i) {
+            if (topology->cpus[i].cpuIndex == 0) {
+                core0 = topology->cpus[i].coreIndex;
+                break;
+            }
+        }
+    }
+
+    numCandidates = 0;
+    for (i = 0; i < topology->numCPUs; ++i) {
+        cpu = &topology->cpus[i];
+        if (!cpu->isAllowed || cpu->coreIndex == core0) {
+            continue;
+        }
+
+        candidates[numCandidates].cpuIndex = cpu->cpuIndex;
+        candidates[numCandidates].coreIndex = cpu->coreIndex;
+        candidates[numCandidates].smtID = (int)cpu->smtID;
+        candidates[numCandidates].domain = (cpu->L3_cacheIndex >= 0) ? cpu->L3_cacheIndex : (topology->numCaches + (int)cpu->packageID);
+        ++numCandidates;
+    }
+
+    return numCandidates;
+}
+
+static void rank_candidates(placement_candidate_t* candidates, int numCandidates) {
+    int i, rank;
+
+    qsort(candidates, (size_t)numCandidates, sizeof(placement_candidate_t), compare_by_core);
+    for (i = 0, rank = 0; i < numCandidates; ++i) {
+        rank = (i && candidates[i].coreIndex == candidates[i - 1].coreIndex) ? (rank + 1) : 0;
+        candidates[i].smtRank = rank;
+    }
+
+    /* cores are numbered in x2APIC order, so sorting by domain keeps that order within a domain */
+    for (i = 0; i < numCandidates; ++i) {
+        candidates[i].coreRankInDomain = candidates[i].coreIndex;
+    }
+    qsort(candidates, (size_t)numCandidates, sizeof(placement_candidate_t), compare_compact);
+    for (i = 0, rank = 0; i < numCandidates; ++i) {
+        if (i && candidates[i].domain != candidates[i - 1].domain) {
+            rank = 0;
+        } else if (i && candidates[i].coreIndex != candidates[i - 1].coreIndex) {
+            ++rank;
+        }
+        candidates[i].coreRankInDomain = rank;
+    }
+}
+
+int libcpucaps_PlanThreads(const cpucaps_topology_t* topology, int numThreads, int policy, cpucaps_plan_t** plan) {
+    placement_candidate_t* candidates;
+    cpucaps_plan_t* result;
+    uint64_t* words;
+    int numCandidates, numWords, numDomains, domain, domainStart, domainSize, first, count, thread, i, cpuIndex;
+    int basePolicy = policy & ~LIBCPUCAPS_PLACEMENT_AVOID_CORE0;
+
+    if (!topology || !plan || numThreads <= 0 || basePolicy < LIBCPUCAPS_PLACEMENT_COMPACT || basePolicy > LIBCPUCAPS_PLACEMENT_PER_L3) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    *plan = NULL;
+
+    candidates = (placement_candidate_t*)calloc((size_t)topology->numCPUs, sizeof(placement_candidate_t));
+    if (!candidates) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    numCandidates = collect_candidates(topology, (policy & LIBCPUCAPS_PLACEMENT_AVOID_CORE0) != 0, candidates);
+    if (!numCandidates) {
+        /* avoiding core 0 left nothing, a crowded core 0 is better than no plan */
+        numCandidates = collect_candidates(topology, 0, candidates);
+    }
+    if (!numCandidates) {
+        free(candidates);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    rank_candidates(candidates, numCandidates);
+
+    numWords = CPU_WORDS(topology->maxCPUIndex);
+    result = (cpucaps_plan_t*)calloc(1, sizeof(cpucaps_plan_t) + sizeof(cpucaps_cpuset_t) * numThreads +
+                                        sizeof(uint64_t) * numWords * numThreads);
+    if (!result) {
+        free(candidates);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    result->numThreads = numThreads;
+    result->threads = (cpucaps_cpuset_t*)(result + 1);
+    words = (uint64_t*)(result->threads + numThreads);
+    for (thread = 0; thread < numThreads; ++thread) {
+        result->threads[thread].numWords = numWords;
+        result->threads[thread].words = words + (size_t)thread * numWords;
+    }
+
+    if (basePolicy == LIBCPUCAPS_PLACEMENT_PER_L3) {
+        qsort(candidates, (size_t)numCandidates, sizeof(placement_candidate_t), compare_per_domain);
+
+        numDomains = 1;
+        for (i = 1; i < numCandidates; ++i) {
+            numDomains += (candidates[i].domain != candidates[i - 1].domain);
+        }
+
+        /* consecutive threads usually cooperate, so each domain gets a contiguous block of them */
+        for (domain = 0, domainStart = 0; domain < numDomains; ++domain) {
+            for (domainSize = 1; domainStart + domainSize < numCandidates &&
+                                 candidates[domainStart + domainSize].domain == candidates[domainStart].domain; ++domainSize) {
+            }
+
+            first = (int)(((int64_t)domain * numThreads) / numDomains);
+            count = (int)(((int64_t)(domain + 1) * numThreads) / numDomains) - first;
+            for (i = 0; i < count; ++i) {
+                cpuIndex = candidates[domainStart + (i % domainSize)].cpuIndex;
+                result->threads[first + i].words[cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpuIndex);
+            }
+
+            domainStart += domainSize;
+        }
+    } else {
+        qsort(candidates, (size_t)numCandidates, sizeof(placement_candidate_t),
+              (basePolicy == LIBCPUCAPS_PLACEMENT_COMPACT) ? compare_compact : compare_scatter);
+
+        /* more threads than cpus wrap around in the same order */
+        for (thread = 0; thread < numThreads; ++thread) {
+            cpuIndex = candidates[thread % numCandidates].cpuIndex;
+            result->threads[thread].words[cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpuIndex);
+        }
+    }
+
+    free(candidates);
+
+    *plan = result;
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+void libcpucaps_FreePlan(cpucaps_plan_t* plan) {
+    free(plan);
+}
+
+int libcpucaps_SetThreadAffinity(const cpucaps_cpuset_t* set) {
+    if (!set || !set->words || set->numWords <= 0 || !libcpucaps_CpuSetCount(set)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+
+    return set_thread_affinity_wrapper(set->words, set->numWords) ? LIBCPUCAPS_ERROR_OK : LIBCPUCAPS_ERROR_FAILED;
+}
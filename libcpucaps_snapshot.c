@@ -0,0 +1,465 @@
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+#include <stdio.h>
+#include <stdlib.h>    /* malloc, free, strtoull */
+#include <string.h>    /* memcpy, memset, memcmp, strlen, strncmp */
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+/* caps & topology of this boot, written once and mapped by later processes instead of probing every cpu */
+/* all values are stored in the native layout, the struct sizes in the header reject other builds */
+
+#define SNAPSHOT_MAGIC          "CPUCAPS"
+#define SNAPSHOT_VERSION        1
+#define SNAPSHOT_BOOT_ID_LEN    40
+#define SNAPSHOT_MAX_PATH       1024
+
+/* what invalidates a snapshot: a reboot, a different cpu or a microcode update */
+typedef struct _s_snapshot_key {
+    char      bootID[SNAPSHOT_BOOT_ID_LEN];
+    uint32_t  signature;        /* CPUID leaf 1 EAX - family, model & stepping */
+    uint32_t  reserved;
+    uint64_t  microcode;        /* 0 if the OS doesn't report it (e.g. in VMs) */
+} snapshot_key_t;
+
+typedef struct _s_snapshot_header {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        headerSize;
+    uint32_t        capsSize;
+    uint32_t        topologySize;
+    uint32_t        cpuSize;
+    uint32_t        cacheSize;
+    snapshot_key_t  key;
+    int32_t         numCPUs;
+    int32_t         numCaches;
+    int32_t         maxCPUIndex;
+    int32_t         reserved;
+    uint64_t        payloadSize;
+    uint64_t        checksum;       /* FNV-1a of the payload */
+} snapshot_header_t;
+
+/* payload: cpucaps_t, cpucaps_topology_t, cpus, caches, then the cpu set words of the caches, */
+/* P-cores, E-cores & P-core primaries (pointers are stored zeroed and rebuilt on load) */
+#define SNAPSHOT_NUM_TOPOLOGY_SETS  3
+
+static void* map_file_wrapper(const char* path, size_t* size);
+static void unmap_file_wrapper(void* data, size_t size);
+static int get_boot_id_wrapper(char* bootID, size_t size);
+static uint64_t get_microcode_wrapper(void);
+static int get_snapshot_path_wrapper(const char* dir, char* path, size_t size);
+
+static int get_snapshot_key(snapshot_key_t* key) {
+    cpuid_result_t cpuidResult;
+
+    memset(key, 0, sizeof(snapshot_key_t));
+    if (!get_boot_id_wrapper(key->bootID, sizeof(key->bootID))) {
+        return 0;
+    }
+
+    cpuid_wrapper(1, 0, &cpuidResult);
+    key->signature = cpuidResult.eax;
+    key->microcode = get_microcode_wrapper();
+
+    return 1;
+}
+
+/* the affinity as words covering cpus up to maxCPUIndex, NULL on failure */
+static uint64_t* get_affinity_words(int maxCPUIndex, int* numWords) {
+    uint64_t* words;
+    int capacity = get_cpu_capacity_wrapper();
+
+    *numWords = CPU_WORDS((capacity > maxCPUIndex) ? capacity : maxCPUIndex);
+    words = (uint64_t*)calloc((size_t)*numWords, sizeof(uint64_t));
+    if (words && !get_thread_affinity_wrapper(words, *numWords)) {
+        free(words);
+        return NULL;
+    }
+    return words;
+}
+
+/* a process restricted to some cpus only probed those, the rest of the topology came from the OS */
+static int is_affinity_complete(const cpucaps_topology_t* topology) {
+    uint64_t* allowed;
+    int numWords, i, cpuIndex, isComplete = 1;
+
+    allowed = get_affinity_words(topology->maxCPUIndex, &numWords);
+    if (!allowed) {
+        return 0;
+    }
+    for (i = 0; i < topology->numCPUs && isComplete; ++i) {
+        cpuIndex = topology->cpus[i].cpuIndex;
+        isComplete = topology->cpus[i].isAllowed && (allowed[cpuIndex / CPU_WORD_BITS] & CPU_WORD_BIT(cpuIndex));
+    }
+
+    free(allowed);
+    return isComplete;
+}
+
+static size_t get_payload_size(int numCPUs, int numCaches, int maxCPUIndex) {
+    return sizeof(cpucaps_t) + sizeof(cpucaps_topology_t) + sizeof(cpucaps_cpu_t) * numCPUs + sizeof(cpucaps_cache_t) * numCaches +
+           sizeof(uint64_t) * CPU_WORDS(maxCPUIndex) * (numCaches + SNAPSHOT_NUM_TOPOLOGY_SETS);
+}
+
+int libcpucaps_SaveSnapshot(const char* dir, const cpucaps_t* caps, const cpucaps_topology_t* topology) {
+    char path[SNAPSHOT_MAX_PATH];
+    char tempPath[SNAPSHOT_MAX_PATH + 16];
+    snapshot_header_t* header;
+    cpucaps_topology_t* savedTopology;
+    cpucaps_cache_t* savedCaches;
+    unsigned char* buffer;
+    unsigned char* p;
+    FILE* file;
+    size_t payloadSize, wordsSize;
+    int cpuWords, i, isWritten, result = LIBCPUCAPS_ERROR_FAILED;
+
+    if (!caps || !topology || topology->numCPUs <= 0) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!is_affinity_complete(topology)) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    cpuWords = CPU_WORDS(topology->maxCPUIndex);
+    wordsSize = sizeof(uint64_t) * cpuWords;
+    payloadSize = get_payload_size(topology->numCPUs, topology->numCaches, topology->maxCPUIndex);
+
+    buffer = (unsigned char*)calloc(1, sizeof(snapshot_header_t) + payloadSize);
+    if (!buffer) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    header = (snapshot_header_t*)buffer;
+    if (!get_snapshot_key(&header->key) || !get_snapshot_path_wrapper(dir, path, sizeof(path))) {
+        free(buffer);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->version = SNAPSHOT_VERSION;
+    header->headerSize = sizeof(snapshot_header_t);
+    header->capsSize = sizeof(cpucaps_t);
+    header->topologySize = sizeof(cpucaps_topology_t);
+    header->cpuSize = sizeof(cpucaps_cpu_t);
+    header->cacheSize = sizeof(cpucaps_cache_t);
+    header->numCPUs = topology->numCPUs;
+    header->numCaches = topology->numCaches;
+    header->maxCPUIndex = topology->maxCPUIndex;
+    header->payloadSize = payloadSize;
+
+    p = buffer + sizeof(snapshot_header_t);
+    memcpy(p, caps, sizeof(cpucaps_t));
+    p += sizeof(cpucaps_t);
+
+    savedTopology = (cpucaps_topology_t*)p;
+    memcpy(savedTopology, topology, sizeof(cpucaps_topology_t));
+    savedTopology->cpus = NULL;
+    savedTopology->caches = NULL;
+    savedTopology->pcoreCPUs.words = savedTopology->ecoreCPUs.words = savedTopology->pcorePrimaryCPUs.words = NULL;
+    p += sizeof(cpucaps_topology_t);
+
+    memcpy(p, topology->cpus, sizeof(cpucaps_cpu_t) * topology->numCPUs);
+    p += sizeof(cpucaps_cpu_t) * topology->numCPUs;
+
+    savedCaches = (cpucaps_cache_t*)p;
+    memcpy(savedCaches, topology->caches, sizeof(cpucaps_cache_t) * topology->numCaches);
+    for (i = 0; i < topology->numCaches; ++i) {
+        savedCaches[i].cpus.words = NULL;
+    }
+    p += sizeof(cpucaps_cache_t) * topology->numCaches;
+
+    for (i = 0; i < topology->numCaches; ++i, p += wordsSize) {
+        memcpy(p, topology->caches[i].cpus.words, wordsSize);
+    }
+    memcpy(p, topology->pcoreCPUs.words, wordsSize);
+    memcpy(p + wordsSize, topology->ecoreCPUs.words, wordsSize);
+    memcpy(p + wordsSize * 2, topology->pcorePrimaryCPUs.words, wordsSize);
+
+    header->checksum = fnv1a64(buffer + sizeof(snapshot_header_t), payloadSize);
+
+    file = create_temp_file_wrapper(path, tempPath, sizeof(tempPath));
+    if (file) {
+        isWritten = fwrite(buffer, 1, sizeof(snapshot_header_t) + payloadSize, file) == sizeof(snapshot_header_t) + payloadSize;
+        result = commit_temp_file_wrapper(file, tempPath, path, isWritten) ? LIBCPUCAPS_ERROR_OK : LIBCPUCAPS_ERROR_FAILED;
+    }
+    free(buffer);
+
+    return result;
+}
+
+static int is_snapshot_valid(const unsigned char* data, size_t size, const snapshot_key_t* key) {
+    const snapshot_header_t* header = (const snapshot_header_t*)data;
+
+    if (size < sizeof(snapshot_header_t) ||
+        memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+        header->version != SNAPSHOT_VERSION ||
+        header->headerSize != sizeof(snapshot_header_t) ||
+        header->capsSize != sizeof(cpucaps_t) ||
+        header->topologySize != sizeof(cpucaps_topology_t) ||
+        header->cpuSize != sizeof(cpucaps_cpu_t) ||
+        header->cacheSize != sizeof(cpucaps_cache_t)) {
+        return 0;
+    }
+    if (memcmp(&header->key, key, sizeof(snapshot_key_t))) {
+        return 0;
+    }
+    if (header->numCPUs <= 0 || header->numCaches < 0 || header->maxCPUIndex < header->numCPUs ||
+        header->payloadSize != size - sizeof(snapshot_header_t) ||
+        header->payloadSize != get_payload_size(header->numCPUs, header->numCaches, header->maxCPUIndex)) {
+        return 0;
+    }
+
+    return fnv1a64(data + sizeof(snapshot_header_t), (size_t)header->payloadSize) == header->checksum;
+}
+
+static cpucaps_topology_t* restore_topology(const snapshot_header_t* header, const unsigned char* p) {
+    cpucaps_topology_t* topology;
+    cpucaps_topology_t blocks;
+    cpucaps_cache_t* cache;
+    uint64_t* words;
+    uint64_t* allowed;
+    size_t wordsSize;
+    int numWords, cpuIndex, i;
+
+    topology = alloc_topology(header->numCPUs, header->numCaches, header->maxCPUIndex);
+    if (!topology) {
+        return NULL;
+    }
+    wordsSize = sizeof(uint64_t) * CPU_WORDS(header->maxCPUIndex);
+
+    /* the scalars come from the snapshot, the pointers stay the ones alloc_topology set up */
+    blocks = *topology;
+    memcpy(topology, p, sizeof(cpucaps_topology_t));
+    topology->cpus = blocks.cpus;
+    topology->caches = blocks.caches;
+    topology->pcoreCPUs = blocks.pcoreCPUs;
+    topology->ecoreCPUs = blocks.ecoreCPUs;
+    topology->pcorePrimaryCPUs = blocks.pcorePrimaryCPUs;
+    p += sizeof(cpucaps_topology_t);
+
+    memcpy(topology->cpus, p, sizeof(cpucaps_cpu_t) * topology->numCPUs);
+    p += sizeof(cpucaps_cpu_t) * topology->numCPUs;
+
+    for (i = 0; i < topology->numCaches; ++i, p += sizeof(cpucaps_cache_t)) {
+        cache = &topology->caches[i];
+        words = cache->cpus.words;
+        memcpy(cache, p, sizeof(cpucaps_cache_t));
+        cache->cpus.numWords = topology->pcoreCPUs.numWords;
+        cache->cpus.words = words;
+    }
+
+    for (i = 0; i < topology->numCaches; ++i, p += wordsSize) {
+        memcpy(topology->caches[i].cpus.words, p, wordsSize);
+    }
+    memcpy(topology->pcoreCPUs.words, p, wordsSize);
+    memcpy(topology->ecoreCPUs.words, p + wordsSize, wordsSize);
+    memcpy(topology->pcorePrimaryCPUs.words, p + wordsSize * 2, wordsSize);
+
+    /* the saving process could run everywhere, this one may be restricted by taskset or a cpuset */
+    allowed = get_affinity_words(topology->maxCPUIndex, &numWords);
+    if (!allowed) {
+        libcpucaps_FreeTopology(topology);
+        return NULL;
+    }
+    for (i = 0; i < topology->numCPUs; ++i) {
+        cpuIndex = topology->cpus[i].cpuIndex;
+        topology->cpus[i].isAllowed = (char)((allowed[cpuIndex / CPU_WORD_BITS] & CPU_WORD_BIT(cpuIndex)) != 0);
+    }
+    free(allowed);
+
+    return topology;
+}
+
+int libcpucaps_LoadSnapshot(const char* dir, cpucaps_t* caps, cpucaps_topology_t** topology) {
+    char path[SNAPSHOT_MAX_PATH];
+    snapshot_key_t key;
+    const unsigned char* data;
+    size_t size;
+    int result = LIBCPUCAPS_ERROR_FAILED;
+
+    if (!caps) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (topology) {
+        *topology = NULL;
+    }
+
+    if (!get_snapshot_key(&key) || !get_snapshot_path_wrapper(dir, path, sizeof(path))) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    data = (const unsigned char*)map_file_wrapper(path, &size);
+    if (!data) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    if (is_snapshot_valid(data, size, &key)) {
+        if (topology) {
+            *topology = restore_topology((const snapshot_header_t*)data, data + sizeof(snapshot_header_t) + sizeof(cpucaps_t));
+        }
+        if (!topology || *topology) {
+            memcpy(caps, data + sizeof(snapshot_header_t), sizeof(cpucaps_t));
+            result = LIBCPUCAPS_ERROR_OK;
+        }
+    }
+
+    unmap_file_wrapper((void*)data, size);
+    return result;
+}
+
+int libcpucaps_GetCapsSnapshot(const char* dir, cpucaps_t* caps, cpucaps_topology_t** topology) {
+    cpucaps_topology_t* detected;
+    int result;
+
+    if (!caps) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (LIBCPUCAPS_ERROR_OK == libcpucaps_LoadSnapshot(dir, caps, topology)) {
+        return LIBCPUCAPS_ERROR_OK;
+    }
+
+    /* the cpus are probed once, the caps' topology summary comes from the same topology */
+    result = libcpucaps_GetCapsEx(caps, LIBCPUCAPS_DETECT_ALL & ~LIBCPUCAPS_DETECT_TOPOLOGY);
+    if (result != LIBCPUCAPS_ERROR_OK) {
+        return result;
+    }
+    result = libcpucaps_GetTopology(&detected);
+    if (result != LIBCPUCAPS_ERROR_OK) {
+        return result;
+    }
+    libcpucaps_CompleteCapsTopology(caps, detected);
+
+    /* a read-only or missing directory only costs the next process another detection */
+    libcpucaps_SaveSnapshot(dir, caps, detected);
+
+    if (topology) {
+        *topology = detected;
+    } else {
+        libcpucaps_FreeTopology(detected);
+    }
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+
+#ifdef __linux__
+
+static void* map_file_wrapper(const char* path, size_t* size) {
+    struct stat st;
+    void* data;
+    FILE* file;
+
+    file = open_trusted_file_wrapper(path);
+    if (!file) {
+        return NULL;
+    }
+    if (fstat(fileno(file), &st) || st.st_size <= 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    return data;
+}
+
+static void unmap_file_wrapper(void* data, size_t size) {
+    munmap(data, size);
+}
+
+static int get_boot_id_wrapper(char* bootID, size_t size) {
+    size_t length;
+
+    if (!read_text_file("/proc/sys/kernel/random/boot_id", bootID, size)) {
+        return 0;
+    }
+    length = strlen(bootID);
+    while (length && (bootID[length - 1] == '\n' || bootID[length - 1] == ' ')) {
+        bootID[--length] = 0;
+    }
+    return length != 0;
+}
+
+/* late-loaded microcode updates all cpus, cpu0 speaks for the rest */
+static uint64_t get_microcode_wrapper(void) {
+    char buffer[4096];
+    const char* p;
+
+    if (read_text_file("/sys/devices/system/cpu/cpu0/microcode/version", buffer, sizeof(buffer))) {
+        return strtoull(buffer, NULL, 16);
+    }
+
+    if (read_text_file("/proc/cpuinfo", buffer, sizeof(buffer))) {
+        for (p = buffer; p; p = strchr(p, '\n')) {
+            if (*p == '\n') {
+                ++p;
+            }
+            if (!strncmp(p, "microcode", 9)) {
+                p = strchr(p, ':');
+                return p ? strtoull(p + 1, NULL, 16) : 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int get_snapshot_path_wrapper(const char* dir, char* path, size_t size) {
+    char defaultDir[SNAPSHOT_MAX_PATH];
+    int length;
+
+    /* XDG_RUNTIME_DIR is per user and cleared on logout, the file name has the uid in case it's /tmp */
+    if (!dir) {
+        if (!get_user_dir_wrapper("XDG_RUNTIME_DIR", NULL, defaultDir, sizeof(defaultDir))) {
+            return 0;
+        }
+        dir = defaultDir;
+    }
+    length = snprintf(path, size, "%s/libcpucaps-%u.snapshot", dir, (unsigned)getuid());
+    return length > 0 && (size_t)length < size;
+}
+
+#else
+
+/* Windows has no boot ID to key the snapshot with, so there's never a valid one */
+static void* map_file_wrapper(const char* path, size_t* size) {
+    (void)path;
+    *size = 0;
+    return NULL;
+}
+
+static void unmap_file_wrapper(void* data, size_t size) {
+    (void)data;
+    (void)size;
+}
+
+static int get_boot_id_wrapper(char* bootID, size_t size) {
+    (void)bootID;
+    (void)size;
+    return 0;
+}
+
+static uint64_t get_microcode_wrapper(void) {
+    return 0;
+}
+
+static int get_snapshot_path_wrapper(const char* dir, char* path, size_t size) {
+    (void)dir;
+    (void)path;
+    (void)size;
+    return 0;
+}
+
+#endif
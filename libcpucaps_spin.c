@@ -0,0 +1,311 @@
+#include "libcpucaps.h"
+#include "libcpucaps_spin.h"
+#include "libcpucaps_tsc.h"
+#include "libcpucaps_internal.h"
+#include <stdlib.h>    /* malloc, free */
+#include <string.h>    /* memset */
+#include <immintrin.h> /* _mm_pause, _tpause, _umonitor, _umwait */
+
+#ifndef _MSC_VER
+#include <x86intrin.h> /* _mm_monitorx, _mm_mwaitx */
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SPIN_TARGET(isa)                __attribute__((target(isa)))
+#else
+#define SPIN_TARGET(isa)
+#endif
+
+#define SPIN_CALIBRATION_PAUSES         2000
+#define SPIN_CALIBRATION_RUNS           5
+#define SPIN_PAUSE_BATCH                8       /* PAUSEs between two checks of the value & the deadline */
+#define SPIN_WAITPKG_C01                1       /* TPAUSE & UMWAIT control: the C0.1 state, the quickest to wake up from */
+#define SPIN_MWAITX_TIMER               2       /* MWAITX ECX[1]: EBX is a timeout in TSC ticks */
+#define SPIN_MWAITX_C0                  0xF0    /* MWAITX EAX hint: stay in C0 */
+#define SPIN_MWAITX_MAX_TICKS           0xFFFFFFFFu
+
+/* a config is never changed once it's published, a waiter sees either the old or the new one as a whole */
+/* replaced ones are kept as a waiter may still be using them */
+typedef struct _s_spin_state {
+    cpucaps_spin_config_t   config;
+    struct _s_spin_state*   replaced;
+} spin_state_t;
+
+/* no measurement: single PAUSEs and deadlines that have already passed */
+static const spin_state_t s_unmeasuredState = { { LIBCPUCAPS_SPIN_PAUSE, 0.0, 0.0, 0.0 }, NULL };
+
+static void* volatile s_spinState = NULL;          /* spin_state_t, stored with release once it's filled in */
+static volatile int32_t s_spinStateLock = 0;       /* held while a thread replaces it */
+
+/* the best of a few runs, a preempted run only ever takes longer */
+static void measure_pause(cpucaps_spin_config_t* config) {
+    uint64_t startNs, startTicks, ns, ticks, bestNs = ~(uint64_t)0, bestTicks = ~(uint64_t)0;
+    uint64_t totalNs = 0, totalTicks = 0;
+    int run, i;
+
+    for (run = 0; run < SPIN_CALIBRATION_RUNS; ++run) {
+        startNs = get_time_ns_wrapper();
+        startTicks = libcpucaps_ReadTSC();
+        for (i = 0; i < SPIN_CALIBRATION_PAUSES; ++i) {
+            _mm_pause();
+        }
+        ticks = libcpucaps_ReadTSC() - startTicks;
+        ns = get_time_ns_wrapper() - startNs;
+
+        bestNs = (ns < bestNs) ? ns : bestNs;
+        bestTicks = (ticks < bestTicks) ? ticks : bestTicks;
+        totalNs += ns;
+        totalTicks += ticks;
+    }
+
+    config->pauseNs = (double)bestNs / SPIN_CALIBRATION_PAUSES;
+    config->pauseTicks = (double)bestTicks / SPIN_CALIBRATION_PAUSES;
+    config->ticksPerNs = totalNs ? (double)totalTicks / (double)totalNs : 0.0;
+}
+
+static uint64_t ns_to_ticks(const cpucaps_spin_config_t* config, uint64_t ns) {
+    double ticks = (double)ns * config->ticksPerNs;
+    return (ticks >= 18446744073709551615.0) ? ~(uint64_t)0 : (uint64_t)ticks;
+}
+
+/* an absolute TSC deadline, saturated so that "forever" doesn't wrap around */
+static uint64_t get_deadline(const cpucaps_spin_config_t* config, uint64_t ns) {
+    uint64_t now = libcpucaps_ReadTSC(), ticks = ns_to_ticks(config, ns);
+    return (ticks > ~now) ? ~(uint64_t)0 : now + ticks;
+}
+
+static void pause_loop(uint64_t deadline) {
+    int i;
+
+    while (libcpucaps_ReadTSC() < deadline) {
+        for (i = 0; i < SPIN_PAUSE_BATCH; ++i) {
+            _mm_pause();
+        }
+    }
+}
+
+static int wait_pause(const volatile uint32_t* address, uint32_t value, uint64_t deadline) {
+    int i;
+
+    for (;;) {
+        if (*address != value) {
+            return 1;
+        }
+        if (libcpucaps_ReadTSC() >= deadline) {
+            return 0;
+        }
+        for (i = 0; i < SPIN_PAUSE_BATCH; ++i) {
+            _mm_pause();
+        }
+    }
+}
+
+/* the OS caps a single wait (IA32_UMWAIT_CONTROL on Linux), the instructions return early then */
+static SPIN_TARGET("waitpkg") void pause_waitpkg(uint64_t deadline) {
+    while (libcpucaps_ReadTSC() < deadline) {
+        _tpause(SPIN_WAITPKG_C01, deadline);
+    }
+}
+
+static SPIN_TARGET("waitpkg") int wait_waitpkg(const volatile uint32_t* address, uint32_t value, uint64_t deadline) {
+    for (;;) {
+        /* armed before the check, a write in between still ends the wait */
+        _umonitor((void*)address);
+        if (*address != value) {
+            return 1;
+        }
+        if (libcpucaps_ReadTSC() >= deadline) {
+            return 0;
+        }
+        _umwait(SPIN_WAITPKG_C01, deadline);
+    }
+}
+
+static SPIN_TARGET("mwaitx") int wait_monitorx(const volatile uint32_t* address, uint32_t value, uint64_t deadline) {
+    uint64_t now;
+
+    for (;;) {
+        _mm_monitorx((void*)address, 0, 0);
+        if (*address != value) {
+            return 1;
+        }
+        now = libcpucaps_ReadTSC();
+        if (now >= deadline) {
+            return 0;
+        }
+        _mm_mwaitx(SPIN_MWAITX_TIMER, SPIN_MWAITX_C0,
+                   (deadline - now > SPIN_MWAITX_MAX_TICKS) ? SPIN_MWAITX_MAX_TICKS : (unsigned int)(deadline - now));
+    }
+}
+
+/* MWAITX needs a line to watch, nobody writes this thread's stack */
+static void pause_monitorx(uint64_t deadline) {
+    volatile uint32_t line = 0;
+    wait_monitorx(&line, 0, deadline);
+}
+
+int libcpucaps_GetSpinConfig(const cpucaps_t* caps, cpucaps_spin_config_t* config) {
+    if (!config) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(config, 0, sizeof(cpucaps_spin_config_t));
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    }
+
+    if (libcpucaps_HasWAITPKG(caps)) {
+        config->method = LIBCPUCAPS_SPIN_WAITPKG;
+    } else if (libcpucaps_HasMONITORX(caps)) {
+        config->method = LIBCPUCAPS_SPIN_MONITORX;
+    } else {
+        config->method = LIBCPUCAPS_SPIN_PAUSE;
+    }
+
+    measure_pause(config);
+    if (config->pauseNs <= 0.0 || config->ticksPerNs <= 0.0) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+/* isDefault only applies the config if none is set yet, so a lazy first call can't undo libcpucaps_SetSpinConfig */
+static int set_config(const cpucaps_spin_config_t* config, int isDefault) {
+    cpucaps_spin_config_t tuned;
+    spin_state_t* state;
+    int result;
+
+    if (!config) {
+        result = libcpucaps_GetSpinConfig(NULL, &tuned);
+        if (result != LIBCPUCAPS_ERROR_OK) {
+            return result;
+        }
+        config = &tuned;
+    }
+    if (!libcpucaps_IsSpinMethodSupported(NULL, config->method) || config->pauseNs <= 0.0 || config->ticksPerNs <= 0.0) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+
+    state = (spin_state_t*)malloc(sizeof(spin_state_t));
+    if (!state) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    state->config = *config;
+
+    while (!atomic_compare_exchange_wrapper(&s_spinStateLock, 0, 1)) {
+        thread_yield_wrapper();
+    }
+    state->replaced = (spin_state_t*)atomic_load_pointer_acquire_wrapper(&s_spinState);
+    if (!isDefault || !state->replaced) {
+        atomic_store_pointer_release_wrapper(&s_spinState, state);
+        state = NULL;
+    }
+    atomic_store_release_wrapper(&s_spinStateLock, 0);
+
+    /* another thread applied the default first */
+    free(state);
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+/* the acquire pairs with set_config's release, the config is seen filled in */
+static const cpucaps_spin_config_t* get_config(void) {
+    const spin_state_t* state = (const spin_state_t*)atomic_load_pointer_acquire_wrapper(&s_spinState);
+
+    if (!state) {
+        set_config(NULL, 1);
+        state = (const spin_state_t*)atomic_load_pointer_acquire_wrapper(&s_spinState);
+    }
+    return state ? &state->config : &s_unmeasuredState.config;
+}
+
+int libcpucaps_SetSpinConfig(const cpucaps_spin_config_t* config) {
+    return set_config(config, 0);
+}
+
+void libcpucaps_GetCurrentSpinConfig(cpucaps_spin_config_t* config) {
+    *config = *get_config();
+}
+
+int libcpucaps_IsSpinMethodSupported(const cpucaps_t* caps, int method) {
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    }
+
+    switch (method) {
+    case LIBCPUCAPS_SPIN_PAUSE:
+        return 1;
+    case LIBCPUCAPS_SPIN_WAITPKG:
+        return libcpucaps_HasWAITPKG(caps);
+    case LIBCPUCAPS_SPIN_MONITORX:
+        return libcpucaps_HasMONITORX(caps);
+    default:
+        return 0;
+    }
+}
+
+uint32_t libcpucaps_SpinIterations(uint64_t ns) {
+    const cpucaps_spin_config_t* config = get_config();
+    double iterations;
+
+    if (config->pauseNs <= 0.0) {
+        return 1;
+    }
+
+    iterations = (double)ns / config->pauseNs;
+    if (iterations < 1.0) {
+        return 1;
+    }
+    return (iterations >= 4294967295.0) ? 0xFFFFFFFFu : (uint32_t)iterations;
+}
+
+void libcpucaps_SpinPause(uint64_t ns) {
+    const cpucaps_spin_config_t* config = get_config();
+    uint64_t deadline = get_deadline(config, ns);
+
+    switch (config->method) {
+    case LIBCPUCAPS_SPIN_WAITPKG:
+        pause_waitpkg(deadline);
+        break;
+    case LIBCPUCAPS_SPIN_MONITORX:
+        pause_monitorx(deadline);
+        break;
+    default:
+        pause_loop(deadline);
+        break;
+    }
+}
+
+int libcpucaps_SpinWait32(const volatile uint32_t* address, uint32_t value, uint64_t timeoutNs) {
+    const cpucaps_spin_config_t* config;
+    uint64_t deadline;
+
+    if (!address) {
+        return 0;
+    }
+    config = get_config();
+    deadline = get_deadline(config, timeoutNs);
+
+    switch (config->method) {
+    case LIBCPUCAPS_SPIN_WAITPKG:
+        return wait_waitpkg(address, value, deadline);
+    case LIBCPUCAPS_SPIN_MONITORX:
+        return wait_monitorx(address, value, deadline);
+    default:
+        return wait_pause(address, value, deadline);
+    }
+}
+
+void libcpucaps_BackoffInit(cpucaps_backoff_t* backoff, uint64_t minNs, uint64_t maxNs) {
+    backoff->minNs = minNs ? minNs : 1;
+    backoff->maxNs = (maxNs > backoff->minNs) ? maxNs : backoff->minNs;
+    backoff->ns = backoff->minNs;
+}
+
+void libcpucaps_Backoff(cpucaps_backoff_t* backoff) {
+    libcpucaps_SpinPause(backoff->ns);
+    backoff->ns = (backoff->ns > backoff->maxNs / 2) ? backoff->maxNs : backoff->ns * 2;
+}
+
+void libcpucaps_BackoffReset(cpucaps_backoff_t* backoff) {
+    backoff->ns = backoff->minNs;
+}
@@ -0,0 +1,65 @@
+#ifndef LIBCPUCAPS_SPIN_H_HEADER
+#define LIBCPUCAPS_SPIN_H_HEADER
+
+/* optional spin-wait module: waiting for another thread by time instead of by a PAUSE count tuned on one cpu */
+/* (a PAUSE takes ~140 cycles since Skylake-SP, ~10 on Zen), with TPAUSE / UMWAIT or MWAITX where available */
+/* as they wake up on a write to the watched line and leave the core to the SMT sibling meanwhile */
+
+#include "libcpucaps.h"
+
+/* wait instructions */
+#define LIBCPUCAPS_SPIN_PAUSE           0   /* PAUSE loops, the count measured at init */
+#define LIBCPUCAPS_SPIN_WAITPKG         1   /* TPAUSE & UMONITOR / UMWAIT in the light C0.1 state, needs WAITPKG */
+#define LIBCPUCAPS_SPIN_MONITORX        2   /* MONITORX & MWAITX with its timer, needs MONITORX */
+#define LIBCPUCAPS_SPIN_NUM_METHODS     3
+
+typedef struct _s_cpucaps_spin_config {
+    int     method;         /* LIBCPUCAPS_SPIN_xxx */
+    double  pauseNs;        /* one PAUSE, measured */
+    double  pauseTicks;     /* one PAUSE in TSC ticks (reference cycles), measured */
+    double  ticksPerNs;     /* TSC rate, converts time budgets to the deadlines of TPAUSE, UMWAIT & MWAITX */
+} cpucaps_spin_config_t;
+
+/* exponential backoff between two bounds */
+typedef struct _s_cpucaps_backoff {
+    uint64_t  ns;           /* next wait */
+    uint64_t  minNs;
+    uint64_t  maxNs;
+} cpucaps_backoff_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* picks the best supported method & measures PAUSE (about a millisecond on the slowest cpus) */
+/* pass NULL caps to use the cached ones, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_GetSpinConfig(const cpucaps_t* caps, cpucaps_spin_config_t* config);
+/* makes the waits below use the config, NULL restores the tuned one, a wait that already started keeps */
+/* the config it started with, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_SetSpinConfig(const cpucaps_spin_config_t* config);
+/* config currently in use */
+void libcpucaps_GetCurrentSpinConfig(cpucaps_spin_config_t* config);
+
+/* returns 1 if the cpu can run the method (LIBCPUCAPS_SPIN_xxx), pass NULL caps to use the cached ones */
+int libcpucaps_IsSpinMethodSupported(const cpucaps_t* caps, int method);
+
+/* the waits below apply the tuned config on their first call if none is set */
+/* PAUSE iterations spanning about ns, at least 1, for callers running their own loops */
+uint32_t libcpucaps_SpinIterations(uint64_t ns);
+/* waits about ns */
+void libcpucaps_SpinPause(uint64_t ns);
+/* waits while *address == value, for timeoutNs at most, returns 1 once the value changed or 0 on timeout */
+/* with UMWAIT & MWAITX the wait ends as soon as another thread writes the line */
+int libcpucaps_SpinWait32(const volatile uint32_t* address, uint32_t value, uint64_t timeoutNs);
+
+void libcpucaps_BackoffInit(cpucaps_backoff_t* backoff, uint64_t minNs, uint64_t maxNs);
+/* waits the current step, then doubles it up to maxNs */
+void libcpucaps_Backoff(cpucaps_backoff_t* backoff);
+/* back to minNs, e.g. after the contended operation succeeded */
+void libcpucaps_BackoffReset(cpucaps_backoff_t* backoff);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_SPIN_H_HEADER */
@@ -0,0 +1,448 @@
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+#include <stdarg.h>    /* va_list */
+#include <stdio.h>     /* vsnprintf */
+#include <string.h>    /* memset, strncpy */
+
+/* compiler targets: the named -march the cpu fully supports, or the x86-64 level when something is missing */
+/* (a VM or container hiding AVX-512 is exactly where -march=native guesses wrong) */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define TARGET_DEFAULT_GCC      __GNUC__    /* the GCC that builds libcpucaps likely builds the rest too */
+#else
+#define TARGET_DEFAULT_GCC      0
+#endif
+
+#define BIT(name, w)    LIBCPUCAPS_FEATURE_BIT(name, w)
+
+/* what -march=<name> lets the compiler use, limited to the features libcpucaps knows about */
+#define ARCH_V2(w)              (X86_LEVEL_V1(w) | X86_LEVEL_V2(w))
+#define ARCH_V3(w)              (ARCH_V2(w) | X86_LEVEL_V3(w))
+#define ARCH_CORE2(w)           (X86_LEVEL_V1(w) | BIT(SSE3, w) | BIT(SSSE3, w) | BIT(CMPXCHG16B, w) | BIT(LAHFSAHF, w))
+#define ARCH_BONNELL(w)         (ARCH_CORE2(w) | BIT(MOVBE, w))
+#define ARCH_NEHALEM(w)         (ARCH_V2(w))
+#define ARCH_WESTMERE(w)        (ARCH_NEHALEM(w) | BIT(AES, w) | BIT(PCLMULQDQ, w))
+#define ARCH_SANDYBRIDGE(w)     (ARCH_WESTMERE(w) | BIT(AVX, w))
+#define ARCH_IVYBRIDGE(w)       (ARCH_SANDYBRIDGE(w) | BIT(F16C, w) | BIT(RDRAND, w))
+#define ARCH_HASWELL(w)         (ARCH_V3(w) | BIT(AES, w) | BIT(PCLMULQDQ, w) | BIT(RDRAND, w))
+#define ARCH_BROADWELL(w)       (ARCH_HASWELL(w) | BIT(ADX, w) | BIT(RDSEED, w))
+#define ARCH_SKYLAKE(w)         (ARCH_BROADWELL(w) | BIT(CLFLUSHOPT, w))
+#define ARCH_SKYLAKE_AVX512(w)  (ARCH_SKYLAKE(w) | X86_LEVEL_V4(w) | BIT(CLWB, w))
+#define ARCH_CASCADELAKE(w)     (ARCH_SKYLAKE_AVX512(w) | BIT(AVX512VNNI, w))
+#define ARCH_COOPERLAKE(w)      (ARCH_CASCADELAKE(w) | BIT(AVX512BF16, w))
+#define ARCH_CANNONLAKE(w)      (ARCH_SKYLAKE(w) | X86_LEVEL_V4(w) | BIT(AVX512VBMI, w) | BIT(SHA, w))
+#define ARCH_ICELAKE_CLIENT(w)  (ARCH_CANNONLAKE(w) | BIT(AVX512VNNI, w) | BIT(GFNI, w) | BIT(VAES, w) | BIT(AVX512VBMI2, w) | \
+                                 BIT(VPCLMULQDQ, w) | BIT(AVX512BITALG, w) | BIT(AVX512VPOPCNTDQ, w))
+#define ARCH_ICELAKE_SERVER(w)  (ARCH_ICELAKE_CLIENT(w) | BIT(CLWB, w))
+#define ARCH_TIGERLAKE(w)       (ARCH_ICELAKE_CLIENT(w) | BIT(CLWB, w))
+#define ARCH_SAPPHIRERAPIDS(w)  (ARCH_ICELAKE_SERVER(w) | BIT(AVX512BF16, w) | BIT(AVX512FP16, w) | BIT(AVXVNNI, w) | \
+                                 BIT(AMX_TILE, w) | BIT(AMX_INT8, w) | BIT(AMX_BF16, w) | BIT(WAITPKG, w))
+#define ARCH_GRANITERAPIDS(w)   (ARCH_SAPPHIRERAPIDS(w) | BIT(AMX_FP16, w))
+#define ARCH_ALDERLAKE(w)       (ARCH_V3(w) | BIT(AES, w) | BIT(PCLMULQDQ, w) | BIT(RDRAND, w) | BIT(RDSEED, w) | BIT(ADX, w) | \
+                                 BIT(CLFLUSHOPT, w) | BIT(CLWB, w) | BIT(SHA, w) | BIT(VAES, w) | BIT(VPCLMULQDQ, w) | BIT(GFNI, w) | \
+                                 BIT(AVXVNNI, w) | BIT(WAITPKG, w))
+#define ARCH_SILVERMONT(w)      (ARCH_V2(w) | BIT(AES, w) | BIT(PCLMULQDQ, w) | BIT(RDRAND, w) | BIT(MOVBE, w))
+#define ARCH_GOLDMONT(w)        (ARCH_SILVERMONT(w) | BIT(RDSEED, w) | BIT(SHA, w) | BIT(CLFLUSHOPT, w))
+#define ARCH_TREMONT(w)         (ARCH_GOLDMONT(w) | BIT(GFNI, w) | BIT(CLWB, w) | BIT(WAITPKG, w))
+#define ARCH_AMDFAM10(w)        (X86_LEVEL_V1(w) | BIT(SSE3, w) | BIT(SSE4A, w) | BIT(ABM, w) | BIT(POPCNT, w) | BIT(CMPXCHG16B, w) | \
+                                 BIT(LAHFSAHF, w))
+#define ARCH_BTVER1(w)          (ARCH_AMDFAM10(w) | BIT(SSSE3, w))
+#define ARCH_BTVER2(w)          (ARCH_BTVER1(w) | ARCH_V2(w) | BIT(AES, w) | BIT(PCLMULQDQ, w) | BIT(AVX, w) | BIT(F16C, w) | \
+                                 BIT(BMI1, w) | BIT(MOVBE, w))
+#define ARCH_BDVER1(w)          (ARCH_V2(w) | BIT(SSE4A, w) | BIT(ABM, w) | BIT(AES, w) | BIT(PCLMULQDQ, w) | BIT(AVX, w) | BIT(FMA4, w))
+#define ARCH_BDVER2(w)          (ARCH_BDVER1(w) | BIT(FMA3, w) | BIT(F16C, w) | BIT(BMI1, w))
+#define ARCH_BDVER4(w)          (ARCH_BDVER2(w) | BIT(AVX2, w) | BIT(BMI2, w) | BIT(MOVBE, w) | BIT(RDRAND, w))
+#define ARCH_ZNVER1(w)          (ARCH_V3(w) | BIT(AES, w) | BIT(PCLMULQDQ, w) | BIT(RDRAND, w) | BIT(RDSEED, w) | BIT(ADX, w) | \
+                                 BIT(SHA, w) | BIT(CLFLUSHOPT, w) | BIT(SSE4A, w))
+#define ARCH_ZNVER2(w)          (ARCH_ZNVER1(w) | BIT(CLWB, w))
+#define ARCH_ZNVER3(w)          (ARCH_ZNVER2(w) | BIT(VAES, w) | BIT(VPCLMULQDQ, w))
+#define ARCH_ZNVER4(w)          (ARCH_ZNVER3(w) | X86_LEVEL_V4(w) | BIT(AVX512VNNI, w) | BIT(AVX512BF16, w) | BIT(AVX512VBMI, w) | \
+                                 BIT(AVX512VBMI2, w) | BIT(AVX512BITALG, w) | BIT(AVX512VPOPCNTDQ, w) | BIT(GFNI, w))
+#define ARCH_ZNVER5(w)          (ARCH_ZNVER4(w) | BIT(AVXVNNI, w))
+
+#define ARCH_MASK(arch)         { { arch(0), arch(1) } }
+
+typedef struct _s_target_arch {
+    char                isAMD;
+    int                 family;         /* display family & model, the extended fields already folded in */
+    int                 firstModel;
+    int                 lastModel;
+    int                 minStepping;
+    const char*         name;           /* GCC & Clang -march / -mtune name */
+    cpucaps_features_t  features;
+} target_arch_t;
+
+/* the first match wins, so steppings of one model go from the newest to the oldest */
+static const target_arch_t s_targetArchs[] = {
+    { 0, 6, 0x0F, 0x0F, 0, "core2",           ARCH_MASK(ARCH_CORE2) },
+    { 0, 6, 0x16, 0x17, 0, "core2",           ARCH_MASK(ARCH_CORE2) },
+    { 0, 6, 0x1D, 0x1D, 0, "core2",           ARCH_MASK(ARCH_CORE2) },
+    { 0, 6, 0x1C, 0x1C, 0, "bonnell",         ARCH_MASK(ARCH_BONNELL) },
+    { 0, 6, 0x26, 0x27, 0, "bonnell",         ARCH_MASK(ARCH_BONNELL) },
+    { 0, 6, 0x35, 0x36, 0, "bonnell",         ARCH_MASK(ARCH_BONNELL) },
+    { 0, 6, 0x1A, 0x1A, 0, "nehalem",         ARCH_MASK(ARCH_NEHALEM) },
+    { 0, 6, 0x1E, 0x1F, 0, "nehalem",         ARCH_MASK(ARCH_NEHALEM) },
+    { 0, 6, 0x2E, 0x2E, 0, "nehalem",         ARCH_MASK(ARCH_NEHALEM) },
+    { 0, 6, 0x25, 0x25, 0, "westmere",        ARCH_MASK(ARCH_WESTMERE) },
+    { 0, 6, 0x2C, 0x2C, 0, "westmere",        ARCH_MASK(ARCH_WESTMERE) },
+    { 0, 6, 0x2F, 0x2F, 0, "westmere",        ARCH_MASK(ARCH_WESTMERE) },
+    { 0, 6, 0x2A, 0x2A, 0, "sandybridge",     ARCH_MASK(ARCH_SANDYBRIDGE) },
+    { 0, 6, 0x2D, 0x2D, 0, "sandybridge",     ARCH_MASK(ARCH_SANDYBRIDGE) },
+    { 0, 6, 0x3A, 0x3A, 0, "ivybridge",       ARCH_MASK(ARCH_IVYBRIDGE) },
+    { 0, 6, 0x3E, 0x3E, 0, "ivybridge",       ARCH_MASK(ARCH_IVYBRIDGE) },
+    { 0, 6, 0x3C, 0x3C, 0, "haswell",         ARCH_MASK(ARCH_HASWELL) },
+    { 0, 6, 0x3F, 0x3F, 0, "haswell",         ARCH_MASK(ARCH_HASWELL) },
+    { 0, 6, 0x45, 0x46, 0, "haswell",         ARCH_MASK(ARCH_HASWELL) },
+    { 0, 6, 0x3D, 0x3D, 0, "broadwell",       ARCH_MASK(ARCH_BROADWELL) },
+    { 0, 6, 0x47, 0x47, 0, "broadwell",       ARCH_MASK(ARCH_BROADWELL) },
+    { 0, 6, 0x4F, 0x4F, 0, "broadwell",       ARCH_MASK(ARCH_BROADWELL) },
+    { 0, 6, 0x56, 0x56, 0, "broadwell",       ARCH_MASK(ARCH_BROADWELL) },
+    { 0, 6, 0x4E, 0x4E, 0, "skylake",         ARCH_MASK(ARCH_SKYLAKE) },
+    { 0, 6, 0x5E, 0x5E, 0, "skylake",         ARCH_MASK(ARCH_SKYLAKE) },
+    { 0, 6, 0x8E, 0x8E, 0, "skylake",         ARCH_MASK(ARCH_SKYLAKE) },
+    { 0, 6, 0x9E, 0x9E, 0, "skylake",         ARCH_MASK(ARCH_SKYLAKE) },
+    { 0, 6, 0xA5, 0xA6, 0, "skylake",         ARCH_MASK(ARCH_SKYLAKE) },
+    { 0, 6, 0x55, 0x55, 11, "cooperlake",     ARCH_MASK(ARCH_COOPERLAKE) },
+    { 0, 6, 0x55, 0x55, 5, "cascadelake",     ARCH_MASK(ARCH_CASCADELAKE) },
+    { 0, 6, 0x55, 0x55, 0, "skylake-avx512",  ARCH_MASK(ARCH_SKYLAKE_AVX512) },
+    { 0, 6, 0x66, 0x66, 0, "cannonlake",      ARCH_MASK(ARCH_CANNONLAKE) },
+    { 0, 6, 0x7D, 0x7E, 0, "icelake-client",  ARCH_MASK(ARCH_ICELAKE_CLIENT) },
+    { 0, 6, 0x6A, 0x6A, 0, "icelake-server",  ARCH_MASK(ARCH_ICELAKE_SERVER) },
+    { 0, 6, 0x6C, 0x6C, 0, "icelake-server",  ARCH_MASK(ARCH_ICELAKE_SERVER) },
+    { 0, 6, 0x8C, 0x8D, 0, "tigerlake",       ARCH_MASK(ARCH_TIGERLAKE) },
+    { 0, 6, 0xA7, 0xA7, 0, "rocketlake",      ARCH_MASK(ARCH_ICELAKE_CLIENT) },
+    { 0, 6, 0x8F, 0x8F, 0, "sapphirerapids",  ARCH_MASK(ARCH_SAPPHIRERAPIDS) },
+    { 0, 6, 0xCF, 0xCF, 0, "emeraldrapids",   ARCH_MASK(ARCH_SAPPHIRERAPIDS) },
+    { 0, 6, 0xAD, 0xAE, 0, "graniterapids",   ARCH_MASK(ARCH_GRANITERAPIDS) },
+    { 0, 6, 0x97, 0x97, 0, "alderlake",       ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0x9A, 0x9A, 0, "alderlake",       ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xB7, 0xB7, 0, "raptorlake",      ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xBA, 0xBA, 0, "raptorlake",      ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xBF, 0xBF, 0, "raptorlake",      ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xAA, 0xAA, 0, "meteorlake",      ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xAC, 0xAC, 0, "meteorlake",      ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xB5, 0xB5, 0, "arrowlake",       ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xC5, 0xC6, 0, "arrowlake",       ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xBD, 0xBD, 0, "lunarlake",       ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0x37, 0x37, 0, "silvermont",      ARCH_MASK(ARCH_SILVERMONT) },
+    { 0, 6, 0x4A, 0x4A, 0, "silvermont",      ARCH_MASK(ARCH_SILVERMONT) },
+    { 0, 6, 0x4D, 0x4D, 0, "silvermont",      ARCH_MASK(ARCH_SILVERMONT) },
+    { 0, 6, 0x5A, 0x5A, 0, "silvermont",      ARCH_MASK(ARCH_SILVERMONT) },
+    { 0, 6, 0x5D, 0x5D, 0, "silvermont",      ARCH_MASK(ARCH_SILVERMONT) },
+    { 0, 6, 0x5C, 0x5C, 0, "goldmont",        ARCH_MASK(ARCH_GOLDMONT) },
+    { 0, 6, 0x5F, 0x5F, 0, "goldmont",        ARCH_MASK(ARCH_GOLDMONT) },
+    { 0, 6, 0x7A, 0x7A, 0, "goldmont-plus",   ARCH_MASK(ARCH_GOLDMONT) },
+    { 0, 6, 0x86, 0x86, 0, "tremont",         ARCH_MASK(ARCH_TREMONT) },
+    { 0, 6, 0x96, 0x96, 0, "tremont",         ARCH_MASK(ARCH_TREMONT) },
+    { 0, 6, 0x9C, 0x9C, 0, "tremont",         ARCH_MASK(ARCH_TREMONT) },
+    { 0, 6, 0xAF, 0xAF, 0, "sierraforest",    ARCH_MASK(ARCH_ALDERLAKE) },
+    { 0, 6, 0xB6, 0xB6, 0, "grandridge",      ARCH_MASK(ARCH_ALDERLAKE) },
+    { 1, 0x10, 0x00, 0xFF, 0, "amdfam10",     ARCH_MASK(ARCH_AMDFAM10) },
+    { 1, 0x14, 0x00, 0xFF, 0, "btver1",       ARCH_MASK(ARCH_BTVER1) },
+    { 1, 0x15, 0x00, 0x0F, 0, "bdver1",       ARCH_MASK(ARCH_BDVER1) },
+    { 1, 0x15, 0x10, 0x2F, 0, "bdver2",       ARCH_MASK(ARCH_BDVER2) },
+    { 1, 0x15, 0x30, 0x3F, 0, "bdver3",       ARCH_MASK(ARCH_BDVER2) },
+    { 1, 0x15, 0x60, 0x7F, 0, "bdver4",       ARCH_MASK(ARCH_BDVER4) },
+    { 1, 0x16, 0x00, 0xFF, 0, "btver2",       ARCH_MASK(ARCH_BTVER2) },
+    { 1, 0x17, 0x00, 0x2F, 0, "znver1",       ARCH_MASK(ARCH_ZNVER1) },
+    { 1, 0x17, 0x30, 0xFF, 0, "znver2",       ARCH_MASK(ARCH_ZNVER2) },
+    { 1, 0x19, 0x10, 0x1F, 0, "znver4",       ARCH_MASK(ARCH_ZNVER4) },
+    { 1, 0x19, 0x60, 0x7F, 0, "znver4",       ARCH_MASK(ARCH_ZNVER4) },
+    { 1, 0x19, 0xA0, 0xAF, 0, "znver4",       ARCH_MASK(ARCH_ZNVER4) },
+    { 1, 0x19, 0x00, 0xFF, 0, "znver3",       ARCH_MASK(ARCH_ZNVER3) },
+    { 1, 0x1A, 0x00, 0xFF, 0, "znver5",       ARCH_MASK(ARCH_ZNVER5) }
+};
+
+/* names newer than GCC 8, what the older compilers get instead (NULL: the x86-64 level & -mtune=generic) */
+typedef struct _s_target_name {
+    const char*  name;
+    int          gccVersion;     /* the first GCC major version knowing the name */
+    const char*  olderName;
+} target_name_t;
+
+static const target_name_t s_targetNames[] = {
+    { "cannonlake",     8,  "skylake" },
+    { "icelake-client", 8,  "cannonlake" },
+    { "icelake-server", 8,  "icelake-client" },
+    { "cascadelake",    9,  "skylake-avx512" },
+    { "goldmont",       9,  "silvermont" },
+    { "goldmont-plus",  9,  "goldmont" },
+    { "tremont",        9,  "goldmont-plus" },
+    { "znver2",         9,  "znver1" },
+    { "cooperlake",     10, "cascadelake" },
+    { "tigerlake",      10, "icelake-client" },
+    { "rocketlake",     11, "icelake-client" },
+    { "sapphirerapids", 11, "cooperlake" },
+    { "alderlake",      11, NULL },
+    { "znver3",         11, "znver2" },
+    { "emeraldrapids",  13, "sapphirerapids" },
+    { "graniterapids",  13, "sapphirerapids" },
+    { "raptorlake",     13, "alderlake" },
+    { "meteorlake",     13, "alderlake" },
+    { "sierraforest",   13, "alderlake" },
+    { "grandridge",     13, "sierraforest" },
+    { "znver4",         13, "znver3" },
+    { "arrowlake",      14, "meteorlake" },
+    { "lunarlake",      14, "arrowlake" },
+    { "znver5",         14, "znver4" }
+};
+
+static const cpucaps_features_t s_levelArchs[] = {
+    { { 0, 0 } },
+    ARCH_MASK(X86_LEVEL_V1),
+    ARCH_MASK(ARCH_V2),
+    ARCH_MASK(ARCH_V3),
+    { { ARCH_V3(0) | X86_LEVEL_V4(0), ARCH_V3(1) | X86_LEVEL_V4(1) } }
+};
+
+static const char* const s_levelNames[] = { "", "x86-64", "x86-64-v2", "x86-64-v3", "x86-64-v4" };
+
+#define TARGET_LEVEL_NAMES_GCC  11      /* the first GCC knowing x86-64-v2 and up, Clang 12 */
+
+/* features with a -m<feature> switch (same in GCC & Clang), in the order they're emitted */
+typedef struct _s_target_feature {
+    int          feature;
+    const char*  flag;
+    int          gccVersion;     /* the first GCC major version knowing the switch, 0 if GCC 8 does */
+} target_feature_t;
+
+static const target_feature_t s_targetFeatures[] = {
+    { LIBCPUCAPS_FEATURE_SSE3,            "-msse3",               0 },
+    { LIBCPUCAPS_FEATURE_SSSE3,           "-mssse3",              0 },
+    { LIBCPUCAPS_FEATURE_SSE41,           "-msse4.1",             0 },
+    { LIBCPUCAPS_FEATURE_SSE42,           "-msse4.2",             0 },
+    { LIBCPUCAPS_FEATURE_SSE4A,           "-msse4a",              0 },
+    { LIBCPUCAPS_FEATURE_CMPXCHG16B,      "-mcx16",               0 },
+    { LIBCPUCAPS_FEATURE_LAHFSAHF,        "-msahf",               0 },
+    { LIBCPUCAPS_FEATURE_POPCNT,          "-mpopcnt",             0 },
+    { LIBCPUCAPS_FEATURE_ABM,             "-mlzcnt",              0 },
+    { LIBCPUCAPS_FEATURE_MOVBE,           "-mmovbe",              0 },
+    { LIBCPUCAPS_FEATURE_AES,             "-maes",                0 },
+    { LIBCPUCAPS_FEATURE_PCLMULQDQ,       "-mpclmul",             0 },
+    { LIBCPUCAPS_FEATURE_RDRAND,          "-mrdrnd",              0 },
+    { LIBCPUCAPS_FEATURE_RDSEED,          "-mrdseed",             0 },
+    { LIBCPUCAPS_FEATURE_ADX,             "-madx",                0 },
+    { LIBCPUCAPS_FEATURE_SHA,             "-msha",                0 },
+    { LIBCPUCAPS_FEATURE_CLFLUSHOPT,      "-mclflushopt",         0 },
+    { LIBCPUCAPS_FEATURE_CLWB,            "-mclwb",               0 },
+    { LIBCPUCAPS_FEATURE_WAITPKG,         "-mwaitpkg",            9 },
+    { LIBCPUCAPS_FEATURE_MONITORX,        "-mmwaitx",             0 },
+    { LIBCPUCAPS_FEATURE_AVX,             "-mavx",                0 },
+    { LIBCPUCAPS_FEATURE_AVX2,            "-mavx2",               0 },
+    { LIBCPUCAPS_FEATURE_F16C,            "-mf16c",               0 },
+    { LIBCPUCAPS_FEATURE_FMA3,            "-mfma",                0 },
+    { LIBCPUCAPS_FEATURE_FMA4,            "-mfma4",               0 },
+    { LIBCPUCAPS_FEATURE_BMI1,            "-mbmi",                0 },
+    { LIBCPUCAPS_FEATURE_BMI2,            "-mbmi2",               0 },
+    { LIBCPUCAPS_FEATURE_VAES,            "-mvaes",               0 },
+    { LIBCPUCAPS_FEATURE_VPCLMULQDQ,      "-mvpclmulqdq",         0 },
+    { LIBCPUCAPS_FEATURE_GFNI,            "-mgfni",               0 },
+    { LIBCPUCAPS_FEATURE_AVXVNNI,         "-mavxvnni",            11 },
+    { LIBCPUCAPS_FEATURE_AVX512F,         "-mavx512f",            0 },
+    { LIBCPUCAPS_FEATURE_AVX512CD,        "-mavx512cd",           0 },
+    { LIBCPUCAPS_FEATURE_AVX512BW,        "-mavx512bw",           0 },
+    { LIBCPUCAPS_FEATURE_AVX512DQ,        "-mavx512dq",           0 },
+    { LIBCPUCAPS_FEATURE_AVX512VL,        "-mavx512vl",           0 },
+    { LIBCPUCAPS_FEATURE_AVX512VNNI,      "-mavx512vnni",         0 },
+    { LIBCPUCAPS_FEATURE_AVX512BF16,      "-mavx512bf16",         10 },
+    { LIBCPUCAPS_FEATURE_AVX512FP16,      "-mavx512fp16",         12 },
+    { LIBCPUCAPS_FEATURE_AVX512VBMI,      "-mavx512vbmi",         0 },
+    { LIBCPUCAPS_FEATURE_AVX512VBMI2,     "-mavx512vbmi2",        0 },
+    { LIBCPUCAPS_FEATURE_AVX512BITALG,    "-mavx512bitalg",       0 },
+    { LIBCPUCAPS_FEATURE_AVX512VPOPCNTDQ, "-mavx512vpopcntdq",    0 },
+    { LIBCPUCAPS_FEATURE_AMX_TILE,        "-mamx-tile",           11 },
+    { LIBCPUCAPS_FEATURE_AMX_INT8,        "-mamx-int8",           11 },
+    { LIBCPUCAPS_FEATURE_AMX_BF16,        "-mamx-bf16",           11 },
+    { LIBCPUCAPS_FEATURE_AMX_FP16,        "-mamx-fp16",           13 }
+};
+
+static const target_arch_t* find_target_arch(const cpucaps_t* caps) {
+    int family = (unsigned char)caps->family;
+    int model = (unsigned char)caps->model;
+    size_t i;
+
+    if (family == 0xF) {
+        family += (unsigned char)caps->familyEx;
+    }
+    if (family == 6 || family >= 0xF) {
+        model |= (unsigned char)caps->modelEx << 4;
+    }
+
+    for (i = 0; i < sizeof(s_targetArchs) / sizeof(s_targetArchs[0]); ++i) {
+        if ((s_targetArchs[i].isAMD ? caps->isAMD : caps->isIntel) && family == s_targetArchs[i].family &&
+            model >= s_targetArchs[i].firstModel && model <= s_targetArchs[i].lastModel && caps->stepping >= s_targetArchs[i].minStepping) {
+            return &s_targetArchs[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const target_name_t* find_target_name(const char* name) {
+    size_t i;
+
+    for (i = 0; i < sizeof(s_targetNames) / sizeof(s_targetNames[0]); ++i) {
+        if (!strcmp(s_targetNames[i].name, name)) {
+            return &s_targetNames[i];
+        }
+    }
+    return NULL;
+}
+
+/* steps back to the newest arch the compiler knows by name, its features are a subset of the newer ones */
+static const target_arch_t* get_known_arch(const target_arch_t* arch, int gccVersion) {
+    const target_name_t* name;
+    size_t i;
+
+    while (arch && gccVersion && (name = find_target_name(arch->name)) && name->gccVersion > gccVersion) {
+        arch = NULL;
+        for (i = 0; name->olderName && i < sizeof(s_targetArchs) / sizeof(s_targetArchs[0]); ++i) {
+            if (!strcmp(s_targetArchs[i].name, name->olderName)) {
+                arch = &s_targetArchs[i];
+                break;
+            }
+        }
+    }
+    return arch;
+}
+
+int libcpucaps_GetTarget(const cpucaps_t* caps, int flags, cpucaps_target_t* target) {
+    const target_arch_t* arch;
+    const cpucaps_features_t* archFeatures;
+    const target_feature_t* feature;
+    int gccVersion = (flags & LIBCPUCAPS_TARGET_GCC_MASK) >> LIBCPUCAPS_TARGET_GCC_SHIFT;
+    int level;
+    size_t i;
+
+    if (!target) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(target, 0, sizeof(cpucaps_target_t));
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_CACHES);
+    }
+
+    if (!gccVersion) {
+        gccVersion = TARGET_DEFAULT_GCC;
+    }
+
+    /* older compilers only know the baseline level, the rest of it goes out as -m<feature> switches */
+    target->x86Level = libcpucaps_GetX86Level(caps);
+    level = (gccVersion && gccVersion < TARGET_LEVEL_NAMES_GCC && target->x86Level > LIBCPUCAPS_X86_LEVEL_V1) ?
+            LIBCPUCAPS_X86_LEVEL_V1 : target->x86Level;
+    archFeatures = &s_levelArchs[level];
+    strncpy(target->march, s_levelNames[level], LIBCPUCAPS_MAX_TARGET_NAME_LEN - 1);
+    strncpy(target->mtune, "generic", LIBCPUCAPS_MAX_TARGET_NAME_LEN - 1);
+
+    /* a cpu missing some of its generation's features still gets tuned for it, and so does one in a VM: */
+    /* a hypervisor may hide any extension, including those libcpucaps doesn't check */
+    arch = (flags & LIBCPUCAPS_TARGET_PORTABLE) ? NULL : get_known_arch(find_target_arch(caps), gccVersion);
+    if (arch) {
+        strncpy(target->mtune, arch->name, LIBCPUCAPS_MAX_TARGET_NAME_LEN - 1);
+        if (caps->hypervisor == LIBCPUCAPS_HYPERVISOR_NONE && libcpucaps_HasAll(caps, &arch->features)) {
+            strncpy(target->march, arch->name, LIBCPUCAPS_MAX_TARGET_NAME_LEN - 1);
+            target->isNamedArch = 1;
+            archFeatures = &arch->features;
+        }
+    }
+
+    for (i = 0; i < sizeof(s_targetFeatures) / sizeof(s_targetFeatures[0]); ++i) {
+        feature = &s_targetFeatures[i];
+        if (libcpucaps_HasFeature(caps, feature->feature) && (!gccVersion || feature->gccVersion <= gccVersion) &&
+            !((archFeatures->words[feature->feature / 64] >> (feature->feature % 64)) & 1)) {
+            libcpucaps_AddFeature(&target->extraFeatures, feature->feature);
+        }
+    }
+
+    target->l1CacheSizeKibiBytes = caps->L1d_sizeKibiBytes;
+    target->l1CacheLineSizeBytes = caps->L1d_lineSizeBytes;
+    target->l2CacheSizeKibiBytes = caps->L2_sizeKibiBytes;
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+
+typedef struct _s_text_buffer {
+    char*   text;
+    size_t  size;
+    size_t  length;
+    int     overflow;
+} text_buffer_t;
+
+static void append_text(text_buffer_t* buffer, const char* format, ...) {
+    va_list args;
+    int written;
+
+    if (buffer->overflow) {
+        return;
+    }
+
+    va_start(args, format);
+    written = vsnprintf(buffer->text + buffer->length, buffer->size - buffer->length, format, args);
+    va_end(args);
+
+    if (written < 0 || (size_t)written >= buffer->size - buffer->length) {
+        buffer->overflow = 1;
+    } else {
+        buffer->length += (size_t)written;
+    }
+}
+
+/* the separator goes before every item but the first */
+static void append_flags(text_buffer_t* buffer, const cpucaps_target_t* target, int flags, const char* before, const char* after,
+                         const char* separator) {
+    const char* next = "";
+    size_t i;
+
+    if (target->march[0]) {
+        append_text(buffer, "%s%s-march=%s%s", next, before, target->march, after);
+        next = separator;
+    }
+    append_text(buffer, "%s%s-mtune=%s%s", next, before, target->mtune, after);
+    next = separator;
+
+    for (i = 0; i < sizeof(s_targetFeatures) / sizeof(s_targetFeatures[0]); ++i) {
+        if ((target->extraFeatures.words[s_targetFeatures[i].feature / 64] >> (s_targetFeatures[i].feature % 64)) & 1) {
+            append_text(buffer, "%s%s%s%s", next, before, s_targetFeatures[i].flag, after);
+        }
+    }
+
+    if (flags & LIBCPUCAPS_TARGET_NO_PARAMS) {
+        return;
+    }
+    if (target->l1CacheSizeKibiBytes) {
+        append_text(buffer, "%s%s--param=l1-cache-size=%d%s", next, before, target->l1CacheSizeKibiBytes, after);
+    }
+    if (target->l1CacheLineSizeBytes) {
+        append_text(buffer, "%s%s--param=l1-cache-line-size=%d%s", next, before, target->l1CacheLineSizeBytes, after);
+    }
+    if (target->l2CacheSizeKibiBytes) {
+        append_text(buffer, "%s%s--param=l2-cache-size=%d%s", next, before, target->l2CacheSizeKibiBytes, after);
+    }
+}
+
+int libcpucaps_FormatTarget(const cpucaps_target_t* target, int flags, char* buffer, size_t bufferSize) {
+    text_buffer_t text;
+
+    if (!target || !buffer || !bufferSize) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    text.text = buffer;
+    text.size = bufferSize;
+    text.length = 0;
+    text.overflow = 0;
+    buffer[0] = 0;
+
+    if (flags & LIBCPUCAPS_TARGET_JSON) {
+        append_text(&text, "{\"march\": \"%s\", \"mtune\": \"%s\", \"x86Level\": %d, \"namedArch\": %s, ",
+                    target->march, target->mtune, target->x86Level, target->isNamedArch ? "true" : "false");
+        append_text(&text, "\"l1CacheSize\": %d, \"l1CacheLineSize\": %d, \"l2CacheSize\": %d, \"flags\": [",
+                    target->l1CacheSizeKibiBytes, target->l1CacheLineSizeBytes, target->l2CacheSizeKibiBytes);
+        append_flags(&text, target, flags, "\"", "\"", ", ");
+        append_text(&text, "]}");
+    } else {
+        append_flags(&text, target, flags, "", "", " ");
+    }
+
+    return text.overflow ? LIBCPUCAPS_ERROR_FAILED : LIBCPUCAPS_ERROR_OK;
+}
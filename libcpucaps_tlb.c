@@ -0,0 +1,383 @@
+#include "libcpucaps.h"
+#include "libcpucaps_tlb.h"
+#include "libcpucaps_internal.h"
+#include <stdio.h>     /* snprintf */
+#include <stdlib.h>    /* strtol */
+#include <string.h>    /* memset, strstr */
+
+#ifndef __linux__
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+#define TLB_DEFAULT_SYSFS_ROOT      "/sys"
+#define TLB_MAX_PATH                1024
+#define TLB_FILE_BUFFER_SIZE        256
+#define TLB_WORKING_SET_PER_PAGE    8       /* without TLB info, a page size is used once the working set spans this many */
+
+/* CPUID leaf 0x18 EBX page size bits */
+#define TLB_LEAF18_4K               0x1
+#define TLB_LEAF18_2M               0x2
+#define TLB_LEAF18_1G               0x8
+
+static const size_t s_pageBytes[LIBCPUCAPS_NUM_PAGE_SIZES] = {
+    (size_t)4 << 10, (size_t)2 << 20, (size_t)1 << 30
+};
+/* sysfs directories of the huge page pools */
+static const char* const s_hugepageDirs[LIBCPUCAPS_NUM_PAGE_SIZES] = {
+    NULL, "hugepages-2048kB", "hugepages-1048576kB"
+};
+
+static int get_large_page_size_wrapper(size_t* bytes);
+
+/* the TLB of the level & type, added on first use, NULL if the report is full */
+static cpucaps_tlb_t* get_tlb(cpucaps_tlb_report_t* report, int level, int type) {
+    cpucaps_tlb_t* tlb;
+    int i;
+
+    for (i = 0; i < report->numTLBs; ++i) {
+        if (report->tlbs[i].level == level && report->tlbs[i].type == type) {
+            return &report->tlbs[i];
+        }
+    }
+    if (report->numTLBs >= LIBCPUCAPS_MAX_TLBS) {
+        return NULL;
+    }
+
+    tlb = &report->tlbs[report->numTLBs++];
+    memset(tlb, 0, sizeof(cpucaps_tlb_t));
+    tlb->level = level;
+    tlb->type = type;
+    return tlb;
+}
+
+static void add_entries(cpucaps_tlb_t* tlb, int pageSize, int entries, int ways) {
+    if (tlb && entries > 0) {
+        tlb->entries[pageSize] += entries;
+        tlb->ways[pageSize] = ways;
+    }
+}
+
+/* https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sdm.html (CPUID leaf 18H) */
+static void query_intel_tlbs(uint32_t highestFunc, cpucaps_tlb_report_t* report) {
+    cpuid_result_t cpuidResult;
+    cpucaps_tlb_t* tlb;
+    uint32_t numSubleaves, subleaf;
+    int type, ways, entries;
+
+    if (highestFunc < 0x18) {
+        return;
+    }
+    cpuid_wrapper(0x18, 0, &cpuidResult);
+    numSubleaves = cpuidResult.eax + 1;
+
+    for (subleaf = 0; subleaf < numSubleaves; ++subleaf) {
+        if (subleaf) {
+            cpuid_wrapper(0x18, subleaf, &cpuidResult);
+        }
+        type = cpuidResult.edx & 0x1F;
+        if (type < LIBCPUCAPS_TLB_DATA || type > LIBCPUCAPS_TLB_STORE) {
+            continue;   /* 0 marks an invalid subleaf */
+        }
+
+        ways = (cpuidResult.ebx >> 16) & 0xFFFF;
+        entries = ways * (int)cpuidResult.ecx;
+        if (GET_BIT(cpuidResult.edx, 8)) {
+            ways = entries;     /* fully associative */
+        }
+
+        tlb = get_tlb(report, (cpuidResult.edx >> 5) & 0x7, type);
+        if (!tlb) {
+            break;
+        }
+        tlb->numSharingThreads = ((cpuidResult.edx >> 14) & 0xFFF) + 1;
+        if (cpuidResult.ebx & TLB_LEAF18_4K) {
+            add_entries(tlb, LIBCPUCAPS_PAGE_4K, entries, ways);
+        }
+        if (cpuidResult.ebx & TLB_LEAF18_2M) {
+            add_entries(tlb, LIBCPUCAPS_PAGE_2M, entries, ways);
+        }
+        if (cpuidResult.ebx & TLB_LEAF18_1G) {
+            add_entries(tlb, LIBCPUCAPS_PAGE_1G, entries, ways);
+        }
+    }
+}
+
+/* ways of AMD's 4-bit associativity field (L2 caches & TLBs), entries if fully associative */
+static int decode_amd_ways(uint32_t associativity, int entries) {
+    static const int ways[16] = { 0, 1, 2, 3, 4, 6, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0 };
+    return (associativity == 0xF) ? entries : ways[associativity & 0xF];
+}
+
+/* the L1 fields of leaf 0x80000005: 8-bit associativity (0xFF = full) & entries */
+static void add_amd_L1_entries(cpucaps_tlb_report_t* report, int pageSize, uint32_t reg) {
+    int dataEntries = (reg >> 16) & 0xFF, instructionEntries = reg & 0xFF;
+    uint32_t dataWays = (reg >> 24) & 0xFF, instructionWays = (reg >> 8) & 0xFF;
+
+    if (dataEntries) {
+        add_entries(get_tlb(report, 1, LIBCPUCAPS_TLB_DATA), pageSize, dataEntries, (dataWays == 0xFF) ? dataEntries : (int)dataWays);
+    }
+    if (instructionEntries) {
+        add_entries(get_tlb(report, 1, LIBCPUCAPS_TLB_INSTRUCTION), pageSize, instructionEntries,
+                    (instructionWays == 0xFF) ? instructionEntries : (int)instructionWays);
+    }
+}
+
+/* the fields of leaves 0x80000006 & 0x80000019: 4-bit associativity & 12-bit entries */
+static void add_amd_entries(cpucaps_tlb_report_t* report, int level, int pageSize, uint32_t reg) {
+    int dataEntries = (reg >> 16) & 0xFFF, instructionEntries = reg & 0xFFF;
+
+    if (dataEntries && (reg >> 28)) {
+        add_entries(get_tlb(report, level, LIBCPUCAPS_TLB_DATA), pageSize, dataEntries, decode_amd_ways(reg >> 28, dataEntries));
+    }
+    if (instructionEntries && ((reg >> 12) & 0xF)) {
+        add_entries(get_tlb(report, level, LIBCPUCAPS_TLB_INSTRUCTION), pageSize, instructionEntries,
+                    decode_amd_ways((reg >> 12) & 0xF, instructionEntries));
+    }
+}
+
+/* https://developer.amd.com/wp-content/resources/56255_3_03.PDF */
+static void query_amd_tlbs(uint32_t highestFuncEx, cpucaps_tlb_report_t* report) {
+    cpuid_result_t cpuidResult;
+
+    if (highestFuncEx >= 0x80000005) {
+        cpuid_wrapper(0x80000005, 0, &cpuidResult);
+        add_amd_L1_entries(report, LIBCPUCAPS_PAGE_4K, cpuidResult.ebx);
+        add_amd_L1_entries(report, LIBCPUCAPS_PAGE_2M, cpuidResult.eax);
+    }
+    if (highestFuncEx >= 0x80000006) {
+        cpuid_wrapper(0x80000006, 0, &cpuidResult);
+        add_amd_entries(report, 2, LIBCPUCAPS_PAGE_4K, cpuidResult.ebx);
+        add_amd_entries(report, 2, LIBCPUCAPS_PAGE_2M, cpuidResult.eax);
+    }
+    if (highestFuncEx >= 0x80000019) {
+        cpuid_wrapper(0x80000019, 0, &cpuidResult);
+        add_amd_entries(report, 1, LIBCPUCAPS_PAGE_1G, cpuidResult.eax);
+        add_amd_entries(report, 2, LIBCPUCAPS_PAGE_1G, cpuidResult.ebx);
+    }
+}
+
+/* data translations per level, the level with the most of them sets the reach */
+static void sum_reach(cpucaps_tlb_report_t* report) {
+    cpucaps_page_size_t* page;
+    const cpucaps_tlb_t* tlb;
+    int pageSize, i;
+
+    for (pageSize = 0; pageSize < LIBCPUCAPS_NUM_PAGE_SIZES; ++pageSize) {
+        page = &report->pageSizes[pageSize];
+        for (i = 0; i < report->numTLBs; ++i) {
+            tlb = &report->tlbs[i];
+            /* stores translate through the same STLB, the load TLB is the one reads hit */
+            if (tlb->type == LIBCPUCAPS_TLB_INSTRUCTION || tlb->type == LIBCPUCAPS_TLB_STORE) {
+                continue;
+            }
+            if (tlb->level == 1 && tlb->entries[pageSize] > page->L1_entries) {
+                page->L1_entries = tlb->entries[pageSize];
+            }
+            if (tlb->entries[pageSize] > page->lastLevelEntries) {
+                page->lastLevelEntries = tlb->entries[pageSize];
+            }
+        }
+        page->reachBytes = (uint64_t)page->lastLevelEntries * page->bytes;
+    }
+}
+
+static long read_count(const char* path) {
+    char buffer[TLB_FILE_BUFFER_SIZE];
+    return read_text_file(path, buffer, sizeof(buffer)) ? strtol(buffer, NULL, 10) : -1;
+}
+
+static void read_hugepages(const char* sysfsRoot, cpucaps_page_size_t* page, const char* dir) {
+    char path[TLB_MAX_PATH];
+    long reserved;
+
+    snprintf(path, sizeof(path), "%s/kernel/mm/hugepages/%s/nr_hugepages", sysfsRoot, dir);
+    page->numHugePages = read_count(path);
+    page->hasHugetlbPool = (page->numHugePages >= 0);
+    if (!page->hasHugetlbPool) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/kernel/mm/hugepages/%s/free_hugepages", sysfsRoot, dir);
+    page->numFreeHugePages = read_count(path);
+    /* reserved pages are promised to mappings that haven't touched them yet */
+    snprintf(path, sizeof(path), "%s/kernel/mm/hugepages/%s/resv_hugepages", sysfsRoot, dir);
+    reserved = read_count(path);
+    if (page->numFreeHugePages > 0 && reserved > 0) {
+        page->numFreeHugePages = (reserved < page->numFreeHugePages) ? page->numFreeHugePages - reserved : 0;
+    }
+}
+
+/* the selected mode is in brackets, e.g. "always [madvise] never" */
+static int read_thp_mode(const char* sysfsRoot) {
+    char path[TLB_MAX_PATH];
+    char buffer[TLB_FILE_BUFFER_SIZE];
+
+    snprintf(path, sizeof(path), "%s/kernel/mm/transparent_hugepage/enabled", sysfsRoot);
+    if (!read_text_file(path, buffer, sizeof(buffer))) {
+        return LIBCPUCAPS_THP_UNKNOWN;
+    }
+    if (strstr(buffer, "[always]")) {
+        return LIBCPUCAPS_THP_ALWAYS;
+    }
+    if (strstr(buffer, "[madvise]")) {
+        return LIBCPUCAPS_THP_MADVISE;
+    }
+    if (strstr(buffer, "[never]")) {
+        return LIBCPUCAPS_THP_NEVER;
+    }
+    return LIBCPUCAPS_THP_UNKNOWN;
+}
+
+int libcpucaps_GetTLBReport(const cpucaps_t* caps, const char* sysfsRoot, cpucaps_tlb_report_t* report) {
+    cpuid_result_t cpuidResult;
+    cpucaps_page_size_t* page;
+    uint32_t highestFunc, highestFuncEx;
+    size_t largePageBytes;
+    int pageSize;
+
+    if (!report) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    }
+    if (!sysfsRoot) {
+        sysfsRoot = TLB_DEFAULT_SYSFS_ROOT;
+    }
+    memset(report, 0, sizeof(cpucaps_tlb_report_t));
+
+    cpuid_wrapper(0, 0, &cpuidResult);
+    highestFunc = cpuidResult.eax;
+    cpuid_wrapper(0x80000000, 0, &cpuidResult);
+    highestFuncEx = cpuidResult.eax;
+
+    /* leaf 2 descriptors of older Intel cpus aren't decoded, 0xFF there points to leaf 0x18 anyway */
+    if (caps->isIntel) {
+        query_intel_tlbs(highestFunc, report);
+    } else if (caps->isAMD) {
+        query_amd_tlbs(highestFuncEx, report);
+    }
+
+    for (pageSize = 0; pageSize < LIBCPUCAPS_NUM_PAGE_SIZES; ++pageSize) {
+        page = &report->pageSizes[pageSize];
+        page->bytes = s_pageBytes[pageSize];
+        page->numHugePages = -1;
+        page->numFreeHugePages = -1;
+        if (s_hugepageDirs[pageSize]) {
+            read_hugepages(sysfsRoot, page, s_hugepageDirs[pageSize]);
+        }
+    }
+    report->pageSizes[LIBCPUCAPS_PAGE_4K].isSupported = 1;
+    /* 2M pages are a part of long mode paging, PSE gives 32-bit paging its 4M pages */
+    report->pageSizes[LIBCPUCAPS_PAGE_2M].isSupported = libcpucaps_HasFeature(caps, LIBCPUCAPS_FEATURE_LONGMODE) || libcpucaps_HasPSE(caps);
+    report->pageSizes[LIBCPUCAPS_PAGE_1G].isSupported = libcpucaps_HasPDPE1GB(caps);
+
+    /* Windows offers its large pages (with SeLockMemoryPrivilege) without telling how many are left */
+    if (get_large_page_size_wrapper(&largePageBytes)) {
+        for (pageSize = LIBCPUCAPS_PAGE_2M; pageSize < LIBCPUCAPS_NUM_PAGE_SIZES; ++pageSize) {
+            if (s_pageBytes[pageSize] == largePageBytes) {
+                report->pageSizes[pageSize].hasHugetlbPool = 1;
+            }
+        }
+    }
+
+    report->thpMode = read_thp_mode(sysfsRoot);
+    sum_reach(report);
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+uint64_t libcpucaps_GetTLBReach(const cpucaps_tlb_report_t* report, int pageSize) {
+    if (!report || pageSize < 0 || pageSize >= LIBCPUCAPS_NUM_PAGE_SIZES) {
+        return 0;
+    }
+    return report->pageSizes[pageSize].reachBytes;
+}
+
+/* LIBCPUCAPS_PAGE_SOURCE_xxx that can back the working set with the page size, -1 if none */
+static int get_page_source(const cpucaps_tlb_report_t* report, int pageSize, size_t workingSetBytes) {
+    const cpucaps_page_size_t* page = &report->pageSizes[pageSize];
+    uint64_t numPages;
+
+    if (pageSize == LIBCPUCAPS_PAGE_4K) {
+        return LIBCPUCAPS_PAGE_SOURCE_DEFAULT;
+    }
+    if (!page->isSupported) {
+        return -1;
+    }
+
+    /* the pool is a sure thing, THP only tries (and only has 2M pages) */
+    numPages = ((uint64_t)workingSetBytes + page->bytes - 1) / page->bytes;
+    if (page->hasHugetlbPool && (page->numFreeHugePages < 0 || (uint64_t)page->numFreeHugePages >= numPages)) {
+        return LIBCPUCAPS_PAGE_SOURCE_HUGETLB;
+    }
+    if (pageSize == LIBCPUCAPS_PAGE_2M && (report->thpMode == LIBCPUCAPS_THP_ALWAYS || report->thpMode == LIBCPUCAPS_THP_MADVISE)) {
+        return LIBCPUCAPS_PAGE_SOURCE_THP;
+    }
+    return -1;
+}
+
+int libcpucaps_RecommendPageSize(const cpucaps_tlb_report_t* report, size_t workingSetBytes, cpucaps_page_advice_t* advice) {
+    int sources[LIBCPUCAPS_NUM_PAGE_SIZES];
+    int best = LIBCPUCAPS_PAGE_4K, hasReach = 0, pageSize;
+
+    if (!report || !advice) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+
+    for (pageSize = 0; pageSize < LIBCPUCAPS_NUM_PAGE_SIZES; ++pageSize) {
+        sources[pageSize] = get_page_source(report, pageSize, workingSetBytes);
+        hasReach |= (sources[pageSize] >= 0 && report->pageSizes[pageSize].reachBytes);
+    }
+
+    if (hasReach) {
+        /* the smallest pages that cover it waste the least memory, else the most reach there is */
+        for (pageSize = 0; pageSize < LIBCPUCAPS_NUM_PAGE_SIZES; ++pageSize) {
+            if (sources[pageSize] < 0) {
+                continue;
+            }
+            if (report->pageSizes[pageSize].reachBytes >= (uint64_t)workingSetBytes) {
+                best = pageSize;
+                break;
+            }
+            if (report->pageSizes[pageSize].reachBytes > report->pageSizes[best].reachBytes) {
+                best = pageSize;
+            }
+        }
+    } else {
+        for (pageSize = 0; pageSize < LIBCPUCAPS_NUM_PAGE_SIZES; ++pageSize) {
+            if (sources[pageSize] >= 0 && (uint64_t)report->pageSizes[pageSize].bytes * TLB_WORKING_SET_PER_PAGE <= (uint64_t)workingSetBytes) {
+                best = pageSize;
+            }
+        }
+    }
+
+    advice->pageSize = best;
+    advice->pageBytes = report->pageSizes[best].bytes;
+    advice->source = sources[best];
+    advice->reachBytes = report->pageSizes[best].reachBytes;
+    advice->coversWorkingSet = advice->reachBytes && advice->reachBytes >= (uint64_t)workingSetBytes;
+
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+
+#ifdef __linux__
+
+/* the pools are read from sysfs */
+static int get_large_page_size_wrapper(size_t* bytes) {
+    (void)bytes;
+    return 0;
+}
+
+#else
+
+static int get_large_page_size_wrapper(size_t* bytes) {
+    *bytes = GetLargePageMinimum();
+    return *bytes != 0;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef LIBCPUCAPS_TLB_H_HEADER
+#define LIBCPUCAPS_TLB_H_HEADER
+
+/* optional TLB module: the translation caches of the cpu (Intel's leaf 0x18, AMD's 0x80000005, 0x80000006 */
+/* & 0x80000019) with the huge pages the OS offers, to size the pages of big tables & mappings so that */
+/* the TLBs cover them */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+
+/* page sizes */
+#define LIBCPUCAPS_PAGE_4K              0
+#define LIBCPUCAPS_PAGE_2M              1
+#define LIBCPUCAPS_PAGE_1G              2
+#define LIBCPUCAPS_NUM_PAGE_SIZES       3
+
+/* TLB types, as in CPUID leaf 0x18 */
+#define LIBCPUCAPS_TLB_DATA             1
+#define LIBCPUCAPS_TLB_INSTRUCTION      2
+#define LIBCPUCAPS_TLB_UNIFIED          3
+#define LIBCPUCAPS_TLB_LOAD             4   /* data TLB for loads only */
+#define LIBCPUCAPS_TLB_STORE            5   /* data TLB for stores only */
+
+/* transparent huge page modes (/sys/kernel/mm/transparent_hugepage/enabled) */
+#define LIBCPUCAPS_THP_UNKNOWN          0
+#define LIBCPUCAPS_THP_NEVER            1
+#define LIBCPUCAPS_THP_MADVISE          2   /* only for ranges marked with madvise(MADV_HUGEPAGE) */
+#define LIBCPUCAPS_THP_ALWAYS           3
+
+/* where the recommended pages come from */
+#define LIBCPUCAPS_PAGE_SOURCE_DEFAULT  0   /* regular pages */
+#define LIBCPUCAPS_PAGE_SOURCE_THP      1   /* transparent huge pages, best effort */
+#define LIBCPUCAPS_PAGE_SOURCE_HUGETLB  2   /* the reserved pool, MAP_HUGETLB | MAP_HUGE_2MB / 1GB or hugetlbfs */
+
+#define LIBCPUCAPS_MAX_TLBS             16
+
+/* one TLB, Intel lists a TLB per set of page sizes, these are merged by level & type */
+typedef struct _s_cpucaps_tlb {
+    int   level;
+    int   type;                                 /* LIBCPUCAPS_TLB_xxx */
+    int   entries[LIBCPUCAPS_NUM_PAGE_SIZES];   /* by LIBCPUCAPS_PAGE_xxx, 0 if it doesn't hold the size */
+                                                /* (on Intel the sizes of one leaf 0x18 entry share them) */
+    int   ways[LIBCPUCAPS_NUM_PAGE_SIZES];      /* equal to entries if fully associative */
+    int   numSharingThreads;                    /* logical cpus using the TLB, 0 if unknown */
+} cpucaps_tlb_t;
+
+typedef struct _s_cpucaps_page_size {
+    size_t    bytes;
+    int       isSupported;          /* by the cpu: 4K always, 2M in long mode or with PSE, 1G with PDPE1GB */
+    int       hasHugetlbPool;       /* the OS offers explicit huge pages of this size */
+    long      numHugePages;         /* pages in the pool, -1 if the OS doesn't tell */
+    long      numFreeHugePages;     /* not in use nor reserved, -1 if the OS doesn't tell */
+    int       L1_entries;           /* data translations of the size the L1 TLBs hold, 0 if unknown */
+    int       lastLevelEntries;     /* ... the level holding the most of them, 0 if unknown */
+    uint64_t  reachBytes;           /* memory those translations cover (lastLevelEntries * bytes) */
+} cpucaps_page_size_t;
+
+typedef struct _s_cpucaps_tlb_report {
+    int                   numTLBs;
+    cpucaps_tlb_t         tlbs[LIBCPUCAPS_MAX_TLBS];
+    cpucaps_page_size_t   pageSizes[LIBCPUCAPS_NUM_PAGE_SIZES];    /* by LIBCPUCAPS_PAGE_xxx */
+    int                   thpMode;                                  /* LIBCPUCAPS_THP_xxx */
+} cpucaps_tlb_report_t;
+
+typedef struct _s_cpucaps_page_advice {
+    int       pageSize;             /* LIBCPUCAPS_PAGE_xxx */
+    size_t    pageBytes;
+    int       source;               /* LIBCPUCAPS_PAGE_SOURCE_xxx */
+    uint64_t  reachBytes;           /* TLB reach with these pages, 0 if unknown */
+    int       coversWorkingSet;     /* 1 if the reach is at least the working set */
+} cpucaps_page_advice_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* reads the TLBs from CPUID and the huge page pools & THP mode from sysfsRoot (NULL means "/sys") */
+/* pass NULL caps to use the cached ones, returns LIBCPUCAPS_ERROR_xxx */
+/* hypervisors often hide the TLB leaves, the entries are 0 then */
+int libcpucaps_GetTLBReport(const cpucaps_t* caps, const char* sysfsRoot, cpucaps_tlb_report_t* report);
+
+/* bytes the data TLBs cover with pages of the size (LIBCPUCAPS_PAGE_xxx), 0 if unknown */
+uint64_t libcpucaps_GetTLBReach(const cpucaps_tlb_report_t* report, int pageSize);
+/* the smallest page size the cpu & OS provide whose TLB reach covers the working set, else the one */
+/* with the largest reach; without TLB info the largest page an 8th of the working set fits */
+/* returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_RecommendPageSize(const cpucaps_tlb_report_t* report, size_t workingSetBytes, cpucaps_page_advice_t* advice);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_TLB_H_HEADER */
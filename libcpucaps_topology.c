@@ -0,0 +1,1213 @@
+﻿#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+
+#include "libcpucaps.h"
+#include "libcpucaps_internal.h"
+#include <stdio.h>
+#include <stdlib.h>    /* malloc, calloc, free, strtol, qsort */
+#include <string.h>    /* memcpy, memset, memcmp, strncmp */
+
+#ifdef __linux__
+
+#include <fcntl.h>     /* open, O_NOFOLLOW */
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>  /* fstat */
+#include <unistd.h>
+
+#else
+
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#endif
+
+/* how the x2APIC ID of a logical cpu is obtained */
+#define TOPOLOGY_METHOD_EXTENDED    0   /* Intel's leaf 0x1F / 0xB (also on recent AMD) */
+#define TOPOLOGY_METHOD_AMD         1   /* AMD's 0x8000001E */
+#define TOPOLOGY_METHOD_LEGACY      2   /* initial APIC ID from leaf 1 */
+
+#define MAX_CACHE_DESCRIPTORS       8
+#define NUM_CORE_TYPE_SETS          3   /* P-cores, E-cores, one thread per P-core */
+
+typedef struct _s_topology_shifts {
+    int      method;
+    uint32_t topologyFunc;
+    uint32_t cacheFunc;     /* Intel's leaf 4, AMD's 0x8000001D or 0 */
+    uint32_t smtShift;
+    uint32_t coreShift;
+    uint32_t moduleShift;
+    uint32_t tileShift;
+    uint32_t dieShift;
+    int      isHybrid;      /* core types differ, leaf 0x1A tells them apart */
+} topology_shifts_t;
+
+/* what a pinned thread reads on its own cpu */
+typedef struct _s_cpu_probe {
+    const topology_shifts_t* shifts;
+    int      cpuIndex;
+    int      isAllowed;
+    int      isValid;
+    int      fromOS;
+    uint32_t x2apicID;
+    uint32_t nodeID;
+    int      coreType;
+    uint32_t nativeModelID;
+    int      numCaches;
+    cpuid_result_t caches[MAX_CACHE_DESCRIPTORS];
+} cpu_probe_t;
+
+
+/* https://www.intel.com/content/dam/develop/external/us/en/documents/intel-64-architecture-processor-topology-enumeration.pdf */
+/* Extended Topology Enumeration Leaf (0xB) & V2 Extended Topology Enumeration Leaf (0x1F) */
+/* In theory we should be able to just while (1) {} and break of level type == 0 */
+/*   but it's better to cap our iterations for sanity */
+#define MAX_INTEL_TOPOLOGY_ITERATIONS   7
+static void query_topology_shifts(topology_shifts_t* shifts) {
+    uint32_t highestFunc, highestFuncEx, level, levelType, nextShift, logicalPerPackage, coresPerPackage;
+    uint32_t levelShifts[6];
+    cpuid_result_t cpuidResult;
+
+    memset(shifts, 0, sizeof(topology_shifts_t));
+    memset(levelShifts, 0xFF, sizeof(levelShifts));
+
+    cpuid_wrapper(0, 0, &cpuidResult);
+    highestFunc = cpuidResult.eax;
+    cpuid_wrapper(0x80000000, 0, &cpuidResult);
+    highestFuncEx = cpuidResult.eax;
+
+    /* deterministic cache parameters, both leaves have the same layout */
+    cpuid_wrapper(0x80000001, 0, &cpuidResult);
+    if (highestFuncEx >= 0x8000001D && GET_BIT(cpuidResult.ecx, 22)) {
+        shifts->cacheFunc = 0x8000001D;
+    } else if (highestFunc >= 4) {
+        cpuid_wrapper(0, 0, &cpuidResult);
+        if (memcmp(&cpuidResult.ebx, "Auth", 4)) {  /* on AMD leaf 4 is reserved */
+            shifts->cacheFunc = 4;
+        }
+    }
+
+    /* Hybrid flag (leaf 7 EDX bit 15) means the "Native Model ID Enumeration Leaf" 0x1A is per core type */
+    if (highestFunc >= 0x1A) {
+        cpuid_wrapper(7, 0, &cpuidResult);
+        shifts->isHybrid = GET_BIT(cpuidResult.edx, 15);
+    }
+
+    shifts->method = TOPOLOGY_METHOD_LEGACY;
+    if (highestFunc >= 31) {
+        cpuid_wrapper(31, 0, &cpuidResult);
+        if (cpuidResult.ebx & 0xFFFF) {
+            shifts->topologyFunc = 31;
+        }
+    }
+    if (!shifts->topologyFunc && highestFunc >= 11) {
+        cpuid_wrapper(11, 0, &cpuidResult);
+        if (cpuidResult.ebx & 0xFFFF) {
+            shifts->topologyFunc = 11;
+        }
+    }
+
+    if (shifts->topologyFunc) {
+        shifts->method = TOPOLOGY_METHOD_EXTENDED;
+
+        for (level = 0; level < MAX_INTEL_TOPOLOGY_ITERATIONS; ++level) {
+            cpuid_wrapper(shifts->topologyFunc, level, &cpuidResult);
+
+            /* Level types:      */
+            /* 0: Invalid.       */
+            /* 1: SMT.           */
+            /* 2: Core.          */
+            /* 3: Module.        */
+            /* 4: Tile.          */
+            /* 5: Die.           */
+            /* 6 - 255: Reserved */
+            levelType = (cpuidResult.ecx >> 8) & 0xFF;
+            if (!levelType) {
+                break;
+            }
+
+            /* Bits 04 - 00: Number of bits to shift right on x2APIC ID to get a unique topology ID of the next level type*. */
+            /* All logical processors with the same next level ID share current level. */
+            nextShift = cpuidResult.eax & 0x1F;
+            if (levelType <= 5) {
+                levelShifts[levelType] = nextShift;
+            }
+        }
+
+        /* levels that are not enumerated take no bits, so they inherit the shift of the level below */
+        shifts->smtShift = (levelShifts[1] != ~0u) ? levelShifts[1] : 0;
+        shifts->coreShift = (levelShifts[2] != ~0u) ? levelShifts[2] : shifts->smtShift;
+        shifts->moduleShift = (levelShifts[3] != ~0u) ? levelShifts[3] : shifts->coreShift;
+        shifts->tileShift = (levelShifts[4] != ~0u) ? levelShifts[4] : shifts->moduleShift;
+        shifts->dieShift = (levelShifts[5] != ~0u) ? levelShifts[5] : shifts->tileShift;
+        return;
+    }
+
+    /* https://www.amd.com/system/files/TechDocs/25481.pdf */
+    /* If CPUID Fn8000_0001_ECX[TopologyExtensions]==0 then CPUID Fn8000_001E_E[D,C,B,A]X is reserved */
+    if (highestFuncEx >= 0x8000001E) {
+        cpuid_wrapper(0x80000001, 0, &cpuidResult);
+        if (GET_BIT(cpuidResult.ecx, 22)) {
+            shifts->method = TOPOLOGY_METHOD_AMD;
+
+            cpuid_wrapper(0x8000001E, 0, &cpuidResult);
+            shifts->smtShift = log2_ceil(((cpuidResult.ebx >> 8) & 0xFF) + 1);   /* ThreadsPerCore */
+
+            cpuid_wrapper(0x80000008, 0, &cpuidResult);
+            shifts->coreShift = (cpuidResult.ecx >> 12) & 0xF;                  /* ApicIdSize */
+            if (!shifts->coreShift) {
+                shifts->coreShift = log2_ceil((cpuidResult.ecx & 0xFF) + 1);
+            }
+            shifts->moduleShift = shifts->tileShift = shifts->dieShift = shifts->coreShift;
+            return;
+        }
+    }
+
+    /* the oldest way: logical processors & cores per package */
+    logicalPerPackage = 1;
+    coresPerPackage = 1;
+    if (highestFunc >= 1) {
+        cpuid_wrapper(1, 0, &cpuidResult);
+        if (GET_BIT(cpuidResult.edx, 28)) {    /* HTT */
+            logicalPerPackage = (cpuidResult.ebx >> 16) & 0xFF;
+        }
+    }
+    if (highestFunc >= 4) {
+        cpuid_wrapper(4, 0, &cpuidResult);
+        coresPerPackage = ((cpuidResult.eax >> 26) & 0x3F) + 1;
+    } else if (highestFuncEx >= 0x80000008) {
+        cpuid_wrapper(0x80000008, 0, &cpuidResult);
+        coresPerPackage = (cpuidResult.ecx & 0xFF) + 1;
+    }
+    if (!logicalPerPackage || logicalPerPackage < coresPerPackage) {
+        logicalPerPackage = coresPerPackage;
+    }
+
+    shifts->smtShift = log2_ceil(logicalPerPackage / coresPerPackage);
+    shifts->coreShift = log2_ceil(logicalPerPackage);
+    shifts->moduleShift = shifts->tileShift = shifts->dieShift = shifts->coreShift;
+}
+
+/* has to run on the probed cpu */
+static void probe_current_cpu(cpu_probe_t* probe) {
+    cpuid_result_t cpuidResult;
+    int subFunc;
+
+    if (probe->shifts->method == TOPOLOGY_METHOD_EXTENDED) {
+        cpuid_per_cpu_wrapper(probe->shifts->topologyFunc, 0, &cpuidResult);
+        probe->x2apicID = cpuidResult.edx;
+    } else if (probe->shifts->method == TOPOLOGY_METHOD_AMD) {
+        cpuid_per_cpu_wrapper(0x8000001E, 0, &cpuidResult);
+        probe->x2apicID = cpuidResult.eax;
+        probe->nodeID = cpuidResult.ecx & 0xFF;
+    } else {
+        cpuid_per_cpu_wrapper(1, 0, &cpuidResult);
+        probe->x2apicID = cpuidResult.ebx >> 24;
+    }
+
+    if (probe->shifts->isHybrid) {
+        cpuid_per_cpu_wrapper(0x1A, 0, &cpuidResult);
+        probe->coreType = (int)(cpuidResult.eax >> 24);
+        probe->nativeModelID = cpuidResult.eax & 0xFFFFFF;
+    }
+
+    /* on hybrid cpus cache sharing differs between core types, so every cpu reports its own */
+    for (subFunc = 0; probe->shifts->cacheFunc && subFunc < MAX_CACHE_DESCRIPTORS; ++subFunc) {
+        cpuid_per_cpu_wrapper(probe->shifts->cacheFunc, (uint32_t)subFunc, &probe->caches[subFunc]);
+        if (!(probe->caches[subFunc].eax & 0x1F)) {   /* Null - No more caches */
+            break;
+        }
+        ++probe->numCaches;
+    }
+
+    probe->isValid = 1;
+}
+
+
+#ifdef __linux__
+
+int get_cpu_capacity_wrapper(void) {
+    static volatile int s_capacity = 0;
+    int capacity = s_capacity;
+    size_t setSize;
+    cpu_set_t* set;
+
+    if (capacity) {
+        return capacity;
+    }
+
+    /* the kernel may be built for more cpus than configured, grow until it accepts our set */
+    capacity = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (capacity < CPU_WORD_BITS) {
+        capacity = CPU_WORD_BITS;
+    }
+    for (;;) {
+        setSize = CPU_ALLOC_SIZE(capacity);
+        set = CPU_ALLOC(capacity);
+        if (!set) {
+            break;
+        }
+        if (!sched_getaffinity(0, setSize, set) || capacity >= (1 << 20)) {
+            CPU_FREE(set);
+            break;
+        }
+        CPU_FREE(set);
+        capacity *= 2;
+    }
+
+    capacity = CPU_WORDS(capacity) * CPU_WORD_BITS;
+    s_capacity = capacity;
+    return capacity;
+}
+
+int get_thread_affinity_wrapper(uint64_t* words, int numWords) {
+    int cpu, numCPUs = numWords * CPU_WORD_BITS;
+    size_t setSize = CPU_ALLOC_SIZE(numCPUs);
+    cpu_set_t* set = CPU_ALLOC(numCPUs);
+
+    if (!set) {
+        return 0;
+    }
+
+    memset(words, 0, sizeof(uint64_t) * numWords);
+    CPU_ZERO_S(setSize, set);
+    if (sched_getaffinity(0, setSize, set)) {
+        CPU_FREE(set);
+        return 0;
+    }
+    for (cpu = 0; cpu < numCPUs; ++cpu) {
+        if (CPU_ISSET_S(cpu, setSize, set)) {
+            words[cpu / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu);
+        }
+    }
+
+    CPU_FREE(set);
+    return 1;
+}
+
+int set_thread_affinity_wrapper(const uint64_t* words, int numWords) {
+    int cpu, result, numCPUs = numWords * CPU_WORD_BITS;
+    size_t setSize = CPU_ALLOC_SIZE(numCPUs);
+    cpu_set_t* set = CPU_ALLOC(numCPUs);
+
+    if (!set) {
+        return 0;
+    }
+
+    CPU_ZERO_S(setSize, set);
+    for (cpu = 0; cpu < numCPUs; ++cpu) {
+        if (words[cpu / CPU_WORD_BITS] & CPU_WORD_BIT(cpu)) {
+            CPU_SET_S(cpu, setSize, set);
+        }
+    }
+    stats_count_affinity();
+    result = !sched_setaffinity(0, setSize, set);
+
+    CPU_FREE(set);
+    return result;
+}
+
+static void get_online_cpus_wrapper(uint64_t* words, int numWords) {
+    char buffer[4096];
+
+    if (read_text_file("/sys/devices/system/cpu/online", buffer, sizeof(buffer))) {
+        parse_cpu_list(buffer, words, numWords);
+    }
+}
+
+typedef struct _s_thread_start {
+    thread_proc_t proc;
+    void*         arg;
+} thread_start_t;
+
+static void* thread_start_proc(void* arg) {
+    thread_start_t start = *(thread_start_t*)arg;
+
+    free(arg);
+    start.proc(start.arg);
+    return NULL;
+}
+
+size_t start_thread_wrapper(thread_proc_t proc, void* arg, int cpuIndex) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    thread_start_t* start;
+    size_t setSize;
+    cpu_set_t* set = NULL;
+    int result;
+
+    start = (thread_start_t*)malloc(sizeof(thread_start_t));
+    if (!start || pthread_attr_init(&attr)) {
+        free(start);
+        return 0;
+    }
+    start->proc = proc;
+    start->arg = arg;
+
+    pthread_attr_setstacksize(&attr, (PTHREAD_STACK_MIN > 65536) ? PTHREAD_STACK_MIN : 65536);
+
+    /* the thread is created already pinned, so it never runs anywhere else */
+    result = 0;
+    if (cpuIndex >= 0) {
+        setSize = CPU_ALLOC_SIZE(cpuIndex + 1);
+        set = CPU_ALLOC(cpuIndex + 1);
+        if (set) {
+            CPU_ZERO_S(setSize, set);
+            CPU_SET_S(cpuIndex, setSize, set);
+            result = pthread_attr_setaffinity_np(&attr, setSize, set);
+        } else {
+            result = -1;
+        }
+    }
+    if (!result) {
+        result = pthread_create(&thread, &attr, thread_start_proc, start);
+    }
+    if (!result && cpuIndex >= 0) {
+        stats_count_pinned_thread();
+    }
+
+    pthread_attr_destroy(&attr);
+    if (set) {
+        CPU_FREE(set);
+    }
+    if (result) {
+        free(start);
+        return 0;
+    }
+
+    return (size_t)thread;
+}
+
+void join_thread_wrapper(size_t thread) {
+    pthread_join((pthread_t)thread, NULL);
+}
+
+static int get_current_cpu_wrapper(void) {
+    return sched_getcpu();
+}
+
+static void probe_core_types_from_os(cpu_probe_t* probes, int numProbes, const char* path, int coreType) {
+    char buffer[4096];
+    uint64_t* words;
+    int i, numWords;
+
+    if (!probes[0].shifts->isHybrid || !read_text_file(path, buffer, sizeof(buffer))) {
+        return;
+    }
+
+    numWords = CPU_WORDS(probes[numProbes - 1].cpuIndex + 1);
+    words = (uint64_t*)calloc((size_t)numWords, sizeof(uint64_t));
+    if (!words) {
+        return;
+    }
+
+    parse_cpu_list(buffer, words, numWords);
+    for (i = 0; i < numProbes; ++i) {
+        if (probes[i].fromOS && (words[probes[i].cpuIndex / CPU_WORD_BITS] & CPU_WORD_BIT(probes[i].cpuIndex))) {
+            probes[i].coreType = coreType;
+        }
+    }
+
+    free(words);
+}
+
+/* the kernel knows the full x2APIC ID of every online cpu, even of ones we are not allowed to run on */
+static void probe_cpus_from_os(cpu_probe_t* probes, int numProbes) {
+    FILE* file;
+    char line[256];
+    int i, cpuIndex = -1;
+    uint32_t apicID;
+
+    if (!numProbes) {
+        return;
+    }
+
+    file = fopen("/proc/cpuinfo", "r");
+    if (!file) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if (!strncmp(line, "processor", 9)) {
+            sscanf(strchr(line, ':') ? strchr(line, ':') + 1 : line, "%d", &cpuIndex);
+        } else if (!strncmp(line, "apicid", 6) && strchr(line, ':') && cpuIndex >= 0) {
+            if (sscanf(strchr(line, ':') + 1, "%u", &apicID) == 1) {
+                for (i = 0; i < numProbes; ++i) {
+                    if (probes[i].cpuIndex == cpuIndex && !probes[i].isValid) {
+                        probes[i].x2apicID = apicID;
+                        probes[i].isValid = 1;
+                        probes[i].fromOS = 1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    fclose(file);
+
+    /* the perf subsystem exposes which cpus belong to each core type */
+    probe_core_types_from_os(probes, numProbes, "/sys/devices/cpu_core/cpus", LIBCPUCAPS_CORE_TYPE_PERFORMANCE);
+    probe_core_types_from_os(probes, numProbes, "/sys/devices/cpu_atom/cpus", LIBCPUCAPS_CORE_TYPE_EFFICIENT);
+}
+
+#else /* Windows */
+
+int get_cpu_capacity_wrapper(void) {
+    return CPU_WORD_BITS;   /* processor groups are not supported, a process lives in a single group of up to 64 cpus */
+}
+
+int get_thread_affinity_wrapper(uint64_t* words, int numWords) {
+    DWORD_PTR processMask, systemMask;
+
+    memset(words, 0, sizeof(uint64_t) * numWords);
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        return 0;
+    }
+    words[0] = (uint64_t)processMask;
+    return 1;
+}
+
+int set_thread_affinity_wrapper(const uint64_t* words, int numWords) {
+    (void)numWords;
+    stats_count_affinity();
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)words[0]) != 0;
+}
+
+static void get_online_cpus_wrapper(uint64_t* words, int numWords) {
+    DWORD_PTR processMask, systemMask;
+
+    (void)numWords;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        words[0] |= (uint64_t)systemMask;
+    }
+}
+
+typedef struct _s_thread_start {
+    thread_proc_t proc;
+    void*         arg;
+} thread_start_t;
+
+static DWORD WINAPI thread_start_proc(LPVOID arg) {
+    thread_start_t start = *(thread_start_t*)arg;
+
+    free(arg);
+    start.proc(start.arg);
+    return 0;
+}
+
+size_t start_thread_wrapper(thread_proc_t proc, void* arg, int cpuIndex) {
+    HANDLE thread;
+    thread_start_t* start;
+
+    start = (thread_start_t*)malloc(sizeof(thread_start_t));
+    if (!start) {
+        return 0;
+    }
+    start->proc = proc;
+    start->arg = arg;
+
+    /* pinned before it starts running */
+    thread = CreateThread(NULL, 65536, thread_start_proc, start, CREATE_SUSPENDED, NULL);
+    if (!thread) {
+        free(start);
+        return 0;
+    }
+    if (cpuIndex >= 0 && (cpuIndex >= CPU_WORD_BITS || !SetThreadAffinityMask(thread, (DWORD_PTR)1 << cpuIndex))) {
+        TerminateThread(thread, 0);
+        CloseHandle(thread);
+        free(start);
+        return 0;
+    }
+    if (cpuIndex >= 0) {
+        stats_count_pinned_thread();
+    }
+    ResumeThread(thread);
+
+    return (size_t)thread;
+}
+
+void join_thread_wrapper(size_t thread) {
+    WaitForSingleObject((HANDLE)thread, INFINITE);
+    CloseHandle((HANDLE)thread);
+}
+
+static int get_current_cpu_wrapper(void) {
+    return (int)GetCurrentProcessorNumber();
+}
+
+static void probe_cpus_from_os(cpu_probe_t* probes, int numProbes) {
+    (void)probes;
+    (void)numProbes;
+}
+
+#endif
+
+static void probe_thread_proc(void* arg) {
+    cpu_probe_t* probe = (cpu_probe_t*)arg;
+
+    /* double check in case the OS disagrees with the requested affinity */
+    if (get_current_cpu_wrapper() == probe->cpuIndex) {
+        probe_current_cpu(probe);
+    }
+}
+
+/* one short-lived thread per cpu, each created already pinned to its cpu so nothing is migrated */
+static void probe_cpus_in_parallel(cpu_probe_t* probes, int numProbes) {
+    size_t* threads;
+    int i;
+
+    threads = (size_t*)calloc((size_t)(numProbes ? numProbes : 1), sizeof(size_t));
+    if (!threads) {
+        return;
+    }
+
+    for (i = 0; i < numProbes; ++i) {
+        if (probes[i].isAllowed && !probes[i].isValid) {
+            threads[i] = start_thread_wrapper(probe_thread_proc, &probes[i], probes[i].cpuIndex);
+        }
+    }
+    for (i = 0; i < numProbes; ++i) {
+        if (threads[i]) {
+            join_thread_wrapper(threads[i]);
+        }
+    }
+
+    free(threads);
+}
+
+/* last resort if threads can't be created: migrate the calling thread, restoring its affinity afterwards */
+static void probe_cpus_serially(cpu_probe_t* probes, int numProbes, int numWords) {
+    uint64_t* oldAffinity;
+    uint64_t* affinity;
+    int i, numLeft = 0;
+
+    /* nothing left that the threads couldn't probe, no need to touch the affinity */
+    for (i = 0; i < numProbes; ++i) {
+        numLeft += (probes[i].isAllowed && !probes[i].isValid);
+    }
+    if (!numLeft) {
+        return;
+    }
+
+    oldAffinity = (uint64_t*)calloc((size_t)numWords * 2, sizeof(uint64_t));
+    if (!oldAffinity) {
+        return;
+    }
+    affinity = oldAffinity + numWords;
+
+    if (!get_thread_affinity_wrapper(oldAffinity, numWords)) {
+        free(oldAffinity);
+        return;
+    }
+
+    for (i = 0; i < numProbes; ++i) {
+        if (probes[i].isAllowed && !probes[i].isValid) {
+            memset(affinity, 0, sizeof(uint64_t) * numWords);
+            affinity[probes[i].cpuIndex / CPU_WORD_BITS] = CPU_WORD_BIT(probes[i].cpuIndex);
+            if (set_thread_affinity_wrapper(affinity, numWords)) {
+                probe_current_cpu(&probes[i]);
+            }
+        }
+    }
+
+    set_thread_affinity_wrapper(oldAffinity, numWords);
+    free(oldAffinity);
+}
+
+
+static uint32_t extract_level_id(uint32_t x2apicID, uint32_t lowShift, uint32_t highShift) {
+    if (highShift <= lowShift) {
+        return 0;
+    }
+    return (x2apicID >> lowShift) & ((highShift - lowShift >= 32) ? ~0u : ((1u << (highShift - lowShift)) - 1));
+}
+
+typedef struct _s_sort_key {
+    uint64_t key;
+    int      position;
+} sort_key_t;
+
+static int compare_sort_keys(const void* a, const void* b) {
+    const sort_key_t* ka = (const sort_key_t*)a;
+    const sort_key_t* kb = (const sort_key_t*)b;
+    if (ka->key != kb->key) {
+        return (ka->key < kb->key) ? -1 : 1;
+    }
+    return ka->position - kb->position;
+}
+
+/* numbers distinct keys 0 ... N-1 in ascending key order, returns N */
+static int enumerate_keys(sort_key_t* keys, int numKeys, int* indices) {
+    int i, count = 0;
+
+    qsort(keys, (size_t)numKeys, sizeof(sort_key_t), compare_sort_keys);
+    for (i = 0; i < numKeys; ++i) {
+        if (i && keys[i].key != keys[i - 1].key) {
+            ++count;
+        }
+        indices[keys[i].position] = count;
+    }
+
+    return numKeys ? (count + 1) : 0;
+}
+
+/* cache instances are told apart by the x2APIC ID bits above the ones of the logical cpus sharing it */
+static uint64_t cache_instance_key(const cpuid_result_t* descriptor, uint32_t x2apicID) {
+    uint32_t level = (descriptor->eax >> 5) & 0x7;
+    uint32_t type = descriptor->eax & 0x1F;
+    uint32_t shareShift = log2_ceil(((descriptor->eax >> 14) & 0xFFF) + 1);
+
+    return ((uint64_t)level << 60) | ((uint64_t)type << 52) | ((shareShift >= 32) ? 0 : (x2apicID >> shareShift));
+}
+
+static void fill_cache(cpucaps_cache_t* cache, const cpuid_result_t* descriptor) {
+    uint64_t lineSize, linePartitions, assocWays, setsNum;
+
+    lineSize = (descriptor->ebx & 0xFFF) + 1;
+    linePartitions = ((descriptor->ebx >> 12) & 0x3FF) + 1;
+    assocWays = ((descriptor->ebx >> 22) & 0x3FF) + 1;
+    setsNum = (uint64_t)descriptor->ecx + 1;
+
+    cache->level = (int)((descriptor->eax >> 5) & 0x7);
+    cache->type = (int)(descriptor->eax & 0x1F);
+    cache->lineSizeBytes = (int)lineSize;
+    cache->partitions = (int)linePartitions;
+    cache->ways = GET_BIT(descriptor->eax, 9) ? 0 : (int)assocWays;     /* 0 means fully associative */
+    cache->sets = (int)setsNum;
+    cache->sizeKibiBytes = (int)((assocWays * linePartitions * lineSize * setsNum) / 1024);
+    cache->isInclusive = (char)GET_BIT(descriptor->edx, 1);
+}
+
+static void set_cpu_cache_index(cpucaps_cpu_t* cpu, const cpucaps_cache_t* cache, int index) {
+    if (cache->level == 1 && cache->type == LIBCPUCAPS_CACHE_DATA) {
+        cpu->L1d_cacheIndex = index;
+    } else if (cache->level == 1 && cache->type == LIBCPUCAPS_CACHE_INSTRUCTION) {
+        cpu->L1i_cacheIndex = index;
+    } else if (cache->level == 2) {
+        cpu->L2_cacheIndex = index;
+    } else if (cache->level == 3) {
+        cpu->L3_cacheIndex = index;
+    }
+}
+
+/* SMT siblings share an L1d, and an L1d belongs to one core, guests often get one of these wrong */
+/* (e.g. threads=1 with the host's leaf 4 saying two threads share the L1), scratch has numCPUs ints */
+static int is_core_split_consistent(const cpucaps_topology_t* topology, int* scratch) {
+    const cpucaps_cpu_t* cpu;
+    int i, numL1d;
+
+    /* L1d instance of every core */
+    for (i = 0; i < topology->numCPUs; ++i) {
+        scratch[i] = -1;
+    }
+    for (i = 0; i < topology->numCPUs; ++i) {
+        cpu = &topology->cpus[i];
+        if (cpu->L1d_cacheIndex < 0) {
+            continue;
+        }
+        if (scratch[cpu->coreIndex] >= 0 && scratch[cpu->coreIndex] != cpu->L1d_cacheIndex) {
+            return 0;
+        }
+        scratch[cpu->coreIndex] = cpu->L1d_cacheIndex;
+    }
+
+    /* as many L1d instances as cores */
+    for (i = 0, numL1d = 0; i < topology->numCaches; ++i) {
+        if (topology->caches[i].level == 1 && topology->caches[i].type == LIBCPUCAPS_CACHE_DATA) {
+            ++numL1d;
+        }
+    }
+    return !numL1d || numL1d == topology->numCores;
+}
+
+/* a single block - the header, the cpus array, the caches array and the cpu sets storage */
+cpucaps_topology_t* alloc_topology(int numCPUs, int numCaches, int maxCPUIndex) {
+    cpucaps_topology_t* result;
+    uint64_t* words;
+    size_t blockSize, wordsOffset;
+    int cpuWords, i;
+
+    cpuWords = CPU_WORDS(maxCPUIndex);
+    blockSize = sizeof(cpucaps_topology_t) + sizeof(cpucaps_cpu_t) * numCPUs + sizeof(cpucaps_cache_t) * numCaches;
+    wordsOffset = (blockSize + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    blockSize = wordsOffset + sizeof(uint64_t) * cpuWords * (numCaches + NUM_CORE_TYPE_SETS);
+
+    result = (cpucaps_topology_t*)calloc(1, blockSize);
+    if (!result) {
+        return NULL;
+    }
+
+    result->numCPUs = numCPUs;
+    result->numCaches = numCaches;
+    result->maxCPUIndex = maxCPUIndex;
+    result->cpus = (cpucaps_cpu_t*)(result + 1);
+    result->caches = (cpucaps_cache_t*)(result->cpus + numCPUs);
+    words = (uint64_t*)((char*)result + wordsOffset);
+    for (i = 0; i < numCaches; ++i) {
+        result->caches[i].cpus.numWords = cpuWords;
+        result->caches[i].cpus.words = words + (size_t)i * cpuWords;
+    }
+    words += (size_t)numCaches * cpuWords;
+    result->pcoreCPUs.numWords = result->ecoreCPUs.numWords = result->pcorePrimaryCPUs.numWords = cpuWords;
+    result->pcoreCPUs.words = words;
+    result->ecoreCPUs.words = words + cpuWords;
+    result->pcorePrimaryCPUs.words = words + (size_t)cpuWords * 2;
+
+    return result;
+}
+
+int libcpucaps_GetTopology(cpucaps_topology_t** topology) {
+    topology_shifts_t shifts;
+    cpu_probe_t* probes;
+    cpu_probe_t localProbe;
+    const cpu_probe_t* cacheDonor;
+    const cpu_probe_t* probe;
+    cpucaps_topology_t* result;
+    cpucaps_cpu_t* cpu;
+    cpucaps_cache_t* cache;
+    sort_key_t* keys;
+    sort_key_t* cacheKeys;
+    int* indices;
+    int* cacheIndices;
+    uint64_t* allowed;
+    uint64_t* online;
+    int capacity, numWords, numProbes, numCPUs, numCacheKeys, numCaches, maxCPUIndex, isVirtual, i, j, k, n;
+
+    if (!topology) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    *topology = NULL;
+
+    isVirtual = is_hypervisor_present();
+
+    query_topology_shifts(&shifts);
+
+    capacity = get_cpu_capacity_wrapper();
+    numWords = CPU_WORDS(capacity);
+    allowed = (uint64_t*)calloc((size_t)numWords * 2, sizeof(uint64_t));
+    if (!allowed) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    online = allowed + numWords;
+
+    get_thread_affinity_wrapper(allowed, numWords);
+    get_online_cpus_wrapper(online, numWords);
+
+    numProbes = 0;
+    for (i = 0; i < numWords; ++i) {
+        online[i] |= allowed[i];
+        numProbes += popcount64(online[i]);
+    }
+
+    probes = (cpu_probe_t*)calloc((size_t)(numProbes ? numProbes : 1), sizeof(cpu_probe_t));
+    if (!probes) {
+        free(allowed);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    for (i = 0, j = 0; i < capacity && j < numProbes; ++i) {
+        if (online[i / CPU_WORD_BITS] & CPU_WORD_BIT(i)) {
+            probes[j].shifts = &shifts;
+            probes[j].cpuIndex = i;
+            probes[j].isAllowed = (allowed[i / CPU_WORD_BITS] & CPU_WORD_BIT(i)) != 0;
+            ++j;
+        }
+    }
+
+    /* in a VM pinning a thread to every vCPU costs a VM exit per leaf & cpu, and reads back nothing more */
+    /* than the topology the hypervisor made up and the OS already knows, so the OS goes first there */
+    memset(&localProbe, 0, sizeof(localProbe));
+    localProbe.shifts = &shifts;
+    if (isVirtual) {
+        probe_cpus_from_os(probes, numProbes);
+        probe_current_cpu(&localProbe);
+    }
+    probe_cpus_in_parallel(probes, numProbes);
+    probe_cpus_serially(probes, numProbes, numWords);
+    probe_cpus_from_os(probes, numProbes);
+    free(allowed);
+
+    /* cpus we couldn't run on borrow cache descriptors of the first probed one */
+    cacheDonor = localProbe.numCaches ? &localProbe : NULL;
+    for (i = 0; i < numProbes && !cacheDonor; ++i) {
+        if (probes[i].isValid && probes[i].numCaches) {
+            cacheDonor = &probes[i];
+        }
+    }
+
+    numCPUs = 0;
+    numCacheKeys = 0;
+    maxCPUIndex = 0;
+    for (i = 0; i < numProbes; ++i) {
+        if (probes[i].isValid) {
+            if (!probes[i].numCaches && cacheDonor) {
+                probes[i].numCaches = cacheDonor->numCaches;
+                memcpy(probes[i].caches, cacheDonor->caches, sizeof(probes[i].caches));
+            }
+            numCacheKeys += probes[i].numCaches;
+            maxCPUIndex = probes[i].cpuIndex + 1;
+            ++numCPUs;
+        }
+    }
+    if (!numCPUs) {
+        free(probes);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    keys = (sort_key_t*)calloc((size_t)numCPUs, sizeof(sort_key_t));
+    indices = (int*)calloc((size_t)numCPUs, sizeof(int));
+    cacheKeys = (sort_key_t*)calloc((size_t)(numCacheKeys ? numCacheKeys : 1), sizeof(sort_key_t));
+    cacheIndices = (int*)calloc((size_t)(numCacheKeys ? numCacheKeys : 1), sizeof(int));
+    if (!keys || !indices || !cacheKeys || !cacheIndices) {
+        free(keys);
+        free(indices);
+        free(cacheKeys);
+        free(cacheIndices);
+        free(probes);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    /* every (cpu, cache descriptor) pair maps to one cache instance */
+    for (i = 0, n = 0; i < numProbes; ++i) {
+        for (k = 0; probes[i].isValid && k < probes[i].numCaches; ++k, ++n) {
+            cacheKeys[n].key = cache_instance_key(&probes[i].caches[k], probes[i].x2apicID);
+            cacheKeys[n].position = n;
+        }
+    }
+    numCaches = enumerate_keys(cacheKeys, numCacheKeys, cacheIndices);
+
+    result = alloc_topology(numCPUs, numCaches, maxCPUIndex);
+    if (!result) {
+        free(keys);
+        free(indices);
+        free(cacheKeys);
+        free(cacheIndices);
+        free(probes);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    result->smtShift = (int)shifts.smtShift;
+    result->coreShift = (int)shifts.coreShift;
+    result->moduleShift = (int)shifts.moduleShift;
+    result->tileShift = (int)shifts.tileShift;
+    result->dieShift = (int)shifts.dieShift;
+    result->isHybrid = shifts.isHybrid;
+
+    for (i = 0, j = 0; i < numProbes; ++i) {
+        if (!probes[i].isValid) {
+            continue;
+        }
+
+        cpu = &result->cpus[j++];
+        cpu->cpuIndex = probes[i].cpuIndex;
+        cpu->x2apicID = probes[i].x2apicID;
+        cpu->isAllowed = (char)probes[i].isAllowed;
+        cpu->fromOS = (char)probes[i].fromOS;
+
+        cpu->smtID = extract_level_id(cpu->x2apicID, 0, shifts.smtShift);
+        cpu->coreID = extract_level_id(cpu->x2apicID, shifts.smtShift, shifts.coreShift);
+        cpu->moduleID = extract_level_id(cpu->x2apicID, shifts.coreShift, shifts.moduleShift);
+        cpu->tileID = extract_level_id(cpu->x2apicID, shifts.moduleShift, shifts.tileShift);
+        cpu->dieID = (shifts.method == TOPOLOGY_METHOD_AMD && !probes[i].fromOS) ? probes[i].nodeID :
+                     extract_level_id(cpu->x2apicID, shifts.tileShift, shifts.dieShift);
+        cpu->packageID = (shifts.dieShift >= 32) ? 0 : (cpu->x2apicID >> shifts.dieShift);
+
+        /* without hybrid there's only one core type, and it's the fastest one available */
+        cpu->coreType = shifts.isHybrid ? probes[i].coreType : LIBCPUCAPS_CORE_TYPE_PERFORMANCE;
+        cpu->nativeModelID = probes[i].nativeModelID;
+
+        cpu->L1d_cacheIndex = cpu->L1i_cacheIndex = cpu->L2_cacheIndex = cpu->L3_cacheIndex = -1;
+    }
+
+    /* join the cache instances with the cpus sharing them */
+    for (i = 0, j = 0, n = 0; i < numProbes; ++i) {
+        probe = &probes[i];
+        if (!probe->isValid) {
+            continue;
+        }
+
+        cpu = &result->cpus[j++];
+        for (k = 0; k < probe->numCaches; ++k, ++n) {
+            cache = &result->caches[cacheIndices[n]];
+            if (!cache->numCPUs) {
+                fill_cache(cache, &probe->caches[k]);
+            }
+            cache->cpus.words[cpu->cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu->cpuIndex);
+            ++cache->numCPUs;
+
+            set_cpu_cache_index(cpu, cache, cacheIndices[n]);
+        }
+    }
+
+    /* duplicate x2APIC IDs mean the IDs can't tell cores apart, so every cpu is a core of its own */
+    for (i = 0; i < numCPUs; ++i) {
+        keys[i].key = result->cpus[i].x2apicID;
+        keys[i].position = i;
+    }
+    if (enumerate_keys(keys, numCPUs, indices) < numCPUs) {
+        result->confidence = LIBCPUCAPS_TOPOLOGY_CONFIDENCE_LOW;
+        result->numCores = numCPUs;
+        for (i = 0; i < numCPUs; ++i) {
+            result->cpus[i].coreIndex = i;
+        }
+    } else {
+        /* everything above the SMT bits identifies a physical core system-wide */
+        for (i = 0; i < numCPUs; ++i) {
+            keys[i].key = (shifts.smtShift >= 32) ? 0 : (result->cpus[i].x2apicID >> shifts.smtShift);
+            keys[i].position = i;
+        }
+        result->numCores = enumerate_keys(keys, numCPUs, indices);
+        for (i = 0; i < numCPUs; ++i) {
+            result->cpus[i].coreIndex = indices[i];
+        }
+        result->confidence = is_core_split_consistent(result, indices) ? (isVirtual ? LIBCPUCAPS_TOPOLOGY_CONFIDENCE_VIRTUAL :
+                             LIBCPUCAPS_TOPOLOGY_CONFIDENCE_HIGH) : LIBCPUCAPS_TOPOLOGY_CONFIDENCE_LOW;
+    }
+
+    /* core type masks, the lowest numbered sibling stands for the whole P-core */
+    memset(indices, 0, sizeof(int) * numCPUs);
+    for (i = 0; i < numCPUs; ++i) {
+        cpu = &result->cpus[i];
+        if (cpu->coreType == LIBCPUCAPS_CORE_TYPE_PERFORMANCE) {
+            result->pcoreCPUs.words[cpu->cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu->cpuIndex);
+            if (!indices[cpu->coreIndex]) {
+                result->pcorePrimaryCPUs.words[cpu->cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu->cpuIndex);
+                indices[cpu->coreIndex] = 1;
+            }
+        } else if (cpu->coreType == LIBCPUCAPS_CORE_TYPE_EFFICIENT) {
+            result->ecoreCPUs.words[cpu->cpuIndex / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu->cpuIndex);
+        }
+    }
+
+    for (i = 0; i < numCPUs; ++i) {
+        keys[i].key = result->cpus[i].packageID;
+        keys[i].position = i;
+    }
+    result->numPackages = enumerate_keys(keys, numCPUs, indices);
+
+    free(keys);
+    free(indices);
+    free(cacheKeys);
+    free(cacheIndices);
+    free(probes);
+
+    *topology = result;
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+void libcpucaps_FreeTopology(cpucaps_topology_t* topology) {
+    free(topology);
+}
+
+
+int libcpucaps_CpuSetHas(const cpucaps_cpuset_t* set, int cpuIndex) {
+    if (!set || cpuIndex < 0 || cpuIndex >= set->numWords * CPU_WORD_BITS) {
+        return 0;
+    }
+    return (set->words[cpuIndex / CPU_WORD_BITS] & CPU_WORD_BIT(cpuIndex)) != 0;
+}
+
+int libcpucaps_CpuSetCount(const cpucaps_cpuset_t* set) {
+    int i, count = 0;
+
+    for (i = 0; set && i < set->numWords; ++i) {
+        count += popcount64(set->words[i]);
+    }
+    return count;
+}
+
+
+int read_text_file(const char* path, char* buffer, size_t bufferSize) {
+    FILE* file;
+    size_t length;
+
+    if (!bufferSize) {
+        return 0;
+    }
+    buffer[0] = 0;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    length = fread(buffer, 1, bufferSize - 1, file);
+    buffer[length] = 0;
+    fclose(file);
+
+    return 1;
+}
+
+int parse_cpu_list(const char* text, uint64_t* words, int numWords) {
+    const char* p = text;
+    char* end;
+    long first, last, cpu;
+    int count = 0;
+
+    while (*p) {
+        if (*p < '0' || *p > '9') {
+            ++p;
+            continue;
+        }
+
+        first = strtol(p, &end, 10);
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+
+        for (cpu = first; cpu <= last && cpu < (long)numWords * CPU_WORD_BITS; ++cpu) {
+            if (!(words[cpu / CPU_WORD_BITS] & CPU_WORD_BIT(cpu))) {
+                words[cpu / CPU_WORD_BITS] |= CPU_WORD_BIT(cpu);
+                ++count;
+            }
+        }
+    }
+
+    return count;
+}
+
+int popcount64(uint64_t value) {
+    int count = 0;
+    while (value) {
+        value &= value - 1;
+        ++count;
+    }
+    return count;
+}
+
+uint32_t log2_ceil(uint32_t value) {
+    uint32_t shift = 0;
+    while (shift < 32 && ((uint64_t)1 << shift) < value) {
+        ++shift;
+    }
+    return shift;
+}
+
+uint64_t fnv1a64(const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+#ifdef __linux__
+
+int get_user_dir_wrapper(const char* envName, const char* homeSubdir, char* dir, size_t size) {
+    const char* envDir = getenv(envName);
+    const char* home = getenv("HOME");
+    int length;
+
+    if (envDir && *envDir) {
+        length = snprintf(dir, size, "%s", envDir);
+    } else if (homeSubdir && home && *home) {
+        length = snprintf(dir, size, "%s/%s", home, homeSubdir);
+    } else {
+        length = snprintf(dir, size, "%s", "/tmp");
+    }
+    return length > 0 && (size_t)length < size;
+}
+
+/* the directories these files go to may be shared (/tmp), so a file is only read if this user wrote it, */
+/* and a symlink planted under its name isn't followed */
+FILE* open_trusted_file_wrapper(const char* path) {
+    struct stat st;
+    FILE* file;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+        close(fd);
+        return NULL;
+    }
+
+    file = fdopen(fd, "rb");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
+
+/* mkostemp creates the file exclusively with mode 0600 under an unpredictable name */
+FILE* create_temp_file_wrapper(const char* path, char* tempPath, size_t tempPathSize) {
+    FILE* file;
+    int fd, length;
+
+    length = snprintf(tempPath, tempPathSize, "%s.XXXXXX", path);
+    if (length <= 0 || (size_t)length >= tempPathSize) {
+        return NULL;
+    }
+    fd = mkostemp(tempPath, O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(tempPath);
+    }
+    return file;
+}
+
+int commit_temp_file_wrapper(FILE* file, const char* tempPath, const char* path, int isComplete) {
+    isComplete = !fclose(file) && isComplete;
+    if (!isComplete || rename(tempPath, path)) {
+        unlink(tempPath);
+        return 0;
+    }
+    return 1;
+}
+
+#else
+
+/* the XDG variables & $HOME don't apply, %LOCALAPPDATA% belongs to the user and is kept across reboots */
+int get_user_dir_wrapper(const char* envName, const char* homeSubdir, char* dir, size_t size) {
+    const char* envDir = getenv("LOCALAPPDATA");
+    int length;
+
+    (void)envName;
+    (void)homeSubdir;
+    if (!envDir || !*envDir) {
+        return 0;
+    }
+    length = snprintf(dir, size, "%s", envDir);
+    return length > 0 && (size_t)length < size;
+}
+
+FILE* open_trusted_file_wrapper(const char* path) {
+    return fopen(path, "rb");
+}
+
+FILE* create_temp_file_wrapper(const char* path, char* tempPath, size_t tempPathSize) {
+    int length = snprintf(tempPath, tempPathSize, "%s.%lu", path, (unsigned long)GetCurrentProcessId());
+
+    if (length <= 0 || (size_t)length >= tempPathSize) {
+        return NULL;
+    }
+    return fopen(tempPath, "wb");
+}
+
+/* rename doesn't replace existing files on Windows */
+int commit_temp_file_wrapper(FILE* file, const char* tempPath, const char* path, int isComplete) {
+    isComplete = !fclose(file) && isComplete;
+    if (!isComplete || !MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING)) {
+        remove(tempPath);
+        return 0;
+    }
+    return 1;
+}
+
+#endif
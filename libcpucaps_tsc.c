@@ -0,0 +1,173 @@
+#ifdef __linux__
+#define _GNU_SOURCE 1
+#endif
+
+#include "libcpucaps.h"
+#include "libcpucaps_tsc.h"
+#include "libcpucaps_internal.h"
+#include <string.h>    /* memset */
+#include <time.h>      /* clock_gettime */
+
+#define TSC_CALIBRATION_MS          5
+#define TSC_CALIBRATION_SAMPLES     5
+
+static uint64_t         s_calibratedHz = 0;
+static volatile int32_t s_calibrationDone = 0;     /* release-stored once s_calibratedHz is set */
+static volatile int32_t s_calibrationLock = 0;
+
+/* unaffected by NTP slewing, so it ticks at the same rate as the hardware */
+static uint64_t get_raw_time_ns_wrapper(void) {
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+    return get_time_ns_wrapper();
+#endif
+}
+
+/* the OS clock read bracketed by two TSC reads, the tightest bracket of a few tries wins */
+static void read_time_pair(uint64_t* ticks, uint64_t* ns) {
+    uint64_t before, after, time, best = ~(uint64_t)0;
+    int i;
+
+    *ticks = *ns = 0;
+    for (i = 0; i < TSC_CALIBRATION_SAMPLES; ++i) {
+        before = libcpucaps_ReadTSC();
+        time = get_raw_time_ns_wrapper();
+        after = libcpucaps_ReadTSC();
+        if (after - before < best) {
+            best = after - before;
+            *ticks = before + (after - before) / 2;
+            *ns = time;
+        }
+    }
+}
+
+uint64_t libcpucaps_CalibrateTSC(int durationMs) {
+    uint64_t startTicks, startNs, endTicks, endNs;
+
+    if (durationMs <= 0) {
+        return 0;
+    }
+
+    read_time_pair(&startTicks, &startNs);
+    do {
+        read_time_pair(&endTicks, &endNs);
+    } while (endNs - startNs < (uint64_t)durationMs * 1000000);
+
+    if (endTicks <= startTicks) {
+        return 0;
+    }
+    return (uint64_t)((double)(endTicks - startTicks) * 1e9 / (double)(endNs - startNs) + 0.5);
+}
+
+/* the calibration costs milliseconds, a process only pays for it once */
+static uint64_t get_calibrated_frequency(void) {
+    if (atomic_load_acquire_wrapper(&s_calibrationDone)) {
+        return s_calibratedHz;
+    }
+
+    while (!atomic_compare_exchange_wrapper(&s_calibrationLock, 0, 1)) {
+        thread_yield_wrapper();
+    }
+    if (!atomic_load_acquire_wrapper(&s_calibrationDone)) {
+        s_calibratedHz = libcpucaps_CalibrateTSC(TSC_CALIBRATION_MS);
+        atomic_store_release_wrapper(&s_calibrationDone, 1);
+    }
+    atomic_store_release_wrapper(&s_calibrationLock, 0);
+
+    return s_calibratedHz;
+}
+
+/* https://www.intel.com/content/dam/www/public/us/en/documents/manuals/64-ia-32-architectures-software-developer-instruction-set-reference-manual-325383.pdf */
+/* Time Stamp Counter and Nominal Core Crystal Clock Information Leaf (0x15), Processor Frequency Information Leaf (0x16) */
+void query_tsc(uint32_t highestFunc, cpucaps_t* caps) {
+    cpuid_result_t cpuidResult;
+    uint64_t frequency = 0;
+    int source = LIBCPUCAPS_TSC_SOURCE_UNKNOWN;
+
+    if (!libcpucaps_HasTSC(caps)) {
+        return;
+    }
+
+    /* TSC = crystal * EBX / EAX, the crystal frequency (ECX) is 0 on some models */
+    if (highestFunc >= 0x15) {
+        cpuid_wrapper(0x15, 0, &cpuidResult);
+        if (cpuidResult.eax && cpuidResult.ebx && cpuidResult.ecx) {
+            frequency = (uint64_t)cpuidResult.ecx * cpuidResult.ebx / cpuidResult.eax;
+            source = LIBCPUCAPS_TSC_SOURCE_CPUID_15;
+        }
+    }
+
+    /* the TSC runs at the base frequency (EAX, in MHz) */
+    if (!frequency && highestFunc >= 0x16) {
+        cpuid_wrapper(0x16, 0, &cpuidResult);
+        if (cpuidResult.eax & 0xFFFF) {
+            frequency = (uint64_t)(cpuidResult.eax & 0xFFFF) * 1000000;
+            source = LIBCPUCAPS_TSC_SOURCE_CPUID_16;
+        }
+    }
+
+    /* VMware & KVM report the guest TSC frequency in kHz */
+    if (!frequency && caps->hypervisorMaxLeaf >= 0x40000010) {
+        cpuid_wrapper(0x40000010, 0, &cpuidResult);
+        if (cpuidResult.eax) {
+            frequency = (uint64_t)cpuidResult.eax * 1000;
+            source = LIBCPUCAPS_TSC_SOURCE_HYPERVISOR;
+        }
+    }
+
+    /* without any of the leaves the frequency stays unknown, libcpucaps_InitTSCClock calibrates it */
+    caps->tscFrequencyHz = frequency;
+    caps->tscFrequencySource = source;
+}
+
+int libcpucaps_InitTSCClock(cpucaps_tsc_clock_t* clock, const cpucaps_t* caps) {
+    uint64_t frequency, mult;
+    uint32_t shift;
+    int source;
+
+    if (!clock) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    memset(clock, 0, sizeof(cpucaps_tsc_clock_t));
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_TSC);
+    }
+    if (!libcpucaps_HasTSC(caps)) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    /* a TSC that changes its rate with the core clock has no single frequency to calibrate */
+    frequency = caps->tscFrequencyHz;
+    source = caps->tscFrequencySource;
+    if (!frequency && libcpucaps_HasInvariantTSC(caps)) {
+        frequency = get_calibrated_frequency();
+        source = LIBCPUCAPS_TSC_SOURCE_CALIBRATED;
+    }
+    if (!frequency) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    /* the biggest shift that still keeps mult in 32 bits gives the most precision */
+    for (shift = 32; ; --shift) {
+        mult = ((1000000000ull << shift) + frequency / 2) / frequency;
+        if (mult <= 0xFFFFFFFFu || !shift) {
+            break;
+        }
+    }
+    if (mult > 0xFFFFFFFFu) {
+        return LIBCPUCAPS_ERROR_FAILED;     /* slower than 1 tick per 4 seconds, not a real TSC */
+    }
+
+    clock->frequencyHz = frequency;
+    clock->frequencySource = source;
+    clock->mult = (uint32_t)mult;
+    clock->shift = shift;
+    clock->isInvariant = libcpucaps_HasInvariantTSC(caps);
+    clock->hasRDTSCP = libcpucaps_HasRDTSCP(caps);
+    clock->baseTicks = libcpucaps_ReadTSC();
+
+    return LIBCPUCAPS_ERROR_OK;
+}
@@ -0,0 +1,73 @@
+#ifndef LIBCPUCAPS_TSC_H_HEADER
+#define LIBCPUCAPS_TSC_H_HEADER
+
+/* low-overhead timestamps: a TSC read plus a multiply & shift, no system call */
+/* only meaningful across cpus & power states when libcpucaps_HasInvariantTSC is set */
+
+#include "libcpucaps.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>     /* __rdtsc, __rdtscp */
+#else
+#include <x86intrin.h>  /* __rdtsc, __rdtscp */
+#endif
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define LIBCPUCAPS_INLINE   static __inline
+#else
+#define LIBCPUCAPS_INLINE   static inline
+#endif
+
+/* ticks to nanoseconds: ns = (ticks * mult) >> shift, split in 32-bit halves so nothing overflows */
+typedef struct _s_cpucaps_tsc_clock {
+    uint64_t  frequencyHz;
+    int       frequencySource;  /* LIBCPUCAPS_TSC_SOURCE_xxx */
+    uint32_t  mult;
+    uint32_t  shift;        /* <= 32 */
+    uint64_t  baseTicks;    /* TSC at init, libcpucaps_TimestampNs counts from here */
+    int       isInvariant;
+    int       hasRDTSCP;
+} cpucaps_tsc_clock_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* precomputes the conversion from the caps' TSC frequency, pass NULL caps to use the cached ones */
+/* an invariant TSC without a frequency in CPUID is calibrated for a few milliseconds, once per process */
+/* returns LIBCPUCAPS_ERROR_xxx, LIBCPUCAPS_ERROR_FAILED if there's no TSC or its frequency is unknown */
+int libcpucaps_InitTSCClock(cpucaps_tsc_clock_t* clock, const cpucaps_t* caps);
+/* measures the TSC against the OS raw monotonic clock for about durationMs, returns Hz or 0 */
+uint64_t libcpucaps_CalibrateTSC(int durationMs);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+/* not serializing, earlier instructions may still be in flight */
+LIBCPUCAPS_INLINE uint64_t libcpucaps_ReadTSC(void) {
+    return (uint64_t)__rdtsc();
+}
+
+/* waits for earlier instructions to finish, cpuAux (optional) gets IA32_TSC_AUX (the OS cpu number on Linux) */
+/* requires libcpucaps_HasRDTSCP */
+LIBCPUCAPS_INLINE uint64_t libcpucaps_ReadTSCP(uint32_t* cpuAux) {
+    unsigned int aux;
+    uint64_t ticks = (uint64_t)__rdtscp(&aux);
+
+    if (cpuAux) {
+        *cpuAux = (uint32_t)aux;
+    }
+    return ticks;
+}
+
+LIBCPUCAPS_INLINE uint64_t libcpucaps_TSCToNanoseconds(const cpucaps_tsc_clock_t* clock, uint64_t ticks) {
+    return (((ticks >> 32) * clock->mult) << (32 - clock->shift)) + (((ticks & 0xFFFFFFFFu) * clock->mult) >> clock->shift);
+}
+
+/* nanoseconds since libcpucaps_InitTSCClock */
+LIBCPUCAPS_INLINE uint64_t libcpucaps_TimestampNs(const cpucaps_tsc_clock_t* clock) {
+    return libcpucaps_TSCToNanoseconds(clock, libcpucaps_ReadTSC() - clock->baseTicks);
+}
+
+#endif /* LIBCPUCAPS_TSC_H_HEADER */
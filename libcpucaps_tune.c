@@ -0,0 +1,554 @@
+#include "libcpucaps.h"
+#include "libcpucaps_tune.h"
+#include "libcpucaps_internal.h"
+#include <stdio.h>
+#include <stdlib.h>    /* malloc, free, getenv, qsort, strtoull */
+#include <string.h>    /* memset, strcmp, strlen, strncmp */
+
+#ifdef __linux__
+#include <unistd.h>    /* getuid */
+#endif
+
+/* the winners of every kernel & size bucket, kept as text so they can be read and edited by hand: */
+/*   libcpucaps-tune 1 */
+/*   vendor GenuineIntel */
+/*   name Intel(R) Xeon(R) ... */
+/*   cpu <family> <model> <stepping> */
+/*   features <word0> <word1> */
+/*   entry <kernel> <bucket> <impl> <nsPerCall> */
+
+#define TUNE_MAGIC                  "libcpucaps-tune"
+#define TUNE_VERSION                1
+#define TUNE_MAX_PATH               1024
+#define TUNE_MAX_LINE               256
+#define TUNE_DEFAULT_WARMUP_NS      2000000
+#define TUNE_DEFAULT_TRIAL_NS       1000000
+#define TUNE_DEFAULT_TRIALS         5
+#define TUNE_MAX_CALIBRATION_CALLS  ((uint64_t)1 << 30)
+#define TUNE_MIN_GAIN               0.02    /* another impl has to beat the table's own choice by this much */
+
+typedef struct _s_tune_job {
+    cpucaps_tune_table_t*           table;
+    const cpucaps_t*                caps;
+    const cpucaps_tune_kernel_t*    kernel;
+    const cpucaps_tune_options_t*   options;
+    int                             result;
+} tune_job_t;
+
+static int get_tune_path_wrapper(const char* dir, const cpucaps_tune_table_t* key, char* path, size_t size);
+
+void libcpucaps_GetDefaultTuneOptions(cpucaps_tune_options_t* options) {
+    if (options) {
+        options->warmupNs = TUNE_DEFAULT_WARMUP_NS;
+        options->trialNs = TUNE_DEFAULT_TRIAL_NS;
+        options->numTrials = TUNE_DEFAULT_TRIALS;
+        options->cpuIndex = -1;
+    }
+}
+
+/* the key fields of a table for the caps, entries empty */
+static void init_key(const cpucaps_t* caps, cpucaps_tune_table_t* table) {
+    int family = (unsigned char)caps->family;
+    int model = (unsigned char)caps->model;
+
+    if (family == 0xF) {
+        family += (unsigned char)caps->familyEx;
+    }
+    if (family == 6 || family >= 0xF) {
+        model |= (unsigned char)caps->modelEx << 4;
+    }
+
+    memset(table, 0, sizeof(cpucaps_tune_table_t));
+    memcpy(table->vendor, caps->vendor, sizeof(table->vendor));
+    memcpy(table->name, caps->name, sizeof(table->name));
+    table->vendor[sizeof(table->vendor) - 1] = 0;
+    table->name[sizeof(table->name) - 1] = 0;
+    table->family = family;
+    table->model = model;
+    table->stepping = (unsigned char)caps->stepping;
+    table->features = caps->features;
+}
+
+static int is_same_key(const cpucaps_tune_table_t* a, const cpucaps_tune_table_t* b) {
+    return !strcmp(a->vendor, b->vendor) && !strcmp(a->name, b->name) && a->family == b->family && a->model == b->model &&
+           a->stepping == b->stepping && !memcmp(&a->features, &b->features, sizeof(cpucaps_features_t));
+}
+
+/* smallest b such that 2^b >= size */
+static int get_bucket(size_t size) {
+    int bucket = 0;
+
+    while (bucket < (int)(sizeof(size_t) * 8 - 1) && ((size_t)1 << bucket) < size) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+/* names are stored as single words */
+static int is_valid_name(const char* name) {
+    size_t length;
+
+    if (!name) {
+        return 0;
+    }
+    length = strlen(name);
+    return length > 0 && length < LIBCPUCAPS_TUNE_MAX_NAME_LEN && !strpbrk(name, " \t\r\n");
+}
+
+int libcpucaps_TuneInit(const cpucaps_t* caps, cpucaps_tune_table_t* table) {
+    if (!table) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES | LIBCPUCAPS_DETECT_NAME);
+    }
+
+    init_key(caps, table);
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+static void run_calls(const cpucaps_tune_kernel_t* kernel, libcpucaps_func_t func, size_t size, uint64_t numCalls) {
+    uint64_t i;
+
+    for (i = 0; i < numCalls; ++i) {
+        kernel->run(func, size, kernel->context);
+    }
+}
+
+/* calls filling about trialNs, doubled until a run is long enough to scale from */
+static uint64_t calibrate_calls(const cpucaps_tune_kernel_t* kernel, libcpucaps_func_t func, size_t size, uint64_t trialNs) {
+    uint64_t numCalls = 1, start, elapsed;
+
+    for (;;) {
+        start = get_time_ns_wrapper();
+        run_calls(kernel, func, size, numCalls);
+        elapsed = get_time_ns_wrapper() - start;
+
+        if (elapsed >= trialNs / 8 || numCalls >= TUNE_MAX_CALIBRATION_CALLS) {
+            break;
+        }
+        numCalls *= 2;
+    }
+
+    if (!elapsed) {
+        return numCalls;
+    }
+    numCalls = (uint64_t)((double)numCalls * (double)trialNs / (double)elapsed);
+    return numCalls ? numCalls : 1;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* removes the kernel's entries, keeping the order of the rest */
+static void remove_entries(cpucaps_tune_table_t* table, const char* kernel) {
+    int i, numKept = 0;
+
+    for (i = 0; i < table->numEntries; ++i) {
+        if (strcmp(table->entries[i].kernel, kernel)) {
+            table->entries[numKept++] = table->entries[i];
+        }
+    }
+    table->numEntries = numKept;
+}
+
+static int tune_kernel(cpucaps_tune_table_t* table, const cpucaps_t* caps, const cpucaps_tune_kernel_t* kernel,
+                       const cpucaps_tune_options_t* options) {
+    const cpucaps_dispatch_t* dispatch = kernel->table;
+    cpucaps_tune_entry_t* entry;
+    int* impls;
+    uint64_t* numCalls;
+    double* samples;
+    double median, bestNs;
+    uint64_t start;
+    size_t size;
+    int numImpls = 0, numBuckets = 0, best, i, trial;
+
+    for (size = (size_t)1 << get_bucket(kernel->minSize); size && size <= kernel->maxSize; size *= 2) {
+        ++numBuckets;
+    }
+
+    impls = (int*)malloc(sizeof(int) * dispatch->numImpls);
+    numCalls = (uint64_t*)malloc(sizeof(uint64_t) * dispatch->numImpls);
+    samples = (double*)malloc(sizeof(double) * dispatch->numImpls * options->numTrials);
+    if (!impls || !numCalls || !samples) {
+        free(impls);
+        free(numCalls);
+        free(samples);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    for (i = 0; i < dispatch->numImpls; ++i) {
+        if (dispatch->impls[i].func && is_valid_name(dispatch->impls[i].name) && libcpucaps_IsImplSupported(&dispatch->impls[i], caps)) {
+            impls[numImpls++] = i;
+        }
+    }
+
+    remove_entries(table, kernel->name);
+    if (!numImpls || table->numEntries + numBuckets > LIBCPUCAPS_TUNE_MAX_ENTRIES) {
+        free(impls);
+        free(numCalls);
+        free(samples);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    /* the first wide vector instructions may run at a reduced rate or clock until the core adapts */
+    for (i = 0; i < numImpls; ++i) {
+        start = get_time_ns_wrapper();
+        do {
+            kernel->run(dispatch->impls[impls[i]].func, kernel->maxSize, kernel->context);
+        } while (get_time_ns_wrapper() - start < options->warmupNs);
+    }
+
+    for (size = (size_t)1 << get_bucket(kernel->minSize); size && size <= kernel->maxSize; size *= 2) {
+        for (i = 0; i < numImpls; ++i) {
+            numCalls[i] = calibrate_calls(kernel, dispatch->impls[impls[i]].func, size, options->trialNs);
+        }
+
+        /* trials take turns, so a slow drift (clock, neighbours) hits every impl alike */
+        for (trial = 0; trial < options->numTrials; ++trial) {
+            for (i = 0; i < numImpls; ++i) {
+                start = get_time_ns_wrapper();
+                run_calls(kernel, dispatch->impls[impls[i]].func, size, numCalls[i]);
+                samples[i * options->numTrials + trial] = (double)(get_time_ns_wrapper() - start) / (double)numCalls[i];
+            }
+        }
+
+        /* impls[0] is what the table picks by features, the others replace it if they're clearly faster, */
+        /* else memory bound sizes where all of them are equal would flip between runs */
+        best = 0;
+        bestNs = 0.0;
+        for (i = 0; i < numImpls; ++i) {
+            qsort(samples + i * options->numTrials, (size_t)options->numTrials, sizeof(double), compare_doubles);
+            median = samples[i * options->numTrials + options->numTrials / 2];
+            if (!i) {
+                bestNs = median;
+            } else if (median < bestNs * (1.0 - TUNE_MIN_GAIN)) {
+                best = i;
+                bestNs = median;
+            }
+        }
+
+        entry = &table->entries[table->numEntries++];
+        memset(entry, 0, sizeof(cpucaps_tune_entry_t));
+        strcpy(entry->kernel, kernel->name);
+        strcpy(entry->impl, dispatch->impls[impls[best]].name);
+        entry->bucket = get_bucket(size);
+        entry->nsPerCall = bestNs;
+    }
+
+    free(impls);
+    free(numCalls);
+    free(samples);
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+static void tune_thread_proc(void* arg) {
+    tune_job_t* job = (tune_job_t*)arg;
+    job->result = tune_kernel(job->table, job->caps, job->kernel, job->options);
+}
+
+/* lowest cpu the calling thread may run on, -1 if unknown */
+static int get_first_allowed_cpu(void) {
+    uint64_t* words;
+    int numWords = CPU_WORDS(get_cpu_capacity_wrapper()), cpu = -1, i;
+
+    words = (uint64_t*)calloc((size_t)numWords, sizeof(uint64_t));
+    if (words && get_thread_affinity_wrapper(words, numWords)) {
+        for (i = 0; i < numWords * CPU_WORD_BITS; ++i) {
+            if (words[i / CPU_WORD_BITS] & CPU_WORD_BIT(i)) {
+                cpu = i;
+                break;
+            }
+        }
+    }
+    free(words);
+    return cpu;
+}
+
+int libcpucaps_Tune(cpucaps_tune_table_t* table, const cpucaps_t* caps, const cpucaps_tune_kernel_t* kernel,
+                    const cpucaps_tune_options_t* options) {
+    cpucaps_tune_options_t defaultOptions;
+    tune_job_t job;
+    size_t thread;
+
+    if (!table || !kernel || !is_valid_name(kernel->name) || !kernel->table || !kernel->table->impls || !kernel->run ||
+        !kernel->minSize || kernel->minSize > kernel->maxSize) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!options) {
+        libcpucaps_GetDefaultTuneOptions(&defaultOptions);
+        options = &defaultOptions;
+    }
+    if (options->numTrials <= 0) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    }
+
+    job.table = table;
+    job.caps = caps;
+    job.kernel = kernel;
+    job.options = options;
+    job.result = LIBCPUCAPS_ERROR_FAILED;
+
+    /* a pinned thread keeps the scheduler from moving the timing runs between cores of different speeds */
+    thread = start_thread_wrapper(tune_thread_proc, &job, (options->cpuIndex >= 0) ? options->cpuIndex : get_first_allowed_cpu());
+    if (thread) {
+        join_thread_wrapper(thread);
+    } else {
+        tune_thread_proc(&job);
+    }
+
+    return job.result;
+}
+
+int libcpucaps_TuneSelect(const cpucaps_tune_table_t* table, const cpucaps_tune_kernel_t* kernel, size_t size) {
+    const cpucaps_tune_entry_t* found = NULL;
+    const cpucaps_tune_entry_t* entry;
+    const cpucaps_t* caps;
+    int bucket = get_bucket(size), i;
+
+    if (!table || !kernel || !kernel->name || !kernel->table || !kernel->table->impls) {
+        return -1;
+    }
+
+    /* the smallest bucket holding size, else the largest one */
+    for (i = 0; i < table->numEntries; ++i) {
+        entry = &table->entries[i];
+        if (strcmp(entry->kernel, kernel->name)) {
+            continue;
+        }
+        if (!found ||
+            (entry->bucket >= bucket && (found->bucket < bucket || entry->bucket < found->bucket)) ||
+            (entry->bucket < bucket && found->bucket < bucket && entry->bucket > found->bucket)) {
+            found = entry;
+        }
+    }
+    if (!found) {
+        return -1;
+    }
+
+    caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES);
+    for (i = 0; i < kernel->table->numImpls; ++i) {
+        if (kernel->table->impls[i].name && !strcmp(kernel->table->impls[i].name, found->impl)) {
+            return (kernel->table->impls[i].func && libcpucaps_IsImplSupported(&kernel->table->impls[i], caps)) ? i : -1;
+        }
+    }
+    return -1;
+}
+
+libcpucaps_func_t libcpucaps_TuneGet(const cpucaps_tune_table_t* table, const cpucaps_tune_kernel_t* kernel, size_t size) {
+    int selected = libcpucaps_TuneSelect(table, kernel, size);
+
+    if (selected >= 0) {
+        return kernel->table->impls[selected].func;
+    }
+    return (kernel && kernel->table) ? libcpucaps_DispatchGet(kernel->table) : 0;
+}
+
+int libcpucaps_TuneSave(const char* dir, const cpucaps_tune_table_t* table) {
+    char path[TUNE_MAX_PATH];
+    char tempPath[TUNE_MAX_PATH + 16];
+    FILE* file;
+    int i, ok;
+
+    if (!table || table->numEntries < 0 || table->numEntries > LIBCPUCAPS_TUNE_MAX_ENTRIES) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!get_tune_path_wrapper(dir, table, path, sizeof(path))) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    file = create_temp_file_wrapper(path, tempPath, sizeof(tempPath));
+    if (!file) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    ok = fprintf(file, "%s %d\nvendor %s\nname %s\ncpu %d %d %d\nfeatures", TUNE_MAGIC, TUNE_VERSION, table->vendor, table->name,
+                 table->family, table->model, table->stepping) > 0;
+    for (i = 0; i < LIBCPUCAPS_FEATURE_WORDS; ++i) {
+        ok = ok && fprintf(file, " %016llx", (unsigned long long)table->features.words[i]) > 0;
+    }
+    ok = ok && fprintf(file, "\n") > 0;
+    for (i = 0; i < table->numEntries; ++i) {
+        ok = ok && fprintf(file, "entry %s %d %s %.3f\n", table->entries[i].kernel, table->entries[i].bucket, table->entries[i].impl,
+                           table->entries[i].nsPerCall) > 0;
+    }
+    return commit_temp_file_wrapper(file, tempPath, path, ok) ? LIBCPUCAPS_ERROR_OK : LIBCPUCAPS_ERROR_FAILED;
+}
+
+/* strips the line break, returns the text after "<key> " or NULL if the line is about something else */
+static char* get_value(char* line, const char* key) {
+    size_t length = strlen(line), keyLength = strlen(key);
+
+    while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+        line[--length] = 0;
+    }
+    if (strncmp(line, key, keyLength) || (line[keyLength] != ' ' && line[keyLength] != 0)) {
+        return NULL;
+    }
+    return line[keyLength] ? line + keyLength + 1 : line + keyLength;
+}
+
+static int parse_table(FILE* file, cpucaps_tune_table_t* table) {
+    char line[TUNE_MAX_LINE];
+    cpucaps_tune_entry_t* entry;
+    char* value;
+    char* end;
+    int version, i;
+
+    if (!fgets(line, sizeof(line), file) || !(value = get_value(line, TUNE_MAGIC)) || sscanf(value, "%d", &version) != 1 ||
+        version != TUNE_VERSION) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if ((value = get_value(line, "vendor"))) {
+            snprintf(table->vendor, sizeof(table->vendor), "%s", value);
+        } else if ((value = get_value(line, "name"))) {
+            snprintf(table->name, sizeof(table->name), "%s", value);
+        } else if ((value = get_value(line, "cpu"))) {
+            if (sscanf(value, "%d %d %d", &table->family, &table->model, &table->stepping) != 3) {
+                return 0;
+            }
+        } else if ((value = get_value(line, "features"))) {
+            for (i = 0; i < LIBCPUCAPS_FEATURE_WORDS; ++i) {
+                table->features.words[i] = strtoull(value, &end, 16);
+                if (end == value) {
+                    return 0;
+                }
+                value = end;
+            }
+        } else if ((value = get_value(line, "entry"))) {
+            if (table->numEntries >= LIBCPUCAPS_TUNE_MAX_ENTRIES) {
+                return 0;
+            }
+            entry = &table->entries[table->numEntries];
+            memset(entry, 0, sizeof(cpucaps_tune_entry_t));
+            /* %31s: LIBCPUCAPS_TUNE_MAX_NAME_LEN - 1 */
+            if (sscanf(value, "%31s %d %31s %lf", entry->kernel, &entry->bucket, entry->impl, &entry->nsPerCall) != 4) {
+                return 0;
+            }
+            ++table->numEntries;
+        }
+    }
+
+    return 1;
+}
+
+int libcpucaps_TuneLoad(const char* dir, const cpucaps_t* caps, cpucaps_tune_table_t* table) {
+    cpucaps_tune_table_t* key;
+    char path[TUNE_MAX_PATH];
+    FILE* file;
+    int isValid;
+
+    if (!table) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES | LIBCPUCAPS_DETECT_NAME);
+    }
+
+    key = (cpucaps_tune_table_t*)malloc(sizeof(cpucaps_tune_table_t));
+    if (!key) {
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    init_key(caps, key);
+
+    file = get_tune_path_wrapper(dir, key, path, sizeof(path)) ? open_trusted_file_wrapper(path) : NULL;
+    if (!file) {
+        free(key);
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+
+    memset(table, 0, sizeof(cpucaps_tune_table_t));
+    isValid = parse_table(file, table) && is_same_key(table, key);
+    fclose(file);
+    free(key);
+
+    if (!isValid) {
+        memset(table, 0, sizeof(cpucaps_tune_table_t));
+        return LIBCPUCAPS_ERROR_FAILED;
+    }
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+static int has_kernel(const cpucaps_tune_table_t* table, const char* kernel) {
+    int i;
+
+    for (i = 0; i < table->numEntries; ++i) {
+        if (!strcmp(table->entries[i].kernel, kernel)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int libcpucaps_GetTuneTable(const char* dir, const cpucaps_t* caps, const cpucaps_tune_kernel_t* kernels, int numKernels,
+                            const cpucaps_tune_options_t* options, cpucaps_tune_table_t* table) {
+    int numTuned = 0, i, result;
+
+    if (!table || numKernels < 0 || (numKernels && !kernels)) {
+        return LIBCPUCAPS_ERROR_INVALID_PARAM;
+    }
+    if (!caps) {
+        caps = libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES | LIBCPUCAPS_DETECT_NAME);
+    }
+
+    if (libcpucaps_TuneLoad(dir, caps, table) != LIBCPUCAPS_ERROR_OK) {
+        init_key(caps, table);
+    }
+
+    for (i = 0; i < numKernels; ++i) {
+        if (!kernels[i].name || has_kernel(table, kernels[i].name)) {
+            continue;
+        }
+        result = libcpucaps_Tune(table, caps, &kernels[i], options);
+        if (result != LIBCPUCAPS_ERROR_OK) {
+            return result;
+        }
+        ++numTuned;
+    }
+
+    if (numTuned && libcpucaps_TuneSave(dir, table) != LIBCPUCAPS_ERROR_OK) {
+        return LIBCPUCAPS_TUNE_NOT_SAVED;
+    }
+    return LIBCPUCAPS_ERROR_OK;
+}
+
+
+/* one file per cpu model, different machines can share a home directory */
+static int get_tune_path_wrapper(const char* dir, const cpucaps_tune_table_t* key, char* path, size_t size) {
+    char defaultDir[TUNE_MAX_PATH];
+    char keyText[LIBCPUCAPS_MAX_CPU_VENDOR_LEN + LIBCPUCAPS_MAX_CPU_NAME_LEN + 128];
+    uint64_t hash;
+    int length, i;
+
+    /* the table outlives reboots, unlike the caps snapshot it belongs to the user's cache directory */
+    if (!dir) {
+        dir = getenv(LIBCPUCAPS_TUNE_DIR_ENV);
+    }
+    if (!dir || !*dir) {
+        if (!get_user_dir_wrapper("XDG_CACHE_HOME", ".cache", defaultDir, sizeof(defaultDir))) {
+            return 0;
+        }
+        dir = defaultDir;
+    }
+
+    length = snprintf(keyText, sizeof(keyText), "%s|%s|%d|%d|%d", key->vendor, key->name, key->family, key->model, key->stepping);
+    hash = fnv1a64(keyText, (length > 0) ? (size_t)length : 0);
+    for (i = 0; i < LIBCPUCAPS_FEATURE_WORDS; ++i) {
+        hash ^= fnv1a64(&key->features.words[i], sizeof(uint64_t)) + (uint64_t)i;
+    }
+
+#ifdef __linux__
+    length = snprintf(path, size, "%s/libcpucaps-tune-%u-%016llx.txt", dir, (unsigned)getuid(), (unsigned long long)hash);
+#else
+    length = snprintf(path, size, "%s\\libcpucaps-tune-%016llx.txt", dir, (unsigned long long)hash);
+#endif
+    return length > 0 && (size_t)length < size;
+}
@@ -0,0 +1,95 @@
+#ifndef LIBCPUCAPS_TUNE_H_HEADER
+#define LIBCPUCAPS_TUNE_H_HEADER
+
+/* optional autotuning module: times every supported impl of a dispatch table on the running cpu and keeps */
+/* the fastest one per problem size, as the feature bits don't tell e.g. whether AVX-512 beats AVX2 */
+/* on a SKU that lowers its clock for it; the winners are saved per cpu model so later processes load them */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+
+#define LIBCPUCAPS_TUNE_MAX_NAME_LEN    32      /* kernel & impl names, without spaces */
+#define LIBCPUCAPS_TUNE_MAX_ENTRIES     512
+#define LIBCPUCAPS_TUNE_DIR_ENV         "LIBCPUCAPS_TUNE_DIR"
+
+/* libcpucaps_GetTuneTable status next to the LIBCPUCAPS_ERROR_xxx ones: the table is complete, */
+/* but saving it failed, so the next process tunes again */
+#define LIBCPUCAPS_TUNE_NOT_SAVED       1
+
+/* runs func (an impl of the kernel's table, cast it to the real signature) once on a problem of size */
+typedef void (*libcpucaps_tune_run_fn)(libcpucaps_func_t func, size_t size, void* context);
+
+/* a kernel to tune, sizes are swept in powers of two from minSize to maxSize */
+typedef struct _s_cpucaps_tune_kernel {
+    const char*             name;
+    cpucaps_dispatch_t*     table;
+    libcpucaps_tune_run_fn  run;
+    void*                   context;        /* passed to run, e.g. buffers of maxSize */
+    size_t                  minSize;
+    size_t                  maxSize;
+} cpucaps_tune_kernel_t;
+
+/* size bucket b covers sizes up to 2^b (and above 2^(b-1)) */
+typedef struct _s_cpucaps_tune_entry {
+    char    kernel[LIBCPUCAPS_TUNE_MAX_NAME_LEN];
+    char    impl[LIBCPUCAPS_TUNE_MAX_NAME_LEN];
+    int     bucket;
+    double  nsPerCall;      /* median of the winner's trials */
+} cpucaps_tune_entry_t;
+
+/* decision table, only valid on the cpu model (and set of usable features) it was tuned on */
+typedef struct _s_cpucaps_tune_table {
+    char                  vendor[LIBCPUCAPS_MAX_CPU_VENDOR_LEN];
+    char                  name[LIBCPUCAPS_MAX_CPU_NAME_LEN];
+    int                   family;           /* display family & model (with the extended fields) */
+    int                   model;
+    int                   stepping;
+    cpucaps_features_t    features;
+    int                   numEntries;
+    cpucaps_tune_entry_t  entries[LIBCPUCAPS_TUNE_MAX_ENTRIES];
+} cpucaps_tune_table_t;
+
+typedef struct _s_cpucaps_tune_options {
+    uint64_t  warmupNs;     /* untimed calls of every impl first, long enough for AVX-512 clock changes */
+    uint64_t  trialNs;      /* a trial repeats the call for this long */
+    int       numTrials;    /* trials of every impl & size, interleaved, the median counts */
+    int       cpuIndex;     /* cpu to pin the tuning thread to, -1 = the first one it's allowed on */
+} cpucaps_tune_options_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* 2 ms of warm-up, 5 trials of 1 ms, on the first allowed cpu */
+void libcpucaps_GetDefaultTuneOptions(cpucaps_tune_options_t* options);
+
+/* empty table keyed to the caps, pass NULL caps to use the cached ones, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_TuneInit(const cpucaps_t* caps, cpucaps_tune_table_t* table);
+/* times the kernel's supported impls at every size (NULL options for the defaults) and replaces */
+/* the kernel's entries, an impl only wins over the table's own choice if it's more than 2% faster */
+/* pass NULL caps to use the cached ones, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_Tune(cpucaps_tune_table_t* table, const cpucaps_t* caps, const cpucaps_tune_kernel_t* kernel,
+                    const cpucaps_tune_options_t* options);
+
+/* index of the winning impl of the kernel's table for size, -1 if the kernel wasn't tuned or the impl */
+/* is missing or unsupported; sizes past the last bucket use the last one */
+int libcpucaps_TuneSelect(const cpucaps_tune_table_t* table, const cpucaps_tune_kernel_t* kernel, size_t size);
+/* winning impl for size, or the table's normal choice (libcpucaps_DispatchGet) without a winner */
+libcpucaps_func_t libcpucaps_TuneGet(const cpucaps_tune_table_t* table, const cpucaps_tune_kernel_t* kernel, size_t size);
+
+/* dir is where the table file lives, NULL means $LIBCPUCAPS_TUNE_DIR, $XDG_CACHE_HOME, ~/.cache or /tmp */
+/* (%LOCALAPPDATA% on Windows), the file name is derived from the cpu, returns LIBCPUCAPS_ERROR_xxx */
+int libcpucaps_TuneSave(const char* dir, const cpucaps_tune_table_t* table);
+/* loads the table tuned on this cpu model, pass NULL caps to use the cached ones */
+/* returns LIBCPUCAPS_ERROR_xxx, LIBCPUCAPS_ERROR_FAILED if there's no valid table */
+int libcpucaps_TuneLoad(const char* dir, const cpucaps_t* caps, cpucaps_tune_table_t* table);
+/* loads the table, tunes the kernels it doesn't cover yet and saves it if anything was tuned */
+/* returns LIBCPUCAPS_ERROR_xxx or LIBCPUCAPS_TUNE_NOT_SAVED */
+int libcpucaps_GetTuneTable(const char* dir, const cpucaps_t* caps, const cpucaps_tune_kernel_t* kernels, int numKernels,
+                            const cpucaps_tune_options_t* options, cpucaps_tune_table_t* table);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIBCPUCAPS_TUNE_H_HEADER */
@@ -1,11 +1,234 @@
-#include "libcpucaps.h"
+﻿#include "libcpucaps.h"
+#include "libcpucaps_measure.h"
+#include "libcpucaps_tlb.h"
+#include "libcpucaps_tsc.h"
 
 #include <stdio.h>
+#include <stdlib.h>    /* strtoull, atoi */
+#include <string.h>
+#include <time.h>      /* timespec_get */
 
-int main() {
+/* effective sizes next to the ones CPUID reports, 0 KB means no knee was found */
+static int print_measurements(void) {
+    const cpucaps_t* caps = libcpucaps_GetCachedCaps();
+    cpucaps_measurements_t measurements;
+    int i;
+
+    printf("Measuring, this takes a while...\n\n");
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_Measure(caps, LIBCPUCAPS_MEASURE_ALL, &measurements)) {
+        printf("Failed to measure\n");
+        return 1;
+    }
+
+    printf("Load latency:\n");
+    for (i = 0; i < measurements.numLatencyPoints; ++i) {
+        printf("  %10llu KB : %7.2f ns\n", (unsigned long long)(measurements.latency[i].workingSetBytes / 1024),
+               measurements.latency[i].nanosecondsPerLoad);
+    }
+
+    printf("\n");
+    printf("Cache sizes:    CPUID   effective\n");
+    printf("    L1d size : %6d KB  %6d KB\n", caps->L1d_sizeKibiBytes, measurements.L1d_effectiveSizeKibiBytes);
+    printf("     L2 size : %6d KB  %6d KB\n", caps->L2_sizeKibiBytes, measurements.L2_effectiveSizeKibiBytes);
+    printf("     L3 size : %6d KB  %6d KB\n", caps->L3_sizeKibiBytes, measurements.L3_effectiveSizeKibiBytes);
+
+    printf("\n");
+    printf("Bandwidth:      1 thread   %d threads\n", measurements.numThreads);
+    printf("        read : %6.2f GB/s  %6.2f GB/s\n", measurements.readGBps, measurements.allCoresReadGBps);
+    printf("       write : %6.2f GB/s  %6.2f GB/s\n", measurements.writeGBps, measurements.allCoresWriteGBps);
+    printf("        copy : %6.2f GB/s  %6.2f GB/s\n", measurements.copyGBps, measurements.allCoresCopyGBps);
+
+    return 0;
+}
+
+/* TLBs, huge pages & the recommended page size for workingSetBytes (a few sizes if 0) */
+static int print_tlb_report(size_t workingSetBytes) {
+    static const char* const tlbTypes[] = { "-", "data", "instruction", "unified", "load", "store" };
+    static const char* const pageNames[LIBCPUCAPS_NUM_PAGE_SIZES] = { "4K", "2M", "1G" };
+    static const char* const thpModes[] = { "unknown", "never", "madvise", "always" };
+    static const char* const sources[] = { "regular pages", "THP", "hugetlb pool" };
+    static const size_t workingSets[] = { (size_t)1 << 20, (size_t)64 << 20, (size_t)1 << 30, (size_t)16 << 30, (size_t)256 << 30 };
+    cpucaps_tlb_report_t report;
+    cpucaps_page_advice_t advice;
+    const cpucaps_page_size_t* page;
+    int i, j, numWorkingSets = (int)(sizeof(workingSets) / sizeof(workingSets[0]));
+
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_GetTLBReport(NULL, NULL, &report)) {
+        printf("Failed to get the TLB report\n");
+        return 1;
+    }
+
+    printf("TLBs:\n");
+    if (!report.numTLBs) {
+        printf("  not reported by CPUID\n");
+    }
+    for (i = 0; i < report.numTLBs; ++i) {
+        printf("  L%d %-11s :", report.tlbs[i].level, tlbTypes[report.tlbs[i].type]);
+        for (j = 0; j < LIBCPUCAPS_NUM_PAGE_SIZES; ++j) {
+            if (report.tlbs[i].entries[j]) {
+                printf(" %s %d entries %d-way,", pageNames[j], report.tlbs[i].entries[j], report.tlbs[i].ways[j]);
+            }
+        }
+        printf(" %d threads\n", report.tlbs[i].numSharingThreads);
+    }
+
+    printf("\n");
+    printf("Page sizes:\n");
+    for (i = 0; i < LIBCPUCAPS_NUM_PAGE_SIZES; ++i) {
+        page = &report.pageSizes[i];
+        printf("  %s : %s, reach %llu MB", pageNames[i], page->isSupported ? "supported" : "not supported",
+               (unsigned long long)(page->reachBytes >> 20));
+        if (page->hasHugetlbPool) {
+            printf(", pool %ld pages (%ld free)", page->numHugePages, page->numFreeHugePages);
+        }
+        printf("\n");
+    }
+    printf("  THP : %s\n", thpModes[report.thpMode]);
+
+    printf("\n");
+    printf("Recommended pages:\n");
+    for (i = 0; i < (workingSetBytes ? 1 : numWorkingSets); ++i) {
+        libcpucaps_RecommendPageSize(&report, workingSetBytes ? workingSetBytes : workingSets[i], &advice);
+        printf("  %10llu MB : %s from %s%s\n", (unsigned long long)((workingSetBytes ? workingSetBytes : workingSets[i]) >> 20),
+               pageNames[advice.pageSize], sources[advice.source], advice.coversWorkingSet ? ", covered by the TLBs" : "");
+    }
+
+    return 0;
+}
+
+static double get_time_ms(void) {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* what a short-lived process pays for the caps, with & without a snapshot in dir (NULL for the default one) */
+static int print_snapshot(const char* dir) {
+    cpucaps_t caps;
+    cpucaps_topology_t* topology;
+    double start, loadMs;
+    int loaded;
+
+    start = get_time_ms();
+    loaded = (LIBCPUCAPS_ERROR_OK == libcpucaps_LoadSnapshot(dir, &caps, &topology));
+    loadMs = get_time_ms() - start;
+
+    if (loaded) {
+        printf("Snapshot loaded in %.3f ms: %d logical cores, %d caches\n", loadMs, topology->numCPUs, topology->numCaches);
+        libcpucaps_FreeTopology(topology);
+        return 0;
+    }
+
+    start = get_time_ms();
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_GetCapsSnapshot(dir, &caps, &topology)) {
+        printf("Failed to get CPU caps\n");
+        return 1;
+    }
+    printf("No valid snapshot, detected in %.3f ms: %d logical cores, %d caches\n", get_time_ms() - start,
+           topology->numCPUs, topology->numCaches);
+    libcpucaps_FreeTopology(topology);
+
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_LoadSnapshot(dir, &caps, NULL)) {
+        printf("Failed to save the snapshot\n");
+        return 1;
+    }
+    printf("Snapshot saved, run again to load it\n");
+    return 0;
+}
+
+/* what the detection costs: CPUID executions per leaf, migrations & time per phase */
+static int print_stats(void) {
+    static const char* const phaseNames[LIBCPUCAPS_NUM_PHASES] = { "vendor", "features", "caches", "TSC", "topology" };
+    cpucaps_t caps;
+    cpucaps_stats_t stats;
+    int i;
+
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_GetCapsStats(&caps, &stats)) {
+        printf("Failed to get CPU caps\n");
+        return 1;
+    }
+
+    printf("Detection took %.3f ms\n", (double)stats.totalNs / 1e6);
+    for (i = 0; i < LIBCPUCAPS_NUM_PHASES; ++i) {
+        printf("  %10s : %9.3f ms\n", phaseNames[i], (double)stats.phaseNs[i] / 1e6);
+    }
+
+    printf("\n");
+    printf("CPUID: %u executed, %u from the leaf cache\n", stats.cpuidExecutions, stats.cpuidCacheHits);
+    for (i = 0; i < stats.numLeaves; ++i) {
+        printf("  0x%08X : %5u executed, %5u cached\n", stats.leaves[i].leaf, stats.leaves[i].executions, stats.leaves[i].cacheHits);
+    }
+
+    printf("\n");
+    printf("Affinity changes : %u\n", stats.affinityCalls);
+    printf("Pinned threads   : %u\n", stats.pinnedThreads);
+    return 0;
+}
+
+/* compiler options for this host, "--json", "--clang" (no --param), "--portable" and "--gcc <major>" may follow in any order */
+static int print_compiler_flags(int argc, char* argv[]) {
+    cpucaps_target_t target;
+    char buffer[2048];
+    int flags = LIBCPUCAPS_TARGET_SHELL;
+    int i;
+
+    for (i = 0; i < argc; ++i) {
+        if (!strcmp(argv[i], "--json")) {
+            flags |= LIBCPUCAPS_TARGET_JSON;
+        } else if (!strcmp(argv[i], "--clang")) {
+            flags |= LIBCPUCAPS_TARGET_NO_PARAMS;
+        } else if (!strcmp(argv[i], "--portable")) {
+            flags |= LIBCPUCAPS_TARGET_PORTABLE;
+        } else if (!strcmp(argv[i], "--gcc") && i + 1 < argc) {
+            flags |= LIBCPUCAPS_TARGET_GCC(atoi(argv[++i]));
+        }
+    }
+
+    if (LIBCPUCAPS_ERROR_OK != libcpucaps_GetTarget(NULL, flags, &target) ||
+        LIBCPUCAPS_ERROR_OK != libcpucaps_FormatTarget(&target, flags, buffer, sizeof(buffer))) {
+        fprintf(stderr, "Failed to get the compiler target\n");
+        return 1;
+    }
+
+    printf("%s\n", buffer);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     int i, j, k;
     cpucaps_t caps;
-    if (LIBCPUCAPS_ERROR_OK == libcpucaps_GetCaps(&caps)) {
+    cpucaps_topology_t* topology;
+    const cpucaps_cpu_t* cpu;
+    const cpucaps_cache_t* cache;
+    cpucaps_numa_t* numa;
+    cpucaps_concurrency_t* concurrency;
+    cpucaps_tsc_clock_t tscClock;
+
+    if (argc > 1 && !strcmp(argv[1], "--measure")) {
+        return print_measurements();
+    }
+    if (argc > 1 && !strcmp(argv[1], "--compiler-flags")) {
+        return print_compiler_flags(argc - 2, argv + 2);
+    }
+    if (argc > 1 && !strcmp(argv[1], "--snapshot")) {
+        return print_snapshot((argc > 2) ? argv[2] : NULL);
+    }
+    if (argc > 1 && !strcmp(argv[1], "--stats")) {
+        return print_stats();
+    }
+    if (argc > 1 && !strcmp(argv[1], "--tlb")) {
+        return print_tlb_report((argc > 2) ? (size_t)strtoull(argv[2], NULL, 0) : 0);
+    }
+
+    /* the cpus are probed once, for the caps' topology summary & the extended topology */
+    if (LIBCPUCAPS_ERROR_OK == libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_ALL & ~LIBCPUCAPS_DETECT_TOPOLOGY)) {
+        if (LIBCPUCAPS_ERROR_OK == libcpucaps_GetTopology(&topology)) {
+            libcpucaps_CompleteCapsTopology(&caps, topology);
+        } else {
+            topology = NULL;
+        }
+
         if (caps.isIntel) {
             printf("Intel cpu detected.\n\n");
         } else if (caps.isAMD) {
@@ -23,6 +246,35 @@ int main() {
         printf("    cpu type : %d\n", caps.cpuType);
         printf("    model ex : %d\n", caps.modelEx);
         printf("   family ex : %d\n", caps.familyEx);
+        printf("  x86-64 lvl : v%d\n", libcpucaps_GetX86Level(&caps));
+        if (libcpucaps_HasAVX10(&caps)) {
+            printf("  AVX10 ver. : %d\n", caps.avx10Version);
+        }
+        if (libcpucaps_HasAMXTile(&caps)) {
+            for (i = 0; i < caps.amxNumPalettes; ++i) {
+                printf(" AMX palette : %d, %d tiles x %d rows x %d B, %d B total\n", caps.amxPalettes[i].palette,
+                       caps.amxPalettes[i].maxNames, caps.amxPalettes[i].maxRows, caps.amxPalettes[i].bytesPerRow,
+                       caps.amxPalettes[i].totalTileBytes);
+            }
+            printf("    AMX TMUL : K %d, N %d B\n", caps.amxTmulMaxK, caps.amxTmulMaxN);
+            printf("    AMX perm : %s\n", (libcpucaps_EnableAMX() == LIBCPUCAPS_ERROR_OK) ? "granted" : "denied");
+        }
+        printf("        XCR0 : 0x%08X\n", (unsigned)caps.xcr0);
+        /* the clock calibrates the TSC if CPUID doesn't give its frequency */
+        if (LIBCPUCAPS_ERROR_OK != libcpucaps_InitTSCClock(&tscClock, &caps)) {
+            tscClock.frequencyHz = 0;
+            tscClock.frequencySource = LIBCPUCAPS_TSC_SOURCE_UNKNOWN;
+        }
+        printf("    TSC freq : %llu Hz (%s)\n", (unsigned long long)tscClock.frequencyHz,
+               (tscClock.frequencySource == LIBCPUCAPS_TSC_SOURCE_CPUID_15) ? "CPUID 0x15" :
+               (tscClock.frequencySource == LIBCPUCAPS_TSC_SOURCE_CPUID_16) ? "CPUID 0x16" :
+               (tscClock.frequencySource == LIBCPUCAPS_TSC_SOURCE_HYPERVISOR) ? "hypervisor" :
+               (tscClock.frequencySource == LIBCPUCAPS_TSC_SOURCE_CALIBRATED) ? "calibrated" : "unknown");
+        if (caps.hypervisor != LIBCPUCAPS_HYPERVISOR_NONE) {
+            printf("  hypervisor : %s (max. leaf 0x%08X)\n", caps.hypervisorVendor, (unsigned)caps.hypervisorMaxLeaf);
+        }
+        printf("    topology : %s\n", (caps.topologyConfidence == LIBCPUCAPS_TOPOLOGY_CONFIDENCE_HIGH) ? "bare metal" :
+               (caps.topologyConfidence == LIBCPUCAPS_TOPOLOGY_CONFIDENCE_VIRTUAL) ? "virtual" : "inconsistent");
         printf(" phys. cores : %d\n", caps.numCores);
         printf(" logi. cores : %d\n", caps.numLogicalCores);
         printf("    L1d line : %d B\n", caps.L1d_lineSizeBytes);
@@ -40,23 +292,89 @@ int main() {
 
         printf("\n");
         printf("Extended topology:\n");
-        for (i = 0, j = 0, k = 0; i < caps.numLogicalCores; ++i, ++j) {
-            if (i && (caps.coreIDs[i - 1] != caps.coreIDs[i])) {
+        if (topology) {
+            printf("  %d package(s), %d physical cores, %d logical cores\n", topology->numPackages, topology->numCores, topology->numCPUs);
+            if (topology->isHybrid) {
+                printf("  hybrid : %d P-core threads (%d P-cores), %d E-core threads\n", libcpucaps_CpuSetCount(&topology->pcoreCPUs),
+                       libcpucaps_CpuSetCount(&topology->pcorePrimaryCPUs), libcpucaps_CpuSetCount(&topology->ecoreCPUs));
+            }
+            printf("  x2APIC shifts : smt %d, core %d, module %d, tile %d, die %d\n",
+                   topology->smtShift, topology->coreShift, topology->moduleShift, topology->tileShift, topology->dieShift);
+            for (i = 0; i < topology->numCPUs; ++i) {
+                cpu = &topology->cpus[i];
+                printf("  cpu %3d : x2APIC 0x%08X, package %u, die %u, tile %u, module %u, core %u, smt %u -> %s-core #%d%s\n",
+                       cpu->cpuIndex, cpu->x2apicID, cpu->packageID, cpu->dieID, cpu->tileID, cpu->moduleID,
+                       cpu->coreID, cpu->smtID, (cpu->coreType == LIBCPUCAPS_CORE_TYPE_EFFICIENT) ? "E" : "P",
+                       cpu->coreIndex, cpu->isAllowed ? "" : " (not allowed)");
+            }
+            for (k = 0; k < topology->numCores; ++k) {
+                for (i = 0, j = 0; i < topology->numCPUs; ++i) {
+                    j += (topology->cpus[i].coreIndex == k);
+                }
                 printf("  Physical core #%d has %d logical cores\n", k, j);
-                j = 0;
-                k++;
             }
+
+            printf("\n");
+            printf("Cache instances:\n");
+            for (i = 0; i < topology->numCaches; ++i) {
+                cache = &topology->caches[i];
+                printf("  L%d%s : %d KB, %d B line, %d ways, %d sets%s, shared by %d logical cores (",
+                       cache->level, (cache->type == LIBCPUCAPS_CACHE_DATA) ? "d" : (cache->type == LIBCPUCAPS_CACHE_INSTRUCTION) ? "i" : " ",
+                       cache->sizeKibiBytes, cache->lineSizeBytes, cache->ways, cache->sets, cache->isInclusive ? ", inclusive" : "",
+                       cache->numCPUs);
+                for (j = 0, k = 0; j < topology->maxCPUIndex; ++j) {
+                    if (libcpucaps_CpuSetHas(&cache->cpus, j)) {
+                        printf(k++ ? " %d" : "%d", j);
+                    }
+                }
+                printf(")\n");
+            }
+
+            printf("\n");
+            printf("NUMA nodes:\n");
+            if (LIBCPUCAPS_ERROR_OK == libcpucaps_GetNUMA(NULL, topology, &numa)) {
+                for (i = 0; i < numa->numNodes; ++i) {
+                    printf("  node %d : %d logical cores, package %d, %llu MB memory, distances",
+                           numa->nodes[i].nodeID, numa->nodes[i].numCPUs, numa->nodes[i].packageID,
+                           (unsigned long long)(numa->nodes[i].memTotalBytes >> 20));
+                    for (j = 0; j < numa->numNodes; ++j) {
+                        printf(" %d", numa->nodes[i].distances[j]);
+                    }
+                    printf("\n");
+                }
+                if (!numa->isConsistent) {
+                    printf("  WARNING: NUMA nodes disagree with CPUID packages\n");
+                }
+                libcpucaps_FreeNUMA(numa);
+            }
+
+            printf("\n");
+            printf("Effective concurrency:\n");
+            if (LIBCPUCAPS_ERROR_OK == libcpucaps_GetConcurrency(NULL, topology, &concurrency)) {
+                printf("  %d logical cores, %d physical cores (%d with every SMT sibling), ", concurrency->numCPUs,
+                       concurrency->numCores, concurrency->numFullCores);
+                if (concurrency->cpuQuota > 0.0) {
+                    printf("quota %.2f cpus, ", concurrency->cpuQuota);
+                }
+                printf("cgroup v%d -> %d threads\n", concurrency->cgroupVersion, concurrency->effectiveThreads);
+                libcpucaps_FreeConcurrency(concurrency);
+            }
+
+            libcpucaps_FreeTopology(topology);
+        } else {
+            printf("  Failed to enumerate topology\n");
         }
-        printf("  Physical core #%d has %d logical cores\n", k, j);
 
         printf("\n");
         printf("CPU caps:\n");
 
-#define PRINT_CAP(cap)  printf("%*s\n", 18, libcpucaps_Has##cap(&caps) ? (#cap " : YES") : (#cap " :  NO"))
+#define PRINT_CAP(cap)  printf("%*s\n", 22, libcpucaps_Has##cap(&caps) ? (#cap " : YES") : (#cap " :  NO"))
 
         PRINT_CAP(FPU);
         PRINT_CAP(PSE);
         PRINT_CAP(TSC);
+        PRINT_CAP(InvariantTSC);
+        PRINT_CAP(RDTSCP);
         PRINT_CAP(CMPXCHG8);
         PRINT_CAP(CMPXCHG16B);
         PRINT_CAP(MMX);
@@ -70,6 +388,7 @@ int main() {
         PRINT_CAP(SSE41);
         PRINT_CAP(SSE42);
         PRINT_CAP(ABM);
+        PRINT_CAP(POPCNT);
         PRINT_CAP(SSE4a);
         PRINT_CAP(MisalignSSE);
         PRINT_CAP(AES);
@@ -84,6 +403,43 @@ int main() {
         PRINT_CAP(RDSEED);
         PRINT_CAP(FMA3);
         PRINT_CAP(FMA4);
+        PRINT_CAP(BMI1);
+        PRINT_CAP(BMI2);
+        PRINT_CAP(ADX);
+        PRINT_CAP(MOVBE);
+        PRINT_CAP(SHA);
+        PRINT_CAP(PCLMULQDQ);
+        PRINT_CAP(VAES);
+        PRINT_CAP(VPCLMULQDQ);
+        PRINT_CAP(GFNI);
+        PRINT_CAP(AVX512BW);
+        PRINT_CAP(AVX512DQ);
+        PRINT_CAP(AVX512VL);
+        PRINT_CAP(AVX512VNNI);
+        PRINT_CAP(AVX512BF16);
+        PRINT_CAP(AVX512FP16);
+        PRINT_CAP(AVX512VBMI);
+        PRINT_CAP(AVX512VBMI2);
+        PRINT_CAP(AVX512BITALG);
+        PRINT_CAP(AVX512VPOPCNTDQ);
+        PRINT_CAP(AVXVNNI);
+        PRINT_CAP(AVX10);
+        PRINT_CAP(ERMS);
+        PRINT_CAP(FSRM);
+        PRINT_CAP(CLFLUSHOPT);
+        PRINT_CAP(CLWB);
+        PRINT_CAP(Hybrid);
+        PRINT_CAP(OSXSAVE);
+        PRINT_CAP(YMMState);
+        PRINT_CAP(ZMMState);
+        PRINT_CAP(AMXState);
+        PRINT_CAP(AMXTile);
+        PRINT_CAP(AMXBF16);
+        PRINT_CAP(AMXINT8);
+        PRINT_CAP(AMXFP16);
+        PRINT_CAP(WAITPKG);
+        PRINT_CAP(MONITORX);
+        PRINT_CAP(PDPE1GB);
 
     } else {
         printf("Failed to get CPU caps\n");
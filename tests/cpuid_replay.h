@@ -0,0 +1,49 @@
+#ifndef LIBCPUCAPS_TESTS_CPUID_REPLAY_H_HEADER
+#define LIBCPUCAPS_TESTS_CPUID_REPLAY_H_HEADER
+
+/* a CPUID backend answering from a table of leaves, for tests of cpus other than the one running them */
+
+#include "libcpucaps.h"
+#include <stddef.h>
+#include <string.h>    /* memcpy */
+
+typedef struct _s_replay_leaf {
+    uint32_t  func;
+    uint32_t  subfunc;
+    uint32_t  regs[4];      /* EAX, EBX, ECX, EDX */
+} replay_leaf_t;
+
+/* vendor strings of leaf 0 as EBX, EDX, ECX */
+#define REPLAY_INTEL_EBX    0x756E6547  /* "Genu" */
+#define REPLAY_INTEL_EDX    0x49656E69  /* "ineI" */
+#define REPLAY_INTEL_ECX    0x6C65746E  /* "ntel" */
+#define REPLAY_AMD_EBX      0x68747541  /* "Auth" */
+#define REPLAY_AMD_EDX      0x69746E65  /* "enti" */
+#define REPLAY_AMD_ECX      0x444D4163  /* "cAMD" */
+
+static const replay_leaf_t* s_replayLeaves = NULL;
+static size_t s_numReplayLeaves = 0;
+static volatile int s_numReplayCalls = 0;   /* CPUIDs that reached the backend, e.g. to see the leaf cache work */
+
+/* leaves missing from the table aren't supported */
+static int replay_cpuid(uint32_t func, uint32_t subfunc, uint32_t regs[4]) {
+    size_t i;
+
+    ++s_numReplayCalls;
+    for (i = 0; i < s_numReplayLeaves; ++i) {
+        if (s_replayLeaves[i].func == func && s_replayLeaves[i].subfunc == subfunc) {
+            memcpy(regs, s_replayLeaves[i].regs, sizeof(s_replayLeaves[i].regs));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* routes the library's CPUIDs to the table, before anything is detected */
+static void replay_leaves(const replay_leaf_t* leaves, size_t numLeaves) {
+    s_replayLeaves = leaves;
+    s_numReplayLeaves = numLeaves;
+    libcpucaps_SetCPUIDBackend(replay_cpuid);
+}
+
+#endif /* LIBCPUCAPS_TESTS_CPUID_REPLAY_H_HEADER */
@@ -0,0 +1,61 @@
+#include "libcpucaps.h"
+#include "libcpucaps_blocking.h"
+#include "test_check.h"
+
+#include <string.h>
+
+/* the L3 budget of a fake Zen cpu: 4 L3 instances (CCXs) of 16 MiB shared by 8 logical cpus each, */
+/* with the number of ways from 0x8000001D or AMD's code from 0x80000006 */
+
+static void make_caps(cpucaps_t* caps) {
+    memset(caps, 0, sizeof(cpucaps_t));
+    caps->isAMD = 1;
+    caps->numCores = 16;
+    caps->numLogicalCores = 32;
+    caps->L3_numInstances = 4;
+    caps->L3_numSharingCPUs = 8;
+    caps->L1d_lineSizeBytes = caps->L2_lineSizeBytes = caps->L3_lineSizeBytes = 64;
+    caps->L1d_sizeKibiBytes = 32;
+    caps->L1d_associativityType = 8;
+    caps->L2_sizeKibiBytes = 512;
+    caps->L2_associativityType = 6;     /* code of 8 ways */
+    caps->L3_sizeKibiBytes = 16 * 1024;
+}
+
+static long long get_L3_budget(const cpucaps_t* caps, int numThreads) {
+    cpucaps_kernel_desc_t kernel = { 8, 3, LIBCPUCAPS_REUSE_2D, 0, 0 };
+    cpucaps_blocking_t blocking;
+
+    kernel.numThreads = numThreads;
+    if (libcpucaps_AdviseBlocking(caps, &kernel, &blocking) != LIBCPUCAPS_ERROR_OK || blocking.numLevels != 3) {
+        return -1;
+    }
+    return (long long)blocking.levels[2].budgetBytes;
+}
+
+int main(void) {
+    cpucaps_t caps;
+    int failures = 0;
+
+    /* 12 real ways (not code 12, 64 ways), one left out of the budget */
+    make_caps(&caps);
+    caps.L3_associativityType = 12;
+    caps.L3_associativityLeaf = 0x8000001D;
+    failures += check("12 ways, 1 thread", get_L3_budget(&caps, 1), 16 * 1024 * 1024 / 12 * 11);
+    /* 32 threads are 8 per instance, not 32 sharing one */
+    failures += check("12 ways, 32 threads", get_L3_budget(&caps, 32), 16 * 1024 * 1024 / 12 * 11 / 8);
+    failures += check("12 ways, 6 threads", get_L3_budget(&caps, 6), 16 * 1024 * 1024 / 12 * 11 / 2);
+    failures += check("12 ways, 64 threads", get_L3_budget(&caps, 64), 16 * 1024 * 1024 / 12 * 11 / 8);
+
+    /* code 10 of 0x80000006 is 32 ways */
+    caps.L3_associativityType = 10;
+    caps.L3_associativityLeaf = 0x80000006;
+    failures += check("code of 32 ways", get_L3_budget(&caps, 1), 16 * 1024 * 1024 / 32 * 31);
+
+    /* without the instances every thread shares the L3 */
+    caps.L3_numInstances = 0;
+    caps.L3_numSharingCPUs = 0;
+    failures += check("code of 32 ways, 32 threads, no instances", get_L3_budget(&caps, 32), 16 * 1024 * 1024 / 32 * 31 / 32);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#include "libcpucaps.h"
+#include "test_check.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* usage: test_cgroup_root <tests/data> */
+/* the limits of the fake cgroup roots: v2 with a 2.5 cpu quota & a cpuset of every cpu, v1 with a 0.5 cpu */
+/* quota & a cpuset of cpu 0, a root without cgroups and one too long for a path. The process' own cgroup */
+/* has no directory in them, so the limits are read from the roots themselves */
+
+#define CGROUP_TEST_MAX_PATH    2048
+
+/* cpus come from the affinity mask of the process, so they're compared with the ones of a root without limits */
+static int check_root(const char* what, const char* root, int version, double quota, int numCPUs) {
+    cpucaps_concurrency_t* concurrency;
+    int failures = 0, effectiveThreads;
+
+    if (libcpucaps_GetConcurrency(root, NULL, &concurrency) != LIBCPUCAPS_ERROR_OK) {
+        printf("%s: libcpucaps_GetConcurrency failed\n", what);
+        return 1;
+    }
+    effectiveThreads = (quota > 0.0 && numCPUs > (int)quota) ? (int)quota : numCPUs;
+    if (effectiveThreads < 1) {
+        effectiveThreads = 1;
+    }
+
+    if (check(what, concurrency->cgroupVersion, version) || check(what, concurrency->cpuQuota == quota, 1) ||
+        check(what, concurrency->numCPUs, numCPUs) || check(what, concurrency->effectiveThreads, effectiveThreads)) {
+        printf("  cgroup version %d, quota %g, %d cpus, %d threads\n", concurrency->cgroupVersion, concurrency->cpuQuota,
+               concurrency->numCPUs, concurrency->effectiveThreads);
+        failures = 1;
+    }
+    libcpucaps_FreeConcurrency(concurrency);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    char root[CGROUP_TEST_MAX_PATH];
+    cpucaps_concurrency_t* unlimited;
+    int numCPUs, hasCPU0, failures = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <tests/data>\n", argv[0]);
+        return 1;
+    }
+
+    snprintf(root, sizeof(root), "%s/missing", argv[1]);
+    if (libcpucaps_GetConcurrency(root, NULL, &unlimited) != LIBCPUCAPS_ERROR_OK) {
+        printf("libcpucaps_GetConcurrency failed without cgroups\n");
+        return 1;
+    }
+    numCPUs = unlimited->numCPUs;
+    hasCPU0 = libcpucaps_CpuSetHas(&unlimited->cpus, 0);
+    failures += check("cgroup version without cgroups", unlimited->cgroupVersion, 0);
+    libcpucaps_FreeConcurrency(unlimited);
+
+    snprintf(root, sizeof(root), "%s/cgroup-v2", argv[1]);
+    failures += check_root("cgroup v2", root, 2, 2.5, numCPUs);
+
+    snprintf(root, sizeof(root), "%s/cgroup-v1", argv[1]);
+    failures += check_root("cgroup v1", root, 1, 0.5, hasCPU0);
+
+    /* the v2 root behind more slashes than a path can hold isn't read cut short */
+    snprintf(root, sizeof(root), "%s%01000dcgroup-v2", argv[1], 0);
+    memset(root + strlen(argv[1]), '/', 1000);
+    failures += check_root("cgroup root too long for a path", root, 0, 0.0, numCPUs);
+
+    return failures ? 1 : 0;
+}
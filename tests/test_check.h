@@ -0,0 +1,17 @@
+#ifndef LIBCPUCAPS_TESTS_TEST_CHECK_H_HEADER
+#define LIBCPUCAPS_TESTS_TEST_CHECK_H_HEADER
+
+/* the check of the tests: prints what failed & returns 1, 0 if it passed, so the failures can be summed up */
+/* conditions are checked as check(what, condition, 1) */
+
+#include <stdio.h>
+
+static int check(const char* what, long long value, long long expected) {
+    if (value == expected) {
+        return 0;
+    }
+    printf("%s: %lld, expected %lld\n", what, value, expected);
+    return 1;
+}
+
+#endif /* LIBCPUCAPS_TESTS_TEST_CHECK_H_HEADER */
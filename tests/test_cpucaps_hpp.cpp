@@ -0,0 +1,66 @@
+#include "cpucaps.hpp"
+#include "test_check.h"
+
+#include <cstring>
+
+/* cpucaps.hpp with the default x86-64 target: SSE2 is folded, the dispatch picks between the impls above it */
+/* at runtime. test_cpucaps_hpp_v3.cpp checks the folding for x86-64-v3 at compile time */
+
+namespace {
+
+struct sum_avx512 {
+    using features = cpucaps::feature_set<cpucaps::avx512f, cpucaps::avx512bw>;
+    static int run(int value) { return value + 512; }
+};
+struct sum_avx2 {
+    using features = cpucaps::feature_set<cpucaps::avx2, cpucaps::fma3>;
+    static int run(int value) { return value + 256; }
+};
+struct sum_sse2 {
+    using features = cpucaps::feature_set<cpucaps::sse2>;
+    static int run(int value) { return value + 128; }
+};
+struct sum_scalar {
+    using features = cpucaps::feature_set<>;
+    static int run(int value) { return value; }
+};
+
+using sum = cpucaps::dispatch<sum_avx512, sum_avx2, sum_sse2, sum_scalar>;
+
+#if defined(__x86_64__) && !defined(__AVX__)
+static_assert(cpucaps::sse2::inBaseline, "SSE2 is a part of x86-64");
+static_assert(!cpucaps::lahfsahf::inBaseline, "LAHF/SAHF isn't a part of x86-64 v1");
+/* the scalar impl after the SSE2 one is dropped */
+static_assert(sum::candidates == 3, "AVX-512, AVX2 & SSE2 are compiled in");
+static_assert(!sum::isStatic, "AVX-512 needs a runtime check");
+#endif
+
+cpucaps_t make_caps(std::initializer_list<int> features) {
+    cpucaps_t caps;
+
+    std::memset(&caps, 0, sizeof(caps));
+    for (int feature : features) {
+        libcpucaps_AddFeature(&caps.features, feature);
+    }
+    return caps;
+}
+
+}
+
+int main() {
+    int failures = 0;
+
+    failures += check("AVX-512", sum::get(make_caps({ LIBCPUCAPS_FEATURE_SSE2, LIBCPUCAPS_FEATURE_AVX2, LIBCPUCAPS_FEATURE_FMA3,
+                                                      LIBCPUCAPS_FEATURE_AVX512F, LIBCPUCAPS_FEATURE_AVX512BW }))(0), 512);
+    failures += check("AVX-512F only", sum::get(make_caps({ LIBCPUCAPS_FEATURE_SSE2, LIBCPUCAPS_FEATURE_AVX2, LIBCPUCAPS_FEATURE_FMA3,
+                                                            LIBCPUCAPS_FEATURE_AVX512F }))(0), 256);
+    failures += check("AVX2 without FMA", sum::get(make_caps({ LIBCPUCAPS_FEATURE_SSE2, LIBCPUCAPS_FEATURE_AVX2 }))(0),
+                      cpucaps::sse2::inBaseline ? 128 : 0);
+
+    /* the process-wide selection is the one of the cached caps */
+    failures += check("this cpu", sum::call(1), sum::get(*libcpucaps_GetCachedCapsEx(LIBCPUCAPS_DETECT_FEATURES))(1));
+    failures += check("has", cpucaps::has<cpucaps::avx2, cpucaps::fma3>(),
+                      libcpucaps_HasAVX2(libcpucaps_GetCachedCaps()) && libcpucaps_HasFMA3(libcpucaps_GetCachedCaps()));
+
+    return failures ? 1 : 0;
+}
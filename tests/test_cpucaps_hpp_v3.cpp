@@ -0,0 +1,36 @@
+#include "cpucaps.hpp"
+
+/* cpucaps.hpp built for -march=x86-64-v3, only checked at compile time so that the test runs on any cpu */
+
+namespace {
+
+struct scale_avx512 {
+    using features = cpucaps::feature_set<cpucaps::avx512f>;
+    static int run(int value) { return value * 16; }
+};
+struct scale_avx2 {
+    using features = cpucaps::feature_set<cpucaps::avx2, cpucaps::fma3>;
+    static int run(int value) { return value * 8; }
+};
+struct scale_sse2 {
+    using features = cpucaps::feature_set<cpucaps::sse2>;
+    static int run(int value) { return value * 4; }
+};
+
+/* every feature of the level is folded */
+static_assert(cpucaps::feature_set<cpucaps::cmpxchg16b, cpucaps::lahfsahf, cpucaps::popcnt, cpucaps::sse3, cpucaps::sse41,
+                                   cpucaps::sse42, cpucaps::ssse3>::inBaseline, "x86-64-v2 features aren't folded");
+static_assert(cpucaps::feature_set<cpucaps::avx, cpucaps::avx2, cpucaps::bmi1, cpucaps::bmi2, cpucaps::f16c, cpucaps::fma3,
+                                   cpucaps::abm, cpucaps::movbe>::inBaseline, "x86-64-v3 features aren't folded");
+
+/* AVX2 is always there, SSE2 is never compiled in */
+static_assert(cpucaps::dispatch<scale_avx2, scale_sse2>::candidates == 1, "SSE2 impl compiled in");
+static_assert(cpucaps::dispatch<scale_avx2, scale_sse2>::isStatic, "AVX2 impl checked at runtime");
+static_assert(cpucaps::dispatch<scale_avx512, scale_avx2, scale_sse2>::candidates == 2, "AVX-512 or AVX2 impl dropped");
+static_assert(!cpucaps::dispatch<scale_avx512, scale_avx2, scale_sse2>::isStatic, "AVX-512 impl not checked at runtime");
+
+/* folded features are left out of the mask, only AVX-512F is checked */
+static_assert(cpucaps::feature_set<cpucaps::avx512f, cpucaps::avx2>::word(LIBCPUCAPS_FEATURE_AVX512F / 64) ==
+              (std::uint64_t(1) << (LIBCPUCAPS_FEATURE_AVX512F % 64)), "AVX2 left in the mask");
+
+}
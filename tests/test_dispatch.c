@@ -0,0 +1,112 @@
+#include "libcpucaps.h"
+#include "cpuid_replay.h"
+#include "test_check.h"
+
+#include <stdio.h>
+
+/* the dispatch table's selection with replayed leaves, libcpucaps_DispatchForce & the lazy libcpucaps_DispatchGet, */
+/* and the GNU ifunc resolver (raw CPUID, not the backend) agreeing with libcpucaps_DispatchResolve on this cpu */
+/* the replayed cpus have no OSXSAVE, so nothing needs the XGETBV that isn't replayed */
+
+#define POPCNT_BIT  (1u << 23)  /* leaf 1 ECX */
+#define SSE2_BIT    (1u << 26)  /* leaf 1 EDX */
+#define BMI2_BIT    (1u << 8)   /* leaf 7 EBX */
+
+enum { LEAF_BASIC, LEAF_FEATURES, LEAF_EXTENDED_FEATURES, LEAF_EXT, NUM_LEAVES };
+
+static replay_leaf_t s_leaves[NUM_LEAVES] = {
+    { 0x00000000, 0, { 0x7, REPLAY_INTEL_EBX, REPLAY_INTEL_ECX, REPLAY_INTEL_EDX } },
+    { 0x00000001, 0, { 0x000906EA, 0, POPCNT_BIT, SSE2_BIT } },
+    { 0x00000007, 0, { 0, BMI2_BIT, 0, 0 } },
+    { 0x80000000, 0, { 0x80000001, 0, 0, 0 } }
+};
+
+/* each impl returns its index */
+static int tier_avx512(void) { return 0; }
+static int tier_avx2(void) { return 1; }
+static int tier_bmi2(void) { return 2; }
+static int tier_popcnt(void) { return 3; }
+static int tier_sse2(void) { return 4; }
+
+static const cpucaps_impl_t s_impls[] = {
+    { "avx512", (libcpucaps_func_t)tier_avx512, { libcpucaps_HasAVX512F, libcpucaps_HasAVX512BW } },
+    { "avx2",   (libcpucaps_func_t)tier_avx2,   { libcpucaps_HasAVX2, libcpucaps_HasFMA3 } },
+    { "bmi2",   (libcpucaps_func_t)tier_bmi2,   { libcpucaps_HasBMI2, libcpucaps_HasPOPCNT } },
+    { "popcnt", (libcpucaps_func_t)tier_popcnt, { libcpucaps_HasPOPCNT } },
+    { "sse2",   (libcpucaps_func_t)tier_sse2,   { libcpucaps_HasSSE2 } }
+};
+
+typedef int (*tier_func_t)(void);
+
+#ifdef LIBCPUCAPS_HAS_IFUNC
+static cpucaps_dispatch_t s_ifuncTable = LIBCPUCAPS_DISPATCH_INIT(s_impls);
+LIBCPUCAPS_DISPATCH_IFUNC(int, ifunc_tier, (void), s_ifuncTable);
+#endif
+
+static int check_resolve(const char* what, const cpucaps_t* caps, int firstAllowed, int selected) {
+    cpucaps_dispatch_t table = LIBCPUCAPS_DISPATCH_INIT(s_impls);
+    int failures = 0;
+
+    failures += check(what, libcpucaps_DispatchForce(&table, caps, firstAllowed), LIBCPUCAPS_ERROR_OK);
+    failures += check(what, table.selected, selected);
+    if (table.func) {
+        failures += check(what, ((tier_func_t)table.func)(), selected);
+    }
+
+    /* back to the normal selection */
+    if (firstAllowed) {
+        failures += check(what, libcpucaps_DispatchForce(&table, caps, 0), LIBCPUCAPS_ERROR_OK);
+        failures += check(what, table.selected <= selected, 1);
+    }
+    return failures;
+}
+
+static void replay_cpu(uint32_t leaf1ECX, uint32_t leaf1EDX, uint32_t leaf7EBX, cpucaps_t* caps) {
+    s_leaves[LEAF_FEATURES].regs[2] = leaf1ECX;
+    s_leaves[LEAF_FEATURES].regs[3] = leaf1EDX;
+    s_leaves[LEAF_EXTENDED_FEATURES].regs[1] = leaf7EBX;
+    replay_leaves(s_leaves, NUM_LEAVES);
+    libcpucaps_GetCapsEx(caps, LIBCPUCAPS_DETECT_FEATURES);
+}
+
+int main(void) {
+    cpucaps_dispatch_t table = LIBCPUCAPS_DISPATCH_INIT(s_impls);
+    cpucaps_dispatch_t noBaseline = { s_impls, 4, 0, -1, 0 };
+    libcpucaps_func_t func;
+    cpucaps_t caps;
+    int failures = 0;
+
+#ifdef LIBCPUCAPS_HAS_IFUNC
+    /* the loader picked it from this cpu, before main */
+    libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_FEATURES);
+    failures += check("resolving this cpu", libcpucaps_DispatchResolve(&table, &caps), LIBCPUCAPS_ERROR_OK);
+    failures += check("ifunc tier", ifunc_tier(), table.selected);
+    failures += check("ifunc table untouched", s_ifuncTable.selected, -1);
+#endif
+
+    /* the lazy resolution of the first call goes through the cached caps, of the replayed cpu */
+    replay_cpu(POPCNT_BIT, SSE2_BIT, BMI2_BIT, &caps);
+    table.selected = -1;
+    table.func = 0;
+    func = libcpucaps_DispatchGet(&table);
+    failures += check("lazy tier", func ? ((tier_func_t)func)() : -1, 2);
+    failures += check("lazy selection", table.selected, 2);
+
+    failures += check_resolve("BMI2 & POPCNT", &caps, 0, 2);
+    failures += check_resolve("forced to POPCNT", &caps, 3, 3);
+    failures += check_resolve("forced to SSE2", &caps, 4, 4);
+    failures += check("forced past the impls", libcpucaps_DispatchForce(&table, &caps, 5), LIBCPUCAPS_ERROR_INVALID_PARAM);
+    failures += check("forced before the impls", libcpucaps_DispatchForce(&table, &caps, -1), LIBCPUCAPS_ERROR_INVALID_PARAM);
+
+    replay_cpu(POPCNT_BIT, SSE2_BIT, 0, &caps);
+    failures += check_resolve("POPCNT", &caps, 0, 3);
+
+    /* nothing supported, the table is left unresolved */
+    replay_cpu(0, SSE2_BIT, 0, &caps);
+    failures += check_resolve("SSE2", &caps, 0, 4);
+    failures += check("no supported impl", libcpucaps_DispatchResolve(&noBaseline, &caps), LIBCPUCAPS_ERROR_FAILED);
+    failures += check("no selected impl", noBaseline.selected, -1);
+    failures += check("no function", noBaseline.func == 0, 1);
+
+    return failures ? 1 : 0;
+}
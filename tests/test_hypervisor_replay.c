@@ -0,0 +1,99 @@
+#include "libcpucaps.h"
+#include "cpuid_replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* the hypervisor detection with replayed leaves: bare metal, KVM, KVM behind Hyper-V enlightenments (its own */
+/* leaves at 0x40000100) and an unknown signature, and the leaf cache that only VMs use */
+
+#define HV_BIT      (1u << 31)  /* leaf 1 ECX */
+
+enum { LEAF_BASIC, LEAF_FEATURES, LEAF_HV_BASE, LEAF_HV_NEXT, LEAF_EXT, NUM_LEAVES };
+
+static replay_leaf_t s_leaves[NUM_LEAVES] = {
+    { 0x00000000, 0, { 0x1, REPLAY_INTEL_EBX, REPLAY_INTEL_ECX, REPLAY_INTEL_EDX } },
+    { 0x00000001, 0, { 0x000806F8, 0, 0, 0 } },
+    { 0x40000000, 0, { 0, 0, 0, 0 } },
+    { 0x40000100, 0, { 0, 0, 0, 0 } },
+    { 0x80000000, 0, { 0x80000001, 0, 0, 0 } }
+};
+
+/* the vendor signature goes to EBX, ECX & EDX */
+static void set_hypervisor_leaf(replay_leaf_t* leaf, uint32_t maxLeaf, const char signature[12]) {
+    leaf->regs[0] = maxLeaf;
+    memcpy(&leaf->regs[1], signature, 12);
+}
+
+static int check_detection(const char* what, int isVM, int hypervisor, const char* vendor, uint32_t maxLeaf) {
+    cpucaps_t caps;
+    int failures = 0;
+
+    s_leaves[LEAF_FEATURES].regs[2] = isVM ? HV_BIT : 0;
+    replay_leaves(s_leaves, NUM_LEAVES);
+    if (libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_FEATURES) != LIBCPUCAPS_ERROR_OK) {
+        printf("%s: libcpucaps_GetCapsEx failed\n", what);
+        return 1;
+    }
+
+    if (libcpucaps_HasFeature(&caps, LIBCPUCAPS_FEATURE_HYPERVISOR) != isVM) {
+        printf("%s: hypervisor bit %d, expected %d\n", what, libcpucaps_HasFeature(&caps, LIBCPUCAPS_FEATURE_HYPERVISOR), isVM);
+        ++failures;
+    }
+    if (caps.hypervisor != hypervisor) {
+        printf("%s: hypervisor %d, expected %d\n", what, caps.hypervisor, hypervisor);
+        ++failures;
+    }
+    if (strcmp(caps.hypervisorVendor, vendor)) {
+        printf("%s: hypervisor vendor \"%s\", expected \"%s\"\n", what, caps.hypervisorVendor, vendor);
+        ++failures;
+    }
+    if (caps.hypervisorMaxLeaf != maxLeaf) {
+        printf("%s: highest hypervisor leaf 0x%x, expected 0x%x\n", what, caps.hypervisorMaxLeaf, maxLeaf);
+        ++failures;
+    }
+    return failures;
+}
+
+/* a second detection reads every leaf from the cache in a VM, and from the backend on bare metal */
+static int check_leaf_cache(const char* what, int isVM) {
+    cpucaps_t caps;
+    int numCalls;
+
+    s_leaves[LEAF_FEATURES].regs[2] = isVM ? HV_BIT : 0;
+    replay_leaves(s_leaves, NUM_LEAVES);
+    libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_FEATURES);
+    numCalls = s_numReplayCalls;
+    libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_FEATURES);
+
+    if (isVM ? (s_numReplayCalls != numCalls) : (s_numReplayCalls == numCalls)) {
+        printf("%s: the second detection ran %d CPUIDs\n", what, s_numReplayCalls - numCalls);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    int failures = 0;
+
+    failures += check_detection("bare metal", 0, LIBCPUCAPS_HYPERVISOR_NONE, "", 0);
+    failures += check_leaf_cache("bare metal", 0);
+
+    set_hypervisor_leaf(&s_leaves[LEAF_HV_BASE], 0x40000001, "KVMKVMKVM\0\0\0");
+    failures += check_detection("KVM", 1, LIBCPUCAPS_HYPERVISOR_KVM, "KVMKVMKVM", 0x40000001);
+    failures += check_leaf_cache("KVM", 1);
+
+    /* the highest leaf stays the one of the base range */
+    set_hypervisor_leaf(&s_leaves[LEAF_HV_BASE], 0x4000000B, "Microsoft Hv");
+    set_hypervisor_leaf(&s_leaves[LEAF_HV_NEXT], 0x40000101, "KVMKVMKVM\0\0\0");
+    failures += check_detection("KVM with Hyper-V enlightenments", 1, LIBCPUCAPS_HYPERVISOR_KVM, "KVMKVMKVM", 0x4000000B);
+
+    set_hypervisor_leaf(&s_leaves[LEAF_HV_NEXT], 0, "\0\0\0\0\0\0\0\0\0\0\0\0");
+    failures += check_detection("Hyper-V", 1, LIBCPUCAPS_HYPERVISOR_HYPERV, "Microsoft Hv", 0x4000000B);
+
+    /* a highest leaf outside the range isn't one */
+    set_hypervisor_leaf(&s_leaves[LEAF_HV_BASE], 0x12345678, "NotAKnownOne");
+    failures += check_detection("unknown hypervisor", 1, LIBCPUCAPS_HYPERVISOR_UNKNOWN, "NotAKnownOne", 0);
+
+    return failures ? 1 : 0;
+}
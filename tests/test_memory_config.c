@@ -0,0 +1,45 @@
+#include "libcpucaps.h"
+#include "libcpucaps_memory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* the config libcpucaps_Memcpy applies on its own has to be the tuned one, thresholds from the L3 & cores */
+
+static int check_config(const char* what, const cpucaps_memory_config_t* current, const cpucaps_memory_config_t* tuned) {
+    if (current->vectorStrategy == tuned->vectorStrategy && current->repThreshold == tuned->repThreshold &&
+        current->nonTemporalThreshold == tuned->nonTemporalThreshold) {
+        return 0;
+    }
+    printf("%s: strategy %d, rep %llu, nt %llu - tuned: strategy %d, rep %llu, nt %llu\n", what,
+           current->vectorStrategy, (unsigned long long)current->repThreshold, (unsigned long long)current->nonTemporalThreshold,
+           tuned->vectorStrategy, (unsigned long long)tuned->repThreshold, (unsigned long long)tuned->nonTemporalThreshold);
+    return 1;
+}
+
+int main(void) {
+    cpucaps_memory_config_t tuned, current;
+    char src[64], dst[64];
+    int failures = 0;
+
+    /* the lazy default of the first call, before anything else detected the caches & topology */
+    memset(src, 1, sizeof(src));
+    libcpucaps_Memcpy(dst, src, sizeof(dst));
+    libcpucaps_GetCurrentMemoryConfig(&current);
+
+    if (libcpucaps_GetMemoryConfig(NULL, &tuned) != LIBCPUCAPS_ERROR_OK) {
+        printf("libcpucaps_GetMemoryConfig failed\n");
+        return 1;
+    }
+    failures += check_config("lazy default", &current, &tuned);
+
+    /* an explicit reset to the tuned config */
+    if (libcpucaps_SetMemoryConfig(NULL) != LIBCPUCAPS_ERROR_OK) {
+        printf("libcpucaps_SetMemoryConfig(NULL) failed\n");
+        return 1;
+    }
+    libcpucaps_GetCurrentMemoryConfig(&current);
+    failures += check_config("reset", &current, &tuned);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+#include "libcpucaps.h"
+#include "libcpucaps_memory.h"
+#include "test_check.h"
+
+#include <stdint.h>    /* SIZE_MAX */
+#include <stdio.h>
+#include <string.h>
+
+/* libcpucaps_Memcpy & libcpucaps_Memset against the C library's, with each vector strategy forced and small */
+/* thresholds: sizes around them, misaligned buffers and the bytes around the destination left alone */
+/* also the non-temporal threshold of a fake cpu with several L3 instances */
+
+#define COPY_REP_THRESHOLD      1000
+#define COPY_NT_THRESHOLD       3000
+#define COPY_GUARD              64
+#define COPY_MAX_SIZE           (COPY_NT_THRESHOLD + 200)
+#define COPY_BUFFER_SIZE        (COPY_MAX_SIZE + 2 * COPY_GUARD + 64)
+
+static const size_t s_sizes[] = {
+    0, 1, 2, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 255, 256, 257,
+    COPY_REP_THRESHOLD - 1, COPY_REP_THRESHOLD, COPY_REP_THRESHOLD + 1,
+    COPY_NT_THRESHOLD - 1, COPY_NT_THRESHOLD, COPY_NT_THRESHOLD + 1, COPY_NT_THRESHOLD + 63, COPY_MAX_SIZE
+};
+static const size_t s_offsets[] = { 0, 1, 7, 16, 33, 63 };
+
+static unsigned char s_src[COPY_BUFFER_SIZE];
+static unsigned char s_dst[COPY_BUFFER_SIZE];
+static unsigned char s_expected[COPY_BUFFER_SIZE];
+
+#define NUM_SIZES       (sizeof(s_sizes) / sizeof(s_sizes[0]))
+#define NUM_OFFSETS     (sizeof(s_offsets) / sizeof(s_offsets[0]))
+
+static int check_copy(const char* what, int strategy, size_t size, size_t srcOffset, size_t dstOffset) {
+    size_t i;
+
+    for (i = 0; i < COPY_BUFFER_SIZE; ++i) {
+        s_src[i] = (unsigned char)(i * 7 + 1);
+        s_dst[i] = s_expected[i] = (unsigned char)(i * 13 + 5);
+    }
+    memcpy(s_expected + COPY_GUARD + dstOffset, s_src + COPY_GUARD + srcOffset, size);
+    if (strategy < 0) {
+        libcpucaps_Memcpy(s_dst + COPY_GUARD + dstOffset, s_src + COPY_GUARD + srcOffset, size);
+    } else {
+        libcpucaps_MemcpyStrategy(strategy, s_dst + COPY_GUARD + dstOffset, s_src + COPY_GUARD + srcOffset, size);
+    }
+    if (memcmp(s_dst, s_expected, COPY_BUFFER_SIZE)) {
+        printf("%s: copy of %llu bytes, src + %llu, dst + %llu\n", what, (unsigned long long)size,
+               (unsigned long long)srcOffset, (unsigned long long)dstOffset);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_set(const char* what, int strategy, size_t size, size_t dstOffset) {
+    size_t i;
+
+    for (i = 0; i < COPY_BUFFER_SIZE; ++i) {
+        s_dst[i] = s_expected[i] = (unsigned char)(i * 13 + 5);
+    }
+    memset(s_expected + COPY_GUARD + dstOffset, 0xA5, size);
+    if (strategy < 0) {
+        libcpucaps_Memset(s_dst + COPY_GUARD + dstOffset, 0xA5, size);
+    } else {
+        libcpucaps_MemsetStrategy(strategy, s_dst + COPY_GUARD + dstOffset, 0xA5, size);
+    }
+    if (memcmp(s_dst, s_expected, COPY_BUFFER_SIZE)) {
+        printf("%s: set of %llu bytes, dst + %llu\n", what, (unsigned long long)size, (unsigned long long)dstOffset);
+        return 1;
+    }
+    return 0;
+}
+
+/* strategy -1 goes through the config's thresholds */
+static int check_strategy(const char* what, int strategy) {
+    size_t i, j, k;
+    int failures = 0;
+
+    for (i = 0; i < NUM_SIZES; ++i) {
+        for (j = 0; j < NUM_OFFSETS; ++j) {
+            for (k = 0; k < NUM_OFFSETS; ++k) {
+                failures += check_copy(what, strategy, s_sizes[i], s_offsets[j], s_offsets[k]);
+            }
+            failures += check_set(what, strategy, s_sizes[i], s_offsets[j]);
+        }
+    }
+    return failures;
+}
+
+int main(void) {
+    static const char* const names[] = { "SSE2", "AVX2", "AVX-512" };
+    cpucaps_memory_config_t config;
+    cpucaps_t caps;
+    int strategy, failures = 0;
+
+    for (strategy = LIBCPUCAPS_MEMORY_SSE2; strategy <= LIBCPUCAPS_MEMORY_AVX512; ++strategy) {
+        if (!libcpucaps_IsMemoryStrategySupported(NULL, strategy)) {
+            printf("%s: not supported, skipped\n", names[strategy - LIBCPUCAPS_MEMORY_SSE2]);
+            continue;
+        }
+        config.vectorStrategy = strategy;
+        config.repThreshold = libcpucaps_IsMemoryStrategySupported(NULL, LIBCPUCAPS_MEMORY_REP) ? COPY_REP_THRESHOLD : SIZE_MAX;
+        config.nonTemporalThreshold = COPY_NT_THRESHOLD;
+        failures += check(names[strategy - LIBCPUCAPS_MEMORY_SSE2], libcpucaps_SetMemoryConfig(&config), LIBCPUCAPS_ERROR_OK);
+
+        failures += check_strategy(names[strategy - LIBCPUCAPS_MEMORY_SSE2], -1);
+        failures += check_strategy(names[strategy - LIBCPUCAPS_MEMORY_SSE2], strategy);
+        failures += check_strategy("non-temporal", LIBCPUCAPS_MEMORY_NONTEMPORAL);
+    }
+    if (libcpucaps_IsMemoryStrategySupported(NULL, LIBCPUCAPS_MEMORY_REP)) {
+        failures += check_strategy("rep", LIBCPUCAPS_MEMORY_REP);
+    }
+
+    /* the vector strategy has to be one of the loops */
+    config.vectorStrategy = LIBCPUCAPS_MEMORY_NONTEMPORAL;
+    failures += check("non-temporal as the vector strategy", libcpucaps_SetMemoryConfig(&config), LIBCPUCAPS_ERROR_INVALID_PARAM);
+
+    /* 32 MiB L3 instances shared by 16 of the 64 logical cpus each: 3/4 of 2 MiB */
+    libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_FEATURES);
+    caps.L2_sizeKibiBytes = 1024;
+    caps.L3_sizeKibiBytes = 32 * 1024;
+    caps.numCores = 32;
+    caps.numLogicalCores = 64;
+    caps.L3_numInstances = 4;
+    caps.L3_numSharingCPUs = 16;
+    failures += check("GetMemoryConfig", libcpucaps_GetMemoryConfig(&caps, &config), LIBCPUCAPS_ERROR_OK);
+    failures += check("non-temporal threshold", (long long)config.nonTemporalThreshold, 1536 * 1024);
+
+    /* without the sharing (no topology detected) the L3 is taken as shared by every logical cpu */
+    caps.L3_numSharingCPUs = 0;
+    libcpucaps_GetMemoryConfig(&caps, &config);
+    failures += check("non-temporal threshold without the sharing", (long long)config.nonTemporalThreshold, 1024 * 1024);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#include "libcpucaps.h"
+#include "test_check.h"
+
+#include <stdio.h>
+
+/* usage: test_numa_sysfs <sysfs root> */
+/* the nodes of tests/data/sysfs: 0 & 2 with 8 cpus each (SMT siblings 8 apart), a cpu-less memory node 3 */
+/* and a root without a node directory, which is a single node */
+
+#define NUMA_TEST_MAX_PATH  1024
+#define GiB                 ((unsigned long long)1 << 30)
+
+static int check_nodes(const cpucaps_numa_t* numa) {
+    static const int nodeIDs[3] = { 0, 2, 3 };
+    static const int numCPUs[3] = { 8, 8, 0 };
+    static const int distances[3][3] = { { 10, 21, 30 }, { 21, 10, 30 }, { 30, 30, 10 } };
+    static const unsigned long long memTotal[3] = { 16 * GiB, 16 * GiB, 64 * GiB };
+    static const unsigned long long memFree[3] = { 8 * GiB, 12 * GiB, 64 * GiB };
+    int failures = 0, n, i;
+
+    if (check("nodes", numa->numNodes, 3)) {
+        return 1;
+    }
+    for (n = 0; n < 3; ++n) {
+        failures += check("node ID", numa->nodes[n].nodeID, nodeIDs[n]);
+        failures += check("node cpus", numa->nodes[n].numCPUs, numCPUs[n]);
+        failures += check("node total memory", (long long)numa->nodes[n].memTotalBytes, (long long)memTotal[n]);
+        failures += check("node free memory", (long long)numa->nodes[n].memFreeBytes, (long long)memFree[n]);
+        /* no topology to tell the packages */
+        failures += check("node package", numa->nodes[n].packageID, -1);
+        for (i = 0; i < 3; ++i) {
+            failures += check("node distance", numa->nodes[n].distances[i], distances[n][i]);
+        }
+    }
+
+    failures += check("node of cpu 0", libcpucaps_GetCPUNode(numa, 0), 0);
+    failures += check("node of cpu 5", libcpucaps_GetCPUNode(numa, 5), 2);
+    failures += check("node of cpu 11", libcpucaps_GetCPUNode(numa, 11), 0);
+    failures += check("node of cpu 15", libcpucaps_GetCPUNode(numa, 15), 2);
+    failures += check("node of cpu 16", libcpucaps_GetCPUNode(numa, 16), -1);
+    failures += check("consistent", numa->isConsistent, 1);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    char missingRoot[NUMA_TEST_MAX_PATH];
+    cpucaps_numa_t* numa;
+    int failures;
+
+    if (argc < 2) {
+        printf("usage: %s <sysfs root>\n", argv[0]);
+        return 1;
+    }
+
+    if (libcpucaps_GetNUMA(argv[1], NULL, &numa) != LIBCPUCAPS_ERROR_OK) {
+        printf("libcpucaps_GetNUMA failed\n");
+        return 1;
+    }
+    failures = check_nodes(numa);
+    libcpucaps_FreeNUMA(numa);
+
+    snprintf(missingRoot, sizeof(missingRoot), "%s/missing", argv[1]);
+    if (libcpucaps_GetNUMA(missingRoot, NULL, &numa) != LIBCPUCAPS_ERROR_OK) {
+        printf("libcpucaps_GetNUMA failed without the node directory\n");
+        return 1;
+    }
+    failures += check("nodes without the node directory", numa->numNodes, 1);
+    failures += check("local distance", numa->nodes[0].distances[0], 10);
+    libcpucaps_FreeNUMA(numa);
+
+    return failures ? 1 : 0;
+}
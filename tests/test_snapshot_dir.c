@@ -0,0 +1,81 @@
+#define _GNU_SOURCE 1
+
+#include "libcpucaps.h"
+#include "test_check.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <stdlib.h>    /* mkdtemp */
+#include <sys/stat.h>  /* lstat */
+#include <unistd.h>    /* getuid, symlink, truncate, unlink, rmdir */
+#endif
+
+/* the snapshot in a directory of its own: saved on the first call, loaded by the next ones, and refused when */
+/* it's been cut short or replaced by a symlink (Linux only, Windows has no snapshots) */
+
+#define SNAPSHOT_TEST_MAX_PATH  1024
+
+#ifdef __linux__
+
+int main(void) {
+    char dir[] = "/tmp/libcpucaps-test-XXXXXX";
+    char path[SNAPSHOT_TEST_MAX_PATH], copyPath[SNAPSHOT_TEST_MAX_PATH];
+    cpucaps_topology_t* saved = NULL;
+    cpucaps_topology_t* loaded = NULL;
+    cpucaps_t savedCaps, loadedCaps;
+    struct stat st;
+    int failures = 0;
+
+    if (!mkdtemp(dir)) {
+        printf("Failed to create a directory\n");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/libcpucaps-%u.snapshot", dir, (unsigned)getuid());
+    snprintf(copyPath, sizeof(copyPath), "%s/copy", dir);
+
+    failures += check("libcpucaps_GetCapsSnapshot failed", libcpucaps_GetCapsSnapshot(dir, &savedCaps, &saved) == LIBCPUCAPS_ERROR_OK, 1);
+    if (saved) {
+        failures += check("the caps' topology summary differs", savedCaps.detectedParts == LIBCPUCAPS_DETECT_ALL &&
+                                                                savedCaps.numCores == saved->numCores &&
+                                                                savedCaps.numLogicalCores == saved->numCPUs, 1);
+    }
+    failures += check("the snapshot isn't a private file", !lstat(path, &st) && S_ISREG(st.st_mode) && (st.st_mode & 0777) == 0600, 1);
+
+    failures += check("libcpucaps_LoadSnapshot failed", libcpucaps_LoadSnapshot(dir, &loadedCaps, &loaded) == LIBCPUCAPS_ERROR_OK, 1);
+    if (saved && loaded) {
+        failures += check("the loaded caps differ", !memcmp(&savedCaps, &loadedCaps, sizeof(cpucaps_t)), 1);
+        failures += check("the loaded topology differs", saved->numCPUs == loaded->numCPUs && saved->numCaches == loaded->numCaches &&
+                                                         !memcmp(saved->cpus, loaded->cpus, sizeof(cpucaps_cpu_t) * saved->numCPUs), 1);
+    }
+    libcpucaps_FreeTopology(loaded);
+    libcpucaps_FreeTopology(saved);
+
+    /* a valid snapshot behind a symlink isn't followed */
+    failures += check("failed to move the snapshot", !rename(path, copyPath) && !symlink(copyPath, path), 1);
+    failures += check("a symlinked snapshot was loaded", libcpucaps_LoadSnapshot(dir, &loadedCaps, NULL) != LIBCPUCAPS_ERROR_OK, 1);
+    unlink(path);
+
+    failures += check("failed to cut the snapshot short", !rename(copyPath, path) && !truncate(path, 64), 1);
+    failures += check("a cut snapshot was loaded", libcpucaps_LoadSnapshot(dir, &loadedCaps, NULL) != LIBCPUCAPS_ERROR_OK, 1);
+
+    /* saving again replaces it */
+    failures += check("libcpucaps_GetCapsSnapshot failed to replace it",
+                      libcpucaps_GetCapsSnapshot(dir, &savedCaps, NULL) == LIBCPUCAPS_ERROR_OK &&
+                      libcpucaps_LoadSnapshot(dir, &loadedCaps, NULL) == LIBCPUCAPS_ERROR_OK, 1);
+
+    unlink(path);
+    unlink(copyPath);
+    failures += check("files were left in the directory", !rmdir(dir), 1);
+
+    return failures ? 1 : 0;
+}
+
+#else
+
+int main(void) {
+    return 0;
+}
+
+#endif
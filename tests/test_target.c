@@ -0,0 +1,78 @@
+#include "libcpucaps.h"
+#include "test_check.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* the compiler target of a Cascade Lake with the x86-64-v4 features only (as a hypervisor might show it) and */
+/* with all of its generation's ones, for GCC 9 (no x86-64-vN names yet) & GCC 11 */
+
+static const int s_levelFeatures[] = {
+    LIBCPUCAPS_FEATURE_CMOV, LIBCPUCAPS_FEATURE_CMPXCHG8, LIBCPUCAPS_FEATURE_FPU, LIBCPUCAPS_FEATURE_FXSR,
+    LIBCPUCAPS_FEATURE_MMX, LIBCPUCAPS_FEATURE_SSE, LIBCPUCAPS_FEATURE_SSE2, LIBCPUCAPS_FEATURE_SYSCALL,
+    LIBCPUCAPS_FEATURE_LONGMODE, LIBCPUCAPS_FEATURE_CMPXCHG16B, LIBCPUCAPS_FEATURE_LAHFSAHF, LIBCPUCAPS_FEATURE_POPCNT,
+    LIBCPUCAPS_FEATURE_SSE3, LIBCPUCAPS_FEATURE_SSE41, LIBCPUCAPS_FEATURE_SSE42, LIBCPUCAPS_FEATURE_SSSE3,
+    LIBCPUCAPS_FEATURE_AVX, LIBCPUCAPS_FEATURE_AVX2, LIBCPUCAPS_FEATURE_BMI1, LIBCPUCAPS_FEATURE_BMI2,
+    LIBCPUCAPS_FEATURE_F16C, LIBCPUCAPS_FEATURE_FMA3, LIBCPUCAPS_FEATURE_ABM, LIBCPUCAPS_FEATURE_MOVBE,
+    LIBCPUCAPS_FEATURE_OSXSAVE, LIBCPUCAPS_FEATURE_AVX512F, LIBCPUCAPS_FEATURE_AVX512BW, LIBCPUCAPS_FEATURE_AVX512CD,
+    LIBCPUCAPS_FEATURE_AVX512DQ, LIBCPUCAPS_FEATURE_AVX512VL
+};
+
+static const int s_cascadelakeFeatures[] = {
+    LIBCPUCAPS_FEATURE_AES, LIBCPUCAPS_FEATURE_PCLMULQDQ, LIBCPUCAPS_FEATURE_RDRAND, LIBCPUCAPS_FEATURE_ADX,
+    LIBCPUCAPS_FEATURE_RDSEED, LIBCPUCAPS_FEATURE_CLFLUSHOPT, LIBCPUCAPS_FEATURE_CLWB, LIBCPUCAPS_FEATURE_AVX512VNNI
+};
+
+static void make_caps(int isComplete, cpucaps_t* caps) {
+    size_t i;
+
+    memset(caps, 0, sizeof(cpucaps_t));
+    caps->isIntel = 1;
+    caps->family = 6;
+    caps->model = 5;
+    caps->modelEx = 5;
+    caps->stepping = 7;
+    for (i = 0; i < sizeof(s_levelFeatures) / sizeof(s_levelFeatures[0]); ++i) {
+        libcpucaps_AddFeature(&caps->features, s_levelFeatures[i]);
+    }
+    for (i = 0; isComplete && i < sizeof(s_cascadelakeFeatures) / sizeof(s_cascadelakeFeatures[0]); ++i) {
+        libcpucaps_AddFeature(&caps->features, s_cascadelakeFeatures[i]);
+    }
+}
+
+static int check_target(const char* what, const cpucaps_t* caps, int gccVersion, const char* march, int extraFeature, int hasExtra) {
+    cpucaps_target_t target;
+    int failures = 0;
+
+    if (libcpucaps_GetTarget(caps, LIBCPUCAPS_TARGET_GCC(gccVersion), &target) != LIBCPUCAPS_ERROR_OK) {
+        printf("%s: libcpucaps_GetTarget failed\n", what);
+        return 1;
+    }
+    if (strcmp(target.march, march)) {
+        printf("%s: -march=%s, expected %s\n", what, target.march, march);
+        ++failures;
+    }
+    failures += check(what, strcmp(target.mtune, "cascadelake"), 0);
+    failures += check(what, target.x86Level, LIBCPUCAPS_X86_LEVEL_V4);
+    failures += check(what, (long long)((target.extraFeatures.words[extraFeature / 64] >> (extraFeature % 64)) & 1), hasExtra);
+    return failures;
+}
+
+int main(void) {
+    cpucaps_t caps;
+    int failures = 0;
+
+    /* the level's features go out one by one for GCC 9 */
+    make_caps(0, &caps);
+    failures += check_target("level, GCC 9", &caps, 9, "x86-64", LIBCPUCAPS_FEATURE_AVX512F, 1);
+    failures += check_target("level, GCC 11", &caps, 11, "x86-64-v4", LIBCPUCAPS_FEATURE_AVX512F, 0);
+
+    make_caps(1, &caps);
+    failures += check_target("named, GCC 9", &caps, 9, "cascadelake", LIBCPUCAPS_FEATURE_AVX512F, 0);
+
+    /* a hypervisor may hide what isn't checked */
+    caps.hypervisor = LIBCPUCAPS_HYPERVISOR_KVM;
+    failures += check_target("named in a VM, GCC 9", &caps, 9, "x86-64", LIBCPUCAPS_FEATURE_AVX512VNNI, 1);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+#include "libcpucaps.h"
+#include "libcpucaps_tlb.h"
+#include "cpuid_replay.h"
+#include "test_check.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* usage: test_tlb_replay intel|amd <sysfs root> */
+/* the TLB report of replayed Intel (leaf 0x18) & AMD (0x80000005, 0x80000006, 0x80000019) leaves, with the */
+/* huge page pools & THP mode of tests/data/sysfs: 16 2M pages with 10 free & 4 reserved, no 1G pages, madvise */
+
+#define GiB     ((long long)1 << 30)
+#define MiB     ((long long)1 << 20)
+
+/* a 2-way SMT server part: 4K, 2M & 1G L1 load TLBs, a 2048 entry 4K/2M STLB and a 1024 entry 1G one */
+static const replay_leaf_t s_intelLeaves[] = {
+    { 0x00000000, 0, { 0x18, REPLAY_INTEL_EBX, REPLAY_INTEL_ECX, REPLAY_INTEL_EDX } },
+    { 0x00000001, 0, { 0x000806F8, 0, 0, 0x8 } },                                   /* family 6 model 0x8F, PSE */
+    { 0x00000018, 0, { 5, 0, 0, 0 } },                                              /* invalid subleaf, 5 more */
+    { 0x00000018, 1, { 0, (64 << 16) | 0x1, 1, 4 | (1 << 5) | (1 << 8) | (1 << 14) } },
+    { 0x00000018, 2, { 0, (32 << 16) | 0x2, 1, 4 | (1 << 5) | (1 << 8) | (1 << 14) } },
+    { 0x00000018, 3, { 0, (8 << 16) | 0x8, 1, 4 | (1 << 5) | (1 << 8) | (1 << 14) } },
+    { 0x00000018, 4, { 0, (16 << 16) | 0x3, 128, 3 | (2 << 5) | (1 << 14) } },
+    { 0x00000018, 5, { 0, (8 << 16) | 0x8, 128, 3 | (2 << 5) | (1 << 14) } },
+    { 0x80000000, 0, { 0x80000008, 0, 0, 0 } },
+    { 0x80000001, 0, { 0, 0, 0, (1u << 29) | (1u << 26) } }                         /* long mode, PDPE1GB */
+};
+
+/* fully associative 64 entry L1 TLBs for every size, 8-way 2048 entry L2 TLBs (512 entries for instructions) */
+static const replay_leaf_t s_amdLeaves[] = {
+    { 0x00000000, 0, { 0x10, REPLAY_AMD_EBX, REPLAY_AMD_ECX, REPLAY_AMD_EDX } },
+    { 0x00000001, 0, { 0x00A20F10, 0, 0, 0x8 } },                                   /* family 0x19 model 0x21, PSE */
+    { 0x80000000, 0, { 0x80000020, 0, 0, 0 } },
+    { 0x80000001, 0, { 0, 0, 0, (1u << 29) | (1u << 26) } },
+    { 0x80000005, 0, { 0xFF40FF40, 0xFF40FF40, 0, 0 } },
+    { 0x80000006, 0, { 0x68006200, 0x68006200, 0, 0 } },
+    { 0x80000019, 0, { 0xF040F040, 0x68000000, 0, 0 } }
+};
+
+static int check_advice(const cpucaps_tlb_report_t* report, long long workingSetBytes, int pageSize, int source, int coversWorkingSet) {
+    cpucaps_page_advice_t advice;
+    int failures = 0;
+
+    if (libcpucaps_RecommendPageSize(report, (size_t)workingSetBytes, &advice) != LIBCPUCAPS_ERROR_OK) {
+        printf("libcpucaps_RecommendPageSize failed\n");
+        return 1;
+    }
+    failures += check("advised page size", (long long)advice.pageSize, (long long)pageSize);
+    failures += check("advised page source", (long long)advice.source, (long long)source);
+    failures += check("advice covers the working set", (long long)advice.coversWorkingSet, (long long)coversWorkingSet);
+    if (failures) {
+        printf("  for a working set of %lld bytes\n", workingSetBytes);
+    }
+    return failures;
+}
+
+static int check_pools(const cpucaps_tlb_report_t* report) {
+    int failures = 0;
+
+    failures += check("THP mode", (long long)report->thpMode, LIBCPUCAPS_THP_MADVISE);
+    failures += check("2M pool", (long long)report->pageSizes[LIBCPUCAPS_PAGE_2M].numHugePages, 16);
+    failures += check("free 2M pages", (long long)report->pageSizes[LIBCPUCAPS_PAGE_2M].numFreeHugePages, 6);
+    failures += check("1G pool", (long long)report->pageSizes[LIBCPUCAPS_PAGE_1G].numHugePages, 0);
+    failures += check("1G supported", (long long)report->pageSizes[LIBCPUCAPS_PAGE_1G].isSupported, 1);
+    return failures;
+}
+
+static int check_intel(const cpucaps_tlb_report_t* report) {
+    int failures = check_pools(report);
+
+    failures += check("TLBs", (long long)report->numTLBs, 2);
+    failures += check("4K L1 entries", (long long)report->pageSizes[LIBCPUCAPS_PAGE_4K].L1_entries, 64);
+    failures += check("2M L1 entries", (long long)report->pageSizes[LIBCPUCAPS_PAGE_2M].L1_entries, 32);
+    failures += check("1G L1 entries", (long long)report->pageSizes[LIBCPUCAPS_PAGE_1G].L1_entries, 8);
+    failures += check("4K reach", libcpucaps_GetTLBReach(report, LIBCPUCAPS_PAGE_4K), 8 * MiB);
+    failures += check("2M reach", libcpucaps_GetTLBReach(report, LIBCPUCAPS_PAGE_2M), 4 * GiB);
+    failures += check("1G reach", libcpucaps_GetTLBReach(report, LIBCPUCAPS_PAGE_1G), 1024 * GiB);
+    failures += check("STLB sharing threads", (long long)report->tlbs[1].numSharingThreads, 2);
+
+    /* 4K pages cover it / 5 pages from the pool / more than the pool has, THP then / 1G pages lack a pool */
+    failures += check_advice(report, 4 * MiB, LIBCPUCAPS_PAGE_4K, LIBCPUCAPS_PAGE_SOURCE_DEFAULT, 1);
+    failures += check_advice(report, 10 * MiB, LIBCPUCAPS_PAGE_2M, LIBCPUCAPS_PAGE_SOURCE_HUGETLB, 1);
+    failures += check_advice(report, 64 * MiB, LIBCPUCAPS_PAGE_2M, LIBCPUCAPS_PAGE_SOURCE_THP, 1);
+    failures += check_advice(report, 8 * GiB, LIBCPUCAPS_PAGE_2M, LIBCPUCAPS_PAGE_SOURCE_THP, 0);
+    return failures;
+}
+
+static int check_amd(const cpucaps_tlb_report_t* report) {
+    int failures = check_pools(report);
+
+    /* L1 & L2, data & instructions */
+    failures += check("TLBs", (long long)report->numTLBs, 4);
+    failures += check("4K L1 entries", (long long)report->pageSizes[LIBCPUCAPS_PAGE_4K].L1_entries, 64);
+    failures += check("1G L1 entries", (long long)report->pageSizes[LIBCPUCAPS_PAGE_1G].L1_entries, 64);
+    failures += check("4K reach", libcpucaps_GetTLBReach(report, LIBCPUCAPS_PAGE_4K), 8 * MiB);
+    failures += check("2M reach", libcpucaps_GetTLBReach(report, LIBCPUCAPS_PAGE_2M), 4 * GiB);
+    failures += check("1G reach", libcpucaps_GetTLBReach(report, LIBCPUCAPS_PAGE_1G), 2048 * GiB);
+
+    failures += check_advice(report, 64 * MiB, LIBCPUCAPS_PAGE_2M, LIBCPUCAPS_PAGE_SOURCE_THP, 1);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    cpucaps_tlb_report_t report;
+    cpucaps_t caps;
+    int isIntel;
+
+    if (argc < 3 || (strcmp(argv[1], "intel") && strcmp(argv[1], "amd"))) {
+        printf("usage: %s intel|amd <sysfs root>\n", argv[0]);
+        return 1;
+    }
+    isIntel = !strcmp(argv[1], "intel");
+    if (isIntel) {
+        replay_leaves(s_intelLeaves, sizeof(s_intelLeaves) / sizeof(s_intelLeaves[0]));
+    } else {
+        replay_leaves(s_amdLeaves, sizeof(s_amdLeaves) / sizeof(s_amdLeaves[0]));
+    }
+
+    if (libcpucaps_GetCapsEx(&caps, LIBCPUCAPS_DETECT_FEATURES) != LIBCPUCAPS_ERROR_OK ||
+        libcpucaps_GetTLBReport(&caps, argv[2], &report) != LIBCPUCAPS_ERROR_OK) {
+        printf("Failed to get the TLB report\n");
+        return 1;
+    }
+    if (isIntel ? !caps.isIntel : !caps.isAMD) {
+        printf("The replayed vendor wasn't detected\n");
+        return 1;
+    }
+
+    return (isIntel ? check_intel(&report) : check_amd(&report)) ? 1 : 0;
+}